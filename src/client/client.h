@@ -3,15 +3,54 @@
 
 #include "../common/protocol.h"
 #include "../common/base64.h"
+#include "../common/compress.h"
+#include "../common/mux.h"
+#include "../common/wire.h"
+#include "../common/sha256.h"
 #include <pthread.h>
 #include <gtk/gtk.h>
 
 // 客户端配置
 #define CLIENT_VERSION "1.0.0"
 #define CONFIG_FILE "client.conf"
+#define CLIENT_ID_FILE "client.id"   // 客户端标识（十六进制），首次启动时随机生成
 #define UPDATE_DIR "updates/"
 #define TEMP_DIR "temp/"
-#define HEARTBEAT_INTERVAL 60  // 心跳间隔（秒）
+#define HEARTBEAT_CHECK_INTERVAL 5  // 心跳线程检查间隔（秒）
+
+// 下载完成并校验的更新包
+#define UPDATE_PACKAGE_FILE UPDATE_DIR "client_update.tar.gz"
+
+// 更新包下载：数据写入临时文件，进度文件记录已落盘的字节数和所属更新包的哈希，重连后从该处续传
+#define UPDATE_PART_FILE UPDATE_DIR "client_update.tar.gz.part"
+#define UPDATE_PROGRESS_FILE UPDATE_DIR "client_update.tar.gz.progress"
+#define UPDATE_PROGRESS_INTERVAL (1024 * 1024)  // 每写入这么多字节落盘一次并记录进度
+
+// 分块清单（服务端支持时）：下载前按清单核对临时文件和已有的更新包文件，只下载缺失或损坏的分块，
+// 接收时逐块校验；同一分块校验失败后最多重新下载到UPDATE_CHUNK_RETRY_MAX次
+#define UPDATE_CHUNK_RETRY_MAX 3
+
+// 应用更新：更新包解压到暂存目录后原子替换可执行文件，旧版本以硬链接保留为备份
+#define UPDATE_STAGING_DIR UPDATE_DIR "staging/"
+#define UPDATE_BACKUP_FILE UPDATE_DIR "client.backup"
+
+// 后台预取：完整更新包在单独的限速连接上下载，暂存后在客户端空闲时或下次启动时应用
+#define UPDATE_STAGED_FILE UPDATE_DIR "client_update.staged"
+#define UPDATE_IDLE_SECONDS 30               // 连接上没有数据往来这么久才应用暂存的更新
+#define UPDATE_PREFETCH_RCVBUF (64 * 1024)   // 限速时预取连接的接收缓冲区
+
+// 局域网对等分发（需启用peer_update）：客户端通过组播发现同一局域网内持有同一更新包的其他客户端，
+// 先从它们那里分块获取，取不到的部分再从服务端下载
+#define PEER_MULTICAST_GROUP "239.255.77.88"
+#define PEER_DISCOVERY_PORT 8889
+#define PEER_DISCOVERY_TIMEOUT_MS 500   // 发出查询后等待应答的时间
+#define PEER_CHUNK_SIZE (1024 * 1024)   // 每次向对等节点请求的字节数
+#define PEER_MAX_SOURCES 8              // 一次下载最多使用的对等节点数
+#define PEER_MAX_UPLOADS 4              // 同时向其他客户端提供数据的连接数上限
+#define PEER_IO_TIMEOUT 10              // 对等连接的收发超时（秒）
+
+// 客户端支持的能力位
+#define CLIENT_CAPABILITIES (CAP_COMPRESS_ZLIB | CAP_MULTIPLEX | CAP_WIRE_V2 | CAP_DELTA_UPDATE | CAP_CHUNK_MANIFEST)
 
 // 默认配置值
 #define DEFAULT_SERVER_HOST "localhost"
@@ -19,6 +58,7 @@
 #define DEFAULT_HEARTBEAT_INTERVAL 60
 #define DEFAULT_CONNECTION_TIMEOUT 30
 #define DEFAULT_MAX_RETRY 3
+#define DEFAULT_UPDATE_RATE_LIMIT (256 * 1024)  // 后台下载更新的限速（字节/秒）
 
 // 连接状态
 typedef enum {
@@ -39,6 +79,10 @@ typedef struct {
     int heartbeat_interval;
     int connection_timeout;
     int max_retry_count;
+    int background_update;    // 自动更新时在后台限速下载完整更新包
+    int update_rate_limit;    // 后台下载限速（字节/秒），0表示不限速
+    int peer_update;          // 与局域网内的其他客户端互相提供更新包
+    int peer_port;            // 向其他客户端提供数据的TCP端口，0表示由系统分配
 } client_config_t;
 
 // 客户端状态结构
@@ -48,13 +92,21 @@ typedef struct {
     pthread_t network_thread;
     pthread_t heartbeat_thread;
     pthread_mutex_t status_mutex;
-    pthread_mutex_t send_mutex;
+    mux_sender_t sender;      // 发送调度器（所有发往服务端的消息经此排队）
+    mux_stream_t streams[MUX_MAX_STREAMS];  // 正在接收的逻辑流（仅网络线程访问）
     int running;
     int gui_mode;
     client_config_t config;
     char server_version[32];
     char latest_version[32];
     int update_available;
+    uint8_t package_hash[SHA256_DIGEST_SIZE];  // 服务端告知的更新包SHA-256，全0表示未知
+    uint32_t update_size;     // 服务端告知的更新包大小，0表示未知
+    uint32_t capabilities;    // 服务端确认的能力位
+    int heartbeat_interval;   // 服务端建议的心跳间隔（秒），0表示使用配置的间隔
+    time_t last_receive_time; // 最近一次收到非心跳帧的时间
+    time_t next_version_check; // 服务端暂缓提供更新时建议的下次版本检查时间，0表示不需要
+    uint8_t client_id[CLIENT_ID_SIZE];  // 客户端标识（启动时加载，之后只读）
 } client_state_t;
 
 // GUI相关结构
@@ -87,12 +139,15 @@ int client_connect(const char* host, int port);
 void client_disconnect();
 int client_send_message(message_type_t type, const void* data, size_t data_size);
 int client_receive_message(message_header_t* header, char** data);
+int handle_stream_data(const wire_view_t* view);
+void close_client_streams();
 void* network_thread_func(void* arg);
 void* heartbeat_thread_func(void* arg);
 
 // 消息处理函数
 int send_version_check();
-int send_update_request();
+void update_schedule_version_check(uint32_t retry_after);
+int send_update_request(uint32_t flags);
 int send_file_upload(const char* filename);
 int send_data_upload(const char* table_name, const char* field_name, const char* data);
 int send_heartbeat();
@@ -100,16 +155,48 @@ int send_heartbeat();
 // 响应处理函数
 int handle_version_response(version_response_msg_t* response);
 int handle_update_data(const char* data, size_t data_size);
-void handle_file_response(const char* data, size_t data_len);
-void handle_data_response(const char* data, size_t data_len);
-void handle_error_response(const char* data, size_t data_len);
+int handle_update_stream(message_header_t* header);
+int handle_update_delta(const wire_view_t* view);
+int handle_update_resume(const wire_view_t* view);
+int handle_update_manifest(const wire_view_t* view);
+void* update_stream_begin();
+int update_stream_write(void* context, const char* data, size_t length);
+int update_stream_finish(void* context);
+void update_stream_abort(void* context, int keep_partial);
+uint32_t update_download_progress(const uint8_t* package_hash);
+void* update_download_open(const uint8_t* package_hash, int resume, uint32_t offset);
+int update_download_append(void* context, const char* data, size_t length);
+int update_download_close(void* context);
+void update_download_discard(void* context, int keep_partial);
+int update_download_append_raw(void* context, const void* data, size_t length);
+int update_file_digest(int fd, uint8_t digest[SHA256_DIGEST_SIZE]);
+void* update_download_open_range(void* manifest, uint32_t offset);
+void* update_manifest_parse(const wire_view_t* view, const uint8_t* package_hash);
+int update_manifest_scan(void* manifest);
+int update_manifest_next_range(void* manifest, uint32_t* offset, uint32_t* length);
+int update_manifest_complete(void* manifest);
+void update_manifest_free(void* manifest);
+void handle_file_response(const wire_view_t* view);
+void handle_data_response(const wire_view_t* view);
+void handle_error_response(const wire_view_t* view);
 
 // 更新相关函数
 int check_for_updates();
 int download_update(const char* data, size_t data_size);
 int apply_update();
+int replace_client_executable(const char* new_client_path);
 int restart_client();
 
+// 后台预取函数
+int update_prefetch_start(const char* version, const uint8_t* package_hash, uint32_t package_size);
+int update_prefetch_active();
+int update_apply_staged();
+
+// 局域网对等分发函数
+int peer_service_start();
+int peer_service_port();
+int peer_fetch_update(const uint8_t* package_hash, uint32_t package_size, uint32_t offset);
+
 // 文件处理函数
 int upload_file(const char* filename);
 char* read_file_content(const char* filename, size_t* file_size);
@@ -119,6 +206,7 @@ int create_directories();
 int load_config();
 int save_config();
 void set_default_config();
+int load_client_id(uint8_t client_id[CLIENT_ID_SIZE]);
 
 // GUI相关函数
 int gui_init(int argc, char* argv[]);
@@ -148,7 +236,5 @@ connection_status_t get_connection_status();
 // 线程安全的状态管理
 void lock_status();
 void unlock_status();
-void lock_send();
-void unlock_send();
 
 #endif // CLIENT_H
\ No newline at end of file
@@ -25,6 +25,10 @@ int load_config(client_config_t* config) {
     config->heartbeat_interval = DEFAULT_HEARTBEAT_INTERVAL;
     config->connection_timeout = DEFAULT_CONNECTION_TIMEOUT;
     config->max_retry_count = DEFAULT_MAX_RETRY;
+    config->background_update = 1;
+    config->update_rate_limit = DEFAULT_UPDATE_RATE_LIMIT;
+    config->peer_update = 0;
+    config->peer_port = 0;
     config->log_level = 1; // INFO级别
     
     // 尝试从配置文件加载
@@ -73,6 +77,20 @@ int load_config(client_config_t* config) {
                 if (config->max_retry_count < 0) {
                     config->max_retry_count = DEFAULT_MAX_RETRY;
                 }
+            } else if (strcmp(key, "background_update") == 0) {
+                config->background_update = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0) ? 1 : 0;
+            } else if (strcmp(key, "update_rate_limit") == 0) {
+                config->update_rate_limit = atoi(value);
+                if (config->update_rate_limit < 0) {
+                    config->update_rate_limit = DEFAULT_UPDATE_RATE_LIMIT;
+                }
+            } else if (strcmp(key, "peer_update") == 0) {
+                config->peer_update = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0) ? 1 : 0;
+            } else if (strcmp(key, "peer_port") == 0) {
+                config->peer_port = atoi(value);
+                if (config->peer_port < 0 || config->peer_port > 65535) {
+                    config->peer_port = 0;
+                }
             } else if (strcmp(key, "log_level") == 0) {
                 config->log_level = atoi(value);
                 if (config->log_level < 0 || config->log_level > 3) {
@@ -114,6 +132,16 @@ int save_config(const client_config_t* config) {
     fprintf(file, "max_retry_count=%d\n", config->max_retry_count);
     fprintf(file, "\n");
     
+    fprintf(file, "# 后台下载更新 (限速单位: 字节/秒, 0=不限速)\n");
+    fprintf(file, "background_update=%s\n", config->background_update ? "true" : "false");
+    fprintf(file, "update_rate_limit=%d\n", config->update_rate_limit);
+    fprintf(file, "\n");
+    
+    fprintf(file, "# 局域网对等分发 (peer_port=0时由系统分配端口)\n");
+    fprintf(file, "peer_update=%s\n", config->peer_update ? "true" : "false");
+    fprintf(file, "peer_port=%d\n", config->peer_port);
+    fprintf(file, "\n");
+    
     fprintf(file, "# 日志级别 (0=DEBUG, 1=INFO, 2=WARN, 3=ERROR)\n");
     fprintf(file, "log_level=%d\n", config->log_level);
     
@@ -135,6 +163,13 @@ void print_config(const client_config_t* config) {
     printf("心跳间隔: %d 秒\n", config->heartbeat_interval);
     printf("连接超时: %d 秒\n", config->connection_timeout);
     printf("最大重试次数: %d\n", config->max_retry_count);
+    printf("后台下载更新: %s\n", config->background_update ? "启用" : "禁用");
+    if (config->update_rate_limit > 0) {
+        printf("后台下载限速: %d 字节/秒\n", config->update_rate_limit);
+    } else {
+        printf("后台下载限速: 不限速\n");
+    }
+    printf("局域网对等分发: %s\n", config->peer_update ? "启用" : "禁用");
     printf("日志级别: %d\n", config->log_level);
     printf("==================\n\n");
 }
@@ -221,6 +256,24 @@ int update_config_item(client_config_t* config, const char* key, const char* val
             return -1;
         }
         config->max_retry_count = retry;
+    } else if (strcmp(key, "background_update") == 0) {
+        config->background_update = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0) ? 1 : 0;
+    } else if (strcmp(key, "update_rate_limit") == 0) {
+        int rate = atoi(value);
+        if (rate < 0) {
+            printf("错误: 后台下载限速不能为负数\n");
+            return -1;
+        }
+        config->update_rate_limit = rate;
+    } else if (strcmp(key, "peer_update") == 0) {
+        config->peer_update = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0) ? 1 : 0;
+    } else if (strcmp(key, "peer_port") == 0) {
+        int port = atoi(value);
+        if (port < 0 || port > 65535) {
+            printf("错误: 无效的端口号\n");
+            return -1;
+        }
+        config->peer_port = port;
     } else if (strcmp(key, "log_level") == 0) {
         int level = atoi(value);
         if (level < 0 || level > 3) {
@@ -249,6 +302,10 @@ void reset_config_to_default(client_config_t* config) {
     config->heartbeat_interval = DEFAULT_HEARTBEAT_INTERVAL;
     config->connection_timeout = DEFAULT_CONNECTION_TIMEOUT;
     config->max_retry_count = DEFAULT_MAX_RETRY;
+    config->background_update = 1;
+    config->update_rate_limit = DEFAULT_UPDATE_RATE_LIMIT;
+    config->peer_update = 0;
+    config->peer_port = 0;
     config->log_level = 1;
     
     printf("配置已重置为默认值\n");
@@ -293,6 +350,16 @@ int update_config_from_args(client_config_t* config, int argc, char* argv[]) {
                 }
                 i++; // 跳过下一个参数
             }
+        } else if (strcmp(argv[i], "--peer-update") == 0) {
+            config->peer_update = 1;
+        } else if (strcmp(argv[i], "--update-rate") == 0) {
+            if (i + 1 < argc) {
+                int rate = atoi(argv[i + 1]);
+                if (rate >= 0) {
+                    config->update_rate_limit = rate;
+                }
+                i++; // 跳过下一个参数
+            }
         } else if (strcmp(argv[i], "--log-level") == 0) {
             if (i + 1 < argc) {
                 int level = atoi(argv[i + 1]);
@@ -361,6 +428,60 @@ int backup_config() {
     return 0;
 }
 
+// 加载客户端标识，不存在或无效时随机生成并保存。服务端按标识给客户端分批发布，
+// 并让同一客户端的主连接和预取连接共用一个传输名额，所以标识在重启之间保持不变
+int load_client_id(uint8_t client_id[CLIENT_ID_SIZE]) {
+    FILE* file = fopen(CLIENT_ID_FILE, "r");
+    if (file) {
+        char hex[CLIENT_ID_SIZE * 2 + 2];
+        int valid = fgets(hex, sizeof(hex), file) != NULL &&
+                    strspn(hex, "0123456789abcdefABCDEF") == CLIENT_ID_SIZE * 2;
+        fclose(file);
+        
+        for (int i = 0; valid && i < CLIENT_ID_SIZE; i++) {
+            unsigned int byte;
+            if (sscanf(hex + i * 2, "%2x", &byte) != 1) {
+                valid = 0;
+            }
+            client_id[i] = (uint8_t)byte;
+        }
+        if (valid) {
+            return 0;
+        }
+        printf("客户端标识文件无效，重新生成\n");
+    }
+    
+    // 优先使用系统随机数，读取失败时退回到时间、进程号和rand()
+    size_t filled = 0;
+    FILE* random = fopen("/dev/urandom", "rb");
+    if (random) {
+        filled = fread(client_id, 1, CLIENT_ID_SIZE, random);
+        fclose(random);
+    }
+    if (filled != CLIENT_ID_SIZE) {
+        srand((unsigned int)time(NULL) ^ ((unsigned int)getpid() << 16));
+        for (int i = 0; i < CLIENT_ID_SIZE; i++) {
+            client_id[i] = (uint8_t)(rand() >> 7);
+        }
+    }
+    
+    // 全0表示没有标识，避开这个值
+    client_id[0] |= 0x01;
+    
+    file = fopen(CLIENT_ID_FILE, "w");
+    if (!file) {
+        printf("错误: 无法保存客户端标识: %s\n", strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < CLIENT_ID_SIZE; i++) {
+        fprintf(file, "%02x", client_id[i]);
+    }
+    fprintf(file, "\n");
+    fclose(file);
+    
+    return 0;
+}
+
 // 设置默认配置
 void set_default_config() {
     // 这个函数可以用来初始化全局配置
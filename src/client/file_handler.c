@@ -33,36 +33,12 @@ int upload_file(const char* filepath) {
         return -1;
     }
     
-    if (file_stat.st_size > MAX_MESSAGE_LEN) {
-        printf("错误: 文件太大 (最大 %d 字节)\n", MAX_MESSAGE_LEN);
+    // 文件大小受消息头中32位长度字段限制，大文件以流的方式发送
+    if ((uint64_t)base64_encoded_length(file_stat.st_size) + sizeof(file_upload_msg_t) > UINT32_MAX) {
+        printf("错误: 文件太大\n");
         return -1;
     }
     
-    // 读取文件内容
-    FILE* file = fopen(filepath, "rb");
-    if (!file) {
-        printf("错误: 无法打开文件: %s\n", strerror(errno));
-        return -1;
-    }
-    
-    char* file_data = malloc(file_stat.st_size);
-    if (!file_data) {
-        printf("错误: 内存分配失败\n");
-        fclose(file);
-        return -1;
-    }
-    
-    size_t bytes_read = fread(file_data, 1, file_stat.st_size, file);
-    fclose(file);
-    
-    if (bytes_read != (size_t)file_stat.st_size) {
-        printf("错误: 文件读取不完整\n");
-        free(file_data);
-        return -1;
-    }
-    
-    free(file_data);
-    
     // 发送文件上传消息
     int result = send_file_upload(filepath);
     
@@ -99,6 +75,39 @@ int send_file_upload(const char* filename) {
     size_t data_len = ftell(file);
     fseek(file, 0, SEEK_SET);
     
+    // 提取文件名（去掉路径）
+    const char* basename = strrchr(filename, '/');
+    if (basename) {
+        basename++; // 跳过 '/'
+    } else {
+        basename = filename;
+    }
+    
+    // 消息前缀按协商的线格式编码
+    uint8_t version = WIRE_VERSION_FOR(g_client.capabilities);
+    size_t prefix_len = WIRE_SIZE(version, file_upload_msg);
+    
+    // 大文件边读边编码发送，不整体读入内存
+    size_t encoded_len = base64_encoded_length(data_len);
+    if (is_stream_frame(MSG_FILE_UPLOAD, 0, prefix_len + encoded_len)) {
+        unsigned char prefix[sizeof(file_upload_msg_v2_t)];
+        memset(prefix, 0, sizeof(prefix));
+        WIRE_PUT_STR(prefix, version, file_upload_msg, filename, basename);
+        WIRE_PUT_U32(prefix, version, file_upload_msg, file_size, data_len);  // 原始文件大小
+        WIRE_PUT_U32(prefix, version, file_upload_msg, chunk_size, encoded_len);  // 编码后的数据大小
+        WIRE_PUT_U32(prefix, version, file_upload_msg, chunk_offset, 0);
+        
+        // 文件交给发送线程，发送完成后关闭
+        int result = mux_send_file_base64(&g_client.sender, MSG_FILE_UPLOAD, prefix, prefix_len,
+                                          file, data_len, NULL, NULL, 1);
+        
+        if (result != 0) {
+            printf("错误: 文件发送失败\n");
+            client_disconnect();
+        }
+        return result;
+    }
+    
     // 读取文件数据
     char* file_data = malloc(data_len);
     if (!file_data) {
@@ -134,13 +143,7 @@ int send_file_upload(const char* filename) {
     }
 
     // 计算消息总大小（使用编码后的数据大小）
-    size_t total_size = sizeof(file_upload_msg_t) + encode_result;
-
-    if (total_size > MAX_MESSAGE_LEN) {
-        printf("错误: 文件太大，无法发送\n");
-        free(encoded_data);
-        return -1;
-    }
+    size_t total_size = prefix_len + encode_result;
 
     // 分配消息缓冲区
     char* buffer = malloc(total_size);
@@ -151,24 +154,14 @@ int send_file_upload(const char* filename) {
     }
 
     // 构造文件上传消息
-    file_upload_msg_t* msg = (file_upload_msg_t*)buffer;
-
-    // 提取文件名（去掉路径）
-    const char* basename = strrchr(filename, '/');
-    if (basename) {
-        basename++; // 跳过 '/'
-    } else {
-        basename = filename;
-    }
-
-    strncpy(msg->filename, basename, MAX_FILENAME_LEN - 1);
-    msg->filename[MAX_FILENAME_LEN - 1] = '\0';
-    msg->file_size = data_len;  // 原始文件大小
-    msg->chunk_size = encode_result;  // 编码后的数据大小
-    msg->chunk_offset = 0;
+    memset(buffer, 0, prefix_len);
+    WIRE_PUT_STR(buffer, version, file_upload_msg, filename, basename);
+    WIRE_PUT_U32(buffer, version, file_upload_msg, file_size, data_len);  // 原始文件大小
+    WIRE_PUT_U32(buffer, version, file_upload_msg, chunk_size, encode_result);  // 编码后的数据大小
+    WIRE_PUT_U32(buffer, version, file_upload_msg, chunk_offset, 0);
 
     // 复制编码后的数据
-    memcpy(msg->data, encoded_data, encode_result);
+    memcpy(buffer + prefix_len, encoded_data, encode_result);
     
     // 发送消息
     int result = client_send_message(MSG_FILE_UPLOAD, buffer, total_size);
@@ -206,9 +199,11 @@ int send_data_upload(const char* table_name, const char* field_name, const char*
         return -1;
     }
     
-    // 计算消息大小
+    // 计算消息大小（消息前缀按协商的线格式编码）
+    uint8_t version = WIRE_VERSION_FOR(g_client.capabilities);
+    size_t prefix_len = WIRE_SIZE(version, data_upload_msg);
     size_t encoded_data_len = strlen(encoded_data);
-    size_t total_size = sizeof(data_upload_msg_t) + encoded_data_len;
+    size_t total_size = prefix_len + encoded_data_len;
     
     if (total_size > MAX_MESSAGE_LEN) {
         printf("错误: 数据太大，无法发送\n");
@@ -225,13 +220,13 @@ int send_data_upload(const char* table_name, const char* field_name, const char*
     }
     
     // 构造数据上传消息
-    data_upload_msg_t* msg = (data_upload_msg_t*)buffer;
-    strncpy(msg->table_name, table_name, sizeof(msg->table_name) - 1);
-    strncpy(msg->field_name, field_name, sizeof(msg->field_name) - 1);
-    msg->data_size = encoded_data_len;
+    memset(buffer, 0, prefix_len);
+    WIRE_PUT_STR(buffer, version, data_upload_msg, table_name, table_name);
+    WIRE_PUT_STR(buffer, version, data_upload_msg, field_name, field_name);
+    WIRE_PUT_U32(buffer, version, data_upload_msg, data_size, encoded_data_len);
     
     // 复制编码后的数据
-    memcpy(msg->data, encoded_data, encoded_data_len);
+    memcpy(buffer + prefix_len, encoded_data, encoded_data_len);
     
     // 发送消息
     int result = client_send_message(MSG_DATA_UPLOAD, buffer, total_size);
@@ -249,30 +244,25 @@ int send_data_upload(const char* table_name, const char* field_name, const char*
 }
 
 // 处理文件响应
-void handle_file_response(const char* data, size_t data_len) {
-    if (!data || data_len < sizeof(FileResponse)) {
+void handle_file_response(const wire_view_t* view) {
+    if (!view) {
         printf("错误: 无效的文件响应\n");
         return;
     }
     
-    const FileResponse* response = (const FileResponse*)data;
+    uint16_t status = WIRE_GET_U16(view, response_msg, status);
+    char message[MAX_MESSAGE_LEN];
+    WIRE_GET_STR(view, response_msg, message, message, sizeof(message));
     
-    printf("文件上传响应: 状态=%d\n", response->status);
+    printf("文件上传响应: 状态=%d\n", status);
     
-    if (response->message_len > 0 && data_len >= sizeof(FileResponse) + response->message_len) {
-        const char* message = data + sizeof(FileResponse);
-        char* msg_str = malloc(response->message_len + 1);
-        if (msg_str) {
-            memcpy(msg_str, message, response->message_len);
-            msg_str[response->message_len] = '\0';
-            printf("服务器消息: %s\n", msg_str);
-            free(msg_str);
-        }
+    if (message[0] != '\0') {
+        printf("服务器消息: %s\n", message);
     }
     
     // 在GUI模式下更新界面
     if (g_client.gui_mode) {
-        if (response->status == STATUS_SUCCESS) {
+        if (status == STATUS_SUCCESS) {
             gui_log_message("文件上传成功");
             gui_set_progress(1.0);
         } else {
@@ -283,30 +273,25 @@ void handle_file_response(const char* data, size_t data_len) {
 }
 
 // 处理数据响应
-void handle_data_response(const char* data, size_t data_len) {
-    if (!data || data_len < sizeof(DataResponse)) {
+void handle_data_response(const wire_view_t* view) {
+    if (!view) {
         printf("错误: 无效的数据响应\n");
         return;
     }
     
-    const DataResponse* response = (const DataResponse*)data;
+    uint16_t status = WIRE_GET_U16(view, response_msg, status);
+    char message[MAX_MESSAGE_LEN];
+    WIRE_GET_STR(view, response_msg, message, message, sizeof(message));
     
-    printf("数据上传响应: 状态=%d\n", response->status);
+    printf("数据上传响应: 状态=%d\n", status);
     
-    if (response->data_len > 0 && data_len >= sizeof(DataResponse) + response->data_len) {
-        const char* message = data + sizeof(DataResponse);
-        char* msg_str = malloc(response->data_len + 1);
-        if (msg_str) {
-            memcpy(msg_str, message, response->data_len);
-            msg_str[response->data_len] = '\0';
-            printf("服务器消息: %s\n", msg_str);
-            free(msg_str);
-        }
+    if (message[0] != '\0') {
+        printf("服务器消息: %s\n", message);
     }
     
     // 在GUI模式下更新界面
     if (g_client.gui_mode) {
-        if (response->status == STATUS_SUCCESS) {
+        if (status == STATUS_SUCCESS) {
             gui_log_message("数据上传成功");
         } else {
             gui_log_message("数据上传失败");
@@ -315,31 +300,25 @@ void handle_data_response(const char* data, size_t data_len) {
 }
 
 // 处理错误响应
-void handle_error_response(const char* data, size_t data_len) {
-    if (!data || data_len < sizeof(ErrorResponse)) {
+void handle_error_response(const wire_view_t* view) {
+    if (!view) {
         printf("错误: 无效的错误响应\n");
         return;
     }
     
-    const ErrorResponse* response = (const ErrorResponse*)data;
-    
-    printf("服务器错误: 代码=%d\n", response->error_code);
-    
-    if (response->message_len > 0 && data_len >= sizeof(ErrorResponse) + response->message_len) {
-        const char* message = data + sizeof(ErrorResponse);
-        char* msg_str = malloc(response->message_len + 1);
-        if (msg_str) {
-            memcpy(msg_str, message, response->message_len);
-            msg_str[response->message_len] = '\0';
-            printf("错误消息: %s\n", msg_str);
-            
-            // 在GUI模式下显示错误
-            if (g_client.gui_mode) {
-                gui_show_error(msg_str);
-                gui_log_message("服务器错误: %s", msg_str);
-            }
-            
-            free(msg_str);
+    uint16_t status = WIRE_GET_U16(view, response_msg, status);
+    char message[MAX_MESSAGE_LEN];
+    WIRE_GET_STR(view, response_msg, message, message, sizeof(message));
+    
+    printf("服务器错误: 代码=%d\n", status);
+    
+    if (message[0] != '\0') {
+        printf("错误消息: %s\n", message);
+        
+        // 在GUI模式下显示错误
+        if (g_client.gui_mode) {
+            gui_show_error(message);
+            gui_log_message("服务器错误: %s", message);
         }
     }
 }
@@ -144,7 +144,15 @@ void command_line_mode() {
                 if (g_client.update_available) {
                     printf("有新版本可用: %s\n", g_client.latest_version);
                 }
+                printf("帧压缩: %s\n", (g_client.capabilities & CAP_COMPRESS_ZLIB) ? "已启用" : "未启用");
             }
+            if (update_prefetch_active()) {
+                printf("后台更新: 进行中\n");
+            }
+            if (peer_service_port() > 0) {
+                printf("局域网对等分发: 数据端口 %d\n", peer_service_port());
+            }
+            compress_print_stats();
         }
         else if (strcmp(command, "update") == 0) {
             if (is_connected()) {
@@ -220,6 +228,15 @@ int main(int argc, char* argv[]) {
     // 创建必要的目录
     create_directories();
     
+    // 加载客户端标识（保存失败时本次运行仍使用生成的标识）
+    load_client_id(g_client.client_id);
+    
+    // 上次在后台下载完成但还没有应用的更新在连接之前应用，成功时直接重启为新版本
+    update_apply_staged();
+    
+    // 启用了局域网对等分发时向其他客户端提供已下载的更新包
+    peer_service_start();
+    
     printf("客户端初始化完成\n");
     
     int result = 0;
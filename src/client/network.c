@@ -1,4 +1,6 @@
 #include "client.h"
+#include "../common/utils.h"
+#include "../common/stream.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,8 +26,8 @@ int client_init() {
         return -1;
     }
     
-    if (pthread_mutex_init(&g_client.send_mutex, NULL) != 0) {
-        perror("pthread_mutex_init send_mutex");
+    if (mux_sender_init(&g_client.sender) != 0) {
+        fprintf(stderr, "初始化发送调度器失败\n");
         pthread_mutex_destroy(&g_client.status_mutex);
         return -1;
     }
@@ -53,8 +55,8 @@ void client_cleanup() {
     }
     
     // 销毁互斥锁
+    mux_sender_destroy(&g_client.sender);
     pthread_mutex_destroy(&g_client.status_mutex);
-    pthread_mutex_destroy(&g_client.send_mutex);
 }
 
 // 连接到服务器
@@ -104,6 +106,15 @@ int client_connect(const char* host, int port) {
         return -1;
     }
     
+    // 启动发送线程，之后所有发往服务端的消息都经发送调度器排队
+    if (mux_sender_start(&g_client.sender, g_client.socket_fd) != 0) {
+        fprintf(stderr, "启动发送线程失败\n");
+        close(g_client.socket_fd);
+        g_client.socket_fd = -1;
+        set_connection_status(CONN_ERROR);
+        return -1;
+    }
+    
     set_connection_status(CONN_CONNECTED);
     
     // 更新配置
@@ -135,11 +146,20 @@ int client_connect(const char* host, int port) {
 
 // 断开连接
 void client_disconnect() {
-    set_connection_status(CONN_DISCONNECTED);
+    // 网络线程和用户线程都可能调用，只由取到socket的一方负责关闭
+    lock_status();
+    int socket_fd = g_client.socket_fd;
+    g_client.socket_fd = -1;
+    g_client.status = CONN_DISCONNECTED;
+    g_client.capabilities = 0;
+    g_client.heartbeat_interval = 0;
+    unlock_status();
     
-    if (g_client.socket_fd > 0) {
-        close(g_client.socket_fd);
-        g_client.socket_fd = -1;
+    if (socket_fd > 0) {
+        // 先中断socket上阻塞的读写，再停止发送线程
+        shutdown(socket_fd, SHUT_RDWR);
+        mux_sender_stop(&g_client.sender);
+        close(socket_fd);
         printf("已断开服务器连接\n");
     }
 }
@@ -150,43 +170,18 @@ int client_send_message(message_type_t type, const void* data, size_t data_size)
         return -1;
     }
     
-    lock_send();
-    
-    // 创建消息头
-    message_header_t header;
-    init_message_header(&header, type, data_size);
-    
-    if (data && data_size > 0) {
-        header.checksum = calculate_checksum(data, data_size);
-    } else {
-        header.checksum = 0;
-    }
-    
-    // 发送消息头
-    ssize_t sent = send(g_client.socket_fd, &header, sizeof(header), 0);
-    if (sent != sizeof(header)) {
-        perror("send header");
-        unlock_send();
+    // 交给发送线程排队，等待写入socket后返回
+    if (mux_send_message(&g_client.sender, type, data, data ? data_size : 0, 1) != 0) {
+        fprintf(stderr, "发送消息失败: 类型=%d\n", type);
         client_disconnect();
         return -1;
     }
     
-    // 发送消息数据
-    if (data && data_size > 0) {
-        sent = send(g_client.socket_fd, data, data_size, 0);
-        if (sent != (ssize_t)data_size) {
-            perror("send data");
-            unlock_send();
-            client_disconnect();
-            return -1;
-        }
-    }
-    
-    unlock_send();
     return 0;
 }
 
 // 接收消息
+// 返回0表示消息已完整接收，返回1表示为流式消息（消息体留在socket中由调用者处理）
 int client_receive_message(message_header_t* header, char** data) {
     if (!header || !is_connected()) {
         return -1;
@@ -210,15 +205,27 @@ int client_receive_message(message_header_t* header, char** data) {
         return -1;
     }
     
-    // 验证消息头
+    // 验证消息头（v2帧的消息头为小端）
+    wire_decode_header(header);
     if (!validate_message_header(header)) {
         printf("无效的消息头\n");
         client_disconnect();
         return -1;
     }
     
-    // 接收消息数据
+    // 收到的数据帧说明连接正常，心跳线程据此跳过显式心跳
+    if (header->type != MSG_HEARTBEAT) {
+        __atomic_store_n(&g_client.last_receive_time, time(NULL), __ATOMIC_RELAXED);
+    }
+    
+    // 大消息和未压缩的更新数据的消息体交给调用者流式处理（更新数据边接收边写入磁盘）
     *data = NULL;
+    if (is_stream_frame(header->type, header->flags, header->length) ||
+        (header->type == MSG_UPDATE_DATA && header->length > 0 && !(header->flags & FRAME_FLAG_COMPRESSED))) {
+        return 1;
+    }
+    
+    // 接收消息数据
     if (header->length > 0) {
         *data = malloc(header->length + 1);
         if (!*data) {
@@ -247,6 +254,26 @@ int client_receive_message(message_header_t* header, char** data) {
             client_disconnect();
             return -1;
         }
+        
+        // 解压数据
+        if (header->flags & FRAME_FLAG_COMPRESSED) {
+            unsigned char* decompressed = NULL;
+            size_t decompressed_size = 0;
+            
+            if (decompress_frame(FRAME_CODEC(header->flags), *data, header->length,
+                                 &decompressed, &decompressed_size, MAX_FRAME_LENGTH) != 0) {
+                printf("消息解压失败\n");
+                free(*data);
+                *data = NULL;
+                client_disconnect();
+                return -1;
+            }
+            
+            free(*data);
+            *data = (char*)decompressed;
+            header->length = (uint32_t)decompressed_size;
+            header->flags = 0;
+        }
     }
     
     return 0;
@@ -260,12 +287,58 @@ void* network_thread_func(void* arg) {
         message_header_t header;
         char* data = NULL;
         
-        if (client_receive_message(&header, &data) == 0) {
+        int receive_result = client_receive_message(&header, &data);
+        
+        if (receive_result == 1) {
+            // 流式消息：消息体边接收边处理
+            if (header.type == MSG_UPDATE_DATA) {
+                handle_update_stream(&header);
+            } else {
+                printf("收到不支持流式处理的消息类型: %d\n", header.type);
+                uint32_t checksum = 0;
+                if (stream_recv_body(g_client.socket_fd, header.length, &checksum, NULL, NULL) < 0) {
+                    client_disconnect();
+                }
+            }
+        } else if (receive_result == 0) {
+            // 消息体按帧自身的线格式版本解析
+            wire_view_t view;
+            
             // 处理接收到的消息
             switch (header.type) {
                 case MSG_VERSION_RESPONSE: {
-                    version_response_msg_t* response = (version_response_msg_t*)data;
-                    handle_version_response(response);
+                    // 旧服务端的响应不含能力位、心跳间隔、补丁大小、更新包哈希和重试间隔字段，缺失部分置零
+                    size_t min_length = WIRE_OFFSET(header.version, version_response_msg, capabilities);
+                    if (wire_view_init(&view, header.version, data, header.length, min_length) != 0) {
+                        printf("收到无效的版本响应\n");
+                        break;
+                    }
+                    
+                    version_response_msg_t response;
+                    memset(&response, 0, sizeof(response));
+                    response.status = WIRE_GET_U16(&view, version_response_msg, status);
+                    WIRE_GET_STR(&view, version_response_msg, server_version,
+                                 response.server_version, sizeof(response.server_version));
+                    WIRE_GET_STR(&view, version_response_msg, latest_version,
+                                 response.latest_version, sizeof(response.latest_version));
+                    response.update_size = WIRE_GET_U32(&view, version_response_msg, update_size);
+                    if (view.length >= min_length + sizeof(uint32_t)) {
+                        response.capabilities = WIRE_GET_U32(&view, version_response_msg, capabilities);
+                    }
+                    if (view.length >= WIRE_OFFSET(view.version, version_response_msg, delta_size)) {
+                        response.heartbeat_interval = WIRE_GET_U32(&view, version_response_msg, heartbeat_interval);
+                    }
+                    if (view.length >= WIRE_OFFSET(view.version, version_response_msg, package_hash)) {
+                        response.delta_size = WIRE_GET_U32(&view, version_response_msg, delta_size);
+                    }
+                    if (view.length >= WIRE_OFFSET(view.version, version_response_msg, retry_after)) {
+                        memcpy(response.package_hash, WIRE_GET_PTR(&view, version_response_msg, package_hash),
+                               sizeof(response.package_hash));
+                    }
+                    if (view.length >= WIRE_SIZE(view.version, version_response_msg)) {
+                        response.retry_after = WIRE_GET_U32(&view, version_response_msg, retry_after);
+                    }
+                    handle_version_response(&response);
                     break;
                 }
                 
@@ -273,21 +346,62 @@ void* network_thread_func(void* arg) {
                     handle_update_data(data, header.length);
                     break;
                 
-                case MSG_FILE_RESPONSE: {
-                    handle_file_response(data, header.length);
+                case MSG_UPDATE_RESUME:
+                    if (wire_view_init(&view, header.version, data, header.length,
+                                       WIRE_SIZE(header.version, update_resume_msg)) != 0) {
+                        printf("收到无效的续传通知\n");
+                        break;
+                    }
+                    handle_update_resume(&view);
                     break;
-                }
                 
-                case MSG_DATA_RESPONSE: {
-                    handle_data_response(data, header.length);
+                case MSG_UPDATE_MANIFEST:
+                    if (wire_view_init(&view, header.version, data, header.length,
+                                       WIRE_SIZE(header.version, update_manifest_msg)) != 0) {
+                        printf("收到无效的分块清单\n");
+                        break;
+                    }
+                    handle_update_manifest(&view);
+                    break;
+                
+                case MSG_UPDATE_DELTA:
+                    if (wire_view_init(&view, header.version, data, header.length,
+                                       WIRE_SIZE(header.version, update_delta_msg)) != 0) {
+                        printf("收到无效的差量补丁\n");
+                        break;
+                    }
+                    handle_update_delta(&view);
                     break;
-                }
                 
+                case MSG_FILE_RESPONSE:
+                case MSG_DATA_RESPONSE:
                 case MSG_ERROR: {
-                    handle_error_response(data, header.length);
+                    if (wire_view_init(&view, header.version, data, header.length,
+                                       WIRE_SIZE(header.version, response_msg)) != 0) {
+                        printf("错误: 无效的响应消息\n");
+                        break;
+                    }
+                    
+                    if (header.type == MSG_FILE_RESPONSE) {
+                        handle_file_response(&view);
+                    } else if (header.type == MSG_DATA_RESPONSE) {
+                        handle_data_response(&view);
+                    } else {
+                        handle_error_response(&view);
+                    }
                     break;
                 }
                 
+                case MSG_STREAM_DATA:
+                    if (wire_view_init(&view, header.version, data, header.length,
+                                       WIRE_SIZE(header.version, stream_data_msg)) != 0) {
+                        printf("收到无效的逻辑流分片\n");
+                        client_disconnect();
+                        break;
+                    }
+                    handle_stream_data(&view);
+                    break;
+                
                 case MSG_HEARTBEAT:
                     // 心跳响应，无需处理
                     break;
@@ -303,18 +417,160 @@ void* network_thread_func(void* arg) {
         }
     }
     
+    // 放弃未接收完的逻辑流
+    close_client_streams();
+    
     return NULL;
 }
 
+// 处理逻辑流分片（按stream_id重组，分片数据直接交给对应的接收处理）
+int handle_stream_data(const wire_view_t* view) {
+    if (!view) {
+        return -1;
+    }
+    
+    uint32_t stream_id = WIRE_GET_U32(view, stream_data_msg, stream_id);
+    uint16_t inner_type = WIRE_GET_U16(view, stream_data_msg, inner_type);
+    uint8_t stream_flags = WIRE_GET_U8(view, stream_data_msg, stream_flags);
+    uint32_t total_length = WIRE_GET_U32(view, stream_data_msg, total_length);
+    const char* fragment = WIRE_GET_PTR(view, stream_data_msg, data);
+    size_t fragment_length = view->length - WIRE_SIZE(view->version, stream_data_msg);
+    mux_stream_t* stream = mux_stream_find(g_client.streams, stream_id);
+    
+    if (stream_flags & STREAM_FLAG_BEGIN) {
+        // 目前只有更新数据会以分片形式发送
+        if (stream || inner_type != MSG_UPDATE_DATA) {
+            printf("收到无效的逻辑流: ID=%u, 类型=%d\n", stream_id, inner_type);
+            client_disconnect();
+            return -1;
+        }
+        
+        stream = mux_stream_open(g_client.streams, stream_id, inner_type, total_length);
+        if (!stream) {
+            printf("同时打开的逻辑流过多\n");
+            client_disconnect();
+            return -1;
+        }
+        
+        printf("分片接收更新数据: %u 字节\n", total_length);
+        
+        // 创建失败时继续接收并丢弃数据，结束时报告失败
+        stream->context = update_stream_begin();
+    } else if (!stream) {
+        printf("收到未知逻辑流的分片: %u\n", stream_id);
+        client_disconnect();
+        return -1;
+    }
+    
+    if (fragment_length > stream->total_length - stream->received) {
+        printf("逻辑流数据超出声明长度: %u\n", stream->stream_id);
+        client_disconnect();
+        return -1;
+    }
+    
+    if (stream->context && update_stream_write(stream->context, fragment, fragment_length) != 0) {
+        update_stream_abort(stream->context, 0);
+        stream->context = NULL;
+    }
+    stream->received += (uint32_t)fragment_length;
+    
+    if (!(stream_flags & STREAM_FLAG_END)) {
+        return 0;
+    }
+    
+    void* context = stream->context;
+    int complete = stream->received == stream->total_length;
+    mux_stream_close(stream);
+    
+    if (!context || !complete) {
+        if (context) {
+            update_stream_abort(context, 0);
+        }
+        printf("更新下载失败\n");
+        log_message_to_gui("更新下载失败");
+        return -1;
+    }
+    
+    return update_stream_finish(context);
+}
+
+// 放弃所有未接收完的逻辑流（断线时调用，已接收的更新数据保留供续传）
+void close_client_streams() {
+    for (int i = 0; i < MUX_MAX_STREAMS; i++) {
+        if (g_client.streams[i].stream_id != 0) {
+            if (g_client.streams[i].context) {
+                update_stream_abort(g_client.streams[i].context, 1);
+            }
+            mux_stream_close(&g_client.streams[i]);
+        }
+    }
+}
+
+// 计算心跳基础间隔：优先使用服务端建议的间隔
+static int heartbeat_base_interval() {
+    lock_status();
+    int interval = g_client.heartbeat_interval;
+    unlock_status();
+    
+    if (interval <= 0) {
+        interval = g_client.config.heartbeat_interval;
+    }
+    
+    return interval > 0 ? interval : DEFAULT_HEARTBEAT_INTERVAL;
+}
+
 // 心跳线程
+// 最近发送过数据帧时不发送显式心跳（服务端只按收到的帧判断存活，只在接收数据时仍要发送）；
+// 一直没有发送数据时间隔逐次加倍，最多退避到服务端建议间隔的 HEARTBEAT_BACKOFF_LIMIT 倍
 void* heartbeat_thread_func(void* arg) {
     (void)arg; // 避免未使用参数警告
     
+    time_t last_heartbeat = time(NULL);
+    int backoff = 1;
+    
     while (g_client.running && is_connected()) {
-        sleep(HEARTBEAT_INTERVAL);
+        // 服务端暂缓提供更新时按其建议的时间重新做版本检查
+        lock_status();
+        int recheck = g_client.next_version_check != 0 && time(NULL) >= g_client.next_version_check;
+        if (recheck) {
+            g_client.next_version_check = 0;
+        }
+        unlock_status();
+        if (recheck && send_version_check() != 0) {
+            break;
+        }
+        
+        int base_interval = heartbeat_base_interval();
         
-        if (is_connected()) {
-            send_heartbeat();
+        // 最近一次发送非心跳帧的时间
+        time_t last_activity = mux_sender_last_activity(&g_client.sender);
+        
+        // 上次心跳之后发送过数据，重新从基础间隔开始
+        if (last_activity > last_heartbeat) {
+            backoff = 1;
+        }
+        
+        time_t last_traffic = last_activity > last_heartbeat ? last_activity : last_heartbeat;
+        time_t now = time(NULL);
+        time_t due = last_traffic + (time_t)base_interval * backoff;
+        
+        if (now < due) {
+            time_t wait = due - now;
+            sleep(wait < HEARTBEAT_CHECK_INTERVAL ? (unsigned int)wait : HEARTBEAT_CHECK_INTERVAL);
+            continue;
+        }
+        
+        if (send_heartbeat() != 0) {
+            break;
+        }
+        last_heartbeat = time(NULL);
+        
+        // 只有服务端声明了建议间隔时才退避，避免超过旧服务端的超时时间
+        lock_status();
+        int advertised = g_client.heartbeat_interval > 0;
+        unlock_status();
+        if (advertised && backoff < HEARTBEAT_BACKOFF_LIMIT) {
+            backoff *= 2;
         }
     }
     
@@ -330,14 +586,6 @@ void unlock_status() {
     pthread_mutex_unlock(&g_client.status_mutex);
 }
 
-void lock_send() {
-    pthread_mutex_lock(&g_client.send_mutex);
-}
-
-void unlock_send() {
-    pthread_mutex_unlock(&g_client.send_mutex);
-}
-
 void set_connection_status(connection_status_t status) {
     lock_status();
     g_client.status = status;
@@ -0,0 +1,515 @@
+#include "client.h"
+#include "../common/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// 局域网对等分发：启用peer_update的客户端加入PEER_MULTICAST_GROUP，收到查询时如果本地已有
+// 同一更新包（按SHA-256比对），就应答自己提供数据的TCP端口；请求方再按块从这些客户端读取
+// 更新包。对等节点不受信任：取完后仍按服务端告知的哈希校验整个更新包，不一致时丢弃，改为
+// 从服务端下载。报文和请求中的整数使用网络字节序
+
+#define PEER_MAGIC 0x42363450  // "B64P"
+#define PEER_QUERY 1
+#define PEER_OFFER 2
+
+// 发现报文
+typedef struct {
+    uint32_t magic;
+    uint8_t type;               // PEER_QUERY / PEER_OFFER
+    uint8_t reserved;
+    uint16_t port;              // 应答方提供数据的TCP端口（查询时为0）
+    uint32_t size;              // 更新包大小（查询时为0）
+    uint8_t hash[SHA256_DIGEST_SIZE];
+} __attribute__((packed)) peer_packet_t;
+
+// 分块请求（同一连接上可以连续发送多个）
+typedef struct {
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    uint32_t offset;
+    uint32_t length;            // 不超过PEER_CHUNK_SIZE
+} __attribute__((packed)) peer_chunk_request_t;
+
+// 分块应答，status为0时随后是length字节的数据
+typedef struct {
+    uint32_t status;
+    uint32_t length;
+} __attribute__((packed)) peer_chunk_reply_t;
+
+// 提供数据的对等节点
+typedef struct {
+    struct sockaddr_in addr;
+    int socket_fd;              // 复用的连接，-1表示尚未连接
+    int failed;                 // 出过错的节点不再使用
+} peer_source_t;
+
+// 本地提供的更新包：按文件身份缓存哈希。描述符在更新包被替换后仍指向原来的内容，
+// 正在进行的上传不会读到新文件
+static struct {
+    pthread_mutex_t mutex;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    uint8_t hash[SHA256_DIGEST_SIZE];
+} g_peer_package = { PTHREAD_MUTEX_INITIALIZER, -1, 0, 0, 0, 0, {0} };
+
+static int g_peer_port = 0;
+static int g_peer_uploads = 0;
+
+// 本地更新包是指定的那一个时返回它的描述符（由调用者关闭）和大小，否则返回-1
+static int peer_package_open(const uint8_t* hash, uint32_t* size) {
+    pthread_mutex_lock(&g_peer_package.mutex);
+    
+    struct stat st;
+    int changed = stat(UPDATE_PACKAGE_FILE, &st) != 0 || g_peer_package.fd == -1 ||
+                  st.st_dev != g_peer_package.dev || st.st_ino != g_peer_package.ino ||
+                  st.st_size != g_peer_package.size || st.st_mtime != g_peer_package.mtime;
+    
+    // 更新包变化后重新计算哈希
+    if (changed) {
+        if (g_peer_package.fd != -1) {
+            close(g_peer_package.fd);
+        }
+        
+        g_peer_package.fd = open(UPDATE_PACKAGE_FILE, O_RDONLY);
+        struct stat opened;
+        if (g_peer_package.fd != -1 &&
+            (fstat(g_peer_package.fd, &opened) != 0 || update_file_digest(g_peer_package.fd, g_peer_package.hash) != 0)) {
+            close(g_peer_package.fd);
+            g_peer_package.fd = -1;
+        }
+        
+        if (g_peer_package.fd != -1) {
+            g_peer_package.dev = opened.st_dev;
+            g_peer_package.ino = opened.st_ino;
+            g_peer_package.size = opened.st_size;
+            g_peer_package.mtime = opened.st_mtime;
+        }
+    }
+    
+    int fd = -1;
+    if (g_peer_package.fd != -1 && g_peer_package.size <= (off_t)UINT32_MAX &&
+        memcmp(g_peer_package.hash, hash, SHA256_DIGEST_SIZE) == 0) {
+        fd = dup(g_peer_package.fd);
+        *size = (uint32_t)g_peer_package.size;
+    }
+    
+    pthread_mutex_unlock(&g_peer_package.mutex);
+    return fd;
+}
+
+// 设置对等连接的收发超时，对端失去响应时不会一直阻塞
+static void peer_set_timeout(int socket_fd) {
+    struct timeval timeout = { PEER_IO_TIMEOUT, 0 };
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// 应答发现查询
+static void peer_answer_query(int udp_fd) {
+    peer_packet_t packet;
+    struct sockaddr_in from;
+    socklen_t from_length = sizeof(from);
+    
+    ssize_t received = recvfrom(udp_fd, &packet, sizeof(packet), 0, (struct sockaddr*)&from, &from_length);
+    if (received != (ssize_t)sizeof(packet) || ntohl(packet.magic) != PEER_MAGIC || packet.type != PEER_QUERY) {
+        return;
+    }
+    
+    uint32_t size = 0;
+    int package_fd = peer_package_open(packet.hash, &size);
+    if (package_fd == -1) {
+        return;
+    }
+    close(package_fd);
+    
+    packet.type = PEER_OFFER;
+    packet.port = htons((uint16_t)g_peer_port);
+    packet.size = htonl(size);
+    sendto(udp_fd, &packet, sizeof(packet), 0, (struct sockaddr*)&from, from_length);
+}
+
+// 上传线程：按请求发送更新包的分块，直到对端关闭连接
+static void* peer_upload_thread_func(void* arg) {
+    int socket_fd = *(int*)arg;
+    free(arg);
+    
+    char* buffer = malloc(PEER_CHUNK_SIZE);
+    peer_chunk_request_t request;
+    
+    while (buffer && recv_all(socket_fd, &request, sizeof(request)) == 0) {
+        uint32_t offset = ntohl(request.offset);
+        uint32_t length = ntohl(request.length);
+        uint32_t size = 0;
+        peer_chunk_reply_t reply = { htonl(1), 0 };
+        
+        int package_fd = peer_package_open(request.hash, &size);
+        if (package_fd != -1) {
+            if (length <= PEER_CHUNK_SIZE && offset <= size && length <= size - offset &&
+                pread(package_fd, buffer, length, offset) == (ssize_t)length) {
+                reply.status = 0;
+                reply.length = htonl(length);
+            }
+            close(package_fd);
+        }
+        
+        if (send_all(socket_fd, &reply, sizeof(reply)) != 0 ||
+            (reply.status == 0 && send_all(socket_fd, buffer, length) != 0)) {
+            break;
+        }
+    }
+    
+    free(buffer);
+    close(socket_fd);
+    __atomic_sub_fetch(&g_peer_uploads, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// 接受其他客户端的连接，超过PEER_MAX_UPLOADS时直接关闭，请求方会换一个节点
+static void peer_accept_upload(int tcp_fd) {
+    int socket_fd = accept(tcp_fd, NULL, NULL);
+    if (socket_fd == -1) {
+        return;
+    }
+    
+    if (__atomic_add_fetch(&g_peer_uploads, 1, __ATOMIC_RELAXED) > PEER_MAX_UPLOADS) {
+        __atomic_sub_fetch(&g_peer_uploads, 1, __ATOMIC_RELAXED);
+        close(socket_fd);
+        return;
+    }
+    
+    peer_set_timeout(socket_fd);
+    
+    int* arg = malloc(sizeof(int));
+    pthread_t thread;
+    if (!arg) {
+        close(socket_fd);
+        __atomic_sub_fetch(&g_peer_uploads, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    *arg = socket_fd;
+    
+    if (pthread_create(&thread, NULL, peer_upload_thread_func, arg) != 0) {
+        perror("pthread_create peer_upload_thread");
+        free(arg);
+        close(socket_fd);
+        __atomic_sub_fetch(&g_peer_uploads, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// 对等服务线程：应答发现查询并接受数据连接
+static void* peer_service_thread_func(void* arg) {
+    int* fds = (int*)arg;
+    struct pollfd poll_fds[2] = {
+        { fds[0], POLLIN, 0 },
+        { fds[1], POLLIN, 0 }
+    };
+    free(fds);
+    
+    // 预先计算本地更新包的哈希，第一个查询不必等待
+    uint8_t none[SHA256_DIGEST_SIZE] = {0};
+    uint32_t size = 0;
+    int package_fd = peer_package_open(none, &size);
+    if (package_fd != -1) {
+        close(package_fd);
+    }
+    
+    while (g_client.running) {
+        if (poll(poll_fds, 2, 1000) <= 0) {
+            continue;
+        }
+        
+        if (poll_fds[0].revents & POLLIN) {
+            peer_answer_query(poll_fds[0].fd);
+        }
+        if (poll_fds[1].revents & POLLIN) {
+            peer_accept_upload(poll_fds[1].fd);
+        }
+    }
+    
+    close(poll_fds[0].fd);
+    close(poll_fds[1].fd);
+    return NULL;
+}
+
+// 启动对等服务（未启用peer_update时什么也不做）
+int peer_service_start() {
+    if (!g_client.config.peer_update) {
+        return 0;
+    }
+    
+    int reuse = 1;
+    struct sockaddr_in addr;
+    socklen_t addr_length = sizeof(addr);
+    
+    int tcp_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons((uint16_t)g_client.config.peer_port);
+    
+    if (tcp_fd == -1 ||
+        setsockopt(tcp_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1 ||
+        bind(tcp_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(tcp_fd, PEER_MAX_UPLOADS) == -1 ||
+        getsockname(tcp_fd, (struct sockaddr*)&addr, &addr_length) == -1) {
+        perror("peer tcp socket");
+        if (tcp_fd != -1) close(tcp_fd);
+        return -1;
+    }
+    g_peer_port = ntohs(addr.sin_port);
+    
+    // 同一台机器上的多个客户端实例共用发现端口，各自都能收到组播查询
+    int udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(PEER_DISCOVERY_PORT);
+    
+    struct ip_mreq membership;
+    memset(&membership, 0, sizeof(membership));
+    inet_pton(AF_INET, PEER_MULTICAST_GROUP, &membership.imr_multiaddr);
+    membership.imr_interface.s_addr = INADDR_ANY;
+    
+    if (udp_fd == -1 ||
+        setsockopt(udp_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1 ||
+        setsockopt(udp_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1 ||
+        bind(udp_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        setsockopt(udp_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) == -1) {
+        perror("peer discovery socket");
+        if (udp_fd != -1) close(udp_fd);
+        close(tcp_fd);
+        return -1;
+    }
+    
+    int* fds = malloc(2 * sizeof(int));
+    pthread_t thread;
+    if (!fds) {
+        close(udp_fd);
+        close(tcp_fd);
+        return -1;
+    }
+    fds[0] = udp_fd;
+    fds[1] = tcp_fd;
+    
+    if (pthread_create(&thread, NULL, peer_service_thread_func, fds) != 0) {
+        perror("pthread_create peer_service_thread");
+        free(fds);
+        close(udp_fd);
+        close(tcp_fd);
+        return -1;
+    }
+    pthread_detach(thread);
+    
+    printf("局域网对等分发已启用: 组播 %s:%d, 数据端口 %d\n", PEER_MULTICAST_GROUP, PEER_DISCOVERY_PORT, g_peer_port);
+    return 0;
+}
+
+// 对等服务的数据端口，未启动时为0
+int peer_service_port() {
+    return g_peer_port;
+}
+
+// 在局域网内查找持有指定更新包的客户端，返回找到的个数
+static int peer_discover(const uint8_t* hash, uint32_t size, peer_source_t* sources) {
+    int udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp_fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    
+    // 同一台机器上的其他实例也要收到查询；查询不跨越路由器
+    unsigned char loop = 1;
+    unsigned char ttl = 1;
+    setsockopt(udp_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    setsockopt(udp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    
+    peer_packet_t query;
+    memset(&query, 0, sizeof(query));
+    query.magic = htonl(PEER_MAGIC);
+    query.type = PEER_QUERY;
+    memcpy(query.hash, hash, SHA256_DIGEST_SIZE);
+    
+    struct sockaddr_in group;
+    memset(&group, 0, sizeof(group));
+    group.sin_family = AF_INET;
+    group.sin_port = htons(PEER_DISCOVERY_PORT);
+    inet_pton(AF_INET, PEER_MULTICAST_GROUP, &group.sin_addr);
+    
+    if (sendto(udp_fd, &query, sizeof(query), 0, (struct sockaddr*)&group, sizeof(group)) == -1) {
+        perror("sendto peer query");
+        close(udp_fd);
+        return -1;
+    }
+    
+    // 在等待时间内收集应答，大小与服务端告知的不一致的节点不用
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int count = 0;
+    
+    while (count < PEER_MAX_SOURCES) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= PEER_DISCOVERY_TIMEOUT_MS) {
+            break;
+        }
+        
+        struct pollfd poll_fd = { udp_fd, POLLIN, 0 };
+        if (poll(&poll_fd, 1, (int)(PEER_DISCOVERY_TIMEOUT_MS - elapsed)) <= 0) {
+            continue;
+        }
+        
+        peer_packet_t offer;
+        struct sockaddr_in from;
+        socklen_t from_length = sizeof(from);
+        ssize_t received = recvfrom(udp_fd, &offer, sizeof(offer), 0, (struct sockaddr*)&from, &from_length);
+        if (received != (ssize_t)sizeof(offer) || ntohl(offer.magic) != PEER_MAGIC || offer.type != PEER_OFFER ||
+            offer.port == 0 || ntohl(offer.size) != size || memcmp(offer.hash, hash, SHA256_DIGEST_SIZE) != 0) {
+            continue;
+        }
+        
+        from.sin_port = offer.port;
+        int duplicate = 0;
+        for (int i = 0; i < count; i++) {
+            if (sources[i].addr.sin_addr.s_addr == from.sin_addr.s_addr && sources[i].addr.sin_port == from.sin_port) {
+                duplicate = 1;
+            }
+        }
+        if (duplicate) {
+            continue;
+        }
+        
+        sources[count].addr = from;
+        sources[count].socket_fd = -1;
+        sources[count].failed = 0;
+        count++;
+    }
+    
+    close(udp_fd);
+    return count;
+}
+
+// 从一个对等节点读取一块数据，出错时把该节点标记为不可用
+static int peer_fetch_chunk(peer_source_t* source, const uint8_t* hash, uint32_t offset,
+                            uint32_t length, char* buffer) {
+    if (source->socket_fd == -1) {
+        source->socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (source->socket_fd == -1) {
+            source->failed = 1;
+            return -1;
+        }
+        
+        peer_set_timeout(source->socket_fd);
+        if (connect(source->socket_fd, (struct sockaddr*)&source->addr, sizeof(source->addr)) == -1) {
+            close(source->socket_fd);
+            source->socket_fd = -1;
+            source->failed = 1;
+            return -1;
+        }
+    }
+    
+    peer_chunk_request_t request;
+    memcpy(request.hash, hash, SHA256_DIGEST_SIZE);
+    request.offset = htonl(offset);
+    request.length = htonl(length);
+    
+    peer_chunk_reply_t reply;
+    if (send_all(source->socket_fd, &request, sizeof(request)) != 0 ||
+        recv_all(source->socket_fd, &reply, sizeof(reply)) != 0 ||
+        ntohl(reply.status) != 0 || ntohl(reply.length) != length ||
+        recv_all(source->socket_fd, buffer, length) != 0) {
+        close(source->socket_fd);
+        source->socket_fd = -1;
+        source->failed = 1;
+        return -1;
+    }
+    
+    return 0;
+}
+
+// 从局域网内的对等节点获取更新包，size为服务端告知的更新包大小，offset为已下载的字节数。
+// 返回0表示已取得完整的更新包并通过校验；1表示没有取完，已取得的部分保留，由服务端续传；
+// -1表示出错，由服务端重新下载
+int peer_fetch_update(const uint8_t* package_hash, uint32_t size, uint32_t offset) {
+    // 不知道更新包大小时无法核对对等节点的应答，直接从服务端下载
+    if (size == 0) {
+        return 1;
+    }
+    
+    peer_source_t sources[PEER_MAX_SOURCES];
+    int count = peer_discover(package_hash, size, sources);
+    if (count <= 0) {
+        printf("局域网内没有持有该更新包的客户端\n");
+        return 1;
+    }
+    
+    // 已下载的部分不可能比更新包还大，进度记录有误时从头获取
+    if (offset > size) {
+        offset = 0;
+    }
+    printf("局域网内有 %d 个客户端持有该更新包 (%u 字节)，从 %u 字节处开始获取\n", count, size, offset);
+    
+    char* buffer = malloc(PEER_CHUNK_SIZE);
+    void* download = buffer ? update_download_open(package_hash, offset > 0, offset) : NULL;
+    if (!download) {
+        free(buffer);
+        return -1;
+    }
+    
+    // 各块轮流从不同的节点获取，出错的节点不再使用
+    uint32_t position = offset;
+    int next = 0;
+    while (position < size) {
+        uint32_t length = size - position < PEER_CHUNK_SIZE ? size - position : PEER_CHUNK_SIZE;
+        int fetched = 0;
+        
+        for (int attempt = 0; attempt < count && !fetched; attempt++) {
+            peer_source_t* source = &sources[(next + attempt) % count];
+            if (!source->failed && peer_fetch_chunk(source, package_hash, position, length, buffer) == 0) {
+                fetched = 1;
+            }
+        }
+        next = (next + 1) % count;
+        
+        if (!fetched || update_download_append_raw(download, buffer, length) != 0) {
+            break;
+        }
+        position += length;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        if (sources[i].socket_fd != -1) {
+            close(sources[i].socket_fd);
+        }
+    }
+    free(buffer);
+    
+    if (position < size) {
+        update_download_discard(download, 1);
+        printf("从对等节点获取了 %u 字节，其余部分从服务端下载\n", position - offset);
+        return 1;
+    }
+    
+    // 校验失败时已取得的数据全部丢弃
+    if (update_download_close(download) != 0) {
+        printf("对等节点提供的更新包校验失败，改为从服务端下载\n");
+        log_message_to_gui("对等节点提供的更新包校验失败");
+        return -1;
+    }
+    
+    printf("已从局域网内的客户端取得完整的更新包 (%u 字节)\n", size - offset);
+    return 0;
+}
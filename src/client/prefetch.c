@@ -0,0 +1,568 @@
+#include "client.h"
+#include "../common/utils.h"
+#include "../common/stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+// 后台预取：自动更新需要完整更新包时不在主连接上下载，而是另开一条连接按update_rate_limit
+// 限速接收（接收端读得慢，TCP流控让服务端的发送随之放慢），主连接上的上传不与更新数据争用
+// 发送队列和带宽。下载完成并校验的更新包暂存起来，客户端空闲UPDATE_IDLE_SECONDS秒后应用，
+// 或在下次启动时应用
+
+// 预取连接的状态（仅预取线程访问）
+typedef struct {
+    int socket_fd;
+    char host[256];
+    int port;
+    char version[32];
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    uint32_t size;                // 服务端告知的更新包大小，0表示未知
+    uint32_t rate_limit;          // 字节/秒，0表示不限速
+    int peer_update;              // 先从局域网内的其他客户端获取
+    int heartbeat_interval;       // 长时间接收期间发送心跳的间隔（秒）
+    uint32_t capabilities;        // 服务端确认的能力位
+    struct timespec start;        // 限速计时起点
+    uint64_t received;            // 起点之后接收的字节数
+    time_t last_send;             // 最近一次发出帧的时间
+    void* download;
+} prefetch_t;
+
+static pthread_mutex_t g_prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int g_prefetch_active = 0;
+
+// 连接服务器。接收缓冲区设小，限速时服务端很快就感知到背压
+static int prefetch_connect(prefetch_t* prefetch) {
+    struct hostent* server = gethostbyname(prefetch->host);
+    if (!server) {
+        fprintf(stderr, "无法解析主机名: %s\n", prefetch->host);
+        return -1;
+    }
+    
+    prefetch->socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (prefetch->socket_fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    
+    if (prefetch->rate_limit > 0) {
+        int buffer_size = UPDATE_PREFETCH_RCVBUF;
+        setsockopt(prefetch->socket_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    }
+    
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(prefetch->port);
+    memcpy(&server_addr.sin_addr.s_addr, server->h_addr_list[0], server->h_length);
+    
+    if (connect(prefetch->socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+        perror("connect");
+        return -1;
+    }
+    
+    return 0;
+}
+
+// 发送一帧（预取连接只声明分块清单能力，始终使用v1线格式、不压缩、不分片）
+static int prefetch_send(prefetch_t* prefetch, uint16_t type, const void* data, size_t length) {
+    message_header_t header;
+    init_message_header(&header, type, (uint32_t)length);
+    header.checksum = length > 0 ? calculate_checksum(data, length) : 0;
+    
+    if (send_all(prefetch->socket_fd, &header, sizeof(header)) != 0 ||
+        (length > 0 && send_all(prefetch->socket_fd, data, length) != 0)) {
+        return -1;
+    }
+    
+    prefetch->last_send = time(NULL);
+    return 0;
+}
+
+// 接收消息头
+static int prefetch_recv_header(prefetch_t* prefetch, message_header_t* header) {
+    if (recv_all(prefetch->socket_fd, header, sizeof(*header)) != 0) {
+        return -1;
+    }
+    
+    wire_decode_header(header);
+    return validate_message_header(header) ? 0 : -1;
+}
+
+// 接收整个消息体并校验，返回的缓冲区由调用者释放
+static char* prefetch_recv_body(prefetch_t* prefetch, const message_header_t* header) {
+    char* data = malloc(header->length + 1);
+    if (!data) {
+        return NULL;
+    }
+    
+    if ((header->length > 0 && recv_all(prefetch->socket_fd, data, header->length) != 0) ||
+        calculate_checksum(data, header->length) != header->checksum) {
+        free(data);
+        return NULL;
+    }
+    
+    data[header->length] = '\0';
+    return data;
+}
+
+// 限速：接收的字节数超出限速允许的量时睡眠，期间不读socket
+static void prefetch_throttle(prefetch_t* prefetch, size_t length) {
+    if (prefetch->rate_limit == 0) {
+        return;
+    }
+    
+    prefetch->received += length;
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (double)(now.tv_sec - prefetch->start.tv_sec) +
+                     (double)(now.tv_nsec - prefetch->start.tv_nsec) / 1e9;
+    double expected = (double)prefetch->received / prefetch->rate_limit;
+    
+    if (expected > elapsed) {
+        double wait = expected - elapsed;
+        struct timespec delay;
+        delay.tv_sec = (time_t)wait;
+        delay.tv_nsec = (long)((wait - (double)delay.tv_sec) * 1e9);
+        nanosleep(&delay, NULL);
+    }
+}
+
+// 写入一段更新数据，并按限速节奏读取
+static int prefetch_write(void* context, const char* data, size_t length) {
+    prefetch_t* prefetch = (prefetch_t*)context;
+    
+    if (update_download_append(prefetch->download, data, length) != 0) {
+        return -1;
+    }
+    
+    prefetch_throttle(prefetch, length);
+    
+    // 限速下载可能持续很久，期间发送心跳，避免服务端按超时断开连接
+    if (time(NULL) - prefetch->last_send >= prefetch->heartbeat_interval) {
+        prefetch_send(prefetch, MSG_HEARTBEAT, NULL, 0);
+    }
+    
+    return 0;
+}
+
+// 版本检查：确认服务端的更新包仍是要预取的那一个
+static int prefetch_check_version(prefetch_t* prefetch) {
+    version_check_msg_t check;
+    memset(&check, 0, sizeof(check));
+    strncpy(check.client_version, CLIENT_VERSION, sizeof(check.client_version) - 1);
+    strncpy(check.platform, "Linux", sizeof(check.platform) - 1);
+    check.capabilities = CAP_CHUNK_MANIFEST;
+    
+    // 带上与主连接相同的客户端标识，服务端让两条连接共用一个传输名额
+    memcpy(check.client_id, g_client.client_id, sizeof(check.client_id));
+    
+    if (prefetch_send(prefetch, MSG_VERSION_CHECK, &check, sizeof(check)) != 0) {
+        return -1;
+    }
+    
+    message_header_t header;
+    if (prefetch_recv_header(prefetch, &header) != 0 || header.type != MSG_VERSION_RESPONSE ||
+        header.length > MAX_FRAME_LENGTH) {
+        printf("后台更新: 版本检查失败\n");
+        return -1;
+    }
+    
+    char* data = prefetch_recv_body(prefetch, &header);
+    wire_view_t view;
+    if (!data || wire_view_init(&view, header.version, data, header.length,
+                                WIRE_OFFSET(header.version, version_response_msg, retry_after)) != 0) {
+        printf("后台更新: 版本响应无效\n");
+        free(data);
+        return -1;
+    }
+    
+    int matched = WIRE_GET_U16(&view, version_response_msg, status) == STATUS_UPDATE_AVAILABLE &&
+                  memcmp(WIRE_GET_PTR(&view, version_response_msg, package_hash), prefetch->hash,
+                         SHA256_DIGEST_SIZE) == 0;
+    uint32_t interval = WIRE_GET_U32(&view, version_response_msg, heartbeat_interval);
+    prefetch->capabilities = WIRE_GET_U32(&view, version_response_msg, capabilities);
+    uint32_t retry_after = view.length >= WIRE_SIZE(view.version, version_response_msg) ?
+                           WIRE_GET_U32(&view, version_response_msg, retry_after) : 0;
+    free(data);
+    
+    // 服务端暂缓提供更新：主连接按建议的时间重新检查，届时再启动预取
+    if (retry_after > 0) {
+        update_schedule_version_check(retry_after);
+        return -1;
+    }
+    
+    if (!matched) {
+        printf("后台更新: 服务端的更新包已变化，放弃本次预取\n");
+        return -1;
+    }
+    
+    if (interval > 0) {
+        prefetch->heartbeat_interval = (int)interval;
+    }
+    return 0;
+}
+
+// 发送更新请求：从offset开始的length字节（0表示到末尾）
+static int prefetch_request(prefetch_t* prefetch, uint32_t flags, uint32_t offset, uint32_t length) {
+    update_request_msg_t request;
+    memset(&request, 0, sizeof(request));
+    request.flags = flags;
+    request.resume_offset = offset;
+    request.range_length = length;
+    memcpy(request.package_hash, prefetch->hash, SHA256_DIGEST_SIZE);
+    
+    return prefetch_send(prefetch, MSG_UPDATE_REQUEST, &request, sizeof(request));
+}
+
+// 接收请求的分块清单
+static void* prefetch_receive_manifest(prefetch_t* prefetch) {
+    if (prefetch_request(prefetch, UPDATE_REQUEST_FULL | UPDATE_REQUEST_MANIFEST, 0, 0) != 0) {
+        return NULL;
+    }
+    
+    while (1) {
+        message_header_t header;
+        if (prefetch_recv_header(prefetch, &header) != 0 || header.length > MAX_FRAME_LENGTH) {
+            printf("后台更新: 接收消息失败\n");
+            return NULL;
+        }
+        
+        char* data = prefetch_recv_body(prefetch, &header);
+        if (!data) {
+            return NULL;
+        }
+        
+        void* manifest = NULL;
+        wire_view_t view;
+        if (header.type == MSG_UPDATE_MANIFEST &&
+            wire_view_init(&view, header.version, data, header.length,
+                           WIRE_SIZE(header.version, update_manifest_msg)) == 0) {
+            manifest = update_manifest_parse(&view, prefetch->hash);
+        }
+        free(data);
+        
+        if (header.type == MSG_UPDATE_MANIFEST || header.type == MSG_ERROR) {
+            return manifest;
+        }
+    }
+}
+
+// 接收一次更新请求的结果并写入更新包（manifest不为NULL时按分块清单写入续传通知指定的位置）
+static int prefetch_receive_update(prefetch_t* prefetch, void* manifest) {
+    int resume = 0;
+    uint32_t resume_offset = 0;
+    
+    while (1) {
+        message_header_t header;
+        if (prefetch_recv_header(prefetch, &header) != 0) {
+            printf("后台更新: 接收消息失败\n");
+            return -1;
+        }
+        
+        if (header.type != MSG_UPDATE_DATA) {
+            if (header.length > MAX_FRAME_LENGTH) {
+                return -1;
+            }
+            
+            char* data = prefetch_recv_body(prefetch, &header);
+            if (!data) {
+                return -1;
+            }
+            
+            wire_view_t view;
+            uint32_t retry_after = 0;
+            if (header.type == MSG_UPDATE_RESUME &&
+                wire_view_init(&view, header.version, data, header.length,
+                               WIRE_SIZE(header.version, update_resume_msg)) == 0) {
+                resume = 1;
+                resume_offset = WIRE_GET_U32(&view, update_resume_msg, offset);
+            }
+            if (header.type == MSG_VERSION_RESPONSE &&
+                wire_view_init(&view, header.version, data, header.length,
+                               WIRE_SIZE(header.version, version_response_msg)) == 0) {
+                retry_after = WIRE_GET_U32(&view, version_response_msg, retry_after);
+            }
+            free(data);
+            
+            // 更新传输名额已满，服务端回复版本响应代替更新数据
+            if (header.type == MSG_VERSION_RESPONSE) {
+                update_schedule_version_check(retry_after);
+                return -1;
+            }
+            
+            if (header.type == MSG_ERROR) {
+                printf("后台更新: 服务端返回错误\n");
+                return -1;
+            }
+            continue;
+        }
+        
+        printf("后台更新: 开始下载 %u 字节%s\n", header.length, resume ? "（续传）" : "");
+        
+        // 按分块清单下载时服务端没有先发续传通知，说明更新包已变化
+        if (manifest) {
+            prefetch->download = resume ? update_download_open_range(manifest, resume_offset) : NULL;
+        } else {
+            prefetch->download = update_download_open(prefetch->hash, resume, resume_offset);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &prefetch->start);
+        prefetch->received = 0;
+        
+        uint32_t checksum = 0;
+        int recv_result = stream_recv_body(prefetch->socket_fd, header.length, &checksum,
+                                           prefetch->download ? prefetch_write : NULL, prefetch);
+        if (!prefetch->download) {
+            return -1;
+        }
+        
+        if (recv_result < 0) {
+            update_download_discard(prefetch->download, 1);
+            return -1;
+        }
+        
+        if (recv_result != 0 || checksum != header.checksum) {
+            update_download_discard(prefetch->download, 0);
+            return -1;
+        }
+        
+        return update_download_close(prefetch->download);
+    }
+}
+
+// 按分块清单下载：只请求本地没有的分块，校验失败的分块重新请求。
+// 服务端不支持或清单不可用时返回1，由调用方改为下载完整更新包
+static int prefetch_download_chunks(prefetch_t* prefetch) {
+    void* manifest = prefetch_receive_manifest(prefetch);
+    if (!manifest || update_manifest_scan(manifest) < 0) {
+        update_manifest_free(manifest);
+        return 1;
+    }
+    
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    int result = 0;
+    while (result == 0 && (result = update_manifest_next_range(manifest, &offset, &length)) > 0) {
+        printf("后台更新: 请求分块范围 %u-%u\n", offset, offset + length);
+        result = prefetch_request(prefetch, UPDATE_REQUEST_FULL, offset, length) == 0 &&
+                 prefetch_receive_update(prefetch, manifest) == 0 ? 0 : -1;
+    }
+    
+    // 通知服务端分块下载已结束，归还这次下载占用的传输名额
+    prefetch_request(prefetch, UPDATE_REQUEST_DONE, 0, 0);
+    
+    if (result == 0) {
+        result = update_manifest_complete(manifest);
+    }
+    update_manifest_free(manifest);
+    return result;
+}
+
+// 在预取连接上下载完整更新包（同一更新包有中断的下载时续传）
+static int prefetch_download(prefetch_t* prefetch) {
+    // 先从局域网内的其他客户端获取，没有取完的部分再从服务端续传
+    if (prefetch->peer_update &&
+        peer_fetch_update(prefetch->hash, prefetch->size, update_download_progress(prefetch->hash)) == 0) {
+        return 0;
+    }
+    
+    if (prefetch_connect(prefetch) != 0 || prefetch_check_version(prefetch) != 0) {
+        return -1;
+    }
+    
+    if (prefetch->capabilities & CAP_CHUNK_MANIFEST) {
+        int result = prefetch_download_chunks(prefetch);
+        if (result <= 0) {
+            return result;
+        }
+    }
+    
+    if (prefetch_request(prefetch, UPDATE_REQUEST_FULL, update_download_progress(prefetch->hash), 0) != 0) {
+        return -1;
+    }
+    
+    return prefetch_receive_update(prefetch, NULL);
+}
+
+// 记录暂存的更新包
+static int prefetch_stage(const prefetch_t* prefetch) {
+    char hex[SHA256_HEX_SIZE];
+    sha256_to_hex(prefetch->hash, hex);
+    
+    FILE* file = fopen(UPDATE_STAGED_FILE, "w");
+    if (!file) {
+        return -1;
+    }
+    fprintf(file, "%s %s\n", prefetch->version, hex);
+    return fclose(file);
+}
+
+// 客户端是否空闲：没有正在发送的消息，且最近UPDATE_IDLE_SECONDS秒没有数据往来
+static int prefetch_client_idle() {
+    if (!is_connected()) {
+        return 1;
+    }
+    
+    time_t last_activity = mux_sender_last_activity(&g_client.sender);
+    time_t last_receive = __atomic_load_n(&g_client.last_receive_time, __ATOMIC_RELAXED);
+    if (last_receive > last_activity) {
+        last_activity = last_receive;
+    }
+    
+    return mux_sender_idle(&g_client.sender) && time(NULL) - last_activity >= UPDATE_IDLE_SECONDS;
+}
+
+// 预取线程
+static void* prefetch_thread_func(void* arg) {
+    prefetch_t* prefetch = (prefetch_t*)arg;
+    
+    int result = prefetch_download(prefetch);
+    if (prefetch->socket_fd != -1) {
+        close(prefetch->socket_fd);
+    }
+    
+    if (result != 0 || prefetch_stage(prefetch) != 0) {
+        printf("后台更新下载失败，稍后重试时从已下载的部分续传\n");
+        log_message_to_gui("后台更新下载失败");
+        free(prefetch);
+        
+        pthread_mutex_lock(&g_prefetch_mutex);
+        g_prefetch_active = 0;
+        pthread_mutex_unlock(&g_prefetch_mutex);
+        return NULL;
+    }
+    
+    printf("更新 %s 已在后台下载完成，客户端空闲时应用\n", prefetch->version);
+    log_message_to_gui("新版本 %s 已下载，将在空闲时或下次启动时应用", prefetch->version);
+    free(prefetch);
+    
+    // 等到没有上传和数据往来时再替换可执行文件并重启
+    while (g_client.running && !prefetch_client_idle()) {
+        sleep(HEARTBEAT_CHECK_INTERVAL);
+    }
+    
+    if (g_client.running) {
+        update_apply_staged();
+    }
+    
+    pthread_mutex_lock(&g_prefetch_mutex);
+    g_prefetch_active = 0;
+    pthread_mutex_unlock(&g_prefetch_mutex);
+    return NULL;
+}
+
+// 开始后台预取更新包（已在进行时不重复启动）
+int update_prefetch_start(const char* version, const uint8_t* package_hash, uint32_t package_size) {
+    if (!version || !package_hash) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&g_prefetch_mutex);
+    if (g_prefetch_active) {
+        pthread_mutex_unlock(&g_prefetch_mutex);
+        printf("后台更新下载已在进行\n");
+        return 0;
+    }
+    g_prefetch_active = 1;
+    pthread_mutex_unlock(&g_prefetch_mutex);
+    
+    prefetch_t* prefetch = calloc(1, sizeof(prefetch_t));
+    if (!prefetch) {
+        pthread_mutex_lock(&g_prefetch_mutex);
+        g_prefetch_active = 0;
+        pthread_mutex_unlock(&g_prefetch_mutex);
+        return -1;
+    }
+    
+    prefetch->socket_fd = -1;
+    strncpy(prefetch->host, g_client.config.server_host, sizeof(prefetch->host) - 1);
+    prefetch->port = g_client.config.server_port;
+    strncpy(prefetch->version, version, sizeof(prefetch->version) - 1);
+    memcpy(prefetch->hash, package_hash, SHA256_DIGEST_SIZE);
+    prefetch->size = package_size;
+    prefetch->rate_limit = g_client.config.update_rate_limit > 0 ? (uint32_t)g_client.config.update_rate_limit : 0;
+    prefetch->heartbeat_interval = DEFAULT_HEARTBEAT_INTERVAL;
+    prefetch->peer_update = g_client.config.peer_update;
+    
+    if (prefetch->rate_limit > 0) {
+        printf("后台下载更新 %s，限速 %u 字节/秒\n", version, prefetch->rate_limit);
+    } else {
+        printf("后台下载更新 %s\n", version);
+    }
+    
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, prefetch_thread_func, prefetch) != 0) {
+        perror("pthread_create prefetch_thread");
+        free(prefetch);
+        pthread_mutex_lock(&g_prefetch_mutex);
+        g_prefetch_active = 0;
+        pthread_mutex_unlock(&g_prefetch_mutex);
+        return -1;
+    }
+    pthread_detach(thread);
+    
+    return 0;
+}
+
+// 后台预取是否正在进行（包括下载完成后等待空闲的阶段）
+int update_prefetch_active() {
+    pthread_mutex_lock(&g_prefetch_mutex);
+    int active = g_prefetch_active;
+    pthread_mutex_unlock(&g_prefetch_mutex);
+    return active;
+}
+
+// 应用暂存的更新（启动时和后台预取完成后客户端空闲时调用）。
+// 成功时重启为新版本，不再返回；没有暂存的更新返回1，失败返回-1
+int update_apply_staged() {
+    FILE* file = fopen(UPDATE_STAGED_FILE, "r");
+    if (!file) {
+        return 1;
+    }
+    
+    char version[32] = "";
+    char recorded[SHA256_HEX_SIZE] = "";
+    int parsed = fscanf(file, "%31s %64s", version, recorded) == 2;
+    fclose(file);
+    
+    // 先删除暂存记录：应用失败时不会在每次启动时反复尝试
+    remove(UPDATE_STAGED_FILE);
+    if (!parsed || strcmp(version, CLIENT_VERSION) == 0) {
+        return 1;
+    }
+    
+    // 暂存之后更新包被改动过时不应用
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char actual[SHA256_HEX_SIZE];
+    int fd = open(UPDATE_PACKAGE_FILE, O_RDONLY);
+    int hashed = fd != -1 ? update_file_digest(fd, digest) : -1;
+    if (fd != -1) {
+        close(fd);
+    }
+    if (hashed != 0) {
+        printf("暂存的更新包不存在\n");
+        return -1;
+    }
+    sha256_to_hex(digest, actual);
+    if (strcmp(actual, recorded) != 0) {
+        printf("暂存的更新包哈希不匹配，放弃应用\n");
+        return -1;
+    }
+    
+    printf("应用暂存的更新: %s\n", version);
+    if (apply_update() != 0) {
+        printf("应用暂存的更新失败\n");
+        log_message_to_gui("应用暂存的更新失败");
+        return -1;
+    }
+    
+    return restart_client();
+}
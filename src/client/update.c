@@ -1,10 +1,389 @@
 #include "client.h"
+#include "../common/stream.h"
+#include "../common/sha256.h"
+#include "../common/delta.h"
+#include "../common/archive.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+
+// 更新包分块清单及本地各分块的状态
+typedef struct {
+    uint8_t package_hash[SHA256_DIGEST_SIZE];
+    uint32_t package_size;
+    uint32_t chunk_size;
+    uint32_t chunk_count;
+    uint8_t (*chunk_hashes)[SHA256_DIGEST_SIZE];
+    uint8_t* chunk_valid;     // 临时文件中该分块已校验通过
+    uint8_t* chunk_attempts;  // 该分块已请求下载的次数
+    int have_package;         // 更新包文件本身已经完整，不需要下载
+} update_manifest_t;
+
+// 更新包下载状态（数据边接收边解码写入临时文件）
+typedef struct {
+    FILE* file;
+    char temp_path[512];
+    char final_path[512];
+    base64_decoder_t decoder;
+    size_t written;
+    size_t synced;            // 已落盘并记录到进度文件的字节数
+    int verify;               // 已知更新包哈希：记录进度、完成时校验
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    sha256_context_t digest;  // 已写入数据的SHA-256
+    update_manifest_t* manifest;    // 按分块清单下载时逐块校验，written为在更新包中的位置
+    sha256_context_t chunk_digest;  // 当前分块已写入数据的SHA-256
+} update_download_t;
+
+// 服务端确认的续传（仅网络线程访问），之后收到的更新数据从offset开始
+static struct {
+    int pending;
+    uint32_t offset;
+    uint8_t hash[SHA256_DIGEST_SIZE];
+} g_update_resume;
+
+// 主连接上正在按分块清单进行的下载（仅网络线程访问）
+static update_manifest_t* g_update_manifest;
+
+// 服务端是否告知了更新包哈希（旧服务端为全0）
+static int update_hash_known(const uint8_t* hash) {
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        if (hash[i] != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 计算已打开文件的SHA-256（从头读到尾，不改变文件偏移）
+int update_file_digest(int fd, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    sha256_context_t context;
+    sha256_init(&context);
+    
+    unsigned char buffer[STREAM_CHUNK_SIZE];
+    off_t offset = 0;
+    while (1) {
+        ssize_t length = pread(fd, buffer, sizeof(buffer), offset);
+        if (length < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (length == 0) {
+            break;
+        }
+        sha256_update(&context, buffer, (size_t)length);
+        offset += length;
+    }
+    
+    sha256_final(&context, digest);
+    return 0;
+}
+
+// 读取下载进度，返回可续传的字节数。进度不属于指定的更新包或临时文件不完整时返回0
+static uint32_t update_progress_load(const uint8_t* hash) {
+    FILE* file = fopen(UPDATE_PROGRESS_FILE, "r");
+    if (!file) {
+        return 0;
+    }
+    
+    char recorded[SHA256_HEX_SIZE];
+    unsigned long offset = 0;
+    int parsed = fscanf(file, "%64s %lu", recorded, &offset) == 2;
+    fclose(file);
+    
+    char expected[SHA256_HEX_SIZE];
+    sha256_to_hex(hash, expected);
+    
+    struct stat st;
+    if (!parsed || strcmp(recorded, expected) != 0 || offset > UINT32_MAX ||
+        stat(UPDATE_PART_FILE, &st) != 0 || (unsigned long)st.st_size < offset) {
+        return 0;
+    }
+    
+    // 续传点必须落在Base64的3字节分组边界上
+    return (uint32_t)(offset - offset % 3);
+}
+
+// 把已写入的数据落盘后记录进度，进度文件中的字节数不会超过已落盘的数据
+static int update_progress_save(update_download_t* download) {
+    if (fflush(download->file) != 0 || fdatasync(fileno(download->file)) != 0) {
+        return -1;
+    }
+    
+    char hex[SHA256_HEX_SIZE];
+    sha256_to_hex(download->hash, hex);
+    
+    FILE* file = fopen(UPDATE_PROGRESS_FILE, "w");
+    if (!file) {
+        return -1;
+    }
+    fprintf(file, "%s %zu\n", hex, download->written);
+    if (fclose(file) != 0) {
+        return -1;
+    }
+    
+    download->synced = download->written;
+    return 0;
+}
+
+// 从fd的offset处读满length字节，读不满返回-1
+static int update_pread_full(int fd, void* buffer, size_t length, off_t offset) {
+    char* cursor = buffer;
+    while (length > 0) {
+        ssize_t got = pread(fd, cursor, length, offset);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (got == 0) {
+            return -1;
+        }
+        cursor += got;
+        offset += got;
+        length -= (size_t)got;
+    }
+    return 0;
+}
+
+// 把length字节全部写到fd的offset处
+static int update_pwrite_full(int fd, const void* buffer, size_t length, off_t offset) {
+    const char* cursor = buffer;
+    while (length > 0) {
+        ssize_t written = pwrite(fd, cursor, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        cursor += written;
+        offset += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+// 分块的长度（最后一块可能较短）
+static size_t update_chunk_length(const update_manifest_t* manifest, uint32_t index) {
+    uint64_t offset = (uint64_t)index * manifest->chunk_size;
+    uint64_t remaining = manifest->package_size - offset;
+    return remaining < manifest->chunk_size ? (size_t)remaining : manifest->chunk_size;
+}
+
+// 读出fd中的一个分块并与清单核对，一致返回0
+static int update_manifest_check_chunk(const update_manifest_t* manifest, int fd, uint32_t index,
+                                       unsigned char* buffer) {
+    size_t length = update_chunk_length(manifest, index);
+    if (update_pread_full(fd, buffer, length, (off_t)index * manifest->chunk_size) != 0) {
+        return -1;
+    }
+    
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_digest(buffer, length, digest);
+    return memcmp(digest, manifest->chunk_hashes[index], SHA256_DIGEST_SIZE) == 0 ? 0 : -1;
+}
+
+// 释放分块清单
+void update_manifest_free(void* context) {
+    update_manifest_t* manifest = (update_manifest_t*)context;
+    if (!manifest) {
+        return;
+    }
+    
+    free(manifest->chunk_hashes);
+    free(manifest->chunk_valid);
+    free(manifest->chunk_attempts);
+    free(manifest);
+}
+
+// 解析服务端的分块清单，清单不属于package_hash对应的更新包或格式无效时返回NULL
+void* update_manifest_parse(const wire_view_t* view, const uint8_t* package_hash) {
+    if (!view || !package_hash) {
+        return NULL;
+    }
+    
+    if (memcmp(WIRE_GET_PTR(view, update_manifest_msg, package_hash), package_hash, SHA256_DIGEST_SIZE) != 0) {
+        printf("分块清单与版本响应中的更新包不一致\n");
+        return NULL;
+    }
+    
+    uint32_t package_size = WIRE_GET_U32(view, update_manifest_msg, package_size);
+    uint32_t chunk_size = WIRE_GET_U32(view, update_manifest_msg, chunk_size);
+    uint32_t chunk_count = WIRE_GET_U32(view, update_manifest_msg, chunk_count);
+    size_t header_length = WIRE_SIZE(view->version, update_manifest_msg);
+    
+    // 分块边界是请求范围的边界，必须落在Base64的3字节分组边界上
+    if (package_size == 0 || chunk_size == 0 || chunk_size % 3 != 0 ||
+        chunk_count != ((uint64_t)package_size + chunk_size - 1) / chunk_size ||
+        view->length - header_length != (size_t)chunk_count * SHA256_DIGEST_SIZE) {
+        printf("分块清单无效\n");
+        return NULL;
+    }
+    
+    update_manifest_t* manifest = calloc(1, sizeof(update_manifest_t));
+    if (!manifest) {
+        return NULL;
+    }
+    
+    memcpy(manifest->package_hash, package_hash, SHA256_DIGEST_SIZE);
+    manifest->package_size = package_size;
+    manifest->chunk_size = chunk_size;
+    manifest->chunk_count = chunk_count;
+    manifest->chunk_hashes = malloc((size_t)chunk_count * SHA256_DIGEST_SIZE);
+    manifest->chunk_valid = calloc(chunk_count, 1);
+    manifest->chunk_attempts = calloc(chunk_count, 1);
+    if (!manifest->chunk_hashes || !manifest->chunk_valid || !manifest->chunk_attempts) {
+        update_manifest_free(manifest);
+        return NULL;
+    }
+    
+    memcpy(manifest->chunk_hashes, WIRE_GET_PTR(view, update_manifest_msg, chunk_hashes),
+           (size_t)chunk_count * SHA256_DIGEST_SIZE);
+    return manifest;
+}
+
+// 核对本地已有的数据：临时文件中与清单一致的分块直接保留，其余分块再到已有的更新包文件
+// （上次应用失败或手工复制的）中找，一致的复制进临时文件。返回还需要下载的分块数，出错返回-1
+int update_manifest_scan(void* context) {
+    update_manifest_t* manifest = (update_manifest_t*)context;
+    memset(manifest->chunk_valid, 0, manifest->chunk_count);
+    memset(manifest->chunk_attempts, 0, manifest->chunk_count);
+    manifest->have_package = 0;
+    
+    if (mkdir(UPDATE_DIR, 0755) == -1 && errno != EEXIST) {
+        perror("mkdir update directory");
+        return -1;
+    }
+    
+    // 更新包文件本身已经完整时什么都不用下载
+    struct stat st;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    int package_fd = open(UPDATE_PACKAGE_FILE, O_RDONLY);
+    if (package_fd != -1 && fstat(package_fd, &st) == 0 && st.st_size == (off_t)manifest->package_size &&
+        update_file_digest(package_fd, digest) == 0 &&
+        memcmp(digest, manifest->package_hash, SHA256_DIGEST_SIZE) == 0) {
+        close(package_fd);
+        memset(manifest->chunk_valid, 1, manifest->chunk_count);
+        manifest->have_package = 1;
+        printf("本地更新包已经完整，无需下载\n");
+        return 0;
+    }
+    
+    int part_fd = open(UPDATE_PART_FILE, O_RDWR | O_CREAT, 0644);
+    unsigned char* buffer = malloc(manifest->chunk_size);
+    if (part_fd == -1 || !buffer) {
+        fprintf(stderr, "无法打开更新文件: %s\n", strerror(errno));
+        if (part_fd != -1) {
+            close(part_fd);
+        }
+        if (package_fd != -1) {
+            close(package_fd);
+        }
+        free(buffer);
+        return -1;
+    }
+    
+    // 临时文件按分块重新校验，不再依赖顺序下载的进度记录
+    remove(UPDATE_PROGRESS_FILE);
+    
+    uint32_t missing = 0;
+    uint32_t reused = 0;
+    int result = 0;
+    for (uint32_t i = 0; i < manifest->chunk_count && result == 0; i++) {
+        if (update_manifest_check_chunk(manifest, part_fd, i, buffer) == 0) {
+            manifest->chunk_valid[i] = 1;
+        } else if (package_fd != -1 && update_manifest_check_chunk(manifest, package_fd, i, buffer) == 0) {
+            if (update_pwrite_full(part_fd, buffer, update_chunk_length(manifest, i),
+                                   (off_t)i * manifest->chunk_size) != 0) {
+                result = -1;
+            }
+            manifest->chunk_valid[i] = 1;
+            reused++;
+        } else {
+            missing++;
+        }
+    }
+    free(buffer);
+    
+    if (result != 0 || ftruncate(part_fd, manifest->package_size) != 0 || fdatasync(part_fd) != 0) {
+        fprintf(stderr, "写入更新文件失败: %s\n", strerror(errno));
+        result = -1;
+    }
+    close(part_fd);
+    if (package_fd != -1) {
+        close(package_fd);
+    }
+    
+    if (result != 0) {
+        return -1;
+    }
+    
+    printf("分块清单: 共 %u 块，本地已有 %u 块（其中 %u 块取自已有的更新包），需要下载 %u 块\n",
+           manifest->chunk_count, manifest->chunk_count - missing, reused, missing);
+    return (int)missing;
+}
+
+// 找出下一段需要下载的连续分块。返回1并给出范围，全部就绪返回0，
+// 有分块下载UPDATE_CHUNK_RETRY_MAX次仍校验失败时返回-1
+int update_manifest_next_range(void* context, uint32_t* offset, uint32_t* length) {
+    update_manifest_t* manifest = (update_manifest_t*)context;
+    
+    uint32_t first = 0;
+    while (first < manifest->chunk_count && manifest->chunk_valid[first]) {
+        first++;
+    }
+    if (first == manifest->chunk_count) {
+        return 0;
+    }
+    
+    if (manifest->chunk_attempts[first] >= UPDATE_CHUNK_RETRY_MAX) {
+        printf("分块 %u 下载 %d 次仍校验失败\n", first, UPDATE_CHUNK_RETRY_MAX);
+        return -1;
+    }
+    
+    uint32_t last = first;
+    while (last < manifest->chunk_count && !manifest->chunk_valid[last]) {
+        manifest->chunk_attempts[last]++;
+        last++;
+    }
+    
+    uint64_t end = (uint64_t)last * manifest->chunk_size;
+    *offset = first * manifest->chunk_size;
+    *length = (uint32_t)((end < manifest->package_size ? end : manifest->package_size) - *offset);
+    return 1;
+}
+
+// 所有分块就绪后校验整个更新包，替换为正式的更新包
+int update_manifest_complete(void* context) {
+    update_manifest_t* manifest = (update_manifest_t*)context;
+    if (manifest->have_package) {
+        remove(UPDATE_PART_FILE);
+        return 0;
+    }
+    
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    int fd = open(UPDATE_PART_FILE, O_RDONLY);
+    int result = fd != -1 && update_file_digest(fd, digest) == 0 ? 0 : -1;
+    if (fd != -1) {
+        close(fd);
+    }
+    
+    if (result == 0 && memcmp(digest, manifest->package_hash, SHA256_DIGEST_SIZE) != 0) {
+        fprintf(stderr, "更新文件哈希不匹配\n");
+        remove(UPDATE_PART_FILE);
+        return -1;
+    }
+    
+    if (result != 0 || rename(UPDATE_PART_FILE, UPDATE_PACKAGE_FILE) != 0) {
+        fprintf(stderr, "更新文件保存失败: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    printf("更新文件已保存: %s (%u 字节)\n", UPDATE_PACKAGE_FILE, manifest->package_size);
+    return 0;
+}
 
 // 发送版本检查
 int send_version_check() {
@@ -12,36 +391,108 @@ int send_version_check() {
         return -1;
     }
     
-    version_check_msg_t msg;
+    // 连接后的第一次版本检查按v1编码，协商出v2之后按v2编码
+    uint8_t version = WIRE_VERSION_FOR(g_client.capabilities);
+    union {
+        version_check_msg_t v1;
+        version_check_msg_v2_t v2;
+    } msg;
     memset(&msg, 0, sizeof(msg));
     
-    // 设置客户端版本
-    strncpy(msg.client_version, CLIENT_VERSION, sizeof(msg.client_version) - 1);
-    
     // 设置平台信息
     #ifdef __linux__
-        strncpy(msg.platform, "Linux", sizeof(msg.platform) - 1);
+        const char* platform = "Linux";
     #elif defined(__APPLE__)
-        strncpy(msg.platform, "macOS", sizeof(msg.platform) - 1);
+        const char* platform = "macOS";
     #elif defined(_WIN32)
-        strncpy(msg.platform, "Windows", sizeof(msg.platform) - 1);
+        const char* platform = "Windows";
     #else
-        strncpy(msg.platform, "Unknown", sizeof(msg.platform) - 1);
+        const char* platform = "Unknown";
     #endif
     
-    printf("发送版本检查: %s (%s)\n", msg.client_version, msg.platform);
+    // 设置客户端版本和平台信息
+    WIRE_PUT_STR(&msg, version, version_check_msg, client_version, CLIENT_VERSION);
+    WIRE_PUT_STR(&msg, version, version_check_msg, platform, platform);
+    
+    // 声明客户端能力位
+    WIRE_PUT_U32(&msg, version, version_check_msg, capabilities, CLIENT_CAPABILITIES);
+    memcpy((char*)&msg + WIRE_OFFSET(version, version_check_msg, client_id),
+           g_client.client_id, sizeof(g_client.client_id));
+    
+    printf("发送版本检查: %s (%s)\n", CLIENT_VERSION, platform);
+    
+    return client_send_message(MSG_VERSION_CHECK, &msg, WIRE_SIZE(version, version_check_msg));
+}
+
+// 发送更新请求（flags为UPDATE_REQUEST_*，旧服务端忽略消息体）
+int send_update_request(uint32_t flags) {
+    if (!is_connected()) {
+        return -1;
+    }
+    
+    uint8_t version = WIRE_VERSION_FOR(g_client.capabilities);
+    union {
+        update_request_msg_t v1;
+        update_request_msg_v2_t v2;
+    } msg;
+    memset(&msg, 0, sizeof(msg));
+    WIRE_PUT_U32(&msg, version, update_request_msg, flags, flags);
+    
+    // 上次中断的下载属于同一更新包时请求续传，服务端确认后才从该处继续写
+    g_update_resume.pending = 0;
+    uint32_t resume_offset = 0;
+    if (!(flags & UPDATE_REQUEST_FULL) && update_hash_known(g_client.package_hash)) {
+        resume_offset = update_progress_load(g_client.package_hash);
+    }
+    if (resume_offset > 0) {
+        WIRE_PUT_U32(&msg, version, update_request_msg, resume_offset, resume_offset);
+        memcpy((char*)&msg + WIRE_OFFSET(version, update_request_msg, package_hash),
+               g_client.package_hash, SHA256_DIGEST_SIZE);
+        printf("请求续传更新文件: 已下载 %u 字节\n", resume_offset);
+    }
+    
+    printf("请求更新文件%s...\n", (flags & UPDATE_REQUEST_MANIFEST) ? "的分块清单" :
+                                  (flags & UPDATE_REQUEST_FULL) ? "（完整更新包）" : "");
+    return client_send_message(MSG_UPDATE_REQUEST, &msg, WIRE_SIZE(version, update_request_msg));
+}
+
+// 请求更新包从offset开始的length字节（按分块清单下载缺失的分块）
+static int send_update_range(uint32_t offset, uint32_t length) {
+    if (!is_connected()) {
+        return -1;
+    }
+    
+    uint8_t version = WIRE_VERSION_FOR(g_client.capabilities);
+    union {
+        update_request_msg_t v1;
+        update_request_msg_v2_t v2;
+    } msg;
+    memset(&msg, 0, sizeof(msg));
+    WIRE_PUT_U32(&msg, version, update_request_msg, flags, UPDATE_REQUEST_FULL);
+    WIRE_PUT_U32(&msg, version, update_request_msg, resume_offset, offset);
+    WIRE_PUT_U32(&msg, version, update_request_msg, range_length, length);
+    memcpy((char*)&msg + WIRE_OFFSET(version, update_request_msg, package_hash),
+           g_update_manifest->package_hash, SHA256_DIGEST_SIZE);
     
-    return client_send_message(MSG_VERSION_CHECK, &msg, sizeof(msg));
+    g_update_resume.pending = 0;
+    printf("请求更新包分块: 偏移=%u, %u 字节\n", offset, length);
+    return client_send_message(MSG_UPDATE_REQUEST, &msg, WIRE_SIZE(version, update_request_msg));
 }
 
-// 发送更新请求
-int send_update_request() {
+// 通知服务端按分块清单的下载已结束，归还这次下载占用的传输名额（服务端不回复）
+static int send_update_done() {
     if (!is_connected()) {
         return -1;
     }
     
-    printf("请求更新文件...\n");
-    return client_send_message(MSG_UPDATE_REQUEST, NULL, 0);
+    uint8_t version = WIRE_VERSION_FOR(g_client.capabilities);
+    union {
+        update_request_msg_t v1;
+        update_request_msg_v2_t v2;
+    } msg;
+    memset(&msg, 0, sizeof(msg));
+    WIRE_PUT_U32(&msg, version, update_request_msg, flags, UPDATE_REQUEST_DONE);
+    return client_send_message(MSG_UPDATE_REQUEST, &msg, WIRE_SIZE(version, update_request_msg));
 }
 
 // 发送心跳
@@ -53,6 +504,31 @@ int send_heartbeat() {
     return client_send_message(MSG_HEARTBEAT, NULL, 0);
 }
 
+// 获取完整更新包：启用后台更新且知道更新包哈希时在单独的限速连接上下载，否则在主连接上请求
+static int request_full_update(uint32_t flags) {
+    if (g_client.config.background_update && update_hash_known(g_client.package_hash)) {
+        return update_prefetch_start(g_client.latest_version, g_client.package_hash, g_client.update_size);
+    }
+    
+    // 服务端提供分块清单时先取清单，只下载本地没有的分块
+    if ((g_client.capabilities & CAP_CHUNK_MANIFEST) && update_hash_known(g_client.package_hash)) {
+        return send_update_request(flags | UPDATE_REQUEST_FULL | UPDATE_REQUEST_MANIFEST);
+    }
+    
+    return send_update_request(flags);
+}
+
+// 按服务端建议的间隔安排下次版本检查（由心跳线程发送），0表示取消
+void update_schedule_version_check(uint32_t retry_after) {
+    lock_status();
+    g_client.next_version_check = retry_after > 0 ? time(NULL) + (time_t)retry_after : 0;
+    unlock_status();
+    
+    if (retry_after > 0) {
+        printf("服务端暂缓提供更新，%u 秒后重新检查\n", retry_after);
+    }
+}
+
 // 处理版本响应
 int handle_version_response(version_response_msg_t* response) {
     if (!response) {
@@ -65,6 +541,25 @@ int handle_version_response(version_response_msg_t* response) {
     strncpy(g_client.server_version, response->server_version, sizeof(g_client.server_version) - 1);
     strncpy(g_client.latest_version, response->latest_version, sizeof(g_client.latest_version) - 1);
     
+    // 记录服务端确认的能力位，之后发送的帧按此启用压缩和分片交错
+    g_client.capabilities = response->capabilities & CLIENT_CAPABILITIES;
+    mux_sender_set_capabilities(&g_client.sender, g_client.capabilities);
+    
+    // 更新包哈希用于校验下载结果和判断能否续传，大小用于核对对等节点提供的更新包
+    memcpy(g_client.package_hash, response->package_hash, SHA256_DIGEST_SIZE);
+    g_client.update_size = response->update_size;
+    
+    // 服务端建议的心跳间隔（旧服务端为0，使用配置的间隔）
+    lock_status();
+    g_client.heartbeat_interval = (int)response->heartbeat_interval;
+    unlock_status();
+    if (response->heartbeat_interval > 0) {
+        printf("服务端建议心跳间隔: %u 秒\n", response->heartbeat_interval);
+    }
+    
+    // 分批发布未轮到本客户端或更新传输名额已满时，服务端告知多久后再检查
+    update_schedule_version_check(response->retry_after);
+    
     switch (response->status) {
         case STATUS_SUCCESS:
             printf("版本检查成功\n");
@@ -75,13 +570,20 @@ int handle_version_response(version_response_msg_t* response) {
             printf("发现新版本: %s (当前版本: %s)\n", 
                    response->latest_version, CLIENT_VERSION);
             printf("更新包大小: %u 字节\n", response->update_size);
+            if (response->delta_size > 0) {
+                printf("可用差量补丁: %u 字节\n", response->delta_size);
+            }
             
             g_client.update_available = 1;
             
-            // 如果启用了自动更新，立即请求更新
+            // 如果启用了自动更新，立即请求更新。差量补丁很小，直接在主连接上下载
             if (g_client.config.auto_update) {
                 printf("自动更新已启用，开始下载更新...\n");
-                send_update_request();
+                if (response->delta_size > 0) {
+                    send_update_request(0);
+                } else {
+                    request_full_update(0);
+                }
             } else {
                 printf("有新版本可用，请手动更新\n");
                 log_message_to_gui("发现新版本 %s，请更新", response->latest_version);
@@ -102,210 +604,902 @@ int handle_version_response(version_response_msg_t* response) {
     return 0;
 }
 
-// 处理更新数据
-int handle_update_data(const char* data, size_t data_size) {
-    if (!data || data_size == 0) {
-        printf("收到空的更新数据\n");
-        return -1;
+// 更新应用成功后重启
+static void restart_after_update(int apply_result) {
+    if (apply_result == 0) {
+        printf("更新应用成功，准备重启...\n");
+        log_message_to_gui("更新应用成功，程序将重启");
+        
+        // 延迟重启，给用户时间看到消息
+        sleep(3);
+        restart_client();
+    } else {
+        printf("更新应用失败\n");
+        log_message_to_gui("更新应用失败");
     }
+}
+
+// 下载完成后应用更新并重启
+static void install_downloaded_update() {
+    printf("更新下载成功\n");
+    log_message_to_gui("更新下载完成，准备应用更新");
     
-    printf("收到更新数据: %zu 字节\n", data_size);
+    restart_after_update(apply_update());
+}
+
+// 请求下一段缺失的分块；所有分块就绪时校验整个更新包并应用
+static int update_fetch_chunks() {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    int result = update_manifest_next_range(g_update_manifest, &offset, &length);
+    if (result > 0) {
+        return send_update_range(offset, length);
+    }
     
-    // 下载并应用更新
-    if (download_update(data, data_size) == 0) {
-        printf("更新下载成功\n");
-        log_message_to_gui("更新下载完成，准备应用更新");
-        
-        // 应用更新
-        if (apply_update() == 0) {
-            printf("更新应用成功，准备重启...\n");
-            log_message_to_gui("更新应用成功，程序将重启");
-            
-            // 延迟重启，给用户时间看到消息
-            sleep(3);
-            restart_client();
-        } else {
-            printf("更新应用失败\n");
-            log_message_to_gui("更新应用失败");
-        }
-    } else {
+    send_update_done();
+    if (result == 0) {
+        result = update_manifest_complete(g_update_manifest);
+    }
+    update_manifest_free(g_update_manifest);
+    g_update_manifest = NULL;
+    
+    if (result != 0) {
         printf("更新下载失败\n");
         log_message_to_gui("更新下载失败");
+        return -1;
     }
     
+    install_downloaded_update();
     return 0;
 }
 
-// 检查更新
-int check_for_updates() {
-    if (!is_connected()) {
-        printf("未连接到服务器\n");
-        return -1;
+// 主连接上的一段更新数据下载完成：按分块清单下载时继续请求剩余的分块，否则应用更新
+static void update_download_completed() {
+    if (g_update_manifest) {
+        update_fetch_chunks();
+        return;
     }
     
-    printf("检查更新...\n");
-    return send_version_check();
+    install_downloaded_update();
 }
 
-// 下载更新
-int download_update(const char* data, size_t data_size) {
-    if (!data || data_size == 0) {
+// 处理分块清单：核对本地已有的分块，只请求缺失或损坏的部分
+int handle_update_manifest(const wire_view_t* view) {
+    if (!view) {
         return -1;
     }
     
-    // 创建更新目录
-    struct stat st = {0};
-    if (stat(UPDATE_DIR, &st) == -1) {
-        if (mkdir(UPDATE_DIR, 0755) == -1) {
-            perror("mkdir update directory");
-            return -1;
-        }
-    }
-    
-    // 解码Base64数据
-    size_t decoded_size = base64_decoded_length(data, data_size);
-    unsigned char* decoded_data = malloc(decoded_size);
-    
-    if (!decoded_data) {
-        fprintf(stderr, "内存分配失败\n");
+    // 后台预取与主连接上的下载共用临时文件，不能同时进行
+    if (update_prefetch_active()) {
+        fprintf(stderr, "后台更新下载正在进行，忽略主连接上的分块清单\n");
         return -1;
     }
     
-    int decode_result = base64_decode(data, data_size, decoded_data, decoded_size);
-    if (decode_result == -1) {
-        fprintf(stderr, "Base64解码失败\n");
-        free(decoded_data);
-        return -1;
-    }
+    update_manifest_free(g_update_manifest);
+    g_update_manifest = update_manifest_parse(view, g_client.package_hash);
     
-    // 保存更新文件
-    char update_file_path[512];
-    snprintf(update_file_path, sizeof(update_file_path), "%sclient_update.tar.gz", UPDATE_DIR);
+    // 清单不可用时改为下载完整更新包
+    if (!g_update_manifest || update_manifest_scan(g_update_manifest) < 0) {
+        update_manifest_free(g_update_manifest);
+        g_update_manifest = NULL;
+        return send_update_request(UPDATE_REQUEST_FULL);
+    }
     
-    FILE* file = fopen(update_file_path, "wb");
+    return update_fetch_chunks();
+}
+
+// 读取整个文件，返回的缓冲区由调用者释放
+static unsigned char* update_read_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
     if (!file) {
-        fprintf(stderr, "无法创建更新文件: %s\n", strerror(errno));
-        free(decoded_data);
-        return -1;
+        return NULL;
     }
     
-    size_t written = fwrite(decoded_data, 1, decode_result, file);
+    unsigned char* data = NULL;
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0 && st.st_size > 0 &&
+        (data = malloc((size_t)st.st_size)) != NULL &&
+        fread(data, 1, (size_t)st.st_size, file) != (size_t)st.st_size) {
+        free(data);
+        data = NULL;
+    }
     fclose(file);
-    free(decoded_data);
     
-    if (written != (size_t)decode_result) {
-        fprintf(stderr, "更新文件写入不完整\n");
-        remove(update_file_path);
+    if (data) {
+        *size = (size_t)st.st_size;
+    }
+    return data;
+}
+
+// 获取当前可执行文件的路径。可执行文件被替换后/proc/self/exe会带上" (deleted)"后缀，
+// 去掉后缀得到的就是新版本所在的路径
+static int update_current_executable(char* path, size_t size) {
+    ssize_t len = readlink("/proc/self/exe", path, size - 1);
+    if (len == -1) {
+        printf("无法获取当前可执行文件路径\n");
         return -1;
     }
+    path[len] = '\0';
     
-    printf("更新文件已保存: %s (%zu 字节)\n", update_file_path, written);
+    const char* suffix = " (deleted)";
+    size_t suffix_length = strlen(suffix);
+    if ((size_t)len > suffix_length && strcmp(path + len - suffix_length, suffix) == 0) {
+        path[len - suffix_length] = '\0';
+    }
     return 0;
 }
 
-// 应用更新
-int apply_update() {
-    char update_file_path[512];
-    char extract_dir[512];
-    char command[1024];
+// 刷新path所在目录的目录项到磁盘
+static int update_sync_parent(const char* path) {
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = '\0';
+    }
     
-    snprintf(update_file_path, sizeof(update_file_path), "%sclient_update.tar.gz", UPDATE_DIR);
-    snprintf(extract_dir, sizeof(extract_dir), "%sextracted/", UPDATE_DIR);
+    int fd = open(slash ? (dir[0] ? dir : "/") : ".", O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        return -1;
+    }
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+// 复制文件并刷盘（源和目标不在同一文件系统、无法链接或重命名时使用）
+static int update_copy_file(const char* source, const char* target, mode_t mode) {
+    int input = open(source, O_RDONLY);
+    if (input == -1) {
+        return -1;
+    }
     
-    // 检查更新文件是否存在
-    if (access(update_file_path, F_OK) != 0) {
-        printf("更新文件不存在: %s\n", update_file_path);
+    int output = open(target, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (output == -1) {
+        close(input);
         return -1;
     }
     
-    // 创建解压目录
-    struct stat st = {0};
-    if (stat(extract_dir, &st) == -1) {
-        if (mkdir(extract_dir, 0755) == -1) {
-            perror("mkdir extract directory");
-            return -1;
+    char buffer[STREAM_CHUNK_SIZE];
+    ssize_t length;
+    int result = 0;
+    while (result == 0 && (length = read(input, buffer, sizeof(buffer))) != 0) {
+        if (length < 0) {
+            if (errno == EINTR) continue;
+            result = -1;
+            break;
+        }
+        for (ssize_t done = 0; done < length; ) {
+            ssize_t written = write(output, buffer + done, (size_t)(length - done));
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                result = -1;
+                break;
+            }
+            done += written;
         }
     }
     
-    // 解压更新文件
-    snprintf(command, sizeof(command), "tar -xzf %s -C %s", update_file_path, extract_dir);
-    
-    printf("解压更新文件: %s\n", command);
-    int result = system(command);
-    
+    if (result == 0 && (fchmod(output, mode) != 0 || fsync(output) != 0)) {
+        result = -1;
+    }
+    close(input);
+    if (close(output) != 0) {
+        result = -1;
+    }
     if (result != 0) {
-        printf("解压更新文件失败\n");
-        return -1;
+        unlink(target);
     }
-    
-    // 检查新的可执行文件
-    char new_client_path[512];
-    snprintf(new_client_path, sizeof(new_client_path), "%sclient", extract_dir);
-    
-    if (access(new_client_path, X_OK) != 0) {
-        printf("新的客户端可执行文件不存在或无执行权限: %s\n", new_client_path);
-        return -1;
+    return result;
+}
+
+static int update_remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+// 删除目录及其中的所有内容（目录不存在不算错误）
+static int update_remove_tree(const char* path) {
+    if (access(path, F_OK) != 0) {
+        return 0;
     }
+    return nftw(path, update_remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// 把补丁应用到当前可执行文件上，生成的新版本写入new_client_path
+static int update_apply_delta(const wire_view_t* view, const char* new_client_path) {
+    size_t header_length = WIRE_SIZE(view->version, update_delta_msg);
+    uint32_t target_size = WIRE_GET_U32(view, update_delta_msg, target_size);
+    uint32_t delta_length = WIRE_GET_U32(view, update_delta_msg, delta_length);
     
-    // 备份当前可执行文件
-    char backup_path[512];
-    snprintf(backup_path, sizeof(backup_path), "%sclient.backup", UPDATE_DIR);
+    if (delta_length != view->length - header_length || target_size == 0) {
+        printf("差量补丁长度错误\n");
+        return -1;
+    }
     
     char current_exe[512];
-    ssize_t len = readlink("/proc/self/exe", current_exe, sizeof(current_exe) - 1);
-    if (len != -1) {
-        current_exe[len] = '\0';
+    if (update_current_executable(current_exe, sizeof(current_exe)) != 0) {
+        return -1;
+    }
+    
+    // 补丁只适用于与服务端记录的旧版本完全相同的可执行文件
+    size_t base_size = 0;
+    unsigned char* base = update_read_file(current_exe, &base_size);
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    if (!base) {
+        printf("读取当前可执行文件失败: %s\n", current_exe);
+        return -1;
+    }
+    
+    sha256_digest(base, base_size, digest);
+    if (memcmp(digest, WIRE_GET_PTR(view, update_delta_msg, base_hash), SHA256_DIGEST_SIZE) != 0) {
+        printf("当前可执行文件与补丁的基准版本不一致\n");
+        free(base);
+        return -1;
+    }
+    
+    unsigned char* target = malloc(target_size);
+    int result = -1;
+    if (target && delta_apply(base, base_size, WIRE_GET_PTR(view, update_delta_msg, data), delta_length,
+                              target, target_size) == 0) {
+        sha256_digest(target, target_size, digest);
+        result = memcmp(digest, WIRE_GET_PTR(view, update_delta_msg, target_hash), SHA256_DIGEST_SIZE) == 0 ? 0 : -1;
+        if (result != 0) {
+            printf("应用补丁后的可执行文件哈希不匹配\n");
+        }
+    } else {
+        printf("应用差量补丁失败\n");
+    }
+    free(base);
+    
+    if (result == 0) {
+        // 刷盘后才能重命名为正式的可执行文件
+        FILE* file = fopen(new_client_path, "wb");
+        if (!file || fwrite(target, 1, target_size, file) != target_size ||
+            fflush(file) != 0 || fsync(fileno(file)) != 0) {
+            printf("写入新的可执行文件失败: %s\n", new_client_path);
+            result = -1;
+        }
+        if (file && fclose(file) != 0) {
+            result = -1;
+        }
+        if (result == 0 && chmod(new_client_path, 0755) != 0) {
+            perror("chmod");
+            result = -1;
+        }
+    }
+    
+    free(target);
+    return result;
+}
+
+// 处理差量补丁：应用并校验成功后替换可执行文件，失败时改为请求完整更新包
+int handle_update_delta(const wire_view_t* view) {
+    if (!view) {
+        return -1;
+    }
+    
+    char base_version[32];
+    WIRE_GET_STR(view, update_delta_msg, base_version, base_version, sizeof(base_version));
+    printf("收到差量补丁: 基准版本=%s, %zu 字节\n", base_version, view->length);
+    
+    const char* new_client_path = UPDATE_STAGING_DIR "client";
+    
+    if ((mkdir(UPDATE_STAGING_DIR, 0755) == -1 && errno != EEXIST) ||
+        update_apply_delta(view, new_client_path) != 0) {
+        printf("差量更新失败，改为下载完整更新包\n");
+        log_message_to_gui("差量更新失败，改为下载完整更新包");
+        return request_full_update(UPDATE_REQUEST_FULL);
+    }
+    
+    log_message_to_gui("差量补丁已应用，准备替换可执行文件");
+    restart_after_update(replace_client_executable(new_client_path));
+    return 0;
+}
+
+// 处理续传通知：紧接着的更新数据是更新包从offset开始的部分
+int handle_update_resume(const wire_view_t* view) {
+    if (!view) {
+        return -1;
+    }
+    
+    g_update_resume.offset = WIRE_GET_U32(view, update_resume_msg, offset);
+    memcpy(g_update_resume.hash, WIRE_GET_PTR(view, update_resume_msg, package_hash), SHA256_DIGEST_SIZE);
+    g_update_resume.pending = 1;
+    
+    printf("服务端从 %u 字节处续传更新包 (共 %u 字节)\n", g_update_resume.offset,
+           WIRE_GET_U32(view, update_resume_msg, total_size));
+    return 0;
+}
+
+// 处理更新数据
+int handle_update_data(const char* data, size_t data_size) {
+    if (!data || data_size == 0) {
+        printf("收到空的更新数据\n");
+        return -1;
+    }
+    
+    printf("收到更新数据: %zu 字节\n", data_size);
+    
+    // 下载并应用更新
+    if (download_update(data, data_size) == 0) {
+        update_download_completed();
+    } else {
+        printf("更新下载失败\n");
+        log_message_to_gui("更新下载失败");
+    }
+    
+    return 0;
+}
+
+// 检查更新
+int check_for_updates() {
+    if (!is_connected()) {
+        printf("未连接到服务器\n");
+        return -1;
+    }
+    
+    printf("检查更新...\n");
+    return send_version_check();
+}
+
+// 打开上次中断留下的临时文件，重新计算已下载部分的哈希后从offset处继续写
+static int update_download_reopen(update_download_t* download, uint32_t offset) {
+    download->file = fopen(download->temp_path, "r+b");
+    if (!download->file) {
+        return -1;
+    }
+    
+    unsigned char buffer[STREAM_CHUNK_SIZE];
+    size_t remaining = offset;
+    while (remaining > 0) {
+        size_t chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        if (fread(buffer, 1, chunk, download->file) != chunk) {
+            break;
+        }
+        sha256_update(&download->digest, buffer, chunk);
+        remaining -= chunk;
+    }
+    
+    if (remaining > 0 || ftruncate(fileno(download->file), offset) != 0 ||
+        fseek(download->file, offset, SEEK_SET) != 0) {
+        fclose(download->file);
+        download->file = NULL;
+        return -1;
+    }
+    
+    download->written = offset;
+    download->synced = offset;
+    return 0;
+}
+
+// 开始下载更新包（写入更新目录下的临时文件），resume时接着已有的前offset字节写。
+// package_hash为服务端告知的更新包哈希（未知时为NULL或全0）
+static int update_download_begin(update_download_t* download, const uint8_t* package_hash,
+                                 int resume, uint32_t offset) {
+    memset(download, 0, sizeof(*download));
+    base64_decoder_init(&download->decoder);
+    sha256_init(&download->digest);
+    
+    if (package_hash && update_hash_known(package_hash)) {
+        download->verify = 1;
+        memcpy(download->hash, package_hash, SHA256_DIGEST_SIZE);
+    }
+    
+    // 创建更新目录
+    struct stat st = {0};
+    if (stat(UPDATE_DIR, &st) == -1) {
+        if (mkdir(UPDATE_DIR, 0755) == -1) {
+            perror("mkdir update directory");
+            return -1;
+        }
+    }
+    
+    snprintf(download->final_path, sizeof(download->final_path), "%s", UPDATE_PACKAGE_FILE);
+    snprintf(download->temp_path, sizeof(download->temp_path), "%s", UPDATE_PART_FILE);
+    
+    if (resume) {
+        // 服务端只发送剩余部分，已下载的部分不可用时这次下载只能放弃
+        if (!download->verify || update_download_reopen(download, offset) != 0) {
+            fprintf(stderr, "无法续传更新文件，下次将重新下载\n");
+            remove(UPDATE_PROGRESS_FILE);
+            return -1;
+        }
         
-        snprintf(command, sizeof(command), "cp %s %s", current_exe, backup_path);
-        if (system(command) != 0) {
-            printf("备份当前可执行文件失败\n");
+        printf("从 %u 字节处续传更新文件\n", offset);
+        return 0;
+    }
+    
+    remove(UPDATE_PROGRESS_FILE);
+    download->file = fopen(download->temp_path, "wb");
+    if (!download->file) {
+        fprintf(stderr, "无法创建更新文件: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    return 0;
+}
+
+// 开始按分块清单下载从offset（分块边界）开始的一段，写入临时文件的对应位置
+static int update_download_begin_range(update_download_t* download, update_manifest_t* manifest,
+                                       uint32_t offset) {
+    memset(download, 0, sizeof(*download));
+    base64_decoder_init(&download->decoder);
+    sha256_init(&download->digest);
+    download->manifest = manifest;
+    
+    snprintf(download->final_path, sizeof(download->final_path), "%s", UPDATE_PACKAGE_FILE);
+    snprintf(download->temp_path, sizeof(download->temp_path), "%s", UPDATE_PART_FILE);
+    
+    if (offset % manifest->chunk_size != 0 || offset >= manifest->package_size) {
+        fprintf(stderr, "续传起点不在分块边界上: %u\n", offset);
+        return -1;
+    }
+    
+    // 临时文件在核对分块时已经创建并调整为更新包大小
+    download->file = fopen(download->temp_path, "r+b");
+    if (!download->file || fseek(download->file, offset, SEEK_SET) != 0) {
+        fprintf(stderr, "无法打开更新文件: %s\n", strerror(errno));
+        if (download->file) {
+            fclose(download->file);
+            download->file = NULL;
+        }
+        return -1;
+    }
+    
+    download->written = offset;
+    download->synced = offset;
+    return 0;
+}
+
+// 开始下载主连接上收到的更新数据（之前收到续传通知时从通知的偏移处继续）
+static int update_download_begin_current(update_download_t* download) {
+    int resume = g_update_resume.pending;
+    g_update_resume.pending = 0;
+    
+    // 后台预取与主连接上的下载共用临时文件和更新包文件，不能同时进行
+    if (update_prefetch_active()) {
+        fprintf(stderr, "后台更新下载正在进行，忽略主连接上的更新数据\n");
+        memset(download, 0, sizeof(*download));
+        return -1;
+    }
+    
+    if (resume && memcmp(g_update_resume.hash, g_client.package_hash, SHA256_DIGEST_SIZE) != 0) {
+        fprintf(stderr, "续传的更新包与版本响应不一致\n");
+        memset(download, 0, sizeof(*download));
+        return -1;
+    }
+    
+    // 按分块清单下载时服务端从请求的分块边界开始发送；没有续传通知说明服务端的更新包已变化，
+    // 发来的是完整更新包，按普通下载处理
+    if (g_update_manifest) {
+        if (resume && memcmp(g_update_resume.hash, g_update_manifest->package_hash, SHA256_DIGEST_SIZE) == 0) {
+            return update_download_begin_range(download, g_update_manifest, g_update_resume.offset);
+        }
+        update_manifest_free(g_update_manifest);
+        g_update_manifest = NULL;
+    }
+    
+    return update_download_begin(download, g_client.package_hash, resume, g_update_resume.offset);
+}
+
+// 按分块清单写入解码后的数据，每写满一个分块就与清单核对，不一致的分块之后重新下载
+static int update_download_store_chunks(update_download_t* download, const unsigned char* data, size_t length) {
+    update_manifest_t* manifest = download->manifest;
+    
+    while (length > 0) {
+        if (download->written >= manifest->package_size) {
+            fprintf(stderr, "更新数据超出更新包大小\n");
             return -1;
         }
         
-        // 替换可执行文件
-        snprintf(command, sizeof(command), "cp %s %s", new_client_path, current_exe);
-        if (system(command) != 0) {
-            printf("替换可执行文件失败\n");
-            // 尝试恢复备份
-            snprintf(command, sizeof(command), "cp %s %s", backup_path, current_exe);
-            system(command);
+        uint32_t index = (uint32_t)(download->written / manifest->chunk_size);
+        size_t within = download->written % manifest->chunk_size;
+        size_t chunk_length = update_chunk_length(manifest, index);
+        size_t piece = chunk_length - within < length ? chunk_length - within : length;
+        
+        if (within == 0) {
+            sha256_init(&download->chunk_digest);
+        }
+        if (fwrite(data, 1, piece, download->file) != piece) {
+            fprintf(stderr, "更新文件写入不完整\n");
             return -1;
         }
+        sha256_update(&download->chunk_digest, data, piece);
         
-        printf("更新应用成功\n");
+        download->written += piece;
+        data += piece;
+        length -= piece;
+        
+        if (within + piece == chunk_length) {
+            uint8_t digest[SHA256_DIGEST_SIZE];
+            sha256_final(&download->chunk_digest, digest);
+            if (memcmp(digest, manifest->chunk_hashes[index], SHA256_DIGEST_SIZE) == 0) {
+                manifest->chunk_valid[index] = 1;
+            } else {
+                printf("分块 %u 校验失败，稍后重新下载\n", index);
+            }
+        }
+    }
+    
+    return 0;
+}
+
+// 写入一段解码后的更新包数据
+static int update_download_store(update_download_t* download, const void* data, size_t length) {
+    if (download->manifest) {
+        return update_download_store_chunks(download, data, length);
+    }
+    
+    if (fwrite(data, 1, length, download->file) != length) {
+        fprintf(stderr, "更新文件写入不完整\n");
+        return -1;
+    }
+    
+    download->written += length;
+    if (!download->verify) {
         return 0;
-    } else {
-        printf("无法获取当前可执行文件路径\n");
+    }
+    sha256_update(&download->digest, data, length);
+    
+    // 定期落盘并记录进度，进程退出或断线后从最近一次记录处续传
+    if (download->written - download->synced >= UPDATE_PROGRESS_INTERVAL &&
+        update_progress_save(download) != 0) {
+        fprintf(stderr, "记录下载进度失败: %s\n", strerror(errno));
+    }
+    
+    return 0;
+}
+
+// 解码一段Base64更新数据并写入临时文件
+static int update_download_write(void* context, const char* data, size_t length) {
+    update_download_t* download = (update_download_t*)context;
+    unsigned char decoded[(STREAM_CHUNK_SIZE / 4 + 1) * 3];
+    
+    while (length > 0) {
+        size_t chunk = length < STREAM_CHUNK_SIZE ? length : STREAM_CHUNK_SIZE;
+        
+        int decoded_length = base64_decoder_update(&download->decoder, data, chunk,
+                                                   decoded, sizeof(decoded));
+        if (decoded_length < 0) {
+            fprintf(stderr, "Base64解码失败\n");
+            return -1;
+        }
+        
+        if (update_download_store(download, decoded, (size_t)decoded_length) != 0) {
+            return -1;
+        }
+        
+        data += chunk;
+        length -= chunk;
+    }
+    
+    return 0;
+}
+
+// 放弃下载。连接中断时（keep_partial）保留已写入的部分供下次续传，数据出错时删除临时文件
+static void update_download_abort(update_download_t* download, int keep_partial) {
+    if (!download->file) {
+        return;
+    }
+    
+    // 按分块清单下载时临时文件中校验通过的分块下次核对时仍可使用
+    if (download->manifest) {
+        fclose(download->file);
+        download->file = NULL;
+        return;
+    }
+    
+    if (keep_partial && download->verify && update_progress_save(download) == 0) {
+        fclose(download->file);
+        download->file = NULL;
+        printf("已保留下载的 %zu 字节，重新连接后续传\n", download->written);
+        return;
+    }
+    
+    fclose(download->file);
+    download->file = NULL;
+    remove(download->temp_path);
+    remove(UPDATE_PROGRESS_FILE);
+}
+
+// 完成下载：关闭临时文件并替换为正式的更新包
+static int update_download_finish(update_download_t* download) {
+    if (base64_decoder_finish(&download->decoder) != 0) {
+        fprintf(stderr, "Base64数据不完整\n");
+        update_download_abort(download, 0);
+        return -1;
+    }
+    
+    // 按分块清单下载的一段已逐块校验，落盘即可，整个更新包在所有分块就绪后校验
+    if (download->manifest) {
+        int result = fflush(download->file) == 0 && fdatasync(fileno(download->file)) == 0 ? 0 : -1;
+        if (fclose(download->file) != 0) {
+            result = -1;
+        }
+        download->file = NULL;
+        if (result != 0) {
+            fprintf(stderr, "更新文件保存失败: %s\n", strerror(errno));
+        }
+        return result;
+    }
+    
+    // 整个更新包（包括续传前已下载的部分）必须与服务端告知的哈希一致
+    if (download->verify) {
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256_final(&download->digest, digest);
+        if (memcmp(digest, download->hash, SHA256_DIGEST_SIZE) != 0) {
+            fprintf(stderr, "更新文件哈希不匹配\n");
+            update_download_abort(download, 0);
+            return -1;
+        }
+    }
+    
+    int close_result = fclose(download->file);
+    download->file = NULL;
+    remove(UPDATE_PROGRESS_FILE);
+    
+    if (close_result != 0 || rename(download->temp_path, download->final_path) != 0) {
+        fprintf(stderr, "更新文件保存失败: %s\n", strerror(errno));
+        remove(download->temp_path);
+        return -1;
+    }
+    
+    printf("更新文件已保存: %s (%zu 字节)\n", download->final_path, download->written);
+    return 0;
+}
+
+// 下载更新
+int download_update(const char* data, size_t data_size) {
+    if (!data || data_size == 0) {
+        return -1;
+    }
+    
+    update_download_t download;
+    if (update_download_begin_current(&download) != 0) {
+        return -1;
+    }
+    
+    if (update_download_write(&download, data, data_size) != 0) {
+        update_download_abort(&download, 0);
         return -1;
     }
+    
+    return update_download_finish(&download);
+}
+
+// 流式处理更新数据（边接收边解码写入磁盘，内存占用与更新包大小无关）
+int handle_update_stream(message_header_t* header) {
+    if (!header) {
+        return -1;
+    }
+    
+    printf("流式接收更新数据: %u 字节\n", header->length);
+    
+    update_download_t download;
+    int begin_result = update_download_begin_current(&download);
+    
+    // 失败时仍读完剩余数据，保持帧边界
+    uint32_t checksum = 0;
+    int recv_result = stream_recv_body(g_client.socket_fd, header->length, &checksum,
+                                       begin_result == 0 ? update_download_write : NULL,
+                                       &download);
+    if (recv_result < 0) {
+        printf("接收消息数据失败\n");
+        update_download_abort(&download, 1);
+        client_disconnect();
+        return -1;
+    }
+    
+    if (checksum != header->checksum) {
+        printf("消息校验和不匹配\n");
+        update_download_abort(&download, 0);
+        client_disconnect();
+        return -1;
+    }
+    
+    if (begin_result != 0 || recv_result != 0 || update_download_finish(&download) != 0) {
+        update_download_abort(&download, 0);
+        printf("更新下载失败\n");
+        log_message_to_gui("更新下载失败");
+        return -1;
+    }
+    
+    update_download_completed();
+    return 0;
+}
+
+// 开始分片接收更新数据
+void* update_stream_begin() {
+    update_download_t* download = malloc(sizeof(update_download_t));
+    if (!download) {
+        return NULL;
+    }
+    
+    if (update_download_begin_current(download) != 0) {
+        free(download);
+        return NULL;
+    }
+    
+    return download;
+}
+
+// 写入一个更新数据分片
+int update_stream_write(void* context, const char* data, size_t length) {
+    return update_download_write(context, data, length);
 }
 
-// 重启客户端
+// 完成分片接收并应用更新
+int update_stream_finish(void* context) {
+    if (update_download_close(context) != 0) {
+        printf("更新下载失败\n");
+        log_message_to_gui("更新下载失败");
+        return -1;
+    }
+    
+    update_download_completed();
+    return 0;
+}
+
+// 放弃分片接收的更新数据（断线时keep_partial为1，保留已接收的部分）
+void update_stream_abort(void* context, int keep_partial) {
+    update_download_discard(context, keep_partial);
+}
+
+// 返回同一更新包可续传的字节数（后台预取在自己的连接上请求续传时使用）
+uint32_t update_download_progress(const uint8_t* package_hash) {
+    return package_hash && update_hash_known(package_hash) ? update_progress_load(package_hash) : 0;
+}
+
+// 开始下载更新包，resume时接着已下载的前offset字节写
+void* update_download_open(const uint8_t* package_hash, int resume, uint32_t offset) {
+    update_download_t* download = malloc(sizeof(update_download_t));
+    if (!download) {
+        return NULL;
+    }
+    
+    if (update_download_begin(download, package_hash, resume, offset) != 0) {
+        free(download);
+        return NULL;
+    }
+    
+    return download;
+}
+
+// 开始按分块清单下载从offset开始的一段（后台预取收到续传通知后调用）
+void* update_download_open_range(void* manifest, uint32_t offset) {
+    update_download_t* download = malloc(sizeof(update_download_t));
+    if (!download) {
+        return NULL;
+    }
+    
+    if (update_download_begin_range(download, (update_manifest_t*)manifest, offset) != 0) {
+        free(download);
+        return NULL;
+    }
+    
+    return download;
+}
+
+// 写入一段Base64编码的更新数据
+int update_download_append(void* context, const char* data, size_t length) {
+    return update_download_write(context, data, length);
+}
+
+// 写入一段未编码的更新包数据（来自局域网对等节点）
+int update_download_append_raw(void* context, const void* data, size_t length) {
+    return update_download_store((update_download_t*)context, data, length);
+}
+
+// 完成下载：校验后保存为正式的更新包（不应用）
+int update_download_close(void* context) {
+    update_download_t* download = (update_download_t*)context;
+    int result = update_download_finish(download);
+    free(download);
+    return result;
+}
+
+// 放弃下载，keep_partial为1时保留已下载的部分供续传
+void update_download_discard(void* context, int keep_partial) {
+    update_download_t* download = (update_download_t*)context;
+    update_download_abort(download, keep_partial);
+    free(download);
+}
+
+// 应用更新：在进程内把更新包解压到暂存目录，再原子替换可执行文件
+int apply_update() {
+    const char* update_file_path = UPDATE_PACKAGE_FILE;
+    
+    // 检查更新文件是否存在
+    if (access(update_file_path, F_OK) != 0) {
+        printf("更新文件不存在: %s\n", update_file_path);
+        return -1;
+    }
+    
+    // 上次中断留下的暂存内容先清掉
+    if (update_remove_tree(UPDATE_STAGING_DIR) != 0 || mkdir(UPDATE_STAGING_DIR, 0755) == -1) {
+        perror("mkdir staging directory");
+        return -1;
+    }
+    
+    printf("解压更新文件: %s -> %s\n", update_file_path, UPDATE_STAGING_DIR);
+    int extracted = archive_extract(update_file_path, UPDATE_STAGING_DIR);
+    if (extracted < 0) {
+        printf("解压更新文件失败\n");
+        return -1;
+    }
+    printf("已解压 %d 个文件\n", extracted);
+    
+    return replace_client_executable(UPDATE_STAGING_DIR "client");
+}
+
+// 用新的可执行文件替换当前可执行文件。旧文件以硬链接保留为备份，新文件用rename()原子地
+// 换到原路径上：任何时刻原路径要么是完整的旧版本，要么是完整的新版本
+int replace_client_executable(const char* new_client_path) {
+    if (access(new_client_path, X_OK) != 0) {
+        printf("新的客户端可执行文件不存在或无执行权限: %s\n", new_client_path);
+        return -1;
+    }
+    
+    char current_exe[512];
+    if (update_current_executable(current_exe, sizeof(current_exe)) != 0) {
+        return -1;
+    }
+    
+    // 备份当前可执行文件（不在同一文件系统时只能复制）
+    unlink(UPDATE_BACKUP_FILE);
+    if (link(current_exe, UPDATE_BACKUP_FILE) != 0 &&
+        (errno != EXDEV || update_copy_file(current_exe, UPDATE_BACKUP_FILE, 0755) != 0)) {
+        printf("备份当前可执行文件失败: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    // 暂存文件与可执行文件在同一文件系统时直接重命名，否则先复制到可执行文件旁边再重命名
+    if (rename(new_client_path, current_exe) != 0) {
+        char staged_path[sizeof(current_exe) + 8];
+        snprintf(staged_path, sizeof(staged_path), "%s.new", current_exe);
+        
+        if (errno != EXDEV || update_copy_file(new_client_path, staged_path, 0755) != 0 ||
+            rename(staged_path, current_exe) != 0) {
+            printf("替换可执行文件失败: %s\n", strerror(errno));
+            unlink(staged_path);
+            return -1;
+        }
+    }
+    
+    if (update_sync_parent(current_exe) != 0) {
+        printf("刷新目录失败: %s\n", strerror(errno));
+    }
+    
+    printf("更新应用成功，旧版本已备份到 %s\n", UPDATE_BACKUP_FILE);
+    return 0;
+}
+
+// 重启客户端（执行替换后的新版本）
 int restart_client() {
     printf("重启客户端...\n");
     
     // 保存配置
     save_config();
     
-    // 获取当前可执行文件路径
+    // 获取当前可执行文件路径（替换后即为新版本）
     char current_exe[512];
-    ssize_t len = readlink("/proc/self/exe", current_exe, sizeof(current_exe) - 1);
-    if (len != -1) {
-        current_exe[len] = '\0';
-        
-        // 断开连接
-        client_disconnect();
-        
-        // 执行新程序
-        execl(current_exe, current_exe, NULL);
-        
-        // 如果execl失败，程序会继续执行到这里
-        perror("execl");
-        return -1;
-    } else {
-        printf("无法获取当前可执行文件路径\n");
+    if (update_current_executable(current_exe, sizeof(current_exe)) != 0) {
         return -1;
     }
+    
+    // 断开连接
+    client_disconnect();
+    
+    // 执行新程序（先输出缓冲区中的日志，exec后会丢失）
+    fflush(stdout);
+    execl(current_exe, current_exe, NULL);
+    
+    // 如果execl失败，程序会继续执行到这里
+    perror("execl");
+    return -1;
 }
 
 // 创建必要的目录
@@ -0,0 +1,352 @@
+#include "archive.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+// tar头中的字段偏移
+#define TAR_NAME_OFFSET 0
+#define TAR_NAME_SIZE 100
+#define TAR_MODE_OFFSET 100
+#define TAR_MODE_SIZE 8
+#define TAR_SIZE_OFFSET 124
+#define TAR_SIZE_SIZE 12
+#define TAR_TYPE_OFFSET 156
+#define TAR_MAGIC_OFFSET 257
+#define TAR_PREFIX_OFFSET 345
+#define TAR_PREFIX_SIZE 155
+
+// 成员名的最大长度（GNU长文件名）
+#define ARCHIVE_NAME_MAX 4096
+
+// 解压时的读写缓冲区大小
+#define ARCHIVE_COPY_SIZE (64 * 1024)
+
+// 一个归档成员的头信息
+typedef struct {
+    char name[ARCHIVE_NAME_MAX];  // 完整成员名（已合并ustar前缀或GNU长文件名）
+    size_t size;                  // 数据长度
+    unsigned int mode;            // 权限位
+    char type;                    // 成员类型（'0'普通文件，'5'目录，...）
+} archive_member_t;
+
+// 解析八进制数字段
+static size_t archive_parse_octal(const unsigned char* field, size_t length) {
+    size_t value = 0;
+    for (size_t i = 0; i < length && field[i] != '\0' && field[i] != ' '; i++) {
+        if (field[i] < '0' || field[i] > '7') {
+            break;
+        }
+        value = value * 8 + (size_t)(field[i] - '0');
+    }
+    return value;
+}
+
+// 去掉成员名开头的"./"
+static const char* archive_strip_name(const char* name) {
+    while (name[0] == '.' && name[1] == '/') {
+        name += 2;
+    }
+    return name;
+}
+
+// 读取一个头块，返回0表示成功，1表示归档结束，-1表示失败
+static int archive_read_header(gzFile file, unsigned char* header) {
+    if (gzread(file, header, ARCHIVE_BLOCK_SIZE) != ARCHIVE_BLOCK_SIZE) {
+        return -1;
+    }
+    
+    for (size_t i = 0; i < ARCHIVE_BLOCK_SIZE; i++) {
+        if (header[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 成员数据补齐到块大小后的长度
+static size_t archive_padded(size_t size) {
+    return (size + ARCHIVE_BLOCK_SIZE - 1) / ARCHIVE_BLOCK_SIZE * ARCHIVE_BLOCK_SIZE;
+}
+
+// 跳过成员数据
+static int archive_skip(gzFile file, size_t size) {
+    return gzseek(file, (z_off_t)archive_padded(size), SEEK_CUR) == -1 ? -1 : 0;
+}
+
+// 读取下一个成员的头（GNU长文件名记录已合并进成员名），返回0表示成功，1表示归档结束，-1表示失败
+static int archive_next_member(gzFile file, archive_member_t* member) {
+    unsigned char header[ARCHIVE_BLOCK_SIZE];
+    int long_name = 0;
+    
+    while (1) {
+        int header_result = archive_read_header(file, header);
+        if (header_result != 0) {
+            return header_result;
+        }
+        
+        member->size = archive_parse_octal(header + TAR_SIZE_OFFSET, TAR_SIZE_SIZE);
+        member->mode = (unsigned int)archive_parse_octal(header + TAR_MODE_OFFSET, TAR_MODE_SIZE);
+        member->type = (char)header[TAR_TYPE_OFFSET];
+        
+        // GNU长文件名：数据块是下一个成员的名字
+        if (member->type == 'L') {
+            size_t padding = archive_padded(member->size) - member->size;
+            if (member->size >= sizeof(member->name) ||
+                gzread(file, member->name, (unsigned)member->size) != (int)member->size ||
+                gzseek(file, (z_off_t)padding, SEEK_CUR) == -1) {
+                return -1;
+            }
+            member->name[member->size] = '\0';
+            long_name = 1;
+            continue;
+        }
+        
+        if (!long_name) {
+            // ustar格式的名字可能拆成前缀和名字两部分
+            if (memcmp(header + TAR_MAGIC_OFFSET, "ustar", 5) == 0 && header[TAR_PREFIX_OFFSET] != '\0') {
+                snprintf(member->name, sizeof(member->name), "%.*s/%.*s", TAR_PREFIX_SIZE,
+                         (const char*)header + TAR_PREFIX_OFFSET, TAR_NAME_SIZE,
+                         (const char*)header + TAR_NAME_OFFSET);
+            } else {
+                snprintf(member->name, sizeof(member->name), "%.*s", TAR_NAME_SIZE,
+                         (const char*)header + TAR_NAME_OFFSET);
+            }
+        }
+        return 0;
+    }
+}
+
+int archive_read_member(const char* path, const char* name, size_t max_size,
+                        unsigned char** data, size_t* size) {
+    if (!path || !name || !data || !size) {
+        return -1;
+    }
+    
+    *data = NULL;
+    *size = 0;
+    
+    // gzopen也能读取未压缩的文件
+    gzFile file = gzopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "无法打开归档文件: %s\n", path);
+        return -1;
+    }
+    
+    const char* wanted = archive_strip_name(name);
+    archive_member_t member;
+    int result = 1;
+    
+    while (result == 1) {
+        int header_result = archive_next_member(file, &member);
+        if (header_result != 0) {
+            result = header_result < 0 ? -1 : 1;
+            break;
+        }
+        
+        int regular = member.type == '0' || member.type == '\0';
+        if (!regular || strcmp(archive_strip_name(member.name), wanted) != 0) {
+            if (archive_skip(file, member.size) != 0) {
+                result = -1;
+            }
+            continue;
+        }
+        
+        if (member.size > max_size) {
+            fprintf(stderr, "归档成员过大: %s (%zu 字节)\n", member.name, member.size);
+            result = -1;
+            break;
+        }
+        
+        *data = malloc(member.size > 0 ? member.size : 1);
+        if (!*data || (member.size > 0 && gzread(file, *data, (unsigned)member.size) != (int)member.size)) {
+            free(*data);
+            *data = NULL;
+            result = -1;
+            break;
+        }
+        
+        *size = member.size;
+        result = 0;
+    }
+    
+    gzclose(file);
+    return result;
+}
+
+// 成员名是否可以安全地解压到目标目录下（不是绝对路径，不含".."）
+static int archive_safe_name(const char* name) {
+    if (name[0] == '/' || name[0] == '\0') {
+        return 0;
+    }
+    
+    const char* part = name;
+    while (part) {
+        if (strncmp(part, "..", 2) == 0 && (part[2] == '/' || part[2] == '\0')) {
+            return 0;
+        }
+        part = strchr(part, '/');
+        if (part) {
+            part++;
+        }
+    }
+    return 1;
+}
+
+// 逐级创建path的各级父目录（已存在不算错误）
+static int archive_make_parents(char* path) {
+    for (char* slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        int result = mkdir(path, 0755);
+        int error = errno;
+        *slash = '/';
+        if (result == -1 && error != EEXIST) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 把当前成员的数据写入文件并刷盘
+static int archive_write_member(gzFile file, const archive_member_t* member, const char* path,
+                                unsigned char* buffer) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, (member->mode & 0777) ? (member->mode & 0777) : 0644);
+    if (fd == -1) {
+        fprintf(stderr, "无法创建文件 %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    size_t remaining = member->size;
+    int result = 0;
+    while (result == 0 && remaining > 0) {
+        unsigned chunk = remaining < ARCHIVE_COPY_SIZE ? (unsigned)remaining : ARCHIVE_COPY_SIZE;
+        if (gzread(file, buffer, chunk) != (int)chunk) {
+            result = -1;
+            break;
+        }
+        
+        for (unsigned done = 0; done < chunk; ) {
+            ssize_t written = write(fd, buffer + done, chunk - done);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                result = -1;
+                break;
+            }
+            done += (unsigned)written;
+        }
+        remaining -= chunk;
+    }
+    
+    // open的权限位受umask影响，按归档中的权限重新设置
+    if (result == 0 && ((member->mode & 0777) && fchmod(fd, member->mode & 0777) != 0)) {
+        result = -1;
+    }
+    if (result == 0 && fsync(fd) != 0) {
+        result = -1;
+    }
+    if (close(fd) != 0) {
+        result = -1;
+    }
+    
+    if (result != 0) {
+        fprintf(stderr, "解压文件失败: %s\n", path);
+        return -1;
+    }
+    
+    size_t padding = archive_padded(member->size) - member->size;
+    return gzseek(file, (z_off_t)padding, SEEK_CUR) == -1 ? -1 : 0;
+}
+
+// 刷新目录项到磁盘
+static int archive_sync_dir(const char* dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        return -1;
+    }
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+int archive_extract(const char* path, const char* dest_dir) {
+    if (!path || !dest_dir) {
+        return -1;
+    }
+    
+    gzFile file = gzopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "无法打开归档文件: %s\n", path);
+        return -1;
+    }
+    
+    archive_member_t member;
+    unsigned char* buffer = malloc(ARCHIVE_COPY_SIZE);
+    char target[ARCHIVE_NAME_MAX + 512];
+    int extracted = 0;
+    int result = buffer ? 1 : -1;
+    
+    while (result == 1) {
+        int header_result = archive_next_member(file, &member);
+        if (header_result != 0) {
+            result = header_result < 0 ? -1 : 0;
+            break;
+        }
+        
+        const char* name = archive_strip_name(member.name);
+        int regular = member.type == '0' || member.type == '\0';
+        int directory = member.type == '5';
+        
+        // 只解压普通文件和目录；链接、设备文件等跳过
+        if ((!regular && !directory) || name[0] == '\0' || strcmp(name, ".") == 0) {
+            if (archive_skip(file, member.size) != 0) {
+                result = -1;
+            }
+            continue;
+        }
+        
+        if (!archive_safe_name(name)) {
+            fprintf(stderr, "归档成员路径不安全: %s\n", member.name);
+            result = -1;
+            break;
+        }
+        
+        snprintf(target, sizeof(target), "%s/%s", dest_dir, name);
+        if (archive_make_parents(target) != 0) {
+            fprintf(stderr, "创建目录失败: %s\n", target);
+            result = -1;
+            break;
+        }
+        
+        if (directory) {
+            size_t length = strlen(target);
+            if (length > 0 && target[length - 1] == '/') {
+                target[length - 1] = '\0';
+            }
+            if ((mkdir(target, 0755) == -1 && errno != EEXIST) || archive_skip(file, member.size) != 0) {
+                fprintf(stderr, "创建目录失败: %s\n", target);
+                result = -1;
+            }
+            continue;
+        }
+        
+        if (archive_write_member(file, &member, target, buffer) != 0) {
+            result = -1;
+            break;
+        }
+        extracted++;
+    }
+    
+    free(buffer);
+    gzclose(file);
+    
+    if (result == 0 && archive_sync_dir(dest_dir) != 0) {
+        fprintf(stderr, "刷新目录失败: %s\n", dest_dir);
+        result = -1;
+    }
+    
+    return result == 0 ? extracted : -1;
+}
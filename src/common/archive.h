@@ -0,0 +1,31 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+
+// tar格式的块大小
+#define ARCHIVE_BLOCK_SIZE 512
+
+/**
+ * 读取tar.gz（或未压缩的tar）中的一个普通文件成员
+ * 成员名比较时忽略开头的"./"，支持ustar前缀和GNU长文件名
+ * @param path 归档文件路径
+ * @param name 成员名
+ * @param max_size 允许的最大成员大小
+ * @param data 数据缓冲区指针（由函数分配，调用者释放）
+ * @param size 成员大小
+ * @return 0表示成功，1表示没有该成员，-1表示失败
+ */
+int archive_read_member(const char* path, const char* name, size_t max_size,
+                        unsigned char** data, size_t* size);
+
+/**
+ * 把tar.gz（或未压缩的tar）中的普通文件和目录解压到指定目录
+ * 每个文件写完后fsync，最后fsync目标目录；绝对路径或含".."的成员视为失败，其他类型的成员跳过
+ * @param path 归档文件路径
+ * @param dest_dir 目标目录（必须已存在）
+ * @return 解压的文件数，失败返回-1（可能已解压部分文件）
+ */
+int archive_extract(const char* path, const char* dest_dir);
+
+#endif // ARCHIVE_H
@@ -102,4 +102,83 @@ int base64_decode(const char* input, size_t input_length,
     }
     
     return decoded_length;
+}
+
+void base64_decoder_init(base64_decoder_t* decoder) {
+    if (!decoder) return;
+    
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+// 解码一组4个字符，返回输出的字节数，失败返回-1
+static int base64_decode_quad(const char* quad, unsigned char* output, int* finished) {
+    int sextets[4];
+    int padding = 0;
+    
+    for (int k = 0; k < 4; k++) {
+        unsigned char c = (unsigned char)quad[k];
+        if (c == '=') {
+            // 填充只能出现在最后两个位置
+            if (k < 2) return -1;
+            padding++;
+            sextets[k] = 0;
+        } else {
+            if (padding > 0 || c >= 128 || base64_decode_table[c] < 0) return -1;
+            sextets[k] = base64_decode_table[c];
+        }
+    }
+    
+    uint32_t triple = ((uint32_t)sextets[0] << 18) | ((uint32_t)sextets[1] << 12) |
+                      ((uint32_t)sextets[2] << 6) | (uint32_t)sextets[3];
+    
+    output[0] = (triple >> 16) & 0xFF;
+    output[1] = (triple >> 8) & 0xFF;
+    output[2] = triple & 0xFF;
+    
+    if (padding > 0) {
+        *finished = 1;
+    }
+    
+    return 3 - padding;
+}
+
+int base64_decoder_update(base64_decoder_t* decoder, const char* input, size_t input_length,
+                          unsigned char* output, size_t output_length) {
+    if (!decoder || (!input && input_length > 0) || !output) return -1;
+    
+    size_t needed = ((decoder->pending_length + input_length) / 4) * 3;
+    if (output_length < needed) return -1;
+    
+    size_t written = 0;
+    size_t i = 0;
+    
+    while (i < input_length) {
+        // 填充之后不允许再有数据
+        if (decoder->finished) return -1;
+        
+        // 先凑满pending中的一组
+        if (decoder->pending_length > 0 || input_length - i < 4) {
+            decoder->pending[decoder->pending_length++] = input[i++];
+            if (decoder->pending_length == 4) {
+                int n = base64_decode_quad(decoder->pending, output + written, &decoder->finished);
+                if (n < 0) return -1;
+                written += n;
+                decoder->pending_length = 0;
+            }
+            continue;
+        }
+        
+        int n = base64_decode_quad(input + i, output + written, &decoder->finished);
+        if (n < 0) return -1;
+        written += n;
+        i += 4;
+    }
+    
+    return (int)written;
+}
+
+int base64_decoder_finish(base64_decoder_t* decoder) {
+    if (!decoder) return -1;
+    
+    return decoder->pending_length == 0 ? 0 : -1;
 }
\ No newline at end of file
@@ -3,6 +3,13 @@
 
 #include <stddef.h>
 
+// 增量Base64解码器状态（用于流式解码，数据可以任意切分后依次输入）
+typedef struct {
+    char pending[4];          // 尚未凑满4个字符的输入
+    size_t pending_length;    // pending中的字符数
+    int finished;             // 已遇到填充字符'='
+} base64_decoder_t;
+
 /**
  * Base64编码函数
  * @param input 输入数据
@@ -47,4 +54,29 @@ size_t base64_decoded_length(const char* input, size_t input_length);
  */
 int is_base64_char(char c);
 
+/**
+ * 初始化增量Base64解码器
+ * @param decoder 解码器状态
+ */
+void base64_decoder_init(base64_decoder_t* decoder);
+
+/**
+ * 增量解码一段Base64数据
+ * @param decoder 解码器状态
+ * @param input 输入的Base64数据片段
+ * @param input_length 片段长度
+ * @param output 输出缓冲区（至少 (input_length / 4 + 1) * 3 字节）
+ * @param output_length 输出缓冲区大小
+ * @return 本次解码输出的字节数，失败返回-1
+ */
+int base64_decoder_update(base64_decoder_t* decoder, const char* input, size_t input_length,
+                          unsigned char* output, size_t output_length);
+
+/**
+ * 结束增量解码，检查输入是否完整
+ * @param decoder 解码器状态
+ * @return 0表示输入完整，-1表示残留不完整的字符
+ */
+int base64_decoder_finish(base64_decoder_t* decoder);
+
 #endif // BASE64_H
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+// 全局统计计数器（多线程原子更新）
+static compress_stats_t g_compress_stats = {0};
+
+// 获取当前线程的CPU时间（纳秒）
+static uint64_t thread_cpu_ns() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void stats_add(uint64_t* counter, uint64_t value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+int compress_codec_supported(uint8_t codec) {
+    return codec == COMPRESS_CODEC_ZLIB;
+}
+
+int compress_frame(uint8_t codec, const void* input, size_t input_length,
+                   unsigned char** output, size_t* output_length) {
+    if (!input || !output || !output_length) {
+        return -1;
+    }
+    
+    *output = NULL;
+    *output_length = 0;
+    
+    if (codec == COMPRESS_CODEC_NONE || input_length < COMPRESS_MIN_SIZE ||
+        input_length > UINT32_MAX) {
+        stats_add(&g_compress_stats.frames_skipped, 1);
+        return 0;
+    }
+    
+    if (!compress_codec_supported(codec)) {
+        return -1;
+    }
+    
+    uint64_t start = thread_cpu_ns();
+    
+    uLongf bound = compressBound((uLong)input_length);
+    unsigned char* buffer = malloc(4 + bound);
+    if (!buffer) {
+        return -1;
+    }
+    
+    // 前4字节保存原始长度（小端序）
+    uint32_t raw_length = (uint32_t)input_length;
+    buffer[0] = raw_length & 0xFF;
+    buffer[1] = (raw_length >> 8) & 0xFF;
+    buffer[2] = (raw_length >> 16) & 0xFF;
+    buffer[3] = (raw_length >> 24) & 0xFF;
+    
+    uLongf compressed_length = bound;
+    int rc = compress2(buffer + 4, &compressed_length, (const Bytef*)input,
+                       (uLong)input_length, COMPRESS_ZLIB_LEVEL);
+    
+    stats_add(&g_compress_stats.compress_cpu_ns, thread_cpu_ns() - start);
+    
+    if (rc != Z_OK) {
+        free(buffer);
+        return -1;
+    }
+    
+    // 压缩无收益时原样发送
+    if (4 + compressed_length >= input_length) {
+        free(buffer);
+        stats_add(&g_compress_stats.frames_skipped, 1);
+        return 0;
+    }
+    
+    *output = buffer;
+    *output_length = 4 + compressed_length;
+    
+    stats_add(&g_compress_stats.frames_compressed, 1);
+    stats_add(&g_compress_stats.bytes_before, input_length);
+    stats_add(&g_compress_stats.bytes_after, *output_length);
+    
+    return 1;
+}
+
+int decompress_frame(uint8_t codec, const void* input, size_t input_length,
+                     unsigned char** output, size_t* output_length, size_t max_length) {
+    if (!input || !output || !output_length || input_length < 4) {
+        return -1;
+    }
+    
+    if (!compress_codec_supported(codec)) {
+        return -1;
+    }
+    
+    const unsigned char* bytes = (const unsigned char*)input;
+    uint32_t raw_length = (uint32_t)bytes[0] |
+                          ((uint32_t)bytes[1] << 8) |
+                          ((uint32_t)bytes[2] << 16) |
+                          ((uint32_t)bytes[3] << 24);
+    
+    // 防止恶意的超大解压长度
+    if (raw_length > max_length) {
+        return -1;
+    }
+    
+    uint64_t start = thread_cpu_ns();
+    
+    unsigned char* buffer = malloc((size_t)raw_length + 1);
+    if (!buffer) {
+        return -1;
+    }
+    
+    uLongf decompressed_length = raw_length;
+    int rc = uncompress(buffer, &decompressed_length, bytes + 4, (uLong)(input_length - 4));
+    
+    stats_add(&g_compress_stats.decompress_cpu_ns, thread_cpu_ns() - start);
+    
+    if (rc != Z_OK || decompressed_length != raw_length) {
+        free(buffer);
+        return -1;
+    }
+    
+    buffer[raw_length] = '\0';
+    *output = buffer;
+    *output_length = raw_length;
+    
+    stats_add(&g_compress_stats.frames_decompressed, 1);
+    
+    return 0;
+}
+
+void compress_get_stats(compress_stats_t* stats) {
+    if (!stats) return;
+    
+    stats->frames_compressed = __atomic_load_n(&g_compress_stats.frames_compressed, __ATOMIC_RELAXED);
+    stats->frames_skipped = __atomic_load_n(&g_compress_stats.frames_skipped, __ATOMIC_RELAXED);
+    stats->bytes_before = __atomic_load_n(&g_compress_stats.bytes_before, __ATOMIC_RELAXED);
+    stats->bytes_after = __atomic_load_n(&g_compress_stats.bytes_after, __ATOMIC_RELAXED);
+    stats->frames_decompressed = __atomic_load_n(&g_compress_stats.frames_decompressed, __ATOMIC_RELAXED);
+    stats->compress_cpu_ns = __atomic_load_n(&g_compress_stats.compress_cpu_ns, __ATOMIC_RELAXED);
+    stats->decompress_cpu_ns = __atomic_load_n(&g_compress_stats.decompress_cpu_ns, __ATOMIC_RELAXED);
+}
+
+void compress_print_stats() {
+    compress_stats_t stats;
+    compress_get_stats(&stats);
+    
+    double ratio = stats.bytes_after > 0 ?
+                   (double)stats.bytes_before / (double)stats.bytes_after : 0.0;
+    
+    printf("压缩帧数: %llu (跳过: %llu, 解压: %llu)\n",
+           (unsigned long long)stats.frames_compressed,
+           (unsigned long long)stats.frames_skipped,
+           (unsigned long long)stats.frames_decompressed);
+    printf("压缩率: %.2f (%llu -> %llu 字节)\n", ratio,
+           (unsigned long long)stats.bytes_before,
+           (unsigned long long)stats.bytes_after);
+    printf("压缩CPU时间: %.3f ms, 解压CPU时间: %.3f ms\n",
+           stats.compress_cpu_ns / 1e6, stats.decompress_cpu_ns / 1e6);
+}
@@ -0,0 +1,72 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 压缩编码ID（写入消息头flags的高4位）
+#define COMPRESS_CODEC_NONE 0
+#define COMPRESS_CODEC_ZLIB 1
+
+// zlib压缩级别（1为最快）
+#define COMPRESS_ZLIB_LEVEL 1
+
+// 小于该大小的帧不压缩
+#define COMPRESS_MIN_SIZE 512
+
+// 压缩统计计数器
+typedef struct {
+    uint64_t frames_compressed;     // 压缩发送的帧数
+    uint64_t frames_skipped;        // 低于阈值或压缩无收益而原样发送的帧数
+    uint64_t bytes_before;          // 压缩前字节数
+    uint64_t bytes_after;           // 压缩后字节数
+    uint64_t frames_decompressed;   // 解压的帧数
+    uint64_t compress_cpu_ns;       // 压缩耗费的CPU时间（纳秒）
+    uint64_t decompress_cpu_ns;     // 解压耗费的CPU时间（纳秒）
+} compress_stats_t;
+
+/**
+ * 压缩一帧数据
+ * 压缩后的格式为: [原始长度(uint32, 小端)] + [编码数据]
+ * @param codec 压缩编码ID
+ * @param input 输入数据
+ * @param input_length 输入数据长度
+ * @param output 输出缓冲区指针（成功时由函数分配，调用者释放）
+ * @param output_length 输出数据长度
+ * @return 1表示已压缩，0表示未压缩（低于阈值或无收益），-1表示失败
+ */
+int compress_frame(uint8_t codec, const void* input, size_t input_length,
+                   unsigned char** output, size_t* output_length);
+
+/**
+ * 解压一帧数据
+ * @param codec 压缩编码ID
+ * @param input 压缩数据
+ * @param input_length 压缩数据长度
+ * @param output 输出缓冲区指针（由函数分配，末尾额外补'\0'，调用者释放）
+ * @param output_length 解压后的数据长度
+ * @param max_length 允许的最大解压长度
+ * @return 0表示成功，-1表示失败
+ */
+int decompress_frame(uint8_t codec, const void* input, size_t input_length,
+                     unsigned char** output, size_t* output_length, size_t max_length);
+
+/**
+ * 检查是否支持指定的压缩编码
+ * @param codec 压缩编码ID
+ * @return 1表示支持，0表示不支持
+ */
+int compress_codec_supported(uint8_t codec);
+
+/**
+ * 获取压缩统计计数器快照
+ * @param stats 输出的统计数据
+ */
+void compress_get_stats(compress_stats_t* stats);
+
+/**
+ * 打印压缩统计信息（压缩率和CPU时间）
+ */
+void compress_print_stats();
+
+#endif // COMPRESS_H
@@ -0,0 +1,245 @@
+#include "delta.h"
+#include <stdlib.h>
+#include <string.h>
+
+// 滚动哈希的乘数
+#define DELTA_HASH_MULTIPLIER 0x01000193u
+
+// 旧数据块索引项（offset为块偏移加1，0表示空槽）
+typedef struct {
+    uint32_t hash;
+    uint32_t offset;
+} delta_slot_t;
+
+// 补丁输出缓冲区
+typedef struct {
+    unsigned char* data;
+    size_t length;
+    size_t capacity;
+    int failed;
+} delta_output_t;
+
+static void delta_put_u32(unsigned char* output, uint32_t value) {
+    output[0] = (unsigned char)value;
+    output[1] = (unsigned char)(value >> 8);
+    output[2] = (unsigned char)(value >> 16);
+    output[3] = (unsigned char)(value >> 24);
+}
+
+static uint32_t delta_get_u32(const unsigned char* input) {
+    return (uint32_t)input[0] | ((uint32_t)input[1] << 8) |
+           ((uint32_t)input[2] << 16) | ((uint32_t)input[3] << 24);
+}
+
+// 计算一个块的哈希
+static uint32_t delta_hash(const unsigned char* data) {
+    uint32_t hash = 0;
+    for (size_t i = 0; i < DELTA_BLOCK_SIZE; i++) {
+        hash = hash * DELTA_HASH_MULTIPLIER + data[i];
+    }
+    return hash;
+}
+
+// 追加数据，空间不足时扩大缓冲区
+static void delta_append(delta_output_t* output, const void* data, size_t length) {
+    if (output->failed) {
+        return;
+    }
+    
+    if (output->length + length > output->capacity) {
+        size_t capacity = output->capacity * 2;
+        if (capacity < output->length + length) {
+            capacity = output->length + length;
+        }
+        
+        unsigned char* buffer = realloc(output->data, capacity);
+        if (!buffer) {
+            output->failed = 1;
+            return;
+        }
+        output->data = buffer;
+        output->capacity = capacity;
+    }
+    
+    memcpy(output->data + output->length, data, length);
+    output->length += length;
+}
+
+// 追加一个操作
+static void delta_emit(delta_output_t* output, uint8_t op, uint32_t length, uint32_t offset,
+                       const unsigned char* data) {
+    unsigned char header[9];
+    header[0] = op;
+    delta_put_u32(header + 1, length);
+    
+    if (op == DELTA_OP_COPY) {
+        delta_put_u32(header + 5, offset);
+        delta_append(output, header, 9);
+    } else {
+        delta_append(output, header, 5);
+        delta_append(output, data, length);
+    }
+}
+
+int delta_create(const void* base, size_t base_size, const void* target, size_t target_size,
+                 unsigned char** delta, size_t* delta_size) {
+    if ((!base && base_size > 0) || (!target && target_size > 0) || !delta || !delta_size ||
+        base_size > UINT32_MAX || target_size > UINT32_MAX) {
+        return -1;
+    }
+    
+    const unsigned char* old_data = base;
+    const unsigned char* new_data = target;
+    delta_output_t output = {NULL, 0, 0, 0};
+    
+    // 旧数据按块建立开放寻址哈希表
+    size_t block_count = base_size / DELTA_BLOCK_SIZE;
+    size_t table_size = 1;
+    while (table_size < block_count * 2) {
+        table_size <<= 1;
+    }
+    
+    delta_slot_t* table = calloc(table_size, sizeof(delta_slot_t));
+    if (!table) {
+        return -1;
+    }
+    
+    for (size_t block = 0; block < block_count; block++) {
+        uint32_t offset = (uint32_t)(block * DELTA_BLOCK_SIZE);
+        uint32_t hash = delta_hash(old_data + offset);
+        size_t slot = hash & (table_size - 1);
+        while (table[slot].offset != 0) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        table[slot].hash = hash;
+        table[slot].offset = offset + 1;
+    }
+    
+    // 滚动窗口移出首字节时需要减去的权重: MULTIPLIER^(BLOCK_SIZE-1)
+    uint32_t outgoing_weight = 1;
+    for (size_t i = 1; i < DELTA_BLOCK_SIZE; i++) {
+        outgoing_weight *= DELTA_HASH_MULTIPLIER;
+    }
+    
+    size_t position = 0;
+    size_t literal_start = 0;
+    uint32_t hash = target_size >= DELTA_BLOCK_SIZE ? delta_hash(new_data) : 0;
+    
+    while (block_count > 0 && position + DELTA_BLOCK_SIZE <= target_size) {
+        size_t match_offset = 0;
+        size_t match_length = 0;
+        
+        size_t slot = hash & (table_size - 1);
+        while (table[slot].offset != 0) {
+            size_t offset = table[slot].offset - 1;
+            if (table[slot].hash == hash &&
+                memcmp(old_data + offset, new_data + position, DELTA_BLOCK_SIZE) == 0) {
+                match_offset = offset;
+                match_length = DELTA_BLOCK_SIZE;
+                break;
+            }
+            slot = (slot + 1) & (table_size - 1);
+        }
+        
+        if (match_length == 0) {
+            // 没有匹配：窗口后移一个字节
+            if (position + DELTA_BLOCK_SIZE < target_size) {
+                hash = (hash - new_data[position] * outgoing_weight) * DELTA_HASH_MULTIPLIER +
+                       new_data[position + DELTA_BLOCK_SIZE];
+            }
+            position++;
+            continue;
+        }
+        
+        // 向后延长匹配，再向前吞掉相同的字面量
+        while (match_offset + match_length < base_size && position + match_length < target_size &&
+               old_data[match_offset + match_length] == new_data[position + match_length]) {
+            match_length++;
+        }
+        while (position > literal_start && match_offset > 0 &&
+               old_data[match_offset - 1] == new_data[position - 1]) {
+            match_offset--;
+            position--;
+            match_length++;
+        }
+        
+        if (position > literal_start) {
+            delta_emit(&output, DELTA_OP_INSERT, (uint32_t)(position - literal_start), 0,
+                       new_data + literal_start);
+        }
+        delta_emit(&output, DELTA_OP_COPY, (uint32_t)match_length, (uint32_t)match_offset, NULL);
+        
+        position += match_length;
+        literal_start = position;
+        if (position + DELTA_BLOCK_SIZE <= target_size) {
+            hash = delta_hash(new_data + position);
+        }
+    }
+    
+    if (target_size > literal_start) {
+        delta_emit(&output, DELTA_OP_INSERT, (uint32_t)(target_size - literal_start), 0,
+                   new_data + literal_start);
+    }
+    
+    free(table);
+    
+    if (output.failed) {
+        free(output.data);
+        return -1;
+    }
+    
+    *delta = output.data;
+    *delta_size = output.length;
+    return 0;
+}
+
+int delta_apply(const void* base, size_t base_size, const void* delta, size_t delta_size,
+                void* target, size_t target_size) {
+    if ((!base && base_size > 0) || (!delta && delta_size > 0) || (!target && target_size > 0)) {
+        return -1;
+    }
+    
+    const unsigned char* input = delta;
+    unsigned char* output = target;
+    size_t read = 0;
+    size_t written = 0;
+    
+    while (read < delta_size) {
+        if (delta_size - read < 5) {
+            return -1;
+        }
+        
+        uint8_t op = input[read];
+        size_t length = delta_get_u32(input + read + 1);
+        read += 5;
+        
+        if (length > target_size - written) {
+            return -1;
+        }
+        
+        if (op == DELTA_OP_COPY) {
+            if (delta_size - read < 4) {
+                return -1;
+            }
+            size_t offset = delta_get_u32(input + read);
+            read += 4;
+            
+            if (offset > base_size || length > base_size - offset) {
+                return -1;
+            }
+            memcpy(output + written, (const unsigned char*)base + offset, length);
+        } else if (op == DELTA_OP_INSERT) {
+            if (length > delta_size - read) {
+                return -1;
+            }
+            memcpy(output + written, input + read, length);
+            read += length;
+        } else {
+            return -1;
+        }
+        
+        written += length;
+    }
+    
+    return written == target_size ? 0 : -1;
+}
@@ -0,0 +1,43 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 差量补丁：用旧版本的数据加一串操作重建新版本
+// 操作格式（整数为小端）:
+//   DELTA_OP_COPY:   [op(1)] [长度(uint32)] [旧数据中的偏移(uint32)]
+//   DELTA_OP_INSERT: [op(1)] [长度(uint32)] [数据]
+#define DELTA_OP_COPY 1
+#define DELTA_OP_INSERT 2
+
+// 匹配块大小：旧数据按该大小分块建立滚动哈希索引，短于该长度的相同内容不复用
+#define DELTA_BLOCK_SIZE 32
+
+/**
+ * 生成从base到target的差量补丁
+ * @param base 旧数据
+ * @param base_size 旧数据长度
+ * @param target 新数据
+ * @param target_size 新数据长度
+ * @param delta 补丁缓冲区指针（由函数分配，调用者释放）
+ * @param delta_size 补丁长度
+ * @return 0表示成功，-1表示失败
+ */
+int delta_create(const void* base, size_t base_size, const void* target, size_t target_size,
+                 unsigned char** delta, size_t* delta_size);
+
+/**
+ * 把补丁应用到旧数据上
+ * @param base 旧数据
+ * @param base_size 旧数据长度
+ * @param delta 补丁
+ * @param delta_size 补丁长度
+ * @param target 输出缓冲区
+ * @param target_size 新数据长度（补丁的输出必须恰好填满）
+ * @return 0表示成功，-1表示补丁无效或与旧数据不符
+ */
+int delta_apply(const void* base, size_t base_size, const void* delta, size_t delta_size,
+                void* target, size_t target_size);
+
+#endif // DELTA_H
@@ -0,0 +1,887 @@
+#include "mux.h"
+#include "base64.h"
+#include "compress.h"
+#include "stream.h"
+#include "utils.h"
+#include "wire.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// 排队的待发送消息
+struct mux_item {
+    struct mux_item* next;
+    mux_class_t class_id;
+    uint16_t type;
+    uint8_t version;              // 线格式版本（排队时按对端能力确定）
+    uint32_t stream_id;           // 分片交错时分配的逻辑流ID
+    uint32_t total_length;        // 消息体总长度
+    uint32_t offset;              // 已发送的消息体长度
+    
+    // 数据来源：内存缓冲区、调用者持有的共享缓冲区，或者 [prefix] + [Base64(文件)]
+    unsigned char* buffer;
+    const unsigned char* shared;  // 不复制也不释放，调用者保证在完成回调前有效
+    uint32_t checksum;            // 共享缓冲区预先计算的校验和
+    int has_checksum;
+    const mux_frame_file_t* frame_file;  // 帧文件（不接管）
+    size_t prefix_length;
+    size_t copied_length;         // 复制进buffer的字节数（计入调度器的queued_bytes）
+    FILE* file;
+    size_t file_size;
+    size_t file_offset;
+    
+    mux_complete_fn on_complete;
+    void* context;
+    int waited;                   // 有调用者在等待完成
+    int done;
+    int result;
+};
+
+static const int mux_weights[MUX_CLASS_COUNT] = {
+    MUX_WEIGHT_CONTROL, MUX_WEIGHT_DATA, MUX_WEIGHT_BULK
+};
+
+// 根据消息类型和大小确定发送类别
+static mux_class_t mux_class_for(uint16_t type, size_t length) {
+    switch (type) {
+        case MSG_FILE_UPLOAD:
+        case MSG_UPDATE_DATA:
+            return length > MUX_FRAGMENT_SIZE ? MUX_CLASS_BULK : MUX_CLASS_DATA;
+        case MSG_DATA_UPLOAD:
+        case MSG_DATA_QUERY_RESULT:
+        case MSG_UPDATE_DELTA:
+        case MSG_UPDATE_MANIFEST:
+            return MUX_CLASS_DATA;
+        default:
+            return MUX_CLASS_CONTROL;
+    }
+}
+
+// 写一个完整的帧（按对端能力压缩），checksum非NULL时为不压缩发送的数据预先算好的校验和
+static int mux_write_frame(mux_sender_t* sender, uint8_t version, uint16_t type,
+                           const void* data, size_t length, const uint32_t* checksum) {
+    message_header_t header;
+    const void* payload = data;
+    size_t payload_length = length;
+    unsigned char* compressed = NULL;
+    
+    init_message_header(&header, type, 0);
+    header.version = version;
+    
+    // 按流处理的大帧不压缩
+    if ((sender->capabilities & CAP_COMPRESS_ZLIB) && length > 0 &&
+        !is_stream_frame(type, 0, (uint32_t)length)) {
+        size_t compressed_length = 0;
+        if (compress_frame(COMPRESS_CODEC_ZLIB, data, length, &compressed, &compressed_length) == 1) {
+            payload = compressed;
+            payload_length = compressed_length;
+            header.flags = FRAME_FLAGS_COMPRESSED(COMPRESS_CODEC_ZLIB);
+        }
+    }
+    
+    header.length = (uint32_t)payload_length;
+    if (checksum && payload == data) {
+        header.checksum = *checksum;
+    } else {
+        header.checksum = payload_length > 0 ? calculate_checksum(payload, payload_length) : 0;
+    }
+    wire_encode_header(&header);
+    
+    int result = 0;
+    if (send_all(sender->socket_fd, &header, sizeof(header)) != 0 ||
+        (payload_length > 0 && send_all(sender->socket_fd, payload, payload_length) != 0)) {
+        result = -1;
+    }
+    
+    free(compressed);
+    return result;
+}
+
+// 从消息体的当前位置读取最多capacity字节（Base64编码按3字节对齐分块）
+static size_t mux_item_read(mux_item_t* item, char* output, size_t capacity) {
+    size_t produced = 0;
+    
+    if (!item->file) {
+        const unsigned char* source = item->shared ? item->shared : item->buffer;
+        size_t available = item->total_length - item->offset;
+        produced = available < capacity ? available : capacity;
+        memcpy(output, source + item->offset, produced);
+        return produced;
+    }
+    
+    // 先输出前缀
+    if (item->offset < item->prefix_length) {
+        size_t available = item->prefix_length - item->offset;
+        produced = available < capacity ? available : capacity;
+        memcpy(output, item->buffer + item->offset, produced);
+    }
+    
+    // 再输出文件内容的Base64编码
+    size_t space = capacity - produced;
+    size_t raw_length = (space / 4) * 3;
+    size_t file_remaining = item->file_size - item->file_offset;
+    if (raw_length > file_remaining) {
+        raw_length = file_remaining;
+    }
+    
+    if (raw_length > 0) {
+        unsigned char* raw = malloc(raw_length);
+        if (!raw) {
+            return 0;
+        }
+        
+        if (fseek(item->file, (long)item->file_offset, SEEK_SET) != 0 ||
+            fread(raw, 1, raw_length, item->file) != raw_length) {
+            free(raw);
+            return 0;
+        }
+        
+        // base64_encode要求为结尾的'\0'预留空间，输出缓冲区已多分配1字节
+        int encoded = base64_encode(raw, raw_length, output + produced,
+                                    base64_encoded_length(raw_length) + 1);
+        free(raw);
+        if (encoded < 0) {
+            return 0;
+        }
+        
+        item->file_offset += raw_length;
+        produced += encoded;
+    }
+    
+    return produced;
+}
+
+// 填写MSG_STREAM_DATA的分片头
+static void mux_fragment_header(char* buffer, uint8_t version, uint32_t stream_id, uint16_t type,
+                                uint8_t stream_flags, uint32_t total_length) {
+    memset(buffer, 0, WIRE_SIZE(version, stream_data_msg));
+    WIRE_PUT_U32(buffer, version, stream_data_msg, stream_id, stream_id);
+    WIRE_PUT_U16(buffer, version, stream_data_msg, inner_type, type);
+    WIRE_PUT_U8(buffer, version, stream_data_msg, stream_flags, stream_flags);
+    WIRE_PUT_U32(buffer, version, stream_data_msg, total_length, total_length);
+}
+
+// 发送一个分片，返回1表示消息已发送完，0表示还有剩余，-1表示失败
+static int mux_send_fragment(mux_sender_t* sender, mux_item_t* item) {
+    size_t header_length = WIRE_SIZE(item->version, stream_data_msg);
+    char* buffer = malloc(header_length + MUX_FRAGMENT_SIZE + 1);
+    if (!buffer) {
+        return -1;
+    }
+    
+    uint8_t stream_flags = item->offset == 0 ? STREAM_FLAG_BEGIN : 0;
+    
+    size_t fragment = mux_item_read(item, buffer + header_length, MUX_FRAGMENT_SIZE);
+    if (fragment == 0 && item->offset < item->total_length) {
+        free(buffer);
+        return -1;
+    }
+    
+    item->offset += (uint32_t)fragment;
+    if (item->offset >= item->total_length) {
+        stream_flags |= STREAM_FLAG_END;
+    }
+    
+    mux_fragment_header(buffer, item->version, item->stream_id, item->type, stream_flags, item->total_length);
+    
+    int result = mux_write_frame(sender, item->version, MSG_STREAM_DATA, buffer, header_length + fragment, NULL);
+    free(buffer);
+    
+    if (result != 0) {
+        return -1;
+    }
+    
+    return (stream_flags & STREAM_FLAG_END) ? 1 : 0;
+}
+
+// 读一遍延迟计算的帧文件中的消息体，算出整帧发送时的校验和
+static int mux_frame_file_checksum(const mux_frame_file_t* frame, uint32_t* checksum) {
+    char* buffer = malloc(MUX_FRAGMENT_SIZE);
+    if (!buffer) {
+        return -1;
+    }
+    
+    *checksum = 0;
+    for (uint32_t position = 0; position < frame->length; position += MUX_FRAGMENT_SIZE) {
+        uint32_t fragment = frame->length - position < MUX_FRAGMENT_SIZE ? frame->length - position : MUX_FRAGMENT_SIZE;
+        if (pread(frame->fd, buffer, fragment, frame->offset + position) != (ssize_t)fragment) {
+            free(buffer);
+            return -1;
+        }
+        *checksum = checksum_update(*checksum, buffer, fragment);
+    }
+    
+    free(buffer);
+    return 0;
+}
+
+// 发送延迟计算的帧文件的一个分片：读出分片算好校验和，随分片头一起从用户态发送
+static int mux_frame_file_send_deferred(mux_sender_t* sender, mux_item_t* item, uint32_t fragment,
+                                        uint8_t stream_flags) {
+    const mux_frame_file_t* frame = item->frame_file;
+    size_t headers_length = sizeof(message_header_t) + WIRE_SIZE(item->version, stream_data_msg);
+    char* buffer = malloc(headers_length + fragment);
+    if (!buffer) {
+        return -1;
+    }
+    
+    char* fragment_header = buffer + sizeof(message_header_t);
+    char* data = buffer + headers_length;
+    if (pread(frame->fd, data, fragment, frame->offset + item->offset) != (ssize_t)fragment) {
+        free(buffer);
+        return -1;
+    }
+    
+    mux_fragment_header(fragment_header, item->version, MUX_SHARED_STREAM_ID, frame->type,
+                        stream_flags, frame->length);
+    
+    message_header_t header;
+    size_t body_length = headers_length - sizeof(message_header_t) + fragment;
+    init_message_header(&header, MSG_STREAM_DATA, (uint32_t)body_length);
+    header.version = item->version;
+    header.checksum = calculate_checksum(fragment_header, body_length);
+    wire_encode_header(&header);
+    memcpy(buffer, &header, sizeof(header));
+    
+    int result = send_all(sender->socket_fd, buffer, headers_length + fragment);
+    free(buffer);
+    return result;
+}
+
+// 发送帧文件的下一部分：帧头和分片头在用户态拼出，消息体由内核从文件发送
+static int mux_frame_file_step(mux_sender_t* sender, mux_item_t* item, uint32_t capabilities) {
+    const mux_frame_file_t* frame = item->frame_file;
+    char headers[sizeof(message_header_t) + sizeof(stream_data_msg_v2_t)];
+    message_header_t header;
+    
+    // 对端不支持分片交错（或保留的流ID被占用）时整帧一次发完
+    if (item->stream_id != MUX_SHARED_STREAM_ID || !(capabilities & CAP_MULTIPLEX)) {
+        init_message_header(&header, frame->type, frame->length);
+        header.version = item->version;
+        uint32_t checksum = frame->checksum;
+        if (frame->deferred && mux_frame_file_checksum(frame, &checksum) != 0) {
+            return -1;
+        }
+        header.checksum = checksum;
+        wire_encode_header(&header);
+        
+        if (send_all(sender->socket_fd, &header, sizeof(header)) != 0 ||
+            stream_sendfile(sender->socket_fd, frame->fd, frame->offset, frame->length) != 0) {
+            return -1;
+        }
+        return 1;
+    }
+    
+    uint32_t index = item->offset / MUX_FRAGMENT_SIZE;
+    uint32_t remaining = frame->length - item->offset;
+    uint32_t fragment = remaining < MUX_FRAGMENT_SIZE ? remaining : MUX_FRAGMENT_SIZE;
+    uint8_t stream_flags = (index == 0 ? STREAM_FLAG_BEGIN : 0) | (fragment == remaining ? STREAM_FLAG_END : 0);
+    size_t fragment_header_length = WIRE_SIZE(item->version, stream_data_msg);
+    
+    if (frame->deferred) {
+        if (mux_frame_file_send_deferred(sender, item, fragment, stream_flags) != 0) {
+            return -1;
+        }
+        item->offset += fragment;
+        return (stream_flags & STREAM_FLAG_END) ? 1 : 0;
+    }
+    
+    init_message_header(&header, MSG_STREAM_DATA, (uint32_t)(fragment_header_length + fragment));
+    header.version = item->version;
+    header.checksum = frame->fragment_checksums[item->version >= WIRE_V2][index];
+    wire_encode_header(&header);
+    
+    memcpy(headers, &header, sizeof(header));
+    mux_fragment_header(headers + sizeof(header), item->version, MUX_SHARED_STREAM_ID, frame->type,
+                        stream_flags, frame->length);
+    
+    if (send_all(sender->socket_fd, headers, sizeof(header) + fragment_header_length) != 0 ||
+        stream_sendfile(sender->socket_fd, frame->fd, frame->offset + item->offset, fragment) != 0) {
+        return -1;
+    }
+    
+    item->offset += fragment;
+    return (stream_flags & STREAM_FLAG_END) ? 1 : 0;
+}
+
+// 发送消息的下一部分，返回1表示消息已发送完，0表示还有剩余，-1表示失败
+static int mux_item_step(mux_sender_t* sender, mux_item_t* item, uint32_t capabilities) {
+    if (item->frame_file) {
+        return mux_frame_file_step(sender, item, capabilities);
+    }
+    
+    // 对端支持分片交错时，大块传输每次只发送一个分片
+    if (item->class_id == MUX_CLASS_BULK && (capabilities & CAP_MULTIPLEX)) {
+        return mux_send_fragment(sender, item);
+    }
+    
+    // 否则整条消息一次发完
+    if (item->file) {
+        return stream_send_file_base64(sender->socket_fd, item->version, item->type, item->buffer,
+                                       item->prefix_length, item->file, item->file_size) == 0 ? 1 : -1;
+    }
+    
+    if (item->shared) {
+        return mux_write_frame(sender, item->version, item->type, item->shared, item->total_length,
+                               item->has_checksum ? &item->checksum : NULL) == 0 ? 1 : -1;
+    }
+    
+    return mux_write_frame(sender, item->version, item->type, item->buffer,
+                           item->total_length, NULL) == 0 ? 1 : -1;
+}
+
+// 释放未入队的消息
+static void mux_item_free(mux_item_t* item) {
+    if (item->file) {
+        fclose(item->file);
+    }
+    free(item->buffer);
+    free(item);
+}
+
+// 完成一条消息（调用时持有sender->mutex）
+static void mux_item_complete(mux_sender_t* sender, mux_item_t* item, int result) {
+    if (item->frame_file && item->stream_id == MUX_SHARED_STREAM_ID) {
+        sender->shared_stream_busy = 0;
+    }
+    
+    if (item->file) {
+        fclose(item->file);
+        item->file = NULL;
+    }
+    
+    free(item->buffer);
+    item->buffer = NULL;
+    
+    // 唤醒等待队列数据减少的生产者
+    if (item->copied_length > 0) {
+        sender->queued_bytes -= item->copied_length;
+        pthread_cond_broadcast(&sender->done_cond);
+    }
+    
+    if (item->on_complete) {
+        item->on_complete(item->context, result);
+    }
+    
+    if (item->waited) {
+        // 由等待者释放
+        item->result = result;
+        item->done = 1;
+        pthread_cond_broadcast(&sender->done_cond);
+    } else {
+        free(item);
+    }
+}
+
+// 从队列头部移除消息（调用时持有sender->mutex）
+static mux_item_t* mux_queue_pop(mux_sender_t* sender, mux_class_t class_id) {
+    mux_item_t* item = sender->head[class_id];
+    if (item) {
+        sender->head[class_id] = item->next;
+        if (!sender->head[class_id]) {
+            sender->tail[class_id] = NULL;
+        }
+        item->next = NULL;
+    }
+    return item;
+}
+
+// 追加到队列尾部（调用时持有sender->mutex）
+static void mux_queue_push(mux_sender_t* sender, mux_item_t* item) {
+    item->next = NULL;
+    if (sender->tail[item->class_id]) {
+        sender->tail[item->class_id]->next = item;
+    } else {
+        sender->head[item->class_id] = item;
+    }
+    sender->tail[item->class_id] = item;
+}
+
+// 按加权轮询选出下一个要发送的类别（调用时持有sender->mutex）
+static int mux_pick_class(mux_sender_t* sender) {
+    for (int pass = 0; pass < 2; pass++) {
+        for (int c = 0; c < MUX_CLASS_COUNT; c++) {
+            if (sender->head[c] && sender->credits[c] > 0) {
+                sender->credits[c]--;
+                return c;
+            }
+        }
+        
+        // 所有非空类别的配额都已用完，开始新的一轮
+        for (int c = 0; c < MUX_CLASS_COUNT; c++) {
+            sender->credits[c] = mux_weights[c];
+        }
+    }
+    
+    return -1;
+}
+
+// 发送线程
+static void* mux_sender_thread(void* arg) {
+    mux_sender_t* sender = (mux_sender_t*)arg;
+    
+    pthread_mutex_lock(&sender->mutex);
+    
+    while (1) {
+        // 停止时丢弃未完成的大块传输，只发送剩余的控制/数据消息
+        if (sender->stopping || sender->failed) {
+            mux_item_t* item;
+            while ((item = mux_queue_pop(sender, MUX_CLASS_BULK)) != NULL) {
+                mux_item_complete(sender, item, -1);
+            }
+        }
+        
+        int class_id = mux_pick_class(sender);
+        if (class_id < 0) {
+            if (sender->stopping) {
+                break;
+            }
+            pthread_cond_wait(&sender->cond, &sender->mutex);
+            continue;
+        }
+        
+        mux_item_t* item = mux_queue_pop(sender, (mux_class_t)class_id);
+        
+        if (sender->failed) {
+            mux_item_complete(sender, item, -1);
+            continue;
+        }
+        
+        uint32_t capabilities = sender->capabilities;
+        pthread_mutex_unlock(&sender->mutex);
+        
+        int step = mux_item_step(sender, item, capabilities);
+        
+        pthread_mutex_lock(&sender->mutex);
+        
+        if (step >= 0 && item->type != MSG_HEARTBEAT) {
+            sender->last_activity = time(NULL);
+        }
+        
+        if (step < 0) {
+            // 发送失败：关闭连接让接收线程退出
+            sender->failed = 1;
+            shutdown(sender->socket_fd, SHUT_RDWR);
+            mux_item_complete(sender, item, -1);
+        } else if (step == 1) {
+            mux_item_complete(sender, item, 0);
+        } else {
+            // 大块传输轮到下一条流
+            mux_queue_push(sender, item);
+        }
+    }
+    
+    pthread_mutex_unlock(&sender->mutex);
+    return NULL;
+}
+
+int mux_sender_init(mux_sender_t* sender) {
+    if (!sender) {
+        return -1;
+    }
+    
+    memset(sender, 0, sizeof(*sender));
+    sender->socket_fd = -1;
+    sender->next_stream_id = 1;
+    
+    if (pthread_mutex_init(&sender->mutex, NULL) != 0) {
+        return -1;
+    }
+    
+    if (pthread_cond_init(&sender->cond, NULL) != 0) {
+        pthread_mutex_destroy(&sender->mutex);
+        return -1;
+    }
+    
+    if (pthread_cond_init(&sender->done_cond, NULL) != 0) {
+        pthread_cond_destroy(&sender->cond);
+        pthread_mutex_destroy(&sender->mutex);
+        return -1;
+    }
+    
+    return 0;
+}
+
+void mux_sender_destroy(mux_sender_t* sender) {
+    if (!sender) return;
+    
+    mux_sender_stop(sender);
+    
+    pthread_cond_destroy(&sender->done_cond);
+    pthread_cond_destroy(&sender->cond);
+    pthread_mutex_destroy(&sender->mutex);
+}
+
+int mux_sender_start(mux_sender_t* sender, int socket_fd) {
+    if (!sender) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&sender->mutex);
+    
+    if (sender->running) {
+        pthread_mutex_unlock(&sender->mutex);
+        return -1;
+    }
+    
+    sender->socket_fd = socket_fd;
+    sender->capabilities = 0;
+    sender->stopping = 0;
+    sender->failed = 0;
+    sender->queued_bytes = 0;
+    for (int c = 0; c < MUX_CLASS_COUNT; c++) {
+        sender->head[c] = NULL;
+        sender->tail[c] = NULL;
+        sender->credits[c] = mux_weights[c];
+    }
+    
+    if (pthread_create(&sender->thread, NULL, mux_sender_thread, sender) != 0) {
+        pthread_mutex_unlock(&sender->mutex);
+        return -1;
+    }
+    
+    sender->running = 1;
+    pthread_mutex_unlock(&sender->mutex);
+    return 0;
+}
+
+void mux_sender_stop(mux_sender_t* sender) {
+    if (!sender) return;
+    
+    pthread_mutex_lock(&sender->mutex);
+    
+    // 未运行或其他线程正在停止
+    if (!sender->running || sender->stopping) {
+        pthread_mutex_unlock(&sender->mutex);
+        return;
+    }
+    
+    sender->stopping = 1;
+    pthread_cond_signal(&sender->cond);
+    pthread_mutex_unlock(&sender->mutex);
+    
+    pthread_join(sender->thread, NULL);
+    
+    // 等待所有等待者取回结果
+    pthread_mutex_lock(&sender->mutex);
+    while (sender->waiters > 0) {
+        pthread_cond_wait(&sender->done_cond, &sender->mutex);
+    }
+    sender->running = 0;
+    sender->stopping = 0;
+    pthread_mutex_unlock(&sender->mutex);
+}
+
+void mux_sender_set_capabilities(mux_sender_t* sender, uint32_t capabilities) {
+    if (!sender) return;
+    
+    pthread_mutex_lock(&sender->mutex);
+    sender->capabilities = capabilities;
+    pthread_mutex_unlock(&sender->mutex);
+}
+
+time_t mux_sender_last_activity(mux_sender_t* sender) {
+    if (!sender) return 0;
+    
+    pthread_mutex_lock(&sender->mutex);
+    time_t last_activity = sender->last_activity;
+    pthread_mutex_unlock(&sender->mutex);
+    
+    return last_activity;
+}
+
+int mux_sender_idle(mux_sender_t* sender) {
+    if (!sender) return 1;
+    
+    pthread_mutex_lock(&sender->mutex);
+    int idle = sender->waiters == 0;
+    for (int c = 0; c < MUX_CLASS_COUNT; c++) {
+        if (sender->head[c]) {
+            idle = 0;
+        }
+    }
+    pthread_mutex_unlock(&sender->mutex);
+    
+    return idle;
+}
+
+int mux_sender_wait_queued(mux_sender_t* sender, size_t max_bytes) {
+    if (!sender) return -1;
+    
+    pthread_mutex_lock(&sender->mutex);
+    while (sender->queued_bytes > max_bytes && sender->running && !sender->stopping && !sender->failed) {
+        pthread_cond_wait(&sender->done_cond, &sender->mutex);
+    }
+    int result = sender->running && !sender->stopping && !sender->failed ? 0 : -1;
+    pthread_mutex_unlock(&sender->mutex);
+    
+    return result;
+}
+
+// 排队并按需等待完成
+static int mux_enqueue(mux_sender_t* sender, mux_item_t* item, int wait) {
+    pthread_mutex_lock(&sender->mutex);
+    
+    if (!sender->running || sender->stopping || sender->failed) {
+        pthread_mutex_unlock(&sender->mutex);
+        mux_item_free(item);
+        return -1;
+    }
+    
+    if (item->frame_file) {
+        // 帧文件的分片校验和按保留的流ID预先算好，被占用时该消息整帧发送
+        if (item->class_id == MUX_CLASS_BULK && !sender->shared_stream_busy) {
+            item->stream_id = MUX_SHARED_STREAM_ID;
+            sender->shared_stream_busy = 1;
+        }
+    } else if (item->class_id == MUX_CLASS_BULK) {
+        item->stream_id = sender->next_stream_id++;
+        if (sender->next_stream_id == MUX_SHARED_STREAM_ID) {
+            sender->next_stream_id = 1;
+        }
+    }
+    item->version = WIRE_VERSION_FOR(sender->capabilities);
+    item->waited = wait;
+    sender->queued_bytes += item->copied_length;
+    mux_queue_push(sender, item);
+    pthread_cond_signal(&sender->cond);
+    
+    int result = 0;
+    if (wait) {
+        sender->waiters++;
+        while (!item->done) {
+            pthread_cond_wait(&sender->done_cond, &sender->mutex);
+        }
+        result = item->result;
+        free(item);
+        
+        // 通知可能在等待的停止操作
+        if (--sender->waiters == 0) {
+            pthread_cond_broadcast(&sender->done_cond);
+        }
+    }
+    
+    pthread_mutex_unlock(&sender->mutex);
+    return result;
+}
+
+int mux_send_message(mux_sender_t* sender, uint16_t type, const void* data, size_t length, int wait) {
+    if (!sender || (length > 0 && !data) || length > UINT32_MAX) {
+        return -1;
+    }
+    
+    mux_item_t* item = calloc(1, sizeof(mux_item_t));
+    if (!item) {
+        return -1;
+    }
+    
+    if (length > 0) {
+        item->buffer = malloc(length);
+        if (!item->buffer) {
+            free(item);
+            return -1;
+        }
+        memcpy(item->buffer, data, length);
+    }
+    
+    item->type = type;
+    item->class_id = mux_class_for(type, length);
+    item->total_length = (uint32_t)length;
+    item->copied_length = length;
+    
+    return mux_enqueue(sender, item, wait);
+}
+
+int mux_send_shared(mux_sender_t* sender, uint16_t type, const void* data, size_t length,
+                    const uint32_t* checksum, mux_complete_fn on_complete, void* context) {
+    if (!sender || !data || length == 0 || length > UINT32_MAX) {
+        return -1;
+    }
+    
+    mux_item_t* item = calloc(1, sizeof(mux_item_t));
+    if (!item) {
+        return -1;
+    }
+    
+    item->type = type;
+    item->class_id = mux_class_for(type, length);
+    item->total_length = (uint32_t)length;
+    item->shared = data;
+    if (checksum) {
+        item->checksum = *checksum;
+        item->has_checksum = 1;
+    }
+    item->on_complete = on_complete;
+    item->context = context;
+    
+    return mux_enqueue(sender, item, 0);
+}
+
+int mux_frame_file_init(mux_frame_file_t* frame, int fd, off_t offset, uint32_t length, uint16_t type) {
+    if (!frame || fd < 0 || length == 0) {
+        return -1;
+    }
+    
+    memset(frame, 0, sizeof(*frame));
+    frame->fd = fd;
+    frame->offset = offset;
+    frame->length = length;
+    frame->type = type;
+    frame->fragment_count = (length + MUX_FRAGMENT_SIZE - 1) / MUX_FRAGMENT_SIZE;
+    
+    char* buffer = malloc(MUX_FRAGMENT_SIZE);
+    frame->fragment_checksums[0] = malloc(frame->fragment_count * sizeof(uint32_t));
+    frame->fragment_checksums[1] = malloc(frame->fragment_count * sizeof(uint32_t));
+    if (!buffer || !frame->fragment_checksums[0] || !frame->fragment_checksums[1]) {
+        free(buffer);
+        mux_frame_file_destroy(frame);
+        return -1;
+    }
+    
+    char fragment_header[sizeof(stream_data_msg_v2_t)];
+    
+    for (uint32_t index = 0; index < frame->fragment_count; index++) {
+        uint32_t position = index * MUX_FRAGMENT_SIZE;
+        uint32_t fragment = length - position < MUX_FRAGMENT_SIZE ? length - position : MUX_FRAGMENT_SIZE;
+        
+        if (pread(fd, buffer, fragment, offset + position) != (ssize_t)fragment) {
+            free(buffer);
+            mux_frame_file_destroy(frame);
+            return -1;
+        }
+        
+        frame->checksum = checksum_update(frame->checksum, buffer, fragment);
+        
+        uint8_t stream_flags = (index == 0 ? STREAM_FLAG_BEGIN : 0) |
+                               (index + 1 == frame->fragment_count ? STREAM_FLAG_END : 0);
+        for (uint8_t version = WIRE_V1; version <= WIRE_V2; version++) {
+            size_t header_length = WIRE_SIZE(version, stream_data_msg);
+            mux_fragment_header(fragment_header, version, MUX_SHARED_STREAM_ID, type, stream_flags, length);
+            uint32_t checksum = checksum_update(0, fragment_header, header_length);
+            frame->fragment_checksums[version >= WIRE_V2][index] = checksum_update(checksum, buffer, fragment);
+        }
+    }
+    
+    free(buffer);
+    return 0;
+}
+
+int mux_frame_file_init_deferred(mux_frame_file_t* frame, int fd, off_t offset, uint32_t length, uint16_t type) {
+    if (!frame || fd < 0 || length == 0) {
+        return -1;
+    }
+    
+    memset(frame, 0, sizeof(*frame));
+    frame->fd = fd;
+    frame->offset = offset;
+    frame->length = length;
+    frame->type = type;
+    frame->fragment_count = (length + MUX_FRAGMENT_SIZE - 1) / MUX_FRAGMENT_SIZE;
+    frame->deferred = 1;
+    return 0;
+}
+
+void mux_frame_file_destroy(mux_frame_file_t* frame) {
+    if (!frame) return;
+    
+    free(frame->fragment_checksums[0]);
+    free(frame->fragment_checksums[1]);
+    frame->fragment_checksums[0] = NULL;
+    frame->fragment_checksums[1] = NULL;
+}
+
+int mux_send_frame_file(mux_sender_t* sender, const mux_frame_file_t* frame,
+                        mux_complete_fn on_complete, void* context) {
+    if (!sender || !frame || frame->length == 0) {
+        return -1;
+    }
+    
+    mux_item_t* item = calloc(1, sizeof(mux_item_t));
+    if (!item) {
+        return -1;
+    }
+    
+    item->type = frame->type;
+    item->class_id = mux_class_for(frame->type, frame->length);
+    item->total_length = frame->length;
+    item->frame_file = frame;
+    item->on_complete = on_complete;
+    item->context = context;
+    
+    return mux_enqueue(sender, item, 0);
+}
+
+int mux_send_file_base64(mux_sender_t* sender, uint16_t type, const void* prefix, size_t prefix_length,
+                         FILE* file, size_t file_size, mux_complete_fn on_complete, void* context,
+                         int wait) {
+    if (!sender || !file || (prefix_length > 0 && !prefix)) {
+        if (file) fclose(file);
+        return -1;
+    }
+    
+    size_t total_length = prefix_length + base64_encoded_length(file_size);
+    mux_item_t* item = calloc(1, sizeof(mux_item_t));
+    if (!item || total_length > UINT32_MAX) {
+        free(item);
+        fclose(file);
+        return -1;
+    }
+    
+    if (prefix_length > 0) {
+        item->buffer = malloc(prefix_length);
+        if (!item->buffer) {
+            free(item);
+            fclose(file);
+            return -1;
+        }
+        memcpy(item->buffer, prefix, prefix_length);
+        item->copied_length = prefix_length;
+    }
+    
+    item->type = type;
+    item->class_id = mux_class_for(type, total_length);
+    item->total_length = (uint32_t)total_length;
+    item->prefix_length = prefix_length;
+    item->file = file;
+    item->file_size = file_size;
+    item->on_complete = on_complete;
+    item->context = context;
+    
+    return mux_enqueue(sender, item, wait);
+}
+
+mux_stream_t* mux_stream_find(mux_stream_t* streams, uint32_t stream_id) {
+    if (!streams || stream_id == 0) return NULL;
+    
+    for (int i = 0; i < MUX_MAX_STREAMS; i++) {
+        if (streams[i].stream_id == stream_id) {
+            return &streams[i];
+        }
+    }
+    
+    return NULL;
+}
+
+mux_stream_t* mux_stream_open(mux_stream_t* streams, uint32_t stream_id, uint16_t type,
+                              uint32_t total_length) {
+    if (!streams || stream_id == 0) return NULL;
+    
+    for (int i = 0; i < MUX_MAX_STREAMS; i++) {
+        if (streams[i].stream_id == 0) {
+            memset(&streams[i], 0, sizeof(streams[i]));
+            streams[i].stream_id = stream_id;
+            streams[i].type = type;
+            streams[i].total_length = total_length;
+            return &streams[i];
+        }
+    }
+    
+    return NULL;
+}
+
+void mux_stream_close(mux_stream_t* stream) {
+    if (!stream) return;
+    
+    memset(stream, 0, sizeof(*stream));
+}
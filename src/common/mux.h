@@ -0,0 +1,246 @@
+#ifndef MUX_H
+#define MUX_H
+
+#include "protocol.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+// 分片交错时每个MSG_STREAM_DATA帧承载的最大数据量
+#define MUX_FRAGMENT_SIZE (64 * 1024)
+
+// 每个接收方同时打开的逻辑流数量上限
+#define MUX_MAX_STREAMS 8
+
+// 帧文件分片发送时使用的保留逻辑流ID（普通消息不分配该ID，同一连接同时只有一条帧文件消息使用）
+#define MUX_SHARED_STREAM_ID 0xFFFFFFFFu
+
+// 发送优先级类别
+typedef enum {
+    MUX_CLASS_CONTROL = 0,    // 控制消息（心跳、版本检查、响应）
+    MUX_CLASS_DATA,           // 小数据上传
+    MUX_CLASS_BULK,           // 大文件上传、更新数据
+    MUX_CLASS_COUNT
+} mux_class_t;
+
+// 加权轮询的权重（每轮各类别最多发送的帧数）
+#define MUX_WEIGHT_CONTROL 8
+#define MUX_WEIGHT_DATA 4
+#define MUX_WEIGHT_BULK 1
+
+/**
+ * 发送完成回调
+ * @param context 回调上下文
+ * @param result 0表示发送成功，-1表示失败或被丢弃
+ */
+typedef void (*mux_complete_fn)(void* context, int result);
+
+typedef struct mux_item mux_item_t;
+
+// 帧文件：消息体预先写入文件，发送时由内核从文件直接写入socket，不经过用户态缓冲区。
+// 消息体不压缩；按MUX_SHARED_STREAM_ID分片发送时各帧的校验和也预先算好。
+// 延迟计算的帧文件（只发送一次的一段）不预先读取，发送线程在发送前逐个分片读出并计算校验和
+typedef struct {
+    int fd;
+    off_t offset;                     // 消息体在文件中的偏移
+    uint32_t length;                  // 消息体长度
+    uint16_t type;                    // 消息类型
+    uint32_t checksum;                // 整帧发送时的帧校验和
+    uint32_t fragment_count;
+    uint32_t* fragment_checksums[2];  // 分片发送时每个MSG_STREAM_DATA帧的校验和（v1、v2）
+    int deferred;                     // 校验和在发送时计算（checksum和fragment_checksums无效）
+} mux_frame_file_t;
+
+// 发送调度器（每个连接一个发送线程，所有写socket的操作都在该线程中完成）
+typedef struct {
+    int socket_fd;
+    uint32_t capabilities;        // 对端能力位（决定是否压缩、是否分片交错）
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;          // 有新消息或停止请求
+    pthread_cond_t done_cond;     // 有消息发送完成
+    mux_item_t* head[MUX_CLASS_COUNT];
+    mux_item_t* tail[MUX_CLASS_COUNT];
+    int credits[MUX_CLASS_COUNT]; // 本轮剩余的发送配额
+    uint32_t next_stream_id;
+    int shared_stream_busy;       // MUX_SHARED_STREAM_ID正在使用
+    int running;                  // 发送线程正在运行
+    int stopping;
+    int failed;
+    int waiters;                  // 正在等待消息完成的调用者数
+    size_t queued_bytes;          // 排队消息复制进来、尚未发送完的字节数
+    time_t last_activity;         // 最近一次写出非心跳帧的时间
+    pthread_t thread;
+} mux_sender_t;
+
+// 接收端的逻辑流重组状态
+typedef struct {
+    uint32_t stream_id;           // 0表示空闲
+    uint16_t type;                // 承载的消息类型
+    uint32_t total_length;        // 承载消息的总长度
+    uint32_t received;            // 已接收的长度
+    void* context;                // 接收端处理上下文
+} mux_stream_t;
+
+/**
+ * 初始化发送调度器（同一调度器可以多次启动/停止）
+ * @param sender 调度器
+ * @return 0表示成功，-1表示失败
+ */
+int mux_sender_init(mux_sender_t* sender);
+
+/**
+ * 销毁发送调度器（会先停止发送线程）
+ * @param sender 调度器
+ */
+void mux_sender_destroy(mux_sender_t* sender);
+
+/**
+ * 启动发送线程
+ * @param sender 调度器
+ * @param socket_fd 连接的套接字
+ * @return 0表示成功，-1表示失败
+ */
+int mux_sender_start(mux_sender_t* sender, int socket_fd);
+
+/**
+ * 停止发送线程：发送完排队的控制/数据消息，丢弃未完成的大块传输，等待线程退出
+ * 发送线程可能阻塞在写socket上，需要立即停止时先shutdown套接字
+ * @param sender 调度器
+ */
+void mux_sender_stop(mux_sender_t* sender);
+
+/**
+ * 更新对端能力位（版本协商完成后调用）
+ * @param sender 调度器
+ * @param capabilities 能力位
+ */
+void mux_sender_set_capabilities(mux_sender_t* sender, uint32_t capabilities);
+
+/**
+ * 获取最近一次写出非心跳帧的时间（用于判断是否需要发送显式心跳）
+ * @param sender 调度器
+ * @return 时间戳，从未发送过返回0
+ */
+time_t mux_sender_last_activity(mux_sender_t* sender);
+
+/**
+ * 判断调度器是否空闲（没有排队的消息，也没有调用者在等待消息发送完成）
+ * @param sender 调度器
+ * @return 空闲返回1，否则返回0
+ */
+int mux_sender_idle(mux_sender_t* sender);
+
+/**
+ * 等待排队消息复制的数据降到max_bytes以下（生产者按对端的接收速度限流，不让队列无限增长）
+ * @param sender 调度器
+ * @param max_bytes 允许继续排队的上限
+ * @return 0表示可以继续排队，-1表示调度器已停止或发送失败
+ */
+int mux_sender_wait_queued(mux_sender_t* sender, size_t max_bytes);
+
+/**
+ * 发送消息（复制数据后排队）
+ * 消息体需按 WIRE_VERSION_FOR(当前能力位) 编码，帧格式版本在排队时确定
+ * @param sender 调度器
+ * @param type 消息类型
+ * @param data 消息数据
+ * @param length 数据长度
+ * @param wait 非0时等待消息写入socket后返回
+ * @return 0表示成功（或已排队），-1表示失败
+ */
+int mux_send_message(mux_sender_t* sender, uint16_t type, const void* data, size_t length, int wait);
+
+/**
+ * 发送调用者持有的共享消息体（不复制），多个连接可以同时发送同一份数据
+ * 数据须保持有效且不被修改，直到完成回调被调用
+ * @param sender 调度器
+ * @param type 消息类型
+ * @param data 消息数据
+ * @param length 数据长度
+ * @param checksum 数据的校验和（帧不压缩时直接使用，不再重新计算），NULL表示发送时再计算
+ * @param on_complete 完成回调（可以为NULL）
+ * @param context 回调上下文
+ * @return 0表示已排队，-1表示失败（排队失败时不调用完成回调）
+ */
+int mux_send_shared(mux_sender_t* sender, uint16_t type, const void* data, size_t length,
+                    const uint32_t* checksum, mux_complete_fn on_complete, void* context);
+
+/**
+ * 读一遍帧文件中的消息体，计算整帧和各分片的校验和
+ * @param frame 帧文件（不接管fd）
+ * @param fd 已打开的文件
+ * @param offset 消息体在文件中的偏移
+ * @param length 消息体长度
+ * @param type 消息类型
+ * @return 0表示成功，-1表示失败
+ */
+int mux_frame_file_init(mux_frame_file_t* frame, int fd, off_t offset, uint32_t length, uint16_t type);
+
+/**
+ * 引用文件中的一段消息体，不预先读取：校验和由发送线程在发送时计算。
+ * 用于续传等只发送一次的范围，请求线程不必先把整段读一遍
+ * @param frame 帧文件（不接管fd）
+ * @param fd 已打开的文件
+ * @param offset 消息体在文件中的偏移
+ * @param length 消息体长度
+ * @param type 消息类型
+ * @return 0表示成功，-1表示失败
+ */
+int mux_frame_file_init_deferred(mux_frame_file_t* frame, int fd, off_t offset, uint32_t length, uint16_t type);
+
+/**
+ * 释放帧文件的校验和表（不关闭fd）
+ */
+void mux_frame_file_destroy(mux_frame_file_t* frame);
+
+/**
+ * 用sendfile发送帧文件中的消息体：对端支持分片交错时逐个分片发送，否则整帧一次发完
+ * 帧文件须保持有效，直到完成回调被调用
+ * @param sender 调度器
+ * @param frame 帧文件
+ * @param on_complete 完成回调（可以为NULL）
+ * @param context 回调上下文
+ * @return 0表示已排队，-1表示失败（排队失败时不调用完成回调）
+ */
+int mux_send_frame_file(mux_sender_t* sender, const mux_frame_file_t* frame,
+                        mux_complete_fn on_complete, void* context);
+
+/**
+ * 以Base64编码发送文件: [prefix] + [Base64(文件内容)]
+ * prefix需按 WIRE_VERSION_FOR(当前能力位) 编码
+ * 文件由调度器接管，发送完成或失败后关闭
+ * @param sender 调度器
+ * @param type 消息类型
+ * @param prefix 消息体前缀（可以为NULL）
+ * @param prefix_length 前缀长度
+ * @param file 已打开的文件
+ * @param file_size 文件大小
+ * @param on_complete 完成回调（可以为NULL）
+ * @param context 回调上下文
+ * @param wait 非0时等待发送完成后返回
+ * @return 0表示成功（或已排队），-1表示失败（排队失败时不调用完成回调）
+ */
+int mux_send_file_base64(mux_sender_t* sender, uint16_t type, const void* prefix, size_t prefix_length,
+                         FILE* file, size_t file_size, mux_complete_fn on_complete, void* context,
+                         int wait);
+
+/**
+ * 查找接收端的逻辑流
+ * @return 找到的流，不存在返回NULL
+ */
+mux_stream_t* mux_stream_find(mux_stream_t* streams, uint32_t stream_id);
+
+/**
+ * 打开接收端的逻辑流
+ * @return 新的流，没有空闲槽位返回NULL
+ */
+mux_stream_t* mux_stream_open(mux_stream_t* streams, uint32_t stream_id, uint16_t type,
+                              uint32_t total_length);
+
+/**
+ * 关闭接收端的逻辑流
+ */
+void mux_stream_close(mux_stream_t* stream);
+
+#endif // MUX_H
@@ -15,6 +15,15 @@
 #define MAX_FILENAME_LEN 256
 #define MAX_MESSAGE_LEN 1024
 
+// 客户端标识长度：客户端首次启动时随机生成并保存，之后的每条连接都在版本检查中带上
+#define CLIENT_ID_SIZE 16
+
+// 单帧最大数据长度（整体读入内存的帧）
+#define MAX_FRAME_LENGTH (10 * 1024 * 1024)
+
+// 超过该长度的文件上传/更新数据帧按流处理，不整体读入内存
+#define STREAM_THRESHOLD (1024 * 1024)
+
 // 消息类型
 typedef enum {
     MSG_VERSION_CHECK = 1,    // 版本检查
@@ -27,7 +36,14 @@ typedef enum {
     MSG_DATA_RESPONSE,        // 数据响应
     MSG_HEARTBEAT,            // 心跳
     MSG_ERROR,                // 错误消息
-    MSG_DISCONNECT            // 断开连接
+    MSG_DISCONNECT,           // 断开连接
+    MSG_STREAM_DATA,          // 逻辑流分片（多路复用）
+    MSG_DATA_QUERY,           // 数据查询
+    MSG_DATA_QUERY_RESULT,    // 数据查询结果
+    MSG_UPDATE_DELTA,         // 差量更新补丁
+    MSG_UPDATE_RESUME,        // 更新包续传（紧接着的MSG_UPDATE_DATA只含续传部分）
+    MSG_UPDATE_MANIFEST,      // 更新包分块清单
+    MSG_TYPE_COUNT            // 消息类型数量（非消息类型）
 } message_type_t;
 
 // 响应状态
@@ -43,16 +59,57 @@ typedef enum {
 // 消息头结构
 typedef struct {
     uint32_t magic;           // 魔数 0x12345678
-    uint16_t version;         // 协议版本
+    uint8_t version;          // 协议版本
+    uint8_t flags;            // 帧标志（低4位）和压缩编码ID（高4位）
     uint16_t type;            // 消息类型
     uint32_t length;          // 数据长度
     uint32_t checksum;        // 校验和
 } __attribute__((packed)) message_header_t;
 
+// 帧标志
+#define FRAME_FLAG_COMPRESSED 0x01    // 数据经过压缩，length/checksum针对压缩后的数据
+
+// 压缩编码ID存放在flags的高4位
+#define FRAME_CODEC(flags) (((flags) >> 4) & 0x0F)
+#define FRAME_FLAGS_COMPRESSED(codec) ((uint8_t)(FRAME_FLAG_COMPRESSED | ((codec) << 4)))
+
+// 能力位（客户端在MSG_VERSION_CHECK中声明，服务端在MSG_VERSION_RESPONSE中返回协商结果）
+#define CAP_COMPRESS_ZLIB 0x00000001  // 支持zlib帧压缩
+#define CAP_MULTIPLEX     0x00000002  // 支持逻辑流分片交错（MSG_STREAM_DATA）
+#define CAP_WIRE_V2       0x00000004  // 支持v2线格式（小端、自然对齐）
+#define CAP_DELTA_UPDATE  0x00000008  // 支持差量更新（MSG_UPDATE_DELTA）
+#define CAP_CHUNK_MANIFEST 0x00000010 // 支持分块清单（MSG_UPDATE_MANIFEST）和按范围请求更新包
+
+// 线格式版本（消息头的version字段，每一帧按自身的version解析）
+#define WIRE_V1 1                     // 主机字节序、packed结构体
+#define WIRE_V2 2                     // 小端字节序、自然对齐、固定偏移
+
+// 空闲时客户端的心跳间隔最多退避到服务端建议间隔的倍数
+#define HEARTBEAT_BACKOFF_LIMIT 4
+
+// 逻辑流分片标志
+#define STREAM_FLAG_BEGIN 0x01        // 逻辑流的第一个分片
+#define STREAM_FLAG_END   0x02        // 逻辑流的最后一个分片
+
+// 数据查询结果标志
+#define DATA_QUERY_FLAG_LAST 0x0001   // 本页的最后一个结果帧
+#define DATA_QUERY_FLAG_MORE 0x0002   // 本页之后还有数据，用next_after_*继续查询
+
+// 更新请求标志
+#define UPDATE_REQUEST_FULL 0x00000001  // 要求完整更新包（差量补丁无法应用时）
+#define UPDATE_REQUEST_MANIFEST 0x00000002  // 只要更新包的分块清单（MSG_UPDATE_MANIFEST），不发送更新数据
+#define UPDATE_REQUEST_DONE 0x00000004      // 按分块清单的下载已结束，归还传输名额（服务端不回复）
+
+// 每页默认/最多返回的行数
+#define DATA_QUERY_DEFAULT_LIMIT 1000
+#define DATA_QUERY_MAX_LIMIT 10000
+
 // 版本检查消息
 typedef struct {
     char client_version[32];  // 客户端版本
     char platform[32];        // 平台信息
+    uint32_t capabilities;    // 客户端能力位（旧客户端不发送此字段）
+    uint8_t client_id[CLIENT_ID_SIZE];  // 客户端标识，全0表示未知（旧客户端不发送此字段）
 } __attribute__((packed)) version_check_msg_t;
 
 // 版本响应消息
@@ -61,8 +118,47 @@ typedef struct {
     char server_version[32];  // 服务器版本
     char latest_version[32];  // 最新版本
     uint32_t update_size;     // 更新包大小
+    uint32_t capabilities;    // 协商后启用的能力位
+    uint32_t heartbeat_interval;  // 建议的心跳间隔（秒），旧服务端不发送此字段
+    uint32_t delta_size;      // 可用的差量补丁大小，0表示没有（旧服务端不发送此字段）
+    uint8_t package_hash[32]; // 完整更新包的SHA-256，全0表示未知（旧服务端不发送此字段）
+    uint32_t retry_after;     // 分批发布暂缓提供更新时，建议多少秒后再检查；0表示不需要（旧服务端不发送此字段）
 } __attribute__((packed)) version_response_msg_t;
 
+// 更新请求消息（旧客户端发送空消息体，不续传的客户端只发送flags）
+typedef struct {
+    uint32_t flags;           // UPDATE_REQUEST_*
+    uint32_t resume_offset;   // 已下载的字节数（3的倍数），0表示从头下载
+    uint8_t package_hash[32]; // 已下载部分所属更新包的SHA-256
+    uint32_t range_length;    // 只要从resume_offset开始的这么多字节，0表示到末尾（旧客户端不发送此字段）
+} __attribute__((packed)) update_request_msg_t;
+
+// 更新包续传消息：随后的MSG_UPDATE_DATA是更新包从offset开始的部分
+typedef struct {
+    uint32_t offset;          // 续传起点
+    uint32_t total_size;      // 完整更新包大小
+    uint8_t package_hash[32]; // 完整更新包的SHA-256
+} __attribute__((packed)) update_resume_msg_t;
+
+// 更新包分块清单：更新包按chunk_size切分（最后一块可能较短），每块一个SHA-256
+typedef struct {
+    uint8_t package_hash[32]; // 完整更新包的SHA-256
+    uint32_t package_size;    // 更新包大小
+    uint32_t chunk_size;      // 分块大小（3的倍数，分块边界即可请求的范围边界）
+    uint32_t chunk_count;     // 分块数
+    uint8_t chunk_hashes[];   // chunk_count个SHA-256
+} __attribute__((packed)) update_manifest_msg_t;
+
+// 差量更新消息：把补丁应用到base_hash对应的客户端可执行文件上，得到target_hash对应的新版本
+typedef struct {
+    char base_version[32];    // 补丁基于的客户端版本
+    uint8_t base_hash[32];    // 旧可执行文件的SHA-256
+    uint8_t target_hash[32];  // 新可执行文件的SHA-256
+    uint32_t target_size;     // 新可执行文件大小
+    uint32_t delta_length;    // 补丁长度
+    char data[];              // 补丁（见delta.h）
+} __attribute__((packed)) update_delta_msg_t;
+
 // 文件上传消息
 typedef struct {
     char filename[MAX_FILENAME_LEN];  // 文件名
@@ -80,12 +176,54 @@ typedef struct {
     char data[];              // Base64编码的数据
 } __attribute__((packed)) data_upload_msg_t;
 
+// 逻辑流分片消息：多条大消息拆成分片后交错发送，接收端按stream_id重组
+typedef struct {
+    uint32_t stream_id;       // 逻辑流ID（发送端分配，非0）
+    uint16_t inner_type;      // 承载的消息类型
+    uint8_t stream_flags;     // STREAM_FLAG_BEGIN / STREAM_FLAG_END
+    uint8_t reserved;         // 保留
+    uint32_t total_length;    // 承载消息的总长度
+    char data[];              // 承载消息的数据分片
+} __attribute__((packed)) stream_data_msg_t;
+
 // 响应消息
 typedef struct {
     uint16_t status;          // 状态码
     char message[MAX_MESSAGE_LEN];  // 响应消息
 } __attribute__((packed)) response_msg_t;
 
+// 数据查询消息：按上传时间和ID升序返回一页数据，用(after_time, after_id)键集游标翻页
+typedef struct {
+    uint32_t query_id;        // 查询ID，结果帧原样带回
+    char table_name[64];      // 表名
+    char field_name[64];      // 字段名，空字符串表示所有字段
+    uint64_t start_time;      // 上传时间下界（Unix秒，包含），0表示不限
+    uint64_t end_time;        // 上传时间上界（Unix秒，不包含），0表示不限
+    uint64_t after_time;      // 游标：上一页最后一行的上传时间，首页为0
+    uint64_t after_id;        // 游标：上一页最后一行的ID，首页为0
+    uint32_t limit;           // 本页最多返回的行数，0表示DATA_QUERY_DEFAULT_LIMIT
+} __attribute__((packed)) data_query_msg_t;
+
+// 数据查询结果消息：一页结果拆成若干帧依次发送，rows中连续存放row_count个data_query_row_t
+typedef struct {
+    uint32_t query_id;        // 查询ID
+    uint16_t status;          // 状态码
+    uint16_t flags;           // DATA_QUERY_FLAG_*
+    uint32_t row_count;       // 本帧的行数
+    uint64_t next_after_time; // 本帧最后一行的游标（可从任意帧继续查询）
+    uint64_t next_after_id;
+    char rows[];              // 行数据
+} __attribute__((packed)) data_query_result_msg_t;
+
+// 数据查询结果行
+typedef struct {
+    uint64_t id;              // 记录ID
+    uint64_t upload_time;     // 上传时间（Unix秒）
+    uint32_t data_size;       // 数据长度
+    char field_name[64];      // 字段名
+    char data[];              // 数据
+} __attribute__((packed)) data_query_row_t;
+
 // 错误响应消息
 typedef struct {
     uint16_t error_code;      // 错误代码
@@ -107,6 +245,139 @@ typedef struct {
     // 消息内容跟在结构体后面
 } __attribute__((packed)) FileResponse;
 
+// ---- v2线格式 ----
+// 消息头布局与v1相同（各字段偏移本来就是自然对齐的），所有整数字段改为小端。
+// 消息体结构体不再packed，所有整数为小端，字段按自然对齐排列，偏移固定。
+// 接收方通过wire.h中的访问函数直接在接收缓冲区上读取字段。
+
+// 版本检查消息 (v2)
+typedef struct {
+    char client_version[32];  // 偏移0
+    char platform[32];        // 偏移32
+    uint32_t capabilities;    // 偏移64
+    uint8_t client_id[CLIENT_ID_SIZE];  // 偏移68
+} version_check_msg_v2_t;
+
+// 版本响应消息 (v2)
+typedef struct {
+    uint16_t status;          // 偏移0
+    uint16_t reserved;        // 偏移2
+    uint32_t update_size;     // 偏移4
+    uint32_t capabilities;    // 偏移8
+    char server_version[32];  // 偏移12
+    char latest_version[32];  // 偏移44
+    uint32_t heartbeat_interval;  // 偏移76
+    uint32_t delta_size;      // 偏移80
+    uint8_t package_hash[32]; // 偏移84
+    uint32_t retry_after;     // 偏移116
+} version_response_msg_v2_t;
+
+// 更新请求消息 (v2)
+typedef struct {
+    uint32_t flags;           // 偏移0
+    uint32_t resume_offset;   // 偏移4
+    uint8_t package_hash[32]; // 偏移8
+    uint32_t range_length;    // 偏移40
+} update_request_msg_v2_t;
+
+// 更新包续传消息 (v2)
+typedef struct {
+    uint32_t offset;          // 偏移0
+    uint32_t total_size;      // 偏移4
+    uint8_t package_hash[32]; // 偏移8
+} update_resume_msg_v2_t;
+
+// 更新包分块清单 (v2)
+typedef struct {
+    uint8_t package_hash[32]; // 偏移0
+    uint32_t package_size;    // 偏移32
+    uint32_t chunk_size;      // 偏移36
+    uint32_t chunk_count;     // 偏移40
+    uint8_t chunk_hashes[];   // 偏移44
+} update_manifest_msg_v2_t;
+
+// 差量更新消息 (v2)
+typedef struct {
+    char base_version[32];    // 偏移0
+    uint8_t base_hash[32];    // 偏移32
+    uint8_t target_hash[32];  // 偏移64
+    uint32_t target_size;     // 偏移96
+    uint32_t delta_length;    // 偏移100
+    char data[];              // 偏移104
+} update_delta_msg_v2_t;
+
+// 文件上传消息 (v2)
+typedef struct {
+    char filename[MAX_FILENAME_LEN];  // 偏移0
+    uint32_t file_size;               // 偏移256
+    uint32_t chunk_size;              // 偏移260
+    uint32_t chunk_offset;            // 偏移264
+    char data[];                      // 偏移268
+} file_upload_msg_v2_t;
+
+// 数据上传消息 (v2)
+typedef struct {
+    char table_name[64];      // 偏移0
+    char field_name[64];      // 偏移64
+    uint32_t data_size;       // 偏移128
+    char data[];              // 偏移132
+} data_upload_msg_v2_t;
+
+// 逻辑流分片消息 (v2)
+typedef struct {
+    uint32_t stream_id;       // 偏移0
+    uint16_t inner_type;      // 偏移4
+    uint8_t stream_flags;     // 偏移6
+    uint8_t reserved;         // 偏移7
+    uint32_t total_length;    // 偏移8
+    char data[];              // 偏移12
+} stream_data_msg_v2_t;
+
+// 响应消息 (v2)
+typedef struct {
+    uint16_t status;                // 偏移0
+    char message[MAX_MESSAGE_LEN];  // 偏移2
+} response_msg_v2_t;
+
+// 数据查询消息 (v2)
+typedef struct {
+    uint32_t query_id;        // 偏移0
+    uint32_t limit;           // 偏移4
+    uint64_t start_time;      // 偏移8
+    uint64_t end_time;        // 偏移16
+    uint64_t after_time;      // 偏移24
+    uint64_t after_id;        // 偏移32
+    char table_name[64];      // 偏移40
+    char field_name[64];      // 偏移104
+} data_query_msg_v2_t;
+
+// 数据查询结果消息 (v2)
+typedef struct {
+    uint32_t query_id;        // 偏移0
+    uint16_t status;          // 偏移4
+    uint16_t flags;           // 偏移6
+    uint32_t row_count;       // 偏移8
+    uint32_t reserved;        // 偏移12
+    uint64_t next_after_time; // 偏移16
+    uint64_t next_after_id;   // 偏移24
+    char rows[];              // 偏移32
+} data_query_result_msg_v2_t;
+
+// 数据查询结果行 (v2)，每行按8字节对齐（data之后补0）
+typedef struct {
+    uint64_t id;              // 偏移0
+    uint64_t upload_time;     // 偏移8
+    uint32_t data_size;       // 偏移16
+    uint32_t reserved;        // 偏移20
+    char field_name[64];      // 偏移24
+    char data[];              // 偏移88
+} data_query_row_v2_t;
+
+// 数据查询结果行占用的字节数（v2补齐到8字节）
+#define DATA_QUERY_ROW_STRIDE(version, data_size) \
+    ((version) >= WIRE_V2 ? ((sizeof(data_query_row_v2_t) + (data_size) + 7) & ~(size_t)7) \
+                          : sizeof(data_query_row_t) + (data_size))
+
 // 协议魔数
 #define PROTOCOL_MAGIC 0x12345678
 
@@ -114,5 +385,6 @@ typedef struct {
 uint32_t calculate_checksum(const void* data, size_t length);
 int validate_message_header(const message_header_t* header);
 void init_message_header(message_header_t* header, uint16_t type, uint32_t length);
+int is_stream_frame(uint16_t type, uint8_t flags, uint32_t length);
 
 #endif // PROTOCOL_H
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "sha256.h"
+#include <string.h>
+
+// 轮常量（前64个素数立方根小数部分的前32位）
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// 处理一个64字节分组
+static void sha256_transform(sha256_context_t* context, const uint8_t block[64]) {
+    uint32_t w[64];
+    
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    
+    uint32_t a = context->state[0];
+    uint32_t b = context->state[1];
+    uint32_t c = context->state[2];
+    uint32_t d = context->state[3];
+    uint32_t e = context->state[4];
+    uint32_t f = context->state[5];
+    uint32_t g = context->state[6];
+    uint32_t h = context->state[7];
+    
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + k[i] + w[i];
+        uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    
+    context->state[0] += a;
+    context->state[1] += b;
+    context->state[2] += c;
+    context->state[3] += d;
+    context->state[4] += e;
+    context->state[5] += f;
+    context->state[6] += g;
+    context->state[7] += h;
+}
+
+// 初始化SHA-256计算状态
+void sha256_init(sha256_context_t* context) {
+    static const uint32_t initial_state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    
+    memcpy(context->state, initial_state, sizeof(initial_state));
+    context->total_length = 0;
+    context->block_length = 0;
+}
+
+// 输入一段数据
+void sha256_update(sha256_context_t* context, const void* data, size_t length) {
+    const uint8_t* input = (const uint8_t*)data;
+    
+    context->total_length += length;
+    
+    // 先补满上次剩余的分组
+    if (context->block_length > 0) {
+        size_t fill = 64 - context->block_length;
+        if (fill > length) {
+            fill = length;
+        }
+        
+        memcpy(context->block + context->block_length, input, fill);
+        context->block_length += fill;
+        input += fill;
+        length -= fill;
+        
+        if (context->block_length < 64) {
+            return;
+        }
+        
+        sha256_transform(context, context->block);
+        context->block_length = 0;
+    }
+    
+    // 完整分组直接处理
+    while (length >= 64) {
+        sha256_transform(context, input);
+        input += 64;
+        length -= 64;
+    }
+    
+    if (length > 0) {
+        memcpy(context->block, input, length);
+        context->block_length = length;
+    }
+}
+
+// 结束计算并输出摘要
+void sha256_final(sha256_context_t* context, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    uint64_t bit_length = context->total_length * 8;
+    
+    // 填充: 0x80 + 若干0 + 64位大端消息长度
+    context->block[context->block_length++] = 0x80;
+    if (context->block_length > 56) {
+        memset(context->block + context->block_length, 0, 64 - context->block_length);
+        sha256_transform(context, context->block);
+        context->block_length = 0;
+    }
+    
+    memset(context->block + context->block_length, 0, 56 - context->block_length);
+    for (int i = 0; i < 8; i++) {
+        context->block[56 + i] = (uint8_t)(bit_length >> (56 - i * 8));
+    }
+    sha256_transform(context, context->block);
+    
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (uint8_t)(context->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(context->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(context->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)context->state[i];
+    }
+}
+
+// 计算一块数据的摘要
+void sha256_digest(const void* data, size_t length, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    sha256_context_t context;
+    sha256_init(&context);
+    sha256_update(&context, data, length);
+    sha256_final(&context, digest);
+}
+
+// 从文件当前位置读到末尾并计算摘要
+long long sha256_file(FILE* file, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    sha256_context_t context;
+    unsigned char buffer[65536];
+    long long total = 0;
+    size_t read_size;
+    
+    if (!file) {
+        return -1;
+    }
+    
+    sha256_init(&context);
+    
+    while ((read_size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        sha256_update(&context, buffer, read_size);
+        total += read_size;
+    }
+    
+    if (ferror(file)) {
+        return -1;
+    }
+    
+    sha256_final(&context, digest);
+    return total;
+}
+
+// 将摘要转换为十六进制字符串
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE]) {
+    static const char digits[] = "0123456789abcdef";
+    
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0x0f];
+    }
+    hex[SHA256_DIGEST_SIZE * 2] = '\0';
+}
@@ -0,0 +1,66 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// SHA-256摘要长度（字节）
+#define SHA256_DIGEST_SIZE 32
+
+// 十六进制摘要字符串长度（含结尾'\0'）
+#define SHA256_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1)
+
+// 增量计算SHA-256的状态
+typedef struct {
+    uint32_t state[8];        // 中间哈希值
+    uint64_t total_length;    // 已输入的字节数
+    uint8_t block[64];        // 尚未凑满一个分组的输入
+    size_t block_length;      // block中的字节数
+} sha256_context_t;
+
+/**
+ * 初始化SHA-256计算状态
+ * @param context 计算状态
+ */
+void sha256_init(sha256_context_t* context);
+
+/**
+ * 输入一段数据（可以任意切分后依次输入）
+ * @param context 计算状态
+ * @param data 数据
+ * @param length 数据长度
+ */
+void sha256_update(sha256_context_t* context, const void* data, size_t length);
+
+/**
+ * 结束计算并输出摘要
+ * @param context 计算状态
+ * @param digest 输出的摘要（SHA256_DIGEST_SIZE字节）
+ */
+void sha256_final(sha256_context_t* context, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * 计算一块数据的SHA-256摘要
+ * @param data 数据
+ * @param length 数据长度
+ * @param digest 输出的摘要
+ */
+void sha256_digest(const void* data, size_t length, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * 从文件当前位置读到末尾并计算SHA-256摘要
+ * @param file 已打开的文件
+ * @param digest 输出的摘要
+ * @return 读取的字节数，读取失败返回-1
+ */
+long long sha256_file(FILE* file, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * 将摘要转换为小写十六进制字符串
+ * @param digest 摘要
+ * @param hex 输出缓冲区（至少SHA256_HEX_SIZE字节）
+ */
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE]);
+
+#endif // SHA256_H
@@ -0,0 +1,178 @@
+#include "stream.h"
+#include "protocol.h"
+#include "base64.h"
+#include "utils.h"
+#include "wire.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+int stream_recv_body(int socket_fd, size_t length, uint32_t* checksum,
+                     stream_chunk_handler_t handler, void* context) {
+    if (!checksum) {
+        return -1;
+    }
+    
+    char* buffer = malloc(STREAM_CHUNK_SIZE);
+    if (!buffer) {
+        return -1;
+    }
+    
+    int handler_failed = 0;
+    
+    while (length > 0) {
+        size_t chunk = length < STREAM_CHUNK_SIZE ? length : STREAM_CHUNK_SIZE;
+        
+        if (recv_all(socket_fd, buffer, chunk) != 0) {
+            free(buffer);
+            return -1;
+        }
+        
+        *checksum = checksum_update(*checksum, buffer, chunk);
+        
+        if (handler && !handler_failed) {
+            if (handler(context, buffer, chunk) != 0) {
+                handler_failed = 1;
+            }
+        }
+        
+        length -= chunk;
+    }
+    
+    free(buffer);
+    return handler_failed ? 1 : 0;
+}
+
+// 逐块读取文件并Base64编码，对每个编码块调用send或累计校验和
+static int stream_encode_file(FILE* file, size_t file_size, int socket_fd, uint32_t* checksum,
+                              unsigned char* raw, char* encoded, size_t encoded_capacity) {
+    if (fseek(file, 0, SEEK_SET) != 0) {
+        return -1;
+    }
+    
+    size_t remaining = file_size;
+    
+    while (remaining > 0) {
+        size_t chunk = remaining < STREAM_CHUNK_SIZE ? remaining : STREAM_CHUNK_SIZE;
+        
+        if (fread(raw, 1, chunk, file) != chunk) {
+            return -1;
+        }
+        
+        int encoded_length = base64_encode(raw, chunk, encoded, encoded_capacity);
+        if (encoded_length < 0) {
+            return -1;
+        }
+        
+        if (checksum) {
+            *checksum = checksum_update(*checksum, encoded, encoded_length);
+        } else if (send_all(socket_fd, encoded, encoded_length) != 0) {
+            return -1;
+        }
+        
+        remaining -= chunk;
+    }
+    
+    return 0;
+}
+
+int stream_sendfile(int socket_fd, int fd, off_t offset, size_t length) {
+    while (length > 0) {
+        size_t slice = length < STREAM_SENDFILE_SLICE ? length : STREAM_SENDFILE_SLICE;
+        ssize_t sent = sendfile(socket_fd, fd, &offset, slice);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        
+        if (sent < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            break;  // 不支持sendfile的文件，改用读写
+        }
+        
+        if (sent <= 0) {
+            return -1;  // 出错，或文件被截断
+        }
+        length -= (size_t)sent;
+    }
+    
+    if (length == 0) {
+        return 0;
+    }
+    
+    char* buffer = malloc(STREAM_CHUNK_SIZE);
+    if (!buffer) {
+        return -1;
+    }
+    
+    int result = 0;
+    while (length > 0 && result == 0) {
+        size_t chunk = length < STREAM_CHUNK_SIZE ? length : STREAM_CHUNK_SIZE;
+        ssize_t got = pread(fd, buffer, chunk, offset);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        
+        if (got <= 0 || send_all(socket_fd, buffer, (size_t)got) != 0) {
+            result = -1;
+        } else {
+            offset += got;
+            length -= (size_t)got;
+        }
+    }
+    
+    free(buffer);
+    return result;
+}
+
+int stream_send_file_base64(int socket_fd, uint8_t version, uint16_t type,
+                            const void* prefix, size_t prefix_length,
+                            FILE* file, size_t file_size) {
+    if (!file || (prefix_length > 0 && !prefix)) {
+        return -1;
+    }
+    
+    size_t body_length = prefix_length + base64_encoded_length(file_size);
+    if (body_length > UINT32_MAX) {
+        return -1;
+    }
+    
+    size_t encoded_capacity = base64_encoded_length(STREAM_CHUNK_SIZE) + 1;
+    unsigned char* raw = malloc(STREAM_CHUNK_SIZE);
+    char* encoded = malloc(encoded_capacity);
+    if (!raw || !encoded) {
+        free(raw);
+        free(encoded);
+        return -1;
+    }
+    
+    // 第一遍：计算校验和
+    uint32_t checksum = checksum_update(0, prefix, prefix_length);
+    if (stream_encode_file(file, file_size, socket_fd, &checksum, raw, encoded, encoded_capacity) != 0) {
+        free(raw);
+        free(encoded);
+        return -1;
+    }
+    
+    message_header_t header;
+    init_message_header(&header, type, (uint32_t)body_length);
+    header.version = version;
+    header.checksum = checksum;
+    wire_encode_header(&header);
+    
+    int result = 0;
+    if (send_all(socket_fd, &header, sizeof(header)) != 0 ||
+        (prefix_length > 0 && send_all(socket_fd, prefix, prefix_length) != 0)) {
+        result = -1;
+    }
+    
+    // 第二遍：编码并发送
+    if (result == 0 &&
+        stream_encode_file(file, file_size, socket_fd, NULL, raw, encoded, encoded_capacity) != 0) {
+        result = -1;
+    }
+    
+    free(raw);
+    free(encoded);
+    return result;
+}
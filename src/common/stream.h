@@ -0,0 +1,63 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// 流式处理的块大小（3的倍数，保证分块Base64编码结果与整体编码一致）
+#define STREAM_CHUNK_SIZE (48 * 1024)
+
+// sendfile每次调用最多发送的字节数
+#define STREAM_SENDFILE_SLICE (1024 * 1024)
+
+/**
+ * 流数据块处理函数
+ * @param context 处理函数上下文
+ * @param data 数据块
+ * @param length 数据块长度
+ * @return 0表示成功，非0表示失败（之后的数据块不再交给处理函数）
+ */
+typedef int (*stream_chunk_handler_t)(void* context, const char* data, size_t length);
+
+/**
+ * 以有界缓冲区分块接收消息体，并交给处理函数
+ * 处理函数失败后仍会读完剩余数据，保证连接上的帧边界不被破坏
+ * @param socket_fd 套接字
+ * @param length 要接收的数据长度
+ * @param checksum 输入为已累计的校验和，输出为包含本段数据的校验和
+ * @param handler 数据块处理函数（可以为NULL，仅丢弃数据）
+ * @param context 处理函数上下文
+ * @return 0表示成功，1表示处理函数失败（数据已读完），-1表示接收失败
+ */
+int stream_recv_body(int socket_fd, size_t length, uint32_t* checksum,
+                     stream_chunk_handler_t handler, void* context);
+
+/**
+ * 以Base64编码流式发送文件: [消息头] + [prefix] + [Base64(文件内容)]
+ * 先读一遍文件计算校验和，再读一遍编码发送，内存占用与文件大小无关
+ * @param socket_fd 套接字
+ * @param version 线格式版本（prefix需按该版本编码）
+ * @param type 消息类型
+ * @param prefix 消息体前缀（固定结构体，可以为NULL）
+ * @param prefix_length 前缀长度
+ * @param file 已打开的文件
+ * @param file_size 文件大小
+ * @return 0表示成功，-1表示失败
+ */
+int stream_send_file_base64(int socket_fd, uint8_t version, uint16_t type,
+                            const void* prefix, size_t prefix_length, FILE* file, size_t file_size);
+
+/**
+ * 把文件的一段直接发送到socket（sendfile，数据不经过用户态缓冲区）
+ * 文件系统不支持sendfile时退回到分块读取后发送
+ * @param socket_fd 套接字
+ * @param fd 文件描述符（不改变其文件位置）
+ * @param offset 起始偏移
+ * @param length 发送长度
+ * @return 0表示成功，-1表示失败
+ */
+int stream_sendfile(int socket_fd, int fd, off_t offset, size_t length);
+
+#endif // STREAM_H
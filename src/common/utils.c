@@ -7,11 +7,17 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <sys/socket.h>
 
 // 计算简单校验和
 uint32_t calculate_checksum(const void* data, size_t length) {
+    return checksum_update(0, data, length);
+}
+
+// 增量计算校验和（分段调用的结果与整体计算一致）
+uint32_t checksum_update(uint32_t checksum, const void* data, size_t length) {
     const unsigned char* bytes = (const unsigned char*)data;
-    uint32_t checksum = 0;
     
     for (size_t i = 0; i < length; i++) {
         checksum += bytes[i];
@@ -30,30 +36,87 @@ int validate_message_header(const message_header_t* header) {
         return 0;
     }
     
+    // 检查线格式版本
+    if (header->version < WIRE_V1 || header->version > WIRE_V2) {
+        return 0;
+    }
+    
     // 检查消息类型
-    if (header->type < MSG_VERSION_CHECK || header->type > MSG_DISCONNECT) {
+    if (header->type < MSG_VERSION_CHECK || header->type >= MSG_TYPE_COUNT) {
         return 0;
     }
     
-    // 检查数据长度（防止过大的数据包）
-    if (header->length > 10 * 1024 * 1024) { // 10MB限制
+    // 检查数据长度（防止过大的数据包），流式处理的帧不受此限制
+    if (header->length > MAX_FRAME_LENGTH &&
+        !is_stream_frame(header->type, header->flags, header->length)) {
         return 0;
     }
     
     return 1;
 }
 
+// 判断帧是否按流处理（只有未压缩的大文件上传/更新数据帧）
+int is_stream_frame(uint16_t type, uint8_t flags, uint32_t length) {
+    if (flags & FRAME_FLAG_COMPRESSED) {
+        return 0;
+    }
+    
+    if (type != MSG_FILE_UPLOAD && type != MSG_UPDATE_DATA) {
+        return 0;
+    }
+    
+    return length > STREAM_THRESHOLD;
+}
+
 // 初始化消息头
 void init_message_header(message_header_t* header, uint16_t type, uint32_t length) {
     if (!header) return;
     
     header->magic = PROTOCOL_MAGIC;
-    header->version = 1;
+    header->version = WIRE_V1;
+    header->flags = 0;
     header->type = type;
     header->length = length;
     header->checksum = 0; // 将在发送前计算
 }
 
+// 发送全部数据（处理部分发送和信号中断）
+int send_all(int socket_fd, const void* data, size_t length) {
+    const char* ptr = (const char*)data;
+    
+    while (length > 0) {
+        ssize_t sent = send(socket_fd, ptr, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        ptr += sent;
+        length -= (size_t)sent;
+    }
+    
+    return 0;
+}
+
+// 接收指定长度的全部数据（对端关闭连接视为失败）
+int recv_all(int socket_fd, void* data, size_t length) {
+    char* ptr = (char*)data;
+    
+    while (length > 0) {
+        ssize_t received = recv(socket_fd, ptr, length, 0);
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (received == 0) {
+            return -1;
+        }
+        ptr += received;
+        length -= (size_t)received;
+    }
+    
+    return 0;
+}
+
 // 获取当前时间戳
 long long get_timestamp() {
     return (long long)time(NULL);
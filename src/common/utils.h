@@ -18,7 +18,12 @@ long get_file_size(const char* filepath);
 void generate_random_string(char* buffer, size_t length);
 void trim_whitespace(char* str);
 
+// 网络函数
+int send_all(int socket_fd, const void* data, size_t length);
+int recv_all(int socket_fd, void* data, size_t length);
+
 // 校验和函数
 uint32_t calculate_checksum(const void* data, size_t length);
+uint32_t checksum_update(uint32_t checksum, const void* data, size_t length);
 
 #endif // UTILS_H
\ No newline at end of file
@@ -0,0 +1,52 @@
+#include "wire.h"
+
+int wire_view_init(wire_view_t* view, uint8_t version, const void* data, size_t length, size_t min_length) {
+    if (!view || (!data && length > 0) || length < min_length) {
+        return -1;
+    }
+    
+    view->data = (const unsigned char*)data;
+    view->length = length;
+    view->version = version;
+    return 0;
+}
+
+void wire_load_str(const char* field, size_t field_size, char* output, size_t output_size) {
+    if (!output || output_size == 0) return;
+    
+    size_t length = 0;
+    while (length < field_size && length < output_size - 1 && field[length] != '\0') {
+        length++;
+    }
+    
+    memcpy(output, field, length);
+    output[length] = '\0';
+}
+
+void wire_store_str(char* field, size_t field_size, const char* string) {
+    memset(field, 0, field_size);
+    
+    if (string) {
+        size_t length = strlen(string);
+        memcpy(field, string, length < field_size - 1 ? length : field_size - 1);
+    }
+}
+
+// 消息头的version字段只有1字节，与字节序无关，据此判断其他字段的格式
+void wire_encode_header(message_header_t* header) {
+    if (!header || header->version < WIRE_V2) return;
+    
+    header->magic = htole32(header->magic);
+    header->type = htole16(header->type);
+    header->length = htole32(header->length);
+    header->checksum = htole32(header->checksum);
+}
+
+void wire_decode_header(message_header_t* header) {
+    if (!header || header->version < WIRE_V2) return;
+    
+    header->magic = le32toh(header->magic);
+    header->type = le16toh(header->type);
+    header->length = le32toh(header->length);
+    header->checksum = le32toh(header->checksum);
+}
@@ -0,0 +1,130 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include "protocol.h"
+#include <endian.h>
+#include <stddef.h>
+#include <string.h>
+
+// 只读消息视图：直接在接收缓冲区上按固定偏移读取字段，不复制消息体、不要求缓冲区对齐
+typedef struct {
+    const unsigned char* data;
+    size_t length;
+    uint8_t version;          // 帧格式版本（WIRE_V1 / WIRE_V2）
+} wire_view_t;
+
+// 根据协商的能力位选择发送使用的线格式版本
+#define WIRE_VERSION_FOR(capabilities) (((capabilities) & CAP_WIRE_V2) ? WIRE_V2 : WIRE_V1)
+
+// 字段偏移：v1为packed结构体 name_t，v2为自然对齐结构体 name_v2_t
+#define WIRE_OFFSET(version, name, field) \
+    ((version) >= WIRE_V2 ? offsetof(name##_v2_t, field) : offsetof(name##_t, field))
+
+// 结构体大小（不含柔性数组成员）
+#define WIRE_SIZE(version, name) \
+    ((version) >= WIRE_V2 ? sizeof(name##_v2_t) : sizeof(name##_t))
+
+// 字段大小（两个版本相同）
+#define WIRE_FIELD_SIZE(name, field) sizeof(((name##_t*)0)->field)
+
+// 读取字段
+#define WIRE_GET_U8(view, name, field) \
+    ((view)->data[WIRE_OFFSET((view)->version, name, field)])
+#define WIRE_GET_U16(view, name, field) \
+    wire_load_u16((view)->data + WIRE_OFFSET((view)->version, name, field), (view)->version)
+#define WIRE_GET_U32(view, name, field) \
+    wire_load_u32((view)->data + WIRE_OFFSET((view)->version, name, field), (view)->version)
+#define WIRE_GET_U64(view, name, field) \
+    wire_load_u64((view)->data + WIRE_OFFSET((view)->version, name, field), (view)->version)
+#define WIRE_GET_PTR(view, name, field) \
+    ((const char*)(view)->data + WIRE_OFFSET((view)->version, name, field))
+#define WIRE_GET_STR(view, name, field, output, output_size) \
+    wire_load_str(WIRE_GET_PTR(view, name, field), WIRE_FIELD_SIZE(name, field), (output), (output_size))
+
+// 写入字段（buffer为消息体起始地址）
+#define WIRE_PUT_U8(buffer, version, name, field, value) \
+    (((unsigned char*)(buffer))[WIRE_OFFSET(version, name, field)] = (uint8_t)(value))
+#define WIRE_PUT_U16(buffer, version, name, field, value) \
+    wire_store_u16((unsigned char*)(buffer) + WIRE_OFFSET(version, name, field), (version), (value))
+#define WIRE_PUT_U32(buffer, version, name, field, value) \
+    wire_store_u32((unsigned char*)(buffer) + WIRE_OFFSET(version, name, field), (version), (value))
+#define WIRE_PUT_U64(buffer, version, name, field, value) \
+    wire_store_u64((unsigned char*)(buffer) + WIRE_OFFSET(version, name, field), (version), (value))
+#define WIRE_PUT_STR(buffer, version, name, field, string) \
+    wire_store_str((char*)(buffer) + WIRE_OFFSET(version, name, field), WIRE_FIELD_SIZE(name, field), (string))
+
+// v1为主机字节序，v2为小端；memcpy避免未对齐访问
+static inline uint16_t wire_load_u16(const void* p, uint8_t version) {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return version >= WIRE_V2 ? le16toh(value) : value;
+}
+
+static inline uint32_t wire_load_u32(const void* p, uint8_t version) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return version >= WIRE_V2 ? le32toh(value) : value;
+}
+
+static inline uint64_t wire_load_u64(const void* p, uint8_t version) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return version >= WIRE_V2 ? le64toh(value) : value;
+}
+
+static inline void wire_store_u16(void* p, uint8_t version, uint16_t value) {
+    if (version >= WIRE_V2) value = htole16(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+static inline void wire_store_u32(void* p, uint8_t version, uint32_t value) {
+    if (version >= WIRE_V2) value = htole32(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+static inline void wire_store_u64(void* p, uint8_t version, uint64_t value) {
+    if (version >= WIRE_V2) value = htole64(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+/**
+ * 初始化消息视图
+ * @param view 视图
+ * @param version 帧格式版本（消息头的version字段）
+ * @param data 消息体
+ * @param length 消息体长度
+ * @param min_length 消息体的最小长度（固定部分的大小）
+ * @return 0表示成功，-1表示消息体太短
+ */
+int wire_view_init(wire_view_t* view, uint8_t version, const void* data, size_t length, size_t min_length);
+
+/**
+ * 复制定长字符串字段（字段不保证以'\0'结尾）
+ * @param field 字段地址
+ * @param field_size 字段大小
+ * @param output 输出缓冲区
+ * @param output_size 输出缓冲区大小
+ */
+void wire_load_str(const char* field, size_t field_size, char* output, size_t output_size);
+
+/**
+ * 写入定长字符串字段（截断并以'\0'结尾）
+ * @param field 字段地址
+ * @param field_size 字段大小
+ * @param string 字符串
+ */
+void wire_store_str(char* field, size_t field_size, const char* string);
+
+/**
+ * 发送前把消息头转换为header->version对应的字节序（原地转换）
+ * @param header 消息头
+ */
+void wire_encode_header(message_header_t* header);
+
+/**
+ * 接收后把消息头转换为主机字节序（原地转换，按version字段判断格式）
+ * @param header 消息头
+ */
+void wire_decode_header(message_header_t* header);
+
+#endif // WIRE_H
@@ -0,0 +1,199 @@
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// 外置值存储：超过BLOB_OFFLOAD_THRESHOLD的字段值按SHA-256内容寻址保存为文件
+// BLOB_DIR/<哈希前两位>/<哈希>，相同内容只存一份。文件先写入同目录的临时文件并刷盘，
+// 再重命名为最终文件名，因此存在的外置文件总是完整的；引用它的行在文件落盘后才提交
+
+// 拼出外置文件路径和所在子目录
+static void blob_store_path(const char* hash_hex, char* path, size_t path_size, char* dir, size_t dir_size) {
+    snprintf(dir, dir_size, "%s/%.2s", BLOB_DIR, hash_hex);
+    snprintf(path, path_size, "%s/%s", dir, hash_hex);
+}
+
+// 检查是否为合法的十六进制哈希
+static int blob_store_valid_hash(const char* hash_hex) {
+    size_t length = strlen(hash_hex);
+    if (length != SHA256_HEX_SIZE - 1) {
+        return 0;
+    }
+    
+    for (size_t i = 0; i < length; i++) {
+        char c = hash_hex[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+// 创建目录（已存在不算错误）
+static int blob_store_mkdir(const char* dir) {
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "创建目录 %s 失败: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// 写入外置值，返回内容的十六进制哈希。内容已存在时只更新修改时间，供回收时判断是否刚被引用
+int blob_store_put(const void* data, size_t size, char hash_hex[SHA256_HEX_SIZE]) {
+    if (!data || !hash_hex) {
+        return -1;
+    }
+    
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_digest(data, size, digest);
+    sha256_to_hex(digest, hash_hex);
+    
+    char dir[sizeof(BLOB_DIR) + 4];
+    char path[sizeof(dir) + SHA256_HEX_SIZE + 1];
+    blob_store_path(hash_hex, path, sizeof(path), dir, sizeof(dir));
+    
+    struct stat st;
+    if (stat(path, &st) == 0 && (size_t)st.st_size == size) {
+        if (utimensat(AT_FDCWD, path, NULL, 0) == -1) {
+            fprintf(stderr, "更新外置值时间失败 %s: %s\n", path, strerror(errno));
+        }
+        return 0;
+    }
+    
+    if (blob_store_mkdir(BLOB_DIR) != 0 || blob_store_mkdir(dir) != 0) {
+        return -1;
+    }
+    
+    char temp_path[sizeof(path) + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+    
+    int fd = mkstemp(temp_path);
+    if (fd == -1) {
+        fprintf(stderr, "创建外置值临时文件失败 %s: %s\n", temp_path, strerror(errno));
+        return -1;
+    }
+    
+    const unsigned char* cursor = data;
+    size_t remaining = size;
+    while (remaining > 0) {
+        ssize_t written = write(fd, cursor, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        cursor += written;
+        remaining -= (size_t)written;
+    }
+    
+    if (remaining > 0 || fsync(fd) == -1) {
+        fprintf(stderr, "写入外置值失败 %s: %s\n", temp_path, strerror(errno));
+        close(fd);
+        unlink(temp_path);
+        return -1;
+    }
+    close(fd);
+    
+    // 并发写入相同内容时后一次重命名覆盖前一次，内容相同
+    if (rename(temp_path, path) == -1) {
+        fprintf(stderr, "保存外置值失败 %s: %s\n", path, strerror(errno));
+        unlink(temp_path);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// 读取外置值，大小与记录不符时视为损坏。返回的缓冲区由调用者释放
+void* blob_store_get(const char* hash_hex, size_t size) {
+    if (!hash_hex || !blob_store_valid_hash(hash_hex)) {
+        return NULL;
+    }
+    
+    char dir[sizeof(BLOB_DIR) + 4];
+    char path[sizeof(dir) + SHA256_HEX_SIZE + 1];
+    blob_store_path(hash_hex, path, sizeof(path), dir, sizeof(dir));
+    
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "无法打开外置值 %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    
+    struct stat st;
+    unsigned char* buffer = NULL;
+    
+    if (fstat(fileno(file), &st) == 0 && (size_t)st.st_size == size &&
+        (buffer = malloc(size > 0 ? size : 1)) != NULL &&
+        fread(buffer, 1, size, file) != size) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(file);
+    
+    if (!buffer) {
+        fprintf(stderr, "读取外置值失败: %s\n", path);
+    }
+    return buffer;
+}
+
+// 删除不再被引用的外置值，返回删除的文件数。最近BLOB_GC_GRACE秒内写入或复用的文件不删除，
+// 它们的行可能还在写线程的队列中尚未提交
+int blob_store_collect(int (*referenced)(const char* hash_hex)) {
+    DIR* root = opendir(BLOB_DIR);
+    if (!root) {
+        return 0;
+    }
+    
+    time_t horizon = time(NULL) - BLOB_GC_GRACE;
+    int removed = 0;
+    struct dirent* bucket;
+    
+    while ((bucket = readdir(root)) != NULL) {
+        if (strlen(bucket->d_name) != 2 || bucket->d_name[0] == '.') {
+            continue;
+        }
+        
+        char dir[sizeof(BLOB_DIR) + 4];
+        snprintf(dir, sizeof(dir), "%s/%.2s", BLOB_DIR, bucket->d_name);
+        
+        DIR* entries = opendir(dir);
+        if (!entries) {
+            continue;
+        }
+        
+        struct dirent* entry;
+        while ((entry = readdir(entries)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            
+            char path[sizeof(dir) + 256];
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            
+            struct stat st;
+            if (stat(path, &st) != 0 || st.st_mtime > horizon) {
+                continue;
+            }
+            
+            // 没有正确命名的文件是中断写入留下的临时文件
+            int orphan = !blob_store_valid_hash(entry->d_name) || referenced(entry->d_name) == 0;
+            if (orphan && unlink(path) == 0) {
+                removed++;
+            }
+        }
+        
+        closedir(entries);
+        rmdir(dir);  // 子目录为空时才会成功
+    }
+    
+    closedir(root);
+    return removed;
+}
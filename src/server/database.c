@@ -2,8 +2,1444 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <math.h>
 #include <sys/stat.h>
 
+// 预编译语句（database_init时准备一次，之后每次调用只需重置并重新绑定参数）
+typedef enum {
+    STMT_STORE_FIELD_DATA = 0,
+    STMT_CLIENT_CONNECT,
+    STMT_CLIENT_DISCONNECT,
+    STMT_LOG_FILE_UPLOAD,
+    STMT_LOG_SYSTEM_EVENT,
+    STMT_BEGIN,
+    STMT_COMMIT,
+    STMT_ROLLBACK,
+    STMT_COUNT
+} db_statement_id_t;
+
+static const char* g_statement_sql[STMT_COUNT] = {
+    [STMT_STORE_FIELD_DATA] =
+        "INSERT INTO field_data (client_ip, table_name, field_name, data_value, data_size, blob_hash) "
+        "VALUES (?, ?, ?, ?, ?, ?)",
+    [STMT_CLIENT_CONNECT] =
+        "INSERT INTO clients (client_ip, client_version, status) VALUES (?, ?, 'connected')",
+    [STMT_CLIENT_DISCONNECT] =
+        "UPDATE clients SET disconnect_time = CURRENT_TIMESTAMP, status = 'disconnected' "
+        "WHERE client_ip = ? AND status = 'connected'",
+    [STMT_LOG_FILE_UPLOAD] =
+        "INSERT INTO file_uploads (client_ip, filename, file_size, file_path) "
+        "VALUES (?, ?, ?, ?)",
+    [STMT_LOG_SYSTEM_EVENT] =
+        "INSERT INTO system_logs (log_level, message, client_ip) "
+        "VALUES (?, ?, ?)",
+    [STMT_BEGIN] = "BEGIN",
+    [STMT_COMMIT] = "COMMIT",
+    [STMT_ROLLBACK] = "ROLLBACK"
+};
+
+// 语句缓存（写连接，由db_mutex保护）
+static sqlite3_stmt* g_statements[STMT_COUNT];
+
+// 只读连接上的预编译语句（每个连接各自准备一份）
+typedef enum {
+    READ_STMT_LATEST_VERSION = 0,
+    READ_STMT_QUERY_FIELD,
+    READ_STMT_QUERY_TABLE,
+    READ_STMT_TABLE_COLUMNS,
+    READ_STMT_RELEASE_PACKAGES,
+    READ_STMT_COUNT
+} db_read_statement_id_t;
+
+static const char* g_read_statement_sql[READ_STMT_COUNT] = {
+    [READ_STMT_LATEST_VERSION] =
+        "SELECT version, rollout_percent FROM version_info WHERE is_latest = 1 LIMIT 1",
+    // 参数: ?1表名 ?2字段名（不按字段查询时不使用） ?3/?4时间范围 ?5/?6游标 ?7行数；
+    // 时间条件都写成upload_time与常量比较，使(table_name, field_name, upload_time)索引可以做范围扫描。
+    // blob_hash不为NULL时data_value只是预览，完整的值在外置文件中
+    [READ_STMT_QUERY_FIELD] =
+        "SELECT id, field_name, CAST(strftime('%s', upload_time) AS INTEGER), data_value, data_size, blob_hash "
+        "FROM field_data WHERE table_name = ?1 AND field_name = ?2 "
+        "AND upload_time >= datetime(?3, 'unixepoch') AND upload_time < datetime(?4, 'unixepoch') "
+        "AND upload_time >= datetime(?5, 'unixepoch') "
+        "AND (upload_time > datetime(?5, 'unixepoch') OR id > ?6) "
+        "ORDER BY upload_time, id LIMIT ?7",
+    [READ_STMT_QUERY_TABLE] =
+        "SELECT id, field_name, CAST(strftime('%s', upload_time) AS INTEGER), data_value, data_size, blob_hash "
+        "FROM field_data WHERE table_name = ?1 "
+        "AND upload_time >= datetime(?3, 'unixepoch') AND upload_time < datetime(?4, 'unixepoch') "
+        "AND upload_time >= datetime(?5, 'unixepoch') "
+        "AND (upload_time > datetime(?5, 'unixepoch') OR id > ?6) "
+        "ORDER BY upload_time, id LIMIT ?7",
+    [READ_STMT_TABLE_COLUMNS] =
+        "SELECT name FROM pragma_table_info(?) ORDER BY cid",
+    // 参数: ?1最新版本 ?2行数
+    [READ_STMT_RELEASE_PACKAGES] =
+        "SELECT version, update_file_path FROM version_info "
+        "WHERE version <> ?1 AND update_file_path IS NOT NULL AND update_file_path <> '' "
+        "ORDER BY id DESC LIMIT ?2"
+};
+
+// 只读连接
+typedef struct {
+    sqlite3* db;
+    sqlite3_stmt* statements[READ_STMT_COUNT];
+} db_reader_t;
+
+// 只读连接池：读取时取出一个空闲连接，用完归还
+static struct {
+    db_reader_t readers[DB_READ_POOL_SIZE];
+    db_reader_t* idle[DB_READ_POOL_SIZE];
+    int idle_count;
+    int count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int started;
+} g_read_pool;
+
+// 准备所有缓存的语句
+static int database_prepare_statements() {
+    for (int i = 0; i < STMT_COUNT; i++) {
+        int rc = sqlite3_prepare_v3(g_server.database, g_statement_sql[i], -1,
+                                    SQLITE_PREPARE_PERSISTENT, &g_statements[i], NULL);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "准备SQL语句失败: %s\n", sqlite3_errmsg(g_server.database));
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+// 释放所有缓存的语句
+static void database_finalize_statements() {
+    for (int i = 0; i < STMT_COUNT; i++) {
+        if (g_statements[i]) {
+            sqlite3_finalize(g_statements[i]);
+            g_statements[i] = NULL;
+        }
+    }
+}
+
+// 写请求最多绑定的参数个数
+#define DB_MAX_PARAMS 6
+
+// 写请求参数类型
+typedef enum {
+    DB_PARAM_NULL = 0,
+    DB_PARAM_TEXT,
+    DB_PARAM_BLOB,
+    DB_PARAM_INT64
+} db_param_type_t;
+
+typedef struct {
+    db_param_type_t type;
+    const void* data;         // TEXT/BLOB数据（即发即弃的请求指向请求自己持有的副本）
+    size_t size;              // BLOB大小
+    sqlite3_int64 value;      // INT64值
+} db_param_t;
+
+// 完成句柄：需要持久化保证的调用者在栈上创建并等待写线程提交后通知
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int done;
+    int result;
+} db_completion_t;
+
+// 写请求（写线程按批次在一个事务中执行）
+typedef struct db_write_request {
+    db_statement_id_t statement;
+    db_param_t params[DB_MAX_PARAMS];
+    int param_count;
+    db_completion_t* completion;       // NULL表示即发即弃
+    struct db_write_request* next;
+    char storage[];                    // 即发即弃请求的参数副本
+} db_write_request_t;
+
+// 写线程状态
+static struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    db_write_request_t* head;
+    db_write_request_t* tail;
+    int count;
+    int running;
+    int started;
+} g_writer;
+
+// 系统日志队列的一个槽位。sequence等于入队位置时槽位空闲，等于入队位置+1时已写入、可以取出
+typedef struct {
+    unsigned long sequence;
+    char level[16];
+    char client_ip[64];       // 空字符串表示NULL
+    char message[DB_LOG_MESSAGE_LEN];
+} db_log_slot_t;
+
+// 系统日志队列（有界多生产者单消费者环形队列）和日志线程状态
+static struct {
+    db_log_slot_t slots[DB_LOG_QUEUE_SIZE];
+    unsigned long enqueue_pos __attribute__((aligned(64)));  // 生产者竞争的位置，与消费者位置分开缓存行
+    unsigned long dequeue_pos __attribute__((aligned(64)));  // 只由日志线程访问
+    long long written;        // 已写入的行数（原子访问）
+    long long dropped;        // 队列满时丢弃的行数（原子访问）
+    long long reported;       // 已经记录到system_logs中的丢弃数（日志线程）
+    pthread_t thread;
+    int running;
+    int started;
+} g_log_queue;
+
+// 存储配置：启动时应用的日志模式和PRAGMA组合
+typedef struct {
+    const char* name;
+    const char* description;
+    const char* journal_mode;
+    const char* synchronous;
+    sqlite3_int64 mmap_size;  // 内存映射大小（字节）
+    int cache_size_kb;        // 页缓存大小（KB）
+    const char* temp_store;
+} db_profile_t;
+
+static const db_profile_t g_profiles[] = {
+    { "compat",   "回滚日志，SQLite默认设置（与旧版本一致）",
+      "DELETE", "FULL",   0,                   2000,  "DEFAULT" },
+    { "safe",     "WAL，每次提交都刷盘",
+      "WAL",    "FULL",   64 * 1024 * 1024,    16384, "MEMORY" },
+    { "balanced", "WAL，只在检查点时刷盘，断电可能丢失最近提交但不会损坏",
+      "WAL",    "NORMAL", 64 * 1024 * 1024,    16384, "MEMORY" },
+    { "fast",     "WAL，不刷盘，仅适用于可重建的数据",
+      "WAL",    "OFF",    256 * 1024 * 1024,   65536, "MEMORY" }
+};
+
+#define DB_PROFILE_COUNT (int)(sizeof(g_profiles) / sizeof(g_profiles[0]))
+
+static const db_profile_t* g_profile = NULL;
+
+// WAL检查点线程状态
+static struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int wal_pages;            // 最近一次提交后WAL中的页数
+    int requested;            // WAL页数达到阈值，需要立即检查点
+    int running;
+    int started;
+} g_checkpointer;
+
+// version_info修改监听（由db_mutex保护）：写连接上修改version_info的事务提交后调用
+static void (*g_version_listener)(void) = NULL;
+static int g_version_changed = 0;
+
+// 物化表：每个逻辑表（table_name）一张真实的表，每个字段一列，首次写入时创建，新字段出现时ALTER TABLE加列。
+// 表名为MATERIALIZED_TABLE_PREFIX加逻辑表名；保留列以'_'开头，以'_'开头的字段名对应的列名再加一个'_'。
+// SQLite的列名不区分大小写，与已有的列只有大小写不同的字段使用列名'_<序号>_<字段名>'。
+// 字段列不声明类型（没有类型亲和性），值按推断的存储类型写入，文本不会被转换成数值
+#define MATERIALIZED_TABLE_PREFIX "data_"
+
+// 物化表中的一列（字段）
+typedef struct materialized_column {
+    char* field_name;
+    char* column_name;
+    sqlite3_stmt* insert;     // 插入语句（首次写入该字段时准备）
+    struct materialized_column* next;
+} materialized_column_t;
+
+// 已确认存在的物化表
+typedef struct materialized_table {
+    char* table_name;
+    materialized_column_t* columns;
+    struct materialized_table* next;
+} materialized_table_t;
+
+// 物化开关和表结构缓存（写连接，由db_mutex保护）
+static int g_materialize = 0;
+static materialized_table_t* g_materialized_tables = NULL;
+
+// 取出缓存的语句（调用时持有db_mutex）
+static sqlite3_stmt* database_statement(db_statement_id_t id) {
+    sqlite3_stmt* stmt = g_statements[id];
+    if (!stmt) {
+        fprintf(stderr, "SQL语句未准备: %d\n", id);
+    }
+    return stmt;
+}
+
+// 使用完毕后重置语句并清除绑定，释放读锁且不保留对调用者缓冲区的引用（调用时持有db_mutex）
+static void database_release_statement(sqlite3_stmt* stmt) {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+// 设置写请求参数
+static void db_param_text(db_write_request_t* request, const char* text) {
+    db_param_t* param = &request->params[request->param_count++];
+    param->type = text ? DB_PARAM_TEXT : DB_PARAM_NULL;
+    param->data = text;
+    param->size = text ? strlen(text) : 0;
+}
+
+static void db_param_blob(db_write_request_t* request, const void* data, size_t size) {
+    db_param_t* param = &request->params[request->param_count++];
+    param->type = DB_PARAM_BLOB;
+    param->data = data;
+    param->size = size;
+}
+
+static void db_param_null(db_write_request_t* request) {
+    db_param_t* param = &request->params[request->param_count++];
+    param->type = DB_PARAM_NULL;
+}
+
+static void db_param_int64(db_write_request_t* request, sqlite3_int64 value) {
+    db_param_t* param = &request->params[request->param_count++];
+    param->type = DB_PARAM_INT64;
+    param->value = value;
+}
+
+// 为即发即弃请求复制参数数据，调用者的缓冲区在返回后即可释放
+static db_write_request_t* db_request_detach(const db_write_request_t* request) {
+    size_t storage_size = 0;
+    for (int i = 0; i < request->param_count; i++) {
+        if (request->params[i].type == DB_PARAM_TEXT || request->params[i].type == DB_PARAM_BLOB) {
+            storage_size += request->params[i].size + 1;
+        }
+    }
+    
+    db_write_request_t* copy = malloc(sizeof(db_write_request_t) + storage_size);
+    if (!copy) {
+        return NULL;
+    }
+    
+    memcpy(copy, request, sizeof(db_write_request_t));
+    
+    char* storage = copy->storage;
+    for (int i = 0; i < copy->param_count; i++) {
+        db_param_t* param = &copy->params[i];
+        if (param->type == DB_PARAM_TEXT || param->type == DB_PARAM_BLOB) {
+            memcpy(storage, param->data, param->size);
+            storage[param->size] = '\0';
+            param->data = storage;
+            storage += param->size + 1;
+        }
+    }
+    
+    return copy;
+}
+
+// 字段名对应的列名（调用者sqlite3_free）
+static char* materialized_column_name(const char* field_name) {
+    return sqlite3_mprintf("%s%s", field_name[0] == '_' ? "_" : "", field_name);
+}
+
+// 释放表结构缓存（事务回滚后缓存可能与实际表结构不一致，下次写入时重新加载，调用时持有db_mutex）
+static void materialized_reset() {
+    while (g_materialized_tables) {
+        materialized_table_t* table = g_materialized_tables;
+        g_materialized_tables = table->next;
+        
+        while (table->columns) {
+            materialized_column_t* column = table->columns;
+            table->columns = column->next;
+            if (column->insert) {
+                sqlite3_finalize(column->insert);
+            }
+            free(column->field_name);
+            free(column->column_name);
+            free(column);
+        }
+        
+        free(table->table_name);
+        free(table);
+    }
+}
+
+// 列名对应的字段名，保留列返回NULL
+static const char* materialized_field_name(const char* column_name) {
+    if (column_name[0] != '_') {
+        return column_name;
+    }
+    if (column_name[1] == '_') {
+        return column_name + 1;
+    }
+    
+    // 与其他字段只有大小写不同的字段：_<序号>_<字段名>
+    const char* p = column_name + 1;
+    while (isdigit((unsigned char)*p)) {
+        p++;
+    }
+    return (p > column_name + 1 && *p == '_') ? p + 1 : NULL;
+}
+
+// 在缓存中登记一列
+static materialized_column_t* materialized_add_column(materialized_table_t* table, const char* field_name,
+                                                      const char* column_name) {
+    materialized_column_t* column = calloc(1, sizeof(materialized_column_t));
+    if (!column || !(column->field_name = strdup(field_name)) ||
+        !(column->column_name = strdup(column_name))) {
+        if (column) {
+            free(column->field_name);
+        }
+        free(column);
+        return NULL;
+    }
+    
+    column->next = table->columns;
+    table->columns = column;
+    return column;
+}
+
+// 执行一条动态生成的SQL（调用者已用sqlite3_mprintf生成，本函数负责释放）
+static int materialized_exec(char* sql) {
+    if (!sql) {
+        return -1;
+    }
+    
+    char* error_msg = NULL;
+    int rc = sqlite3_exec(g_server.database, sql, NULL, NULL, &error_msg);
+    sqlite3_free(sql);
+    
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "物化表操作失败: %s\n", error_msg);
+        sqlite3_free(error_msg);
+        return -1;
+    }
+    return 0;
+}
+
+// 取得物化表，不存在时创建表和上传时间索引并加载已有的列（调用时持有db_mutex）
+static materialized_table_t* materialized_table(const char* table_name) {
+    for (materialized_table_t* table = g_materialized_tables; table; table = table->next) {
+        if (strcmp(table->table_name, table_name) == 0) {
+            return table;
+        }
+    }
+    
+    if (materialized_exec(sqlite3_mprintf(
+            "CREATE TABLE IF NOT EXISTS \"" MATERIALIZED_TABLE_PREFIX "%w\" ("
+            "_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "_client_ip TEXT,"
+            "_upload_time DATETIME DEFAULT CURRENT_TIMESTAMP);"
+            "CREATE INDEX IF NOT EXISTS \"" MATERIALIZED_TABLE_PREFIX "%w_upload_time\" "
+            "ON \"" MATERIALIZED_TABLE_PREFIX "%w\" (_upload_time);",
+            table_name, table_name, table_name)) != 0) {
+        return NULL;
+    }
+    
+    materialized_table_t* table = calloc(1, sizeof(materialized_table_t));
+    if (!table || !(table->table_name = strdup(table_name))) {
+        free(table);
+        return NULL;
+    }
+    table->next = g_materialized_tables;
+    g_materialized_tables = table;
+    
+    // 加载已有的字段列
+    char* sql = sqlite3_mprintf("SELECT name FROM pragma_table_info('" MATERIALIZED_TABLE_PREFIX "%q')", table_name);
+    sqlite3_stmt* stmt = NULL;
+    if (sql && sqlite3_prepare_v2(g_server.database, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* name = (const char*)sqlite3_column_text(stmt, 0);
+            const char* field_name = name ? materialized_field_name(name) : NULL;
+            if (field_name) {
+                materialized_add_column(table, field_name, name);
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_free(sql);
+    
+    return table;
+}
+
+// 为新字段选择列名：与已有的列只有大小写不同时改用带序号的列名（调用者sqlite3_free）
+static char* materialized_new_column_name(const materialized_table_t* table, const char* field_name) {
+    char* column_name = materialized_column_name(field_name);
+    
+    for (int n = 1; column_name; n++) {
+        const materialized_column_t* column = table->columns;
+        while (column && sqlite3_stricmp(column->column_name, column_name) != 0) {
+            column = column->next;
+        }
+        if (!column) {
+            break;
+        }
+        sqlite3_free(column_name);
+        column_name = sqlite3_mprintf("_%d_%s", n, field_name);
+    }
+    return column_name;
+}
+
+// 浮点数的最短往返文本（写入和读取物化表使用同一格式，保证取回的文本与上传的一致）
+static void materialized_format_real(double value, char* buffer, size_t size) {
+    for (int precision = 1; precision <= 17; precision++) {
+        snprintf(buffer, size, "%.*g", precision, value);
+        if (strtod(buffer, NULL) == value) {
+            return;
+        }
+    }
+}
+
+// 推断字段值的存储类型：整数、浮点数、文本或二进制（数值类型同时输出解析结果）
+static int materialized_value_type(const void* data, size_t size, long long* integer_value, double* real_value) {
+    const char* text = (const char*)data;
+    char buffer[64];
+    
+    if (size > 0 && size < sizeof(buffer)) {
+        memcpy(buffer, text, size);
+        buffer[size] = '\0';
+        
+        // 只接受规范写法的整数，保证取回的文本与上传的一致
+        char* end;
+        errno = 0;
+        long long integer = strtoll(buffer, &end, 10);
+        if (*end == '\0' && errno == 0) {
+            char canonical[32];
+            snprintf(canonical, sizeof(canonical), "%lld", integer);
+            if (strcmp(canonical, buffer) == 0) {
+                *integer_value = integer;
+                return SQLITE_INTEGER;
+            }
+        }
+        
+        // 浮点数同样只接受按最短往返格式写出的（例如"1.50"、"1e3"仍按文本存储）
+        double real = strtod(buffer, &end);
+        if (*end == '\0' && end != buffer && isfinite(real)) {
+            char canonical[32];
+            materialized_format_real(real, canonical, sizeof(canonical));
+            if (strcmp(canonical, buffer) == 0) {
+                *real_value = real;
+                return SQLITE_FLOAT;
+            }
+        }
+    }
+    
+    for (size_t i = 0; i < size; i++) {
+        if (text[i] == '\0') {
+            return SQLITE_BLOB;
+        }
+    }
+    return SQLITE_TEXT;
+}
+
+// 把字段数据写入物化表（调用时持有db_mutex，在写线程的批次事务中执行）
+static int materialized_store(const db_write_request_t* request) {
+    const char* client_ip = (const char*)request->params[0].data;
+    const char* table_name = (const char*)request->params[1].data;
+    const char* field_name = (const char*)request->params[2].data;
+    const void* data = request->params[3].data;
+    size_t data_size = request->params[3].size;
+    
+    materialized_table_t* table = materialized_table(table_name);
+    if (!table) {
+        return -1;
+    }
+    
+    materialized_column_t* column = NULL;
+    for (materialized_column_t* entry = table->columns; entry; entry = entry->next) {
+        if (strcmp(entry->field_name, field_name) == 0) {
+            column = entry;
+            break;
+        }
+    }
+    
+    long long integer_value = 0;
+    double real_value = 0;
+    int value_type = materialized_value_type(data, data_size, &integer_value, &real_value);
+    
+    // 新字段：加一个不声明类型的列，同一列中可以混合存放数值和文本
+    if (!column) {
+        char* column_name = materialized_new_column_name(table, field_name);
+        int result = materialized_exec(sqlite3_mprintf(
+            "ALTER TABLE \"" MATERIALIZED_TABLE_PREFIX "%w\" ADD COLUMN \"%w\"",
+            table_name, column_name));
+        
+        if (result == 0) {
+            column = materialized_add_column(table, field_name, column_name);
+        }
+        sqlite3_free(column_name);
+        if (!column) {
+            return -1;
+        }
+    }
+    
+    if (!column->insert) {
+        char* sql = sqlite3_mprintf(
+            "INSERT INTO \"" MATERIALIZED_TABLE_PREFIX "%w\" (_client_ip, \"%w\") VALUES (?, ?)",
+            table_name, column->column_name);
+        
+        int rc = sql ? sqlite3_prepare_v3(g_server.database, sql, -1, SQLITE_PREPARE_PERSISTENT,
+                                          &column->insert, NULL) : SQLITE_NOMEM;
+        sqlite3_free(sql);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "准备SQL语句失败: %s\n", sqlite3_errmsg(g_server.database));
+            return -1;
+        }
+    }
+    
+    sqlite3_stmt* stmt = column->insert;
+    sqlite3_bind_text(stmt, 1, client_ip, -1, SQLITE_STATIC);
+    
+    switch (value_type) {
+        case SQLITE_INTEGER:
+            sqlite3_bind_int64(stmt, 2, integer_value);
+            break;
+        case SQLITE_FLOAT:
+            sqlite3_bind_double(stmt, 2, real_value);
+            break;
+        case SQLITE_TEXT:
+            sqlite3_bind_text(stmt, 2, data, (int)data_size, SQLITE_STATIC);
+            break;
+        default:
+            sqlite3_bind_blob(stmt, 2, data, (int)data_size, SQLITE_STATIC);
+            break;
+    }
+    
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "执行SQL语句失败: %s\n", sqlite3_errmsg(g_server.database));
+    }
+    
+    database_release_statement(stmt);
+    return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+// 绑定参数并执行一条写请求（调用时持有db_mutex）
+static int db_execute_request(const db_write_request_t* request) {
+    // 开启物化时字段数据写入对应的物化表
+    if (g_materialize && request->statement == STMT_STORE_FIELD_DATA) {
+        return materialized_store(request);
+    }
+    
+    sqlite3_stmt* stmt = database_statement(request->statement);
+    if (!stmt) {
+        return -1;
+    }
+    
+    for (int i = 0; i < request->param_count; i++) {
+        const db_param_t* param = &request->params[i];
+        switch (param->type) {
+            case DB_PARAM_TEXT:
+                sqlite3_bind_text(stmt, i + 1, param->data, (int)param->size, SQLITE_STATIC);
+                break;
+            case DB_PARAM_BLOB:
+                sqlite3_bind_blob(stmt, i + 1, param->data, (int)param->size, SQLITE_STATIC);
+                break;
+            case DB_PARAM_INT64:
+                sqlite3_bind_int64(stmt, i + 1, param->value);
+                break;
+            default:
+                sqlite3_bind_null(stmt, i + 1);
+                break;
+        }
+    }
+    
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "执行SQL语句失败: %s\n", sqlite3_errmsg(g_server.database));
+    }
+    
+    database_release_statement(stmt);
+    return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+// 执行不带参数的缓存语句（BEGIN/COMMIT/ROLLBACK，调用时持有db_mutex）
+static int db_execute_simple(db_statement_id_t id) {
+    sqlite3_stmt* stmt = database_statement(id);
+    if (!stmt) {
+        return -1;
+    }
+    
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "执行SQL语句失败: %s\n", sqlite3_errmsg(g_server.database));
+    }
+    
+    database_release_statement(stmt);
+    return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+// 通知请求完成并释放即发即弃请求
+static void db_complete_request(db_write_request_t* request, int result) {
+    if (request->completion) {
+        db_completion_t* completion = request->completion;
+        pthread_mutex_lock(&completion->mutex);
+        completion->result = result;
+        completion->done = 1;
+        pthread_cond_signal(&completion->cond);
+        pthread_mutex_unlock(&completion->mutex);
+    } else {
+        free(request);
+    }
+}
+
+// 在一个事务中提交一批写请求
+static void db_commit_batch(db_write_request_t* batch, int count) {
+    int results[DB_BATCH_MAX_ROWS];
+    int index = 0;
+    
+    pthread_mutex_lock(&g_server.db_mutex);
+    
+    int in_transaction = (db_execute_simple(STMT_BEGIN) == 0);
+    
+    for (db_write_request_t* request = batch; request && index < count; request = request->next) {
+        results[index++] = db_execute_request(request);
+    }
+    
+    // 提交失败时整批回滚，所有请求都视为失败
+    int commit_result = 0;
+    if (in_transaction && db_execute_simple(STMT_COMMIT) != 0) {
+        if (!sqlite3_get_autocommit(g_server.database)) {
+            db_execute_simple(STMT_ROLLBACK);
+        }
+        commit_result = -1;
+        
+        // 回滚会撤销本批次中的建表和加列
+        materialized_reset();
+    }
+    
+    // 提交后再通知，保证监听者从只读连接上能读到新数据
+    if (g_version_changed) {
+        g_version_changed = 0;
+        if (commit_result == 0 && g_version_listener) {
+            g_version_listener();
+        }
+    }
+    
+    pthread_mutex_unlock(&g_server.db_mutex);
+    
+    index = 0;
+    db_write_request_t* request = batch;
+    while (request && index < count) {
+        db_write_request_t* next = request->next;
+        db_complete_request(request, commit_result != 0 ? -1 : results[index]);
+        index++;
+        request = next;
+    }
+}
+
+// 数据库写线程：收集写请求，按行数或时间上限组成批次后一次提交
+static void* database_writer_thread(void* arg) {
+    (void)arg;
+    
+    pthread_mutex_lock(&g_writer.mutex);
+    
+    while (1) {
+        while (g_writer.running && !g_writer.head) {
+            pthread_cond_wait(&g_writer.cond, &g_writer.mutex);
+        }
+        
+        // 停止时先处理完队列中剩余的请求
+        if (!g_writer.head) {
+            break;
+        }
+        
+        // 从第一个请求到达起最多再等待DB_BATCH_MAX_DELAY_MS，让后续请求加入同一批次
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += DB_BATCH_MAX_DELAY_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        
+        while (g_writer.running && g_writer.count < DB_BATCH_MAX_ROWS) {
+            if (pthread_cond_timedwait(&g_writer.cond, &g_writer.mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        
+        // 取出一批请求
+        db_write_request_t* batch = g_writer.head;
+        db_write_request_t* last = batch;
+        int count = 1;
+        while (last->next && count < DB_BATCH_MAX_ROWS) {
+            last = last->next;
+            count++;
+        }
+        
+        g_writer.head = last->next;
+        if (!g_writer.head) {
+            g_writer.tail = NULL;
+        }
+        g_writer.count -= count;
+        last->next = NULL;
+        
+        pthread_mutex_unlock(&g_writer.mutex);
+        db_commit_batch(batch, count);
+        pthread_mutex_lock(&g_writer.mutex);
+    }
+    
+    pthread_mutex_unlock(&g_writer.mutex);
+    return NULL;
+}
+
+// 启动数据库写线程
+static int database_writer_start() {
+    memset(&g_writer, 0, sizeof(g_writer));
+    
+    if (pthread_mutex_init(&g_writer.mutex, NULL) != 0) {
+        perror("pthread_mutex_init writer");
+        return -1;
+    }
+    
+    if (pthread_cond_init(&g_writer.cond, NULL) != 0) {
+        perror("pthread_cond_init writer");
+        pthread_mutex_destroy(&g_writer.mutex);
+        return -1;
+    }
+    
+    g_writer.running = 1;
+    if (pthread_create(&g_writer.thread, NULL, database_writer_thread, NULL) != 0) {
+        perror("pthread_create writer");
+        g_writer.running = 0;
+        pthread_cond_destroy(&g_writer.cond);
+        pthread_mutex_destroy(&g_writer.mutex);
+        return -1;
+    }
+    
+    g_writer.started = 1;
+    return 0;
+}
+
+// 停止数据库写线程（先提交队列中剩余的请求）
+static void database_writer_stop() {
+    if (!g_writer.started) {
+        return;
+    }
+    
+    pthread_mutex_lock(&g_writer.mutex);
+    g_writer.running = 0;
+    pthread_cond_broadcast(&g_writer.cond);
+    pthread_mutex_unlock(&g_writer.mutex);
+    
+    pthread_join(g_writer.thread, NULL);
+    
+    pthread_cond_destroy(&g_writer.cond);
+    pthread_mutex_destroy(&g_writer.mutex);
+    g_writer.started = 0;
+}
+
+// 提交写请求。wait为1时阻塞到所在批次提交完成并返回执行结果；
+// 为0时复制参数后立即返回（即发即弃，适用于日志类写入）
+static int database_submit(const db_write_request_t* request, int wait) {
+    db_completion_t completion;
+    db_write_request_t* queued;
+    
+    if (wait) {
+        pthread_mutex_init(&completion.mutex, NULL);
+        pthread_cond_init(&completion.cond, NULL);
+        completion.done = 0;
+        completion.result = -1;
+        
+        // 调用者的缓冲区在等待期间保持有效，无需复制
+        queued = malloc(sizeof(db_write_request_t));
+        if (queued) {
+            memcpy(queued, request, sizeof(db_write_request_t));
+            queued->completion = &completion;
+        }
+    } else {
+        queued = db_request_detach(request);
+        if (queued) {
+            queued->completion = NULL;
+        }
+    }
+    
+    if (!queued) {
+        fprintf(stderr, "分配数据库写请求失败\n");
+        if (wait) {
+            pthread_cond_destroy(&completion.cond);
+            pthread_mutex_destroy(&completion.mutex);
+        }
+        return -1;
+    }
+    queued->next = NULL;
+    
+    pthread_mutex_lock(&g_writer.mutex);
+    
+    if (!g_writer.running) {
+        pthread_mutex_unlock(&g_writer.mutex);
+        free(queued);
+        if (wait) {
+            pthread_cond_destroy(&completion.cond);
+            pthread_mutex_destroy(&completion.mutex);
+        }
+        return -1;
+    }
+    
+    if (g_writer.tail) {
+        g_writer.tail->next = queued;
+    } else {
+        g_writer.head = queued;
+    }
+    g_writer.tail = queued;
+    g_writer.count++;
+    
+    // 队列从空变为非空或攒满一批时唤醒写线程
+    if (g_writer.count == 1 || g_writer.count >= DB_BATCH_MAX_ROWS) {
+        pthread_cond_signal(&g_writer.cond);
+    }
+    
+    pthread_mutex_unlock(&g_writer.mutex);
+    
+    if (!wait) {
+        return 0;
+    }
+    
+    pthread_mutex_lock(&completion.mutex);
+    while (!completion.done) {
+        pthread_cond_wait(&completion.cond, &completion.mutex);
+    }
+    int result = completion.result;
+    pthread_mutex_unlock(&completion.mutex);
+    
+    // 写线程只在完成时通知，持久化请求由等待者释放
+    free(queued);
+    pthread_cond_destroy(&completion.cond);
+    pthread_mutex_destroy(&completion.mutex);
+    
+    return result;
+}
+
+// 日志入队（无锁）：抢占一个空闲槽位写入后发布，队列满时丢弃
+static int db_log_enqueue(const char* level, const char* message, const char* client_ip) {
+    unsigned long pos = __atomic_load_n(&g_log_queue.enqueue_pos, __ATOMIC_RELAXED);
+    db_log_slot_t* slot;
+    
+    while (1) {
+        slot = &g_log_queue.slots[pos & (DB_LOG_QUEUE_SIZE - 1)];
+        long diff = (long)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+        
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&g_log_queue.enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // 槽位还没被日志线程取走：队列已满
+            __atomic_add_fetch(&g_log_queue.dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        } else {
+            pos = __atomic_load_n(&g_log_queue.enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    
+    snprintf(slot->level, sizeof(slot->level), "%s", level);
+    snprintf(slot->message, sizeof(slot->message), "%s", message);
+    snprintf(slot->client_ip, sizeof(slot->client_ip), "%s", client_ip ? client_ip : "");
+    
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// 取出下一条已发布的日志，没有时返回NULL。处理完后调用db_log_release归还槽位
+static db_log_slot_t* db_log_peek() {
+    unsigned long pos = g_log_queue.dequeue_pos;
+    db_log_slot_t* slot = &g_log_queue.slots[pos & (DB_LOG_QUEUE_SIZE - 1)];
+    
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+        return NULL;
+    }
+    return slot;
+}
+
+static void db_log_release(db_log_slot_t* slot) {
+    unsigned long pos = g_log_queue.dequeue_pos++;
+    __atomic_store_n(&slot->sequence, pos + DB_LOG_QUEUE_SIZE, __ATOMIC_RELEASE);
+}
+
+// 执行一条日志插入（调用时持有db_mutex）
+static int db_log_insert(const char* level, const char* message, const char* client_ip) {
+    sqlite3_stmt* stmt = database_statement(STMT_LOG_SYSTEM_EVENT);
+    if (!stmt) {
+        return -1;
+    }
+    
+    sqlite3_bind_text(stmt, 1, level, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, message, -1, SQLITE_STATIC);
+    if (client_ip && client_ip[0]) {
+        sqlite3_bind_text(stmt, 3, client_ip, -1, SQLITE_STATIC);
+    }
+    
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "写入系统日志失败: %s\n", sqlite3_errmsg(g_server.database));
+    }
+    
+    database_release_statement(stmt);
+    return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+// 在一个事务中写入队列中的日志（最多DB_BATCH_MAX_ROWS条），返回取出的条数
+static int db_log_flush() {
+    db_log_slot_t* slot = db_log_peek();
+    long long dropped = __atomic_load_n(&g_log_queue.dropped, __ATOMIC_RELAXED);
+    
+    if (!slot && dropped == g_log_queue.reported) {
+        return 0;
+    }
+    
+    int count = 0;
+    int inserted = 0;
+    
+    pthread_mutex_lock(&g_server.db_mutex);
+    int in_transaction = (db_execute_simple(STMT_BEGIN) == 0);
+    
+    for (; slot && count < DB_BATCH_MAX_ROWS; slot = db_log_peek()) {
+        if (db_log_insert(slot->level, slot->message, slot->client_ip) == 0) {
+            inserted++;
+        }
+        db_log_release(slot);
+        count++;
+    }
+    
+    // 新的丢弃也记一条日志，便于发现数据库跟不上
+    if (dropped != g_log_queue.reported) {
+        char message[128];
+        snprintf(message, sizeof(message), "系统日志队列已满，丢弃了 %lld 条日志",
+                 dropped - g_log_queue.reported);
+        if (db_log_insert("WARNING", message, NULL) == 0) {
+            inserted++;
+        }
+        g_log_queue.reported = dropped;
+    }
+    
+    if (in_transaction && db_execute_simple(STMT_COMMIT) != 0) {
+        if (!sqlite3_get_autocommit(g_server.database)) {
+            db_execute_simple(STMT_ROLLBACK);
+        }
+        inserted = 0;
+    }
+    pthread_mutex_unlock(&g_server.db_mutex);
+    
+    __atomic_add_fetch(&g_log_queue.written, inserted, __ATOMIC_RELAXED);
+    return count;
+}
+
+// 日志线程：每隔DB_LOG_FLUSH_MS毫秒把队列中的日志批量写入，停止前写完剩余日志
+static void* database_log_thread(void* arg) {
+    (void)arg;
+    
+    struct timespec interval = { 0, DB_LOG_FLUSH_MS * 1000000L };
+    
+    while (__atomic_load_n(&g_log_queue.running, __ATOMIC_ACQUIRE)) {
+        // 积压超过一批时连续写入
+        if (db_log_flush() < DB_BATCH_MAX_ROWS) {
+            nanosleep(&interval, NULL);
+        }
+    }
+    
+    while (db_log_flush() > 0) {
+    }
+    
+    return NULL;
+}
+
+// 启动系统日志线程
+static int database_log_start() {
+    memset(&g_log_queue, 0, sizeof(g_log_queue));
+    for (unsigned long i = 0; i < DB_LOG_QUEUE_SIZE; i++) {
+        g_log_queue.slots[i].sequence = i;
+    }
+    
+    g_log_queue.running = 1;
+    if (pthread_create(&g_log_queue.thread, NULL, database_log_thread, NULL) != 0) {
+        perror("pthread_create log");
+        g_log_queue.running = 0;
+        return -1;
+    }
+    
+    g_log_queue.started = 1;
+    return 0;
+}
+
+// 停止系统日志线程（先写完队列中的日志）
+static void database_log_stop() {
+    if (!g_log_queue.started) {
+        return;
+    }
+    
+    __atomic_store_n(&g_log_queue.running, 0, __ATOMIC_RELEASE);
+    pthread_join(g_log_queue.thread, NULL);
+    g_log_queue.started = 0;
+}
+
+// 获取系统日志统计
+void database_log_stats(long long* written, long long* dropped) {
+    if (written) {
+        *written = __atomic_load_n(&g_log_queue.written, __ATOMIC_RELAXED);
+    }
+    if (dropped) {
+        *dropped = __atomic_load_n(&g_log_queue.dropped, __ATOMIC_RELAXED);
+    }
+}
+
+// 写连接的行修改回调（持有db_mutex）
+static void database_update_hook(void* arg, int operation, const char* database_name,
+                                 const char* table_name, sqlite3_int64 rowid) {
+    (void)arg;
+    (void)operation;
+    (void)database_name;
+    (void)rowid;
+    
+    if (strcmp(table_name, "version_info") == 0) {
+        g_version_changed = 1;
+    }
+}
+
+// 设置version_info修改监听（NULL表示取消），返回后旧的监听不会再被调用
+void database_set_version_listener(void (*listener)(void)) {
+    pthread_mutex_lock(&g_server.db_mutex);
+    g_version_listener = listener;
+    pthread_mutex_unlock(&g_server.db_mutex);
+}
+
+// 开启或关闭逻辑表物化（database_init之前调用）
+void database_set_materialize(int enabled) {
+    g_materialize = enabled;
+}
+
+// 选择存储配置（database_init之前调用）
+int database_set_profile(const char* name) {
+    for (int i = 0; i < DB_PROFILE_COUNT; i++) {
+        if (strcmp(g_profiles[i].name, name) == 0) {
+            g_profile = &g_profiles[i];
+            return 0;
+        }
+    }
+    
+    return -1;
+}
+
+// 当前存储配置名
+const char* database_profile_name() {
+    if (!g_profile) {
+        database_set_profile(DB_DEFAULT_PROFILE);
+    }
+    return g_profile->name;
+}
+
+// 打印所有存储配置
+void database_print_profiles() {
+    for (int i = 0; i < DB_PROFILE_COUNT; i++) {
+        printf("    %-10s %s\n", g_profiles[i].name, g_profiles[i].description);
+    }
+}
+
+// 应用存储配置
+static int database_apply_profile() {
+    char sql[512];
+    
+    if (!g_profile) {
+        database_set_profile(DB_DEFAULT_PROFILE);
+    }
+    
+    snprintf(sql, sizeof(sql),
+             "PRAGMA journal_mode=%s;"
+             "PRAGMA synchronous=%s;"
+             "PRAGMA mmap_size=%lld;"
+             "PRAGMA cache_size=-%d;"
+             "PRAGMA temp_store=%s;"
+             "PRAGMA journal_size_limit=%d;",
+             g_profile->journal_mode, g_profile->synchronous,
+             (long long)g_profile->mmap_size, g_profile->cache_size_kb,
+             g_profile->temp_store, DB_WAL_SIZE_LIMIT);
+    
+    char* error_msg = NULL;
+    int rc = sqlite3_exec(g_server.database, sql, NULL, NULL, &error_msg);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "应用存储配置失败: %s\n", error_msg);
+        sqlite3_free(error_msg);
+        return -1;
+    }
+    
+    printf("存储配置: %s (%s)\n", g_profile->name, g_profile->description);
+    return 0;
+}
+
+// 是否处于WAL模式
+static int database_is_wal() {
+    sqlite3_stmt* stmt;
+    int wal = 0;
+    
+    if (sqlite3_prepare_v2(g_server.database, "PRAGMA journal_mode", -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* mode = (const char*)sqlite3_column_text(stmt, 0);
+            wal = mode && sqlite3_stricmp(mode, "wal") == 0;
+        }
+        sqlite3_finalize(stmt);
+    }
+    
+    return wal;
+}
+
+// 读取一个整数结果，失败时返回-1
+static int database_query_int(const char* sql) {
+    sqlite3_stmt* stmt;
+    int value = -1;
+    
+    if (sqlite3_prepare_v2(g_server.database, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            value = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    
+    return value;
+}
+
+// 新数据库开启增量自动清理，数据保留线程删除旧行后可以逐步把空闲页归还给文件系统。
+// auto_vacuum只能在建表前设置，已有的数据库需要停服后手动VACUUM一次才能切换
+static void database_enable_incremental_vacuum() {
+    if (database_query_int("PRAGMA auto_vacuum") == 2) {
+        return;
+    }
+    
+    if (database_query_int("SELECT count(*) FROM sqlite_master") == 0) {
+        sqlite3_exec(g_server.database, "PRAGMA auto_vacuum=INCREMENTAL;", NULL, NULL, NULL);
+        return;
+    }
+    
+    printf("提示: 数据库未开启增量清理，删除旧数据后文件不会缩小。"
+           "可在停止服务器后执行: sqlite3 %s \"PRAGMA auto_vacuum=INCREMENTAL; VACUUM;\"\n", DATABASE_PATH);
+}
+
+// WAL提交回调（在写线程中调用，持有db_mutex）：记录WAL页数，达到阈值时唤醒检查点线程。
+// 注册该回调后SQLite不再在提交路径上自动检查点
+static int database_wal_hook(void* arg, sqlite3* db, const char* name, int pages) {
+    (void)arg;
+    (void)db;
+    (void)name;
+    
+    pthread_mutex_lock(&g_checkpointer.mutex);
+    g_checkpointer.wal_pages = pages;
+    if (pages >= DB_CHECKPOINT_PAGES && !g_checkpointer.requested) {
+        g_checkpointer.requested = 1;
+        pthread_cond_signal(&g_checkpointer.cond);
+    }
+    pthread_mutex_unlock(&g_checkpointer.mutex);
+    
+    return SQLITE_OK;
+}
+
+// 检查点线程：按时间间隔或WAL页数阈值做检查点，避免WAL无限增长
+static void* database_checkpoint_thread(void* arg) {
+    (void)arg;
+    
+    pthread_mutex_lock(&g_checkpointer.mutex);
+    
+    while (g_checkpointer.running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += DB_CHECKPOINT_INTERVAL;
+        
+        while (g_checkpointer.running && !g_checkpointer.requested) {
+            if (pthread_cond_timedwait(&g_checkpointer.cond, &g_checkpointer.mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        
+        g_checkpointer.requested = 0;
+        int pages = g_checkpointer.wal_pages;
+        if (!g_checkpointer.running || pages == 0) {
+            continue;
+        }
+        
+        pthread_mutex_unlock(&g_checkpointer.mutex);
+        
+        // 持有db_mutex期间写线程可能调用WAL回调，因此先释放检查点线程自己的锁
+        int mode = pages >= DB_WAL_TRUNCATE_PAGES ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_PASSIVE;
+        int log_pages = 0;
+        int checkpointed = 0;
+        
+        pthread_mutex_lock(&g_server.db_mutex);
+        int rc = sqlite3_wal_checkpoint_v2(g_server.database, NULL, mode, &log_pages, &checkpointed);
+        pthread_mutex_unlock(&g_server.db_mutex);
+        
+        if (rc != SQLITE_OK && rc != SQLITE_BUSY) {
+            fprintf(stderr, "WAL检查点失败: %s\n", sqlite3_errstr(rc));
+        }
+        
+        pthread_mutex_lock(&g_checkpointer.mutex);
+        
+        // 全部回写后下一次写入会从头复用WAL；否则保留剩余页数等待下次检查点
+        if (rc == SQLITE_OK && g_checkpointer.wal_pages == pages) {
+            g_checkpointer.wal_pages = log_pages > checkpointed ? log_pages - checkpointed : 0;
+        }
+    }
+    
+    pthread_mutex_unlock(&g_checkpointer.mutex);
+    return NULL;
+}
+
+// 启动WAL检查点线程
+static int database_checkpointer_start() {
+    memset(&g_checkpointer, 0, sizeof(g_checkpointer));
+    
+    if (pthread_mutex_init(&g_checkpointer.mutex, NULL) != 0) {
+        perror("pthread_mutex_init checkpointer");
+        return -1;
+    }
+    
+    if (pthread_cond_init(&g_checkpointer.cond, NULL) != 0) {
+        perror("pthread_cond_init checkpointer");
+        pthread_mutex_destroy(&g_checkpointer.mutex);
+        return -1;
+    }
+    
+    g_checkpointer.running = 1;
+    if (pthread_create(&g_checkpointer.thread, NULL, database_checkpoint_thread, NULL) != 0) {
+        perror("pthread_create checkpointer");
+        g_checkpointer.running = 0;
+        pthread_cond_destroy(&g_checkpointer.cond);
+        pthread_mutex_destroy(&g_checkpointer.mutex);
+        return -1;
+    }
+    
+    g_checkpointer.started = 1;
+    sqlite3_wal_hook(g_server.database, database_wal_hook, NULL);
+    
+    return 0;
+}
+
+// 停止WAL检查点线程（关闭连接时SQLite会做最后一次检查点）
+static void database_checkpointer_stop() {
+    if (!g_checkpointer.started) {
+        return;
+    }
+    
+    sqlite3_wal_hook(g_server.database, NULL, NULL);
+    
+    pthread_mutex_lock(&g_checkpointer.mutex);
+    g_checkpointer.running = 0;
+    pthread_cond_broadcast(&g_checkpointer.cond);
+    pthread_mutex_unlock(&g_checkpointer.mutex);
+    
+    pthread_join(g_checkpointer.thread, NULL);
+    
+    pthread_cond_destroy(&g_checkpointer.cond);
+    pthread_mutex_destroy(&g_checkpointer.mutex);
+    g_checkpointer.started = 0;
+}
+
+// 关闭一个只读连接
+static void database_reader_close(db_reader_t* reader) {
+    for (int i = 0; i < READ_STMT_COUNT; i++) {
+        if (reader->statements[i]) {
+            sqlite3_finalize(reader->statements[i]);
+            reader->statements[i] = NULL;
+        }
+    }
+    
+    if (reader->db) {
+        sqlite3_close(reader->db);
+        reader->db = NULL;
+    }
+}
+
+// 打开一个只读连接并准备读语句
+static int database_reader_open(db_reader_t* reader) {
+    char sql[128];
+    
+    memset(reader, 0, sizeof(*reader));
+    
+    // 连接只在取出期间被一个线程使用，无需SQLite的连接级互斥
+    int rc = sqlite3_open_v2(DATABASE_PATH, &reader->db,
+                             SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "无法打开只读数据库连接: %s\n", sqlite3_errmsg(reader->db));
+        database_reader_close(reader);
+        return -1;
+    }
+    
+    sqlite3_busy_timeout(reader->db, DB_BUSY_TIMEOUT_MS);
+    
+    snprintf(sql, sizeof(sql), "PRAGMA mmap_size=%lld; PRAGMA cache_size=-%d;",
+             (long long)g_profile->mmap_size, g_profile->cache_size_kb);
+    sqlite3_exec(reader->db, sql, NULL, NULL, NULL);
+    
+    for (int i = 0; i < READ_STMT_COUNT; i++) {
+        rc = sqlite3_prepare_v3(reader->db, g_read_statement_sql[i], -1,
+                                SQLITE_PREPARE_PERSISTENT, &reader->statements[i], NULL);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "准备SQL语句失败: %s\n", sqlite3_errmsg(reader->db));
+            database_reader_close(reader);
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+// 打开只读连接池
+static int database_read_pool_start() {
+    memset(&g_read_pool, 0, sizeof(g_read_pool));
+    
+    if (pthread_mutex_init(&g_read_pool.mutex, NULL) != 0) {
+        perror("pthread_mutex_init read pool");
+        return -1;
+    }
+    
+    if (pthread_cond_init(&g_read_pool.cond, NULL) != 0) {
+        perror("pthread_cond_init read pool");
+        pthread_mutex_destroy(&g_read_pool.mutex);
+        return -1;
+    }
+    
+    g_read_pool.started = 1;
+    
+    for (int i = 0; i < DB_READ_POOL_SIZE; i++) {
+        if (database_reader_open(&g_read_pool.readers[i]) != 0) {
+            return -1;
+        }
+        g_read_pool.idle[g_read_pool.idle_count++] = &g_read_pool.readers[i];
+        g_read_pool.count++;
+    }
+    
+    return 0;
+}
+
+// 关闭只读连接池（调用前所有读取必须已经结束）
+static void database_read_pool_stop() {
+    if (!g_read_pool.started) {
+        return;
+    }
+    
+    for (int i = 0; i < g_read_pool.count; i++) {
+        database_reader_close(&g_read_pool.readers[i]);
+    }
+    
+    pthread_cond_destroy(&g_read_pool.cond);
+    pthread_mutex_destroy(&g_read_pool.mutex);
+    g_read_pool.started = 0;
+}
+
+// 取出一个空闲的只读连接，全部被占用时等待归还
+static db_reader_t* database_reader_acquire() {
+    if (!g_read_pool.started) {
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&g_read_pool.mutex);
+    while (g_read_pool.idle_count == 0) {
+        pthread_cond_wait(&g_read_pool.cond, &g_read_pool.mutex);
+    }
+    db_reader_t* reader = g_read_pool.idle[--g_read_pool.idle_count];
+    pthread_mutex_unlock(&g_read_pool.mutex);
+    
+    return reader;
+}
+
+// 归还只读连接
+static void database_reader_release(db_reader_t* reader) {
+    pthread_mutex_lock(&g_read_pool.mutex);
+    g_read_pool.idle[g_read_pool.idle_count++] = reader;
+    pthread_cond_signal(&g_read_pool.cond);
+    pthread_mutex_unlock(&g_read_pool.mutex);
+}
+
 // 初始化数据库
 int database_init() {
     // 创建数据库目录
@@ -26,6 +1462,18 @@ int database_init() {
     
     printf("数据库连接成功: %s\n", DATABASE_PATH);
     
+    sqlite3_busy_timeout(g_server.database, DB_BUSY_TIMEOUT_MS);
+    sqlite3_update_hook(g_server.database, database_update_hook, NULL);
+    
+    // 必须在设置日志模式和建表之前
+    database_enable_incremental_vacuum();
+    
+    // 应用存储配置
+    if (database_apply_profile() != 0) {
+        database_cleanup();
+        return -1;
+    }
+    
     // 创建表
     if (database_create_tables() != 0) {
         fprintf(stderr, "创建数据库表失败\n");
@@ -33,12 +1481,57 @@ int database_init() {
         return -1;
     }
     
+    // 准备语句缓存
+    pthread_mutex_lock(&g_server.db_mutex);
+    int prepare_result = database_prepare_statements();
+    pthread_mutex_unlock(&g_server.db_mutex);
+    
+    if (prepare_result != 0) {
+        database_cleanup();
+        return -1;
+    }
+    
+    // 表创建完成后再打开只读连接
+    if (database_read_pool_start() != 0) {
+        database_cleanup();
+        return -1;
+    }
+    
+    // WAL模式下由后台线程负责检查点
+    if (database_is_wal() && database_checkpointer_start() != 0) {
+        database_cleanup();
+        return -1;
+    }
+    
+    // 启动组提交写线程
+    if (database_writer_start() != 0) {
+        database_cleanup();
+        return -1;
+    }
+    
+    // 启动系统日志线程
+    if (database_log_start() != 0) {
+        database_cleanup();
+        return -1;
+    }
+    
     return 0;
 }
 
 // 清理数据库资源
 void database_cleanup() {
+    // 先停止写线程和日志线程，确保排队中的写入已提交
+    database_log_stop();
+    database_writer_stop();
+    database_checkpointer_stop();
+    database_read_pool_stop();
+    
     if (g_server.database) {
+        pthread_mutex_lock(&g_server.db_mutex);
+        materialized_reset();
+        database_finalize_statements();
+        pthread_mutex_unlock(&g_server.db_mutex);
+        
         sqlite3_close(g_server.database);
         g_server.database = NULL;
         printf("数据库连接已关闭\n");
@@ -77,9 +1570,16 @@ int database_create_tables() {
         "field_name TEXT NOT NULL,"
         "data_value BLOB,"
         "data_size INTEGER,"
-        "upload_time DATETIME DEFAULT CURRENT_TIMESTAMP"
+        "upload_time DATETIME DEFAULT CURRENT_TIMESTAMP,"
+        "blob_hash TEXT"
         ");",
         
+        // 按表、字段和时间查询字段数据（MSG_DATA_QUERY）的索引
+        "CREATE INDEX IF NOT EXISTS idx_field_data_table_field_time "
+        "ON field_data (table_name, field_name, upload_time);",
+        "CREATE INDEX IF NOT EXISTS idx_field_data_table_time "
+        "ON field_data (table_name, upload_time);",
+        
         // 系统日志表
         "CREATE TABLE IF NOT EXISTS system_logs ("
         "id INTEGER PRIMARY KEY AUTOINCREMENT,"
@@ -96,7 +1596,8 @@ int database_create_tables() {
         "release_date DATETIME DEFAULT CURRENT_TIMESTAMP,"
         "update_file_path TEXT,"
         "description TEXT,"
-        "is_latest INTEGER DEFAULT 0"
+        "is_latest INTEGER DEFAULT 0,"
+        "rollout_percent INTEGER DEFAULT 100"
         ");"
     };
     
@@ -114,6 +1615,32 @@ int database_create_tables() {
         }
     }
     
+    // 旧数据库的field_data表没有blob_hash列，补上后再建外置值引用索引（只索引外置的行）
+    if (database_query_int("SELECT count(*) FROM pragma_table_info('field_data') WHERE name = 'blob_hash'") == 0 &&
+        sqlite3_exec(g_server.database, "ALTER TABLE field_data ADD COLUMN blob_hash TEXT", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "升级field_data表失败: %s\n", sqlite3_errmsg(g_server.database));
+        pthread_mutex_unlock(&g_server.db_mutex);
+        return -1;
+    }
+    
+    // 旧数据库的version_info表没有rollout_percent列，补上后已有版本都是全量发布
+    if (database_query_int("SELECT count(*) FROM pragma_table_info('version_info') WHERE name = 'rollout_percent'") == 0 &&
+        sqlite3_exec(g_server.database, "ALTER TABLE version_info ADD COLUMN rollout_percent INTEGER DEFAULT 100",
+                     NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "升级version_info表失败: %s\n", sqlite3_errmsg(g_server.database));
+        pthread_mutex_unlock(&g_server.db_mutex);
+        return -1;
+    }
+    
+    if (sqlite3_exec(g_server.database,
+                     "CREATE INDEX IF NOT EXISTS idx_field_data_blob_hash "
+                     "ON field_data (blob_hash) WHERE blob_hash IS NOT NULL",
+                     NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "创建表失败: %s\n", sqlite3_errmsg(g_server.database));
+        pthread_mutex_unlock(&g_server.db_mutex);
+        return -1;
+    }
+    
     // 插入默认版本信息
     const char* sql_insert_version = 
         "INSERT OR IGNORE INTO version_info (version, description, is_latest) "
@@ -133,180 +1660,289 @@ int database_create_tables() {
     return 0;
 }
 
-// 存储字段数据
+// 存储字段数据（等待所在批次提交后返回，保证应答客户端时数据已落盘）。
+// 大值先写入外置文件，行中只存哈希、大小和预览；物化表的列有类型，值仍然内联存储
 int database_store_field_data(const char* table_name, const char* field_name, 
                              const unsigned char* data, size_t data_size) {
     if (!g_server.database || !table_name || !field_name || !data) {
         return -1;
     }
     
-    const char* sql = 
-        "INSERT INTO field_data (client_ip, table_name, field_name, data_value, data_size) "
-        "VALUES (?, ?, ?, ?, ?)";
-    
-    pthread_mutex_lock(&g_server.db_mutex);
-    
-    sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(g_server.database, sql, -1, &stmt, NULL);
-    
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "准备SQL语句失败: %s\n", sqlite3_errmsg(g_server.database));
-        pthread_mutex_unlock(&g_server.db_mutex);
+    char blob_hash[SHA256_HEX_SIZE];
+    int offload = !g_materialize && data_size > BLOB_OFFLOAD_THRESHOLD;
+    if (offload && blob_store_put(data, data_size, blob_hash) != 0) {
         return -1;
     }
     
-    // 绑定参数
-    sqlite3_bind_text(stmt, 1, "unknown", -1, SQLITE_STATIC); // TODO: 获取实际客户端IP
-    sqlite3_bind_text(stmt, 2, table_name, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, field_name, -1, SQLITE_STATIC);
-    sqlite3_bind_blob(stmt, 4, data, data_size, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 5, (int)data_size);
-    
-    rc = sqlite3_step(stmt);
+    db_write_request_t request = { .statement = STMT_STORE_FIELD_DATA };
+    db_param_text(&request, "unknown"); // TODO: 获取实际客户端IP
+    db_param_text(&request, table_name);
+    db_param_text(&request, field_name);
+    db_param_blob(&request, data, offload ? BLOB_PREVIEW_SIZE : data_size);
+    db_param_int64(&request, (sqlite3_int64)data_size);
+    if (offload) {
+        db_param_text(&request, blob_hash);
+    } else {
+        db_param_null(&request);
+    }
     
-    if (rc != SQLITE_DONE) {
-        fprintf(stderr, "执行SQL语句失败: %s\n", sqlite3_errmsg(g_server.database));
-        sqlite3_finalize(stmt);
-        pthread_mutex_unlock(&g_server.db_mutex);
+    if (database_submit(&request, 1) != 0) {
         return -1;
     }
     
-    sqlite3_finalize(stmt);
-    pthread_mutex_unlock(&g_server.db_mutex);
-    
     printf("字段数据已存储: 表=%s, 字段=%s, 大小=%zu字节\n", 
            table_name, field_name, data_size);
     
     return 0;
 }
 
-// 记录客户端连接
+// 记录客户端连接（即发即弃）
 int database_log_client_connection(const char* client_ip, const char* client_version, 
                                   const char* action) {
     if (!g_server.database || !client_ip || !action) {
         return -1;
     }
     
-    const char* sql;
+    db_write_request_t request;
+    memset(&request, 0, sizeof(request));
+    
     if (strcmp(action, "connect") == 0) {
-        sql = "INSERT INTO clients (client_ip, client_version, status) VALUES (?, ?, 'connected')";
+        request.statement = STMT_CLIENT_CONNECT;
+        db_param_text(&request, client_ip);
+        db_param_text(&request, client_version);
     } else {
-        sql = "UPDATE clients SET disconnect_time = CURRENT_TIMESTAMP, status = 'disconnected' "
-              "WHERE client_ip = ? AND status = 'connected'";
+        request.statement = STMT_CLIENT_DISCONNECT;
+        db_param_text(&request, client_ip);
     }
     
-    pthread_mutex_lock(&g_server.db_mutex);
+    return database_submit(&request, 0);
+}
+
+// 记录文件上传（即发即弃，文件本身已写入磁盘）
+int database_log_file_upload(const char* client_ip, const char* filename, 
+                            size_t file_size, const char* file_path) {
+    if (!g_server.database || !client_ip || !filename || !file_path) {
+        return -1;
+    }
     
-    sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(g_server.database, sql, -1, &stmt, NULL);
+    db_write_request_t request = { .statement = STMT_LOG_FILE_UPLOAD };
+    db_param_text(&request, client_ip);
+    db_param_text(&request, filename);
+    db_param_int64(&request, (sqlite3_int64)file_size);
+    db_param_text(&request, file_path);
     
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "准备SQL语句失败: %s\n", sqlite3_errmsg(g_server.database));
-        pthread_mutex_unlock(&g_server.db_mutex);
+    return database_submit(&request, 0);
+}
+
+// 记录系统日志（无锁入队后立即返回，由日志线程批量写入；队列满时丢弃并返回-1）
+int database_log_system_event(const char* level, const char* message, const char* client_ip) {
+    if (!g_log_queue.started || !level || !message) {
         return -1;
     }
     
-    sqlite3_bind_text(stmt, 1, client_ip, -1, SQLITE_STATIC);
-    if (strcmp(action, "connect") == 0 && client_version) {
-        sqlite3_bind_text(stmt, 2, client_version, -1, SQLITE_STATIC);
-    }
+    return db_log_enqueue(level, message, client_ip);
+}
+
+// 查询物化表：每个非NULL的字段列作为一行结果回调（调用时持有只读连接）
+static int materialized_query(db_reader_t* reader, const field_data_query_t* query, int64_t end_time,
+                              field_data_row_handler_t handler, void* context) {
+    char table[sizeof(MATERIALIZED_TABLE_PREFIX) + sizeof(query->table_name)];
+    snprintf(table, sizeof(table), MATERIALIZED_TABLE_PREFIX "%s", query->table_name);
     
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    // 按表结构拼出字段列，指定字段时只选该列
+    sqlite3_str* sql = sqlite3_str_new(reader->db);
+    sqlite3_str_appendall(sql, "SELECT _id, CAST(strftime('%s', _upload_time) AS INTEGER)");
     
-    pthread_mutex_unlock(&g_server.db_mutex);
+    char* filter_column = NULL;
+    int column_count = 0;
     
-    return (rc == SQLITE_DONE) ? 0 : -1;
-}
-
-// 记录文件上传
-int database_log_file_upload(const char* client_ip, const char* filename, 
-                            size_t file_size, const char* file_path) {
-    if (!g_server.database || !client_ip || !filename || !file_path) {
-        return -1;
+    sqlite3_stmt* columns = reader->statements[READ_STMT_TABLE_COLUMNS];
+    sqlite3_bind_text(columns, 1, table, -1, SQLITE_STATIC);
+    while (sqlite3_step(columns) == SQLITE_ROW) {
+        const char* name = (const char*)sqlite3_column_text(columns, 0);
+        const char* field_name = name ? materialized_field_name(name) : NULL;
+        if (!field_name) {
+            continue;  // 保留列
+        }
+        if (query->field_name[0]) {
+            if (strcmp(field_name, query->field_name) != 0) {
+                continue;
+            }
+            filter_column = sqlite3_mprintf("%s", name);
+        }
+        sqlite3_str_appendf(sql, ", \"%w\"", name);
+        column_count++;
     }
+    database_release_statement(columns);
     
-    const char* sql = 
-        "INSERT INTO file_uploads (client_ip, filename, file_size, file_path) "
-        "VALUES (?, ?, ?, ?)";
+    sqlite3_str_appendf(sql, " FROM \"%w\" WHERE _upload_time >= datetime(?1, 'unixepoch') "
+                        "AND _upload_time < datetime(?2, 'unixepoch') "
+                        "AND _upload_time >= datetime(?3, 'unixepoch') "
+                        "AND (_upload_time > datetime(?3, 'unixepoch') OR _id > ?4)", table);
+    if (filter_column) {
+        sqlite3_str_appendf(sql, " AND \"%w\" IS NOT NULL", filter_column);
+    }
+    sqlite3_str_appendall(sql, " ORDER BY _upload_time, _id LIMIT ?5");
+    sqlite3_free(filter_column);
     
-    pthread_mutex_lock(&g_server.db_mutex);
+    char* sql_text = sqlite3_str_finish(sql);
     
-    sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(g_server.database, sql, -1, &stmt, NULL);
+    // 表不存在或没有匹配的字段列
+    if (column_count == 0) {
+        sqlite3_free(sql_text);
+        return 0;
+    }
     
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "准备SQL语句失败: %s\n", sqlite3_errmsg(g_server.database));
-        pthread_mutex_unlock(&g_server.db_mutex);
+    sqlite3_stmt* stmt = NULL;
+    if (!sql_text || sqlite3_prepare_v2(reader->db, sql_text, -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "准备SQL语句失败: %s\n", sqlite3_errmsg(reader->db));
+        sqlite3_free(sql_text);
         return -1;
     }
+    sqlite3_free(sql_text);
     
-    sqlite3_bind_text(stmt, 1, client_ip, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, filename, -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)file_size);
-    sqlite3_bind_text(stmt, 4, file_path, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 1, query->start_time);
+    sqlite3_bind_int64(stmt, 2, end_time);
+    sqlite3_bind_int64(stmt, 3, query->after_time);
+    sqlite3_bind_int64(stmt, 4, query->after_id);
+    sqlite3_bind_int64(stmt, 5, query->limit);
     
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    int count = 0;
+    int result = 0;
+    int rc;
     
-    pthread_mutex_unlock(&g_server.db_mutex);
+    while (result == 0 && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        field_data_row_t row;
+        row.id = sqlite3_column_int64(stmt, 0);
+        row.upload_time = sqlite3_column_int64(stmt, 1);
+        
+        for (int i = 0; i < column_count && result == 0; i++) {
+            int type = sqlite3_column_type(stmt, i + 2);
+            if (type == SQLITE_NULL) {
+                continue;
+            }
+            
+            // 数值按文本形式返回：整数和浮点数都只在写入的文本是这一格式时才按数值存储，
+            // 因此与上传时的内容一致
+            char real_text[32];
+            row.field_name = materialized_field_name(sqlite3_column_name(stmt, i + 2));
+            if (type == SQLITE_FLOAT) {
+                materialized_format_real(sqlite3_column_double(stmt, i + 2), real_text, sizeof(real_text));
+                row.data = real_text;
+                row.data_size = strlen(real_text);
+            } else {
+                row.data = type == SQLITE_BLOB ? sqlite3_column_blob(stmt, i + 2)
+                                               : (const void*)sqlite3_column_text(stmt, i + 2);
+                row.data_size = (size_t)sqlite3_column_bytes(stmt, i + 2);
+            }
+            
+            count++;
+            result = handler(&row, context);
+        }
+    }
     
-    return (rc == SQLITE_DONE) ? 0 : -1;
+    if (result == 0 && rc != SQLITE_DONE) {
+        fprintf(stderr, "查询物化表失败: %s\n", sqlite3_errmsg(reader->db));
+        result = -1;
+    }
+    
+    sqlite3_finalize(stmt);
+    return result < 0 ? -1 : count;
 }
 
-// 记录系统日志
-int database_log_system_event(const char* level, const char* message, const char* client_ip) {
-    if (!g_server.database || !level || !message) {
+// 查询字段数据（使用只读连接，按上传时间和ID升序逐行回调）
+int database_query_field_data(const field_data_query_t* query, field_data_row_handler_t handler, void* context) {
+    if (!g_server.database || !query || !handler) {
         return -1;
     }
     
-    const char* sql = 
-        "INSERT INTO system_logs (log_level, message, client_ip) "
-        "VALUES (?, ?, ?)";
+    db_reader_t* reader = database_reader_acquire();
+    if (!reader) {
+        return -1;
+    }
     
-    pthread_mutex_lock(&g_server.db_mutex);
+    // 上界不限时取一个远大于任何上传时间的值（9999-12-31），保持索引范围扫描
+    int64_t end_time = query->end_time > 0 ? query->end_time : 253402300799LL;
     
-    sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(g_server.database, sql, -1, &stmt, NULL);
+    // 开启物化时数据在物化表中
+    if (g_materialize) {
+        int count = materialized_query(reader, query, end_time, handler, context);
+        database_reader_release(reader);
+        return count;
+    }
     
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "准备SQL语句失败: %s\n", sqlite3_errmsg(g_server.database));
-        pthread_mutex_unlock(&g_server.db_mutex);
-        return -1;
+    // 指定字段时使用(table_name, field_name, upload_time)索引，否则使用(table_name, upload_time)索引
+    int by_field = query->field_name[0] != '\0';
+    sqlite3_stmt* stmt = reader->statements[by_field ? READ_STMT_QUERY_FIELD : READ_STMT_QUERY_TABLE];
+    
+    sqlite3_bind_text(stmt, 1, query->table_name, -1, SQLITE_STATIC);
+    if (by_field) {
+        sqlite3_bind_text(stmt, 2, query->field_name, -1, SQLITE_STATIC);
     }
+    sqlite3_bind_int64(stmt, 3, query->start_time);
+    sqlite3_bind_int64(stmt, 4, end_time);
+    sqlite3_bind_int64(stmt, 5, query->after_time);
+    sqlite3_bind_int64(stmt, 6, query->after_id);
+    sqlite3_bind_int64(stmt, 7, query->limit);
     
-    sqlite3_bind_text(stmt, 1, level, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, message, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, client_ip, -1, SQLITE_STATIC);
+    int count = 0;
+    int result = 0;
+    int rc;
     
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        field_data_row_t row;
+        row.id = sqlite3_column_int64(stmt, 0);
+        row.field_name = (const char*)sqlite3_column_text(stmt, 1);
+        row.upload_time = sqlite3_column_int64(stmt, 2);
+        row.data = sqlite3_column_blob(stmt, 3);
+        row.data_size = (size_t)sqlite3_column_bytes(stmt, 3);
+        if (!row.field_name) {
+            row.field_name = "";
+        }
+        
+        // 外置的值从文件读出完整内容
+        const char* blob_hash = (const char*)sqlite3_column_text(stmt, 5);
+        void* blob = NULL;
+        if (blob_hash) {
+            row.data_size = (size_t)sqlite3_column_int64(stmt, 4);
+            if (!(row.data = blob = blob_store_get(blob_hash, row.data_size))) {
+                result = -1;
+                break;
+            }
+        }
+        
+        count++;
+        result = handler(&row, context);
+        free(blob);
+        if (result != 0) {
+            break;
+        }
+    }
     
-    pthread_mutex_unlock(&g_server.db_mutex);
+    if (result == 0 && rc != SQLITE_DONE) {
+        fprintf(stderr, "查询字段数据失败: %s\n", sqlite3_errmsg(reader->db));
+        result = -1;
+    }
     
-    return (rc == SQLITE_DONE) ? 0 : -1;
+    database_release_statement(stmt);
+    database_reader_release(reader);
+    
+    return result < 0 ? -1 : count;
 }
 
-// 获取最新版本信息
-int database_get_latest_version(char* version_buffer, size_t buffer_size) {
-    if (!g_server.database || !version_buffer) {
+// 获取最新版本信息和分批发布比例（使用只读连接，不与写线程争用db_mutex）
+int database_get_latest_version(char* version_buffer, size_t buffer_size, int* rollout_percent) {
+    if (!g_server.database || !version_buffer || !rollout_percent) {
         return -1;
     }
     
-    const char* sql = "SELECT version FROM version_info WHERE is_latest = 1 LIMIT 1";
-    
-    pthread_mutex_lock(&g_server.db_mutex);
-    
-    sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(g_server.database, sql, -1, &stmt, NULL);
-    
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "准备SQL语句失败: %s\n", sqlite3_errmsg(g_server.database));
-        pthread_mutex_unlock(&g_server.db_mutex);
+    db_reader_t* reader = database_reader_acquire();
+    if (!reader) {
         return -1;
     }
     
-    rc = sqlite3_step(stmt);
+    sqlite3_stmt* stmt = reader->statements[READ_STMT_LATEST_VERSION];
+    int rc = sqlite3_step(stmt);
     
     if (rc == SQLITE_ROW) {
         const char* version = (const char*)sqlite3_column_text(stmt, 0);
@@ -314,14 +1950,57 @@ int database_get_latest_version(char* version_buffer, size_t buffer_size) {
             strncpy(version_buffer, version, buffer_size - 1);
             version_buffer[buffer_size - 1] = '\0';
         }
+        
+        // NULL视为全量发布，超出范围的值截断到0-100
+        *rollout_percent = sqlite3_column_type(stmt, 1) == SQLITE_NULL ? 100 : sqlite3_column_int(stmt, 1);
+        if (*rollout_percent < 0) {
+            *rollout_percent = 0;
+        } else if (*rollout_percent > 100) {
+            *rollout_percent = 100;
+        }
     } else {
         // 如果没有找到，使用服务器版本
         strncpy(version_buffer, SERVER_VERSION, buffer_size - 1);
         version_buffer[buffer_size - 1] = '\0';
+        *rollout_percent = 100;
     }
     
-    sqlite3_finalize(stmt);
-    pthread_mutex_unlock(&g_server.db_mutex);
+    sqlite3_reset(stmt);
+    database_reader_release(reader);
     
     return 0;
-}
\ No newline at end of file
+}
+
+// 按发布顺序从新到旧列出除最新版本外、登记了更新包路径的版本，handler返回非0时停止
+int database_get_release_packages(const char* latest_version, int limit,
+                                  int (*handler)(const char* version, const char* path, void* context),
+                                  void* context) {
+    if (!g_server.database || !latest_version || !handler) {
+        return -1;
+    }
+    
+    db_reader_t* reader = database_reader_acquire();
+    if (!reader) {
+        return -1;
+    }
+    
+    sqlite3_stmt* stmt = reader->statements[READ_STMT_RELEASE_PACKAGES];
+    sqlite3_bind_text(stmt, 1, latest_version, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, limit);
+    
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char* version = (const char*)sqlite3_column_text(stmt, 0);
+        const char* path = (const char*)sqlite3_column_text(stmt, 1);
+        if (version && path && handler(version, path, context) != 0) {
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+    
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    database_reader_release(reader);
+    
+    return rc == SQLITE_DONE ? 0 : -1;
+}
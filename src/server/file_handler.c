@@ -1,5 +1,8 @@
 #include "server.h"
 #include "../common/base64.h"
+#include "../common/stream.h"
+#include "../common/utils.h"
+#include "../common/wire.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +10,26 @@
 #include <errno.h>
 #include <time.h>
 #include <arpa/inet.h>
+#include <unistd.h>
+
+// 单个上传文件的大小上限（解码后的字节数），0表示不限
+static uint64_t g_max_upload_size = UPLOAD_DEFAULT_MAX_SIZE;
+
+// 设置单个上传文件的大小上限
+void file_upload_set_max_size(uint64_t max_size) {
+    g_max_upload_size = max_size;
+}
+
+// 检查文件上传消息是否超出大小上限（消息长度包括固定前缀和Base64编码的文件数据）
+int file_upload_too_large(uint8_t version, uint64_t message_length) {
+    if (g_max_upload_size == 0) {
+        return 0;
+    }
+    
+    uint64_t max_length = WIRE_SIZE(version, file_upload_msg) +
+                          (g_max_upload_size + 2) / 3 * 4;
+    return message_length > max_length;
+}
 
 // 创建上传目录
 int create_upload_directory() {
@@ -131,71 +154,376 @@ int save_uploaded_file(const char* filename, const unsigned char* data, size_t d
     return 0;
 }
 
-// 处理文件上传消息
-int handle_file_upload(client_connection_t* client, file_upload_msg_t* msg) {
-    if (!client || !msg) {
+// 开始接收上传文件（写入上传目录下的临时文件）
+int file_transfer_begin(file_transfer_t* transfer, const char* filename, uint32_t file_size) {
+    if (!transfer || !filename) {
         return -1;
     }
     
-    printf("处理文件上传: %s (大小: %u 字节)\n", msg->filename, msg->file_size);
+    memset(transfer, 0, sizeof(*transfer));
     
-    // 解码Base64数据
-    size_t decoded_size = base64_decoded_length(msg->data, msg->chunk_size);
-    unsigned char* decoded_data = malloc(decoded_size);
+    // 只保留文件名部分，避免路径穿越
+    const char* basename = strrchr(filename, '/');
+    basename = basename ? basename + 1 : filename;
+    if (basename[0] == '\0') {
+        return -1;
+    }
     
-    if (!decoded_data) {
-        fprintf(stderr, "内存分配失败\n");
-        send_file_response(client, STATUS_SERVER_ERROR, "服务器内存不足");
+    strncpy(transfer->filename, basename, sizeof(transfer->filename) - 1);
+    transfer->total_size = file_size;
+    transfer->start_time = time(NULL);
+    base64_decoder_init(&transfer->decoder);
+    
+    snprintf(transfer->temp_path, sizeof(transfer->temp_path), "%s.upload_XXXXXX", UPLOAD_DIR);
+    int fd = mkstemp(transfer->temp_path);
+    if (fd == -1) {
+        fprintf(stderr, "无法创建临时文件: %s\n", strerror(errno));
         return -1;
     }
     
-    int decode_result = base64_decode(msg->data, msg->chunk_size, decoded_data, decoded_size);
-    if (decode_result == -1) {
-        fprintf(stderr, "Base64解码失败\n");
-        free(decoded_data);
-        send_file_response(client, STATUS_ERROR, "数据解码失败");
+    transfer->file_handle = fdopen(fd, "wb");
+    if (!transfer->file_handle) {
+        close(fd);
+        remove(transfer->temp_path);
         return -1;
     }
     
-    // 保存文件
-    int save_result = save_uploaded_file(msg->filename, decoded_data, decode_result);
-    free(decoded_data);
+    return 0;
+}
+
+// 解码一段Base64数据并写入临时文件
+int file_transfer_write(file_transfer_t* transfer, const char* encoded, size_t length) {
+    if (!transfer || !transfer->file_handle) {
+        return -1;
+    }
+    
+    unsigned char decoded[(STREAM_CHUNK_SIZE / 4 + 1) * 3];
     
+    while (length > 0) {
+        size_t chunk = length < STREAM_CHUNK_SIZE ? length : STREAM_CHUNK_SIZE;
+        
+        int decoded_length = base64_decoder_update(&transfer->decoder, encoded, chunk,
+                                                   decoded, sizeof(decoded));
+        if (decoded_length < 0) {
+            fprintf(stderr, "Base64解码失败\n");
+            return -1;
+        }
+        
+        if (fwrite(decoded, 1, decoded_length, transfer->file_handle) != (size_t)decoded_length) {
+            fprintf(stderr, "文件写入失败: %s\n", strerror(errno));
+            return -1;
+        }
+        
+        transfer->received_size += decoded_length;
+        encoded += chunk;
+        length -= chunk;
+    }
+    
+    return 0;
+}
+
+// 完成文件接收：关闭临时文件并移动到最终位置
+int file_transfer_finish(file_transfer_t* transfer) {
+    if (!transfer || !transfer->file_handle) {
+        return -1;
+    }
+    
+    if (base64_decoder_finish(&transfer->decoder) != 0) {
+        fprintf(stderr, "Base64数据不完整\n");
+        file_transfer_abort(transfer);
+        return -1;
+    }
+    
+    int close_result = fclose(transfer->file_handle);
+    transfer->file_handle = NULL;
+    
+    if (close_result != 0) {
+        fprintf(stderr, "文件写入失败: %s\n", strerror(errno));
+        remove(transfer->temp_path);
+        return -1;
+    }
+    
+    // 生成唯一文件名
+    char* unique_filename = generate_unique_filename(transfer->filename);
+    char* full_path = unique_filename ? get_upload_file_path(unique_filename) : NULL;
+    if (!full_path) {
+        fprintf(stderr, "获取文件路径失败\n");
+        free(unique_filename);
+        remove(transfer->temp_path);
+        return -1;
+    }
+    
+    if (rename(transfer->temp_path, full_path) != 0) {
+        fprintf(stderr, "无法保存文件 %s: %s\n", full_path, strerror(errno));
+        remove(transfer->temp_path);
+        free(unique_filename);
+        free(full_path);
+        return -1;
+    }
+    
+    printf("文件保存成功: %s (大小: %u 字节)\n", full_path, transfer->received_size);
+    
+    // 记录到数据库
+    database_log_file_upload("unknown", unique_filename, transfer->received_size, full_path);
+    
+    free(unique_filename);
+    free(full_path);
+    return 0;
+}
+
+// 放弃文件接收并删除临时文件
+void file_transfer_abort(file_transfer_t* transfer) {
+    if (!transfer) return;
+    
+    if (transfer->file_handle) {
+        fclose(transfer->file_handle);
+        transfer->file_handle = NULL;
+        remove(transfer->temp_path);
+    }
+}
+
+// 流式接收的数据块处理函数
+static int file_transfer_chunk_handler(void* context, const char* data, size_t length) {
+    return file_transfer_write((file_transfer_t*)context, data, length);
+}
+
+// 发送文件上传结果并记录系统日志
+static void report_file_upload(client_connection_t* client, const char* filename, int result) {
     // 获取客户端IP地址（避免inet_ntoa静态缓冲区问题）
     char client_ip[INET_ADDRSTRLEN];
     strncpy(client_ip, inet_ntoa(client->address.sin_addr), sizeof(client_ip) - 1);
     client_ip[sizeof(client_ip) - 1] = '\0';
     
-    if (save_result == 0) {
+    if (result == 0) {
         send_file_response(client, STATUS_SUCCESS, "文件上传成功");
         
         // 记录系统日志
         char log_msg[512];
-        snprintf(log_msg, sizeof(log_msg), "文件上传成功: %s", msg->filename);
+        snprintf(log_msg, sizeof(log_msg), "文件上传成功: %s", filename);
         database_log_system_event("INFO", log_msg, client_ip);
     } else {
         send_file_response(client, STATUS_SERVER_ERROR, "文件保存失败");
         
         // 记录错误日志
         char log_msg[512];
-        snprintf(log_msg, sizeof(log_msg), "文件上传失败: %s", msg->filename);
+        snprintf(log_msg, sizeof(log_msg), "文件上传失败: %s", filename);
         database_log_system_event("ERROR", log_msg, client_ip);
     }
+}
+
+// 处理文件上传消息
+int handle_file_upload(client_connection_t* client, const wire_view_t* view) {
+    if (!client || !view) {
+        return -1;
+    }
+    
+    char filename[MAX_FILENAME_LEN];
+    WIRE_GET_STR(view, file_upload_msg, filename, filename, sizeof(filename));
+    uint32_t file_size = WIRE_GET_U32(view, file_upload_msg, file_size);
+    uint32_t chunk_size = WIRE_GET_U32(view, file_upload_msg, chunk_size);
+    
+    printf("处理文件上传: %s (大小: %u 字节)\n", filename, file_size);
+    
+    if (file_upload_too_large(view->version, view->length)) {
+        send_file_response(client, STATUS_ERROR, "文件超出大小上限");
+        return -1;
+    }
+    
+    if (chunk_size > view->length - WIRE_SIZE(view->version, file_upload_msg)) {
+        send_file_response(client, STATUS_ERROR, "数据长度错误");
+        return -1;
+    }
+    
+    // 解码Base64数据并保存文件
+    file_transfer_t transfer;
+    if (file_transfer_begin(&transfer, filename, file_size) != 0) {
+        send_file_response(client, STATUS_SERVER_ERROR, "文件保存失败");
+        return -1;
+    }
+    
+    if (file_transfer_write(&transfer, WIRE_GET_PTR(view, file_upload_msg, data), chunk_size) != 0) {
+        file_transfer_abort(&transfer);
+        send_file_response(client, STATUS_ERROR, "数据解码失败");
+        return -1;
+    }
+    
+    int save_result = file_transfer_finish(&transfer);
+    report_file_upload(client, filename, save_result);
+    
+    return save_result;
+}
+
+// 流式处理文件上传消息（数据边接收边解码写入磁盘）
+int handle_file_upload_stream(client_connection_t* client, message_header_t* header) {
+    if (!client || !header) {
+        return -1;
+    }
+    
+    unsigned char prefix[sizeof(file_upload_msg_v2_t)];
+    size_t prefix_length = WIRE_SIZE(header->version, file_upload_msg);
+    if (header->length < prefix_length) {
+        send_error_response(client, "无效的文件上传消息");
+        return -1;
+    }
+    
+    // 超出上限时不接收消息体，直接断开连接
+    if (file_upload_too_large(header->version, header->length)) {
+        printf("文件上传超出大小上限: %u 字节\n", header->length);
+        send_file_response(client, STATUS_ERROR, "文件超出大小上限");
+        return -1;
+    }
+    
+    // 接收固定长度的消息前缀
+    if (recv_all(client->socket_fd, prefix, prefix_length) != 0) {
+        printf("接收消息数据失败\n");
+        return -1;
+    }
+    
+    wire_view_t view;
+    wire_view_init(&view, header->version, prefix, prefix_length, prefix_length);
+    
+    char filename[MAX_FILENAME_LEN];
+    WIRE_GET_STR(&view, file_upload_msg, filename, filename, sizeof(filename));
+    uint32_t file_size = WIRE_GET_U32(&view, file_upload_msg, file_size);
+    
+    uint32_t checksum = checksum_update(0, prefix, prefix_length);
+    size_t body_length = header->length - prefix_length;
+    
+    printf("流式处理文件上传: %s (大小: %u 字节)\n", filename, file_size);
+    
+    file_transfer_t transfer;
+    int begin_result = file_transfer_begin(&transfer, filename, file_size);
+    
+    // 失败时仍读完剩余数据，保持帧边界
+    int recv_result = stream_recv_body(client->socket_fd, body_length, &checksum,
+                                       begin_result == 0 ? file_transfer_chunk_handler : NULL,
+                                       &transfer);
+    if (recv_result < 0) {
+        printf("接收消息数据失败\n");
+        file_transfer_abort(&transfer);
+        return -1;
+    }
+    
+    if (checksum != header->checksum) {
+        printf("消息校验和不匹配\n");
+        file_transfer_abort(&transfer);
+        send_error_response(client, "数据校验失败");
+        return -1;
+    }
+    
+    int save_result;
+    if (begin_result != 0 || recv_result != 0) {
+        file_transfer_abort(&transfer);
+        save_result = -1;
+    } else {
+        save_result = file_transfer_finish(&transfer);
+    }
+    
+    report_file_upload(client, filename, save_result);
     
     return save_result;
 }
 
+// 创建分片接收的文件上传
+upload_stream_t* upload_stream_create(uint8_t version) {
+    upload_stream_t* upload = calloc(1, sizeof(upload_stream_t));
+    if (upload) {
+        upload->version = version;
+        upload->prefix_length = WIRE_SIZE(version, file_upload_msg);
+    }
+    return upload;
+}
+
+// 写入一个分片：先凑齐固定长度的消息前缀，之后的数据解码写入临时文件
+int upload_stream_write(upload_stream_t* upload, const char* data, size_t length) {
+    if (!upload || upload->failed) {
+        return -1;
+    }
+    
+    if (upload->prefix_received < upload->prefix_length) {
+        size_t needed = upload->prefix_length - upload->prefix_received;
+        size_t copied = length < needed ? length : needed;
+        
+        memcpy(upload->prefix + upload->prefix_received, data, copied);
+        upload->prefix_received += copied;
+        data += copied;
+        length -= copied;
+        
+        if (upload->prefix_received < upload->prefix_length) {
+            return 0;
+        }
+        
+        wire_view_t view;
+        wire_view_init(&view, upload->version, upload->prefix, upload->prefix_length, upload->prefix_length);
+        WIRE_GET_STR(&view, file_upload_msg, filename, upload->filename, sizeof(upload->filename));
+        uint32_t file_size = WIRE_GET_U32(&view, file_upload_msg, file_size);
+        
+        printf("分片接收文件上传: %s (大小: %u 字节)\n", upload->filename, file_size);
+        
+        if (file_transfer_begin(&upload->transfer, upload->filename, file_size) != 0) {
+            upload->failed = 1;
+            return -1;
+        }
+    }
+    
+    if (length > 0 && file_transfer_write(&upload->transfer, data, length) != 0) {
+        upload->failed = 1;
+        return -1;
+    }
+    
+    return 0;
+}
+
+// 完成分片接收的文件上传并发送结果
+int upload_stream_finish(client_connection_t* client, upload_stream_t* upload) {
+    if (!client || !upload) {
+        return -1;
+    }
+    
+    int save_result;
+    if (upload->failed || upload->prefix_received < upload->prefix_length) {
+        file_transfer_abort(&upload->transfer);
+        save_result = -1;
+    } else {
+        save_result = file_transfer_finish(&upload->transfer);
+    }
+    
+    report_file_upload(client, upload->filename, save_result);
+    
+    return save_result;
+}
+
+// 释放分片接收的文件上传（未完成时删除临时文件）
+void upload_stream_destroy(upload_stream_t* upload) {
+    if (!upload) return;
+    
+    file_transfer_abort(&upload->transfer);
+    free(upload);
+}
+
 // 处理数据上传消息
-int handle_data_upload(client_connection_t* client, data_upload_msg_t* msg) {
-    if (!client || !msg) {
+int handle_data_upload(client_connection_t* client, const wire_view_t* view) {
+    if (!client || !view) {
         return -1;
     }
     
+    char table_name[64];
+    char field_name[64];
+    WIRE_GET_STR(view, data_upload_msg, table_name, table_name, sizeof(table_name));
+    WIRE_GET_STR(view, data_upload_msg, field_name, field_name, sizeof(field_name));
+    uint32_t data_size = WIRE_GET_U32(view, data_upload_msg, data_size);
+    const char* data = WIRE_GET_PTR(view, data_upload_msg, data);
+    
     printf("处理数据上传: 表=%s, 字段=%s (大小: %u 字节)\n", 
-           msg->table_name, msg->field_name, msg->data_size);
+           table_name, field_name, data_size);
+    
+    if (data_size > view->length - WIRE_SIZE(view->version, data_upload_msg)) {
+        send_data_response(client, STATUS_ERROR, "数据长度错误");
+        return -1;
+    }
     
     // 解码Base64数据
-    size_t decoded_size = base64_decoded_length(msg->data, msg->data_size);
+    size_t decoded_size = base64_decoded_length(data, data_size);
     unsigned char* decoded_data = malloc(decoded_size);
     
     if (!decoded_data) {
@@ -204,7 +532,7 @@ int handle_data_upload(client_connection_t* client, data_upload_msg_t* msg) {
         return -1;
     }
     
-    int decode_result = base64_decode(msg->data, msg->data_size, decoded_data, decoded_size);
+    int decode_result = base64_decode(data, data_size, decoded_data, decoded_size);
     if (decode_result == -1) {
         fprintf(stderr, "Base64解码失败\n");
         free(decoded_data);
@@ -213,7 +541,7 @@ int handle_data_upload(client_connection_t* client, data_upload_msg_t* msg) {
     }
     
     // 存储到数据库
-    int store_result = database_store_field_data(msg->table_name, msg->field_name, 
+    int store_result = database_store_field_data(table_name, field_name, 
                                                decoded_data, decode_result);
     free(decoded_data);
     
@@ -228,7 +556,7 @@ int handle_data_upload(client_connection_t* client, data_upload_msg_t* msg) {
         // 记录系统日志
         char log_msg[512];
         snprintf(log_msg, sizeof(log_msg), "数据上传成功: %s.%s", 
-                msg->table_name, msg->field_name);
+                table_name, field_name);
         database_log_system_event("INFO", log_msg, client_ip);
     } else {
         send_data_response(client, STATUS_SERVER_ERROR, "数据存储失败");
@@ -236,105 +564,46 @@ int handle_data_upload(client_connection_t* client, data_upload_msg_t* msg) {
         // 记录错误日志
         char log_msg[512];
         snprintf(log_msg, sizeof(log_msg), "数据上传失败: %s.%s", 
-                msg->table_name, msg->field_name);
+                table_name, field_name);
         database_log_system_event("ERROR", log_msg, client_ip);
     }
     
     return store_result;
 }
 
-// 发送文件响应
-int send_file_response(client_connection_t* client, status_code_t status, const char* message) {
-    if (!client) return -1;
-    
-    response_msg_t response;
+// 按协商的线格式编码并发送响应
+static int send_response(client_connection_t* client, uint16_t type, status_code_t status,
+                         const char* message) {
+    uint8_t version = WIRE_VERSION_FOR(client->capabilities);
+    union {
+        response_msg_t v1;
+        response_msg_v2_t v2;
+    } response;
     memset(&response, 0, sizeof(response));
-    response.status = status;
     
-    if (message) {
-        strncpy(response.message, message, sizeof(response.message) - 1);
-    }
-    
-    // 创建消息头
-    message_header_t header;
-    init_message_header(&header, MSG_FILE_RESPONSE, sizeof(response));
-    header.checksum = calculate_checksum(&response, sizeof(response));
+    WIRE_PUT_U16(&response, version, response_msg, status, status);
+    WIRE_PUT_STR(&response, version, response_msg, message, message);
     
-    // 发送消息头
-    if (send(client->socket_fd, &header, sizeof(header), 0) != sizeof(header)) {
-        perror("send header");
-        return -1;
-    }
-    
-    // 发送响应数据
-    if (send(client->socket_fd, &response, sizeof(response), 0) != sizeof(response)) {
-        perror("send response");
-        return -1;
-    }
+    return server_send_message(client, type, &response, WIRE_SIZE(version, response_msg));
+}
+
+// 发送文件响应
+int send_file_response(client_connection_t* client, status_code_t status, const char* message) {
+    if (!client) return -1;
     
-    return 0;
+    return send_response(client, MSG_FILE_RESPONSE, status, message);
 }
 
 // 发送数据响应
 int send_data_response(client_connection_t* client, status_code_t status, const char* message) {
     if (!client) return -1;
     
-    response_msg_t response;
-    memset(&response, 0, sizeof(response));
-    response.status = status;
-    
-    if (message) {
-        strncpy(response.message, message, sizeof(response.message) - 1);
-    }
-    
-    // 创建消息头
-    message_header_t header;
-    init_message_header(&header, MSG_DATA_RESPONSE, sizeof(response));
-    header.checksum = calculate_checksum(&response, sizeof(response));
-    
-    // 发送消息头
-    if (send(client->socket_fd, &header, sizeof(header), 0) != sizeof(header)) {
-        perror("send header");
-        return -1;
-    }
-    
-    // 发送响应数据
-    if (send(client->socket_fd, &response, sizeof(response), 0) != sizeof(response)) {
-        perror("send response");
-        return -1;
-    }
-    
-    return 0;
+    return send_response(client, MSG_DATA_RESPONSE, status, message);
 }
 
 // 发送错误响应
 int send_error_response(client_connection_t* client, const char* error_message) {
     if (!client) return -1;
     
-    response_msg_t response;
-    memset(&response, 0, sizeof(response));
-    response.status = STATUS_ERROR;
-    
-    if (error_message) {
-        strncpy(response.message, error_message, sizeof(response.message) - 1);
-    }
-    
-    // 创建消息头
-    message_header_t header;
-    init_message_header(&header, MSG_ERROR, sizeof(response));
-    header.checksum = calculate_checksum(&response, sizeof(response));
-    
-    // 发送消息头
-    if (send(client->socket_fd, &header, sizeof(header), 0) != sizeof(header)) {
-        perror("send header");
-        return -1;
-    }
-    
-    // 发送响应数据
-    if (send(client->socket_fd, &response, sizeof(response), 0) != sizeof(response)) {
-        perror("send response");
-        return -1;
-    }
-    
-    return 0;
-}
\ No newline at end of file
+    return send_response(client, MSG_ERROR, STATUS_ERROR, error_message);
+}
@@ -38,6 +38,14 @@ void print_usage(const char* program_name) {
     printf("使用方法: %s [选项]\n", program_name);
     printf("选项:\n");
     printf("  -p <端口>    指定服务器端口 (默认: %d)\n", DEFAULT_PORT);
+    printf("  -s <配置>    指定数据库存储配置 (默认: %s)\n", DB_DEFAULT_PROFILE);
+    database_print_profiles();
+    printf("  -m           把字段数据写入按表名物化的类型化数据表 (默认写入field_data)\n");
+    printf("  -R <策略>    设置数据保留策略，格式为 表名:天数[:行数]，0表示不限，未设置的表不删除。当前策略:\n");
+    retention_print_policies();
+    printf("  -A           清理前把旧数据复制到%s下按日期命名的归档数据库\n", ARCHIVE_DIR);
+    printf("  -U <数量>    同时进行的更新传输上限，0表示不限 (默认: %d)\n", ROLLOUT_DEFAULT_MAX_TRANSFERS);
+    printf("  -u <MB>      单个上传文件的大小上限，0表示不限 (默认: %d)\n", UPLOAD_DEFAULT_MAX_SIZE / (1024 * 1024));
     printf("  -h           显示此帮助信息\n");
     printf("  -v           显示版本信息\n");
 }
@@ -56,6 +64,20 @@ void print_server_status() {
     printf("运行状态: %s\n", g_server.running ? "运行中" : "已停止");
     printf("连接的客户端数量: %d\n", get_client_count());
     printf("数据库状态: %s\n", g_server.database ? "已连接" : "未连接");
+    printf("存储配置: %s\n", database_profile_name());
+    
+    latest_version_t latest;
+    if (version_cache_get(&latest) == 0) {
+        printf("最新版本: %s (更新包%s)\n", latest.version,
+               latest.package_available ? latest.package_hash_hex : "不存在");
+    }
+    long long logs_written = 0;
+    long long logs_dropped = 0;
+    database_log_stats(&logs_written, &logs_dropped);
+    printf("系统日志: 已写入 %lld 条，丢弃 %lld 条\n", logs_written, logs_dropped);
+    rollout_print_status();
+    retention_print_status();
+    compress_print_stats();
     printf("==================\n\n");
 }
 
@@ -82,10 +104,12 @@ void cleanup_inactive_clients() {
     
     for (int i = 0; i < MAX_CLIENTS; i++) {
         if (g_server.clients[i].active) {
-            // 检查心跳超时（5分钟）
-            if (current_time - g_server.clients[i].last_heartbeat > 300) {
+            // 检查心跳超时（任何帧都算作存活）
+            if (current_time - g_server.clients[i].last_heartbeat > HEARTBEAT_TIMEOUT) {
                 printf("客户端 %d 心跳超时，断开连接\n", i);
-                disconnect_client(&g_server.clients[i]);
+                shutdown_client(&g_server.clients[i]);
+            } else {
+                rollout_expire_offer(&g_server.clients[i], current_time);
             }
         }
     }
@@ -117,7 +141,7 @@ int main(int argc, char* argv[]) {
     int opt;
     
     // 解析命令行参数
-    while ((opt = getopt(argc, argv, "p:hv")) != -1) {
+    while ((opt = getopt(argc, argv, "p:s:mR:AU:u:hv")) != -1) {
         switch (opt) {
             case 'p':
                 port = atoi(optarg);
@@ -126,6 +150,47 @@ int main(int argc, char* argv[]) {
                     return 1;
                 }
                 break;
+            case 's':
+                if (database_set_profile(optarg) != 0) {
+                    fprintf(stderr, "错误: 未知的存储配置 %s\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm':
+                database_set_materialize(1);
+                break;
+            case 'R':
+                if (retention_set_policy(optarg) != 0) {
+                    fprintf(stderr, "错误: 无效的数据保留策略 %s\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'A':
+                retention_set_archive(1);
+                break;
+            case 'U': {
+                char* end = NULL;
+                long max_transfers = strtol(optarg, &end, 10);
+                if (!end || *end != '\0' || max_transfers < 0 || max_transfers > MAX_CLIENTS) {
+                    fprintf(stderr, "错误: 无效的更新传输上限 %s\n", optarg);
+                    return 1;
+                }
+                rollout_set_max_transfers((int)max_transfers);
+                break;
+            }
+            case 'u': {
+                // 消息长度字段是32位，Base64编码后的文件不会超过3GB
+                char* end = NULL;
+                long max_upload_mb = strtol(optarg, &end, 10);
+                if (!end || *end != '\0' || max_upload_mb < 0 || max_upload_mb > 3072) {
+                    fprintf(stderr, "错误: 无效的上传大小上限 %s\n", optarg);
+                    return 1;
+                }
+                file_upload_set_max_size((uint64_t)max_upload_mb * 1024 * 1024);
+                break;
+            }
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -157,14 +222,28 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
+    // 加载最新版本缓存
+    if (version_cache_init() != 0) {
+        fprintf(stderr, "初始化最新版本缓存失败\n");
+        database_cleanup();
+        server_cleanup();
+        return 1;
+    }
+    
     // 创建上传目录
     if (create_upload_directory() != 0) {
         fprintf(stderr, "创建上传目录失败\n");
+        version_cache_cleanup();
         database_cleanup();
         server_cleanup();
         return 1;
     }
     
+    // 启动数据保留线程
+    if (retention_start() != 0) {
+        fprintf(stderr, "启动数据保留线程失败\n");
+    }
+    
     printf("服务器初始化完成，监听端口 %d\n", port);
     print_server_status();
     
@@ -185,6 +264,8 @@ int main(int argc, char* argv[]) {
     
     // 清理资源
     printf("正在清理资源...\n");
+    retention_stop();
+    version_cache_cleanup();
     database_cleanup();
     server_cleanup();
     
@@ -1,8 +1,10 @@
 #include "server.h"
+#include "../common/stream.h"
+#include "../common/utils.h"
+#include "../common/wire.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <arpa/inet.h>
 
 // 处理客户端消息
@@ -11,28 +13,73 @@ int handle_client_message(client_connection_t* client, message_header_t* header,
         return -1;
     }
     
+    // 消息体按帧自身的线格式版本解析
+    wire_view_t view;
+    
     switch (header->type) {
         case MSG_VERSION_CHECK: {
-            version_check_msg_t* msg = (version_check_msg_t*)data;
-            return handle_version_check(client, msg);
+            // 旧客户端的消息不含能力位和客户端标识字段，缺失部分置零
+            size_t min_length = WIRE_OFFSET(header->version, version_check_msg, capabilities);
+            if (wire_view_init(&view, header->version, data, header->length, min_length) != 0) {
+                return handle_version_check(client, NULL);
+            }
+            
+            version_check_msg_t msg;
+            memset(&msg, 0, sizeof(msg));
+            WIRE_GET_STR(&view, version_check_msg, client_version, msg.client_version, sizeof(msg.client_version));
+            WIRE_GET_STR(&view, version_check_msg, platform, msg.platform, sizeof(msg.platform));
+            if (view.length >= WIRE_OFFSET(view.version, version_check_msg, client_id)) {
+                msg.capabilities = WIRE_GET_U32(&view, version_check_msg, capabilities);
+            }
+            if (view.length >= WIRE_SIZE(view.version, version_check_msg)) {
+                memcpy(msg.client_id, WIRE_GET_PTR(&view, version_check_msg, client_id), sizeof(msg.client_id));
+            }
+            return handle_version_check(client, &msg);
         }
         
         case MSG_UPDATE_REQUEST:
-            return handle_update_request(client);
+            // 旧客户端发送空消息体，不续传的客户端只发送flags
+            if (wire_view_init(&view, header->version, data, header->length,
+                               WIRE_OFFSET(header->version, update_request_msg, resume_offset)) != 0) {
+                return handle_update_request(client, NULL);
+            }
+            return handle_update_request(client, &view);
         
-        case MSG_FILE_UPLOAD: {
-            file_upload_msg_t* msg = (file_upload_msg_t*)data;
-            return handle_file_upload(client, msg);
-        }
+        case MSG_FILE_UPLOAD:
+            if (wire_view_init(&view, header->version, data, header->length,
+                               WIRE_SIZE(header->version, file_upload_msg)) != 0) {
+                send_error_response(client, "无效的文件上传消息");
+                return -1;
+            }
+            return handle_file_upload(client, &view);
         
-        case MSG_DATA_UPLOAD: {
-            data_upload_msg_t* msg = (data_upload_msg_t*)data;
-            return handle_data_upload(client, msg);
-        }
+        case MSG_DATA_UPLOAD:
+            if (wire_view_init(&view, header->version, data, header->length,
+                               WIRE_SIZE(header->version, data_upload_msg)) != 0) {
+                send_error_response(client, "无效的数据上传消息");
+                return -1;
+            }
+            return handle_data_upload(client, &view);
         
         case MSG_HEARTBEAT:
             return handle_heartbeat(client);
         
+        case MSG_STREAM_DATA:
+            if (wire_view_init(&view, header->version, data, header->length,
+                               WIRE_SIZE(header->version, stream_data_msg)) != 0) {
+                send_error_response(client, "无效的逻辑流分片");
+                return -1;
+            }
+            return handle_stream_data(client, &view);
+        
+        case MSG_DATA_QUERY:
+            if (wire_view_init(&view, header->version, data, header->length,
+                               WIRE_SIZE(header->version, data_query_msg)) != 0) {
+                send_error_response(client, "无效的数据查询消息");
+                return -1;
+            }
+            return handle_data_query(client, &view);
+        
         default:
             printf("未知消息类型: %d\n", header->type);
             send_error_response(client, "未知消息类型");
@@ -40,6 +87,116 @@ int handle_client_message(client_connection_t* client, message_header_t* header,
     }
 }
 
+// 处理按流接收的大消息（消息体由处理函数自行从socket读取）
+int handle_stream_message(client_connection_t* client, message_header_t* header) {
+    if (!client || !header) {
+        return -1;
+    }
+    
+    switch (header->type) {
+        case MSG_FILE_UPLOAD:
+            return handle_file_upload_stream(client, header);
+        
+        default: {
+            // 丢弃消息体后报错
+            printf("不支持流式处理的消息类型: %d\n", header->type);
+            uint32_t checksum = 0;
+            stream_recv_body(client->socket_fd, header->length, &checksum, NULL, NULL);
+            send_error_response(client, "不支持的消息类型");
+            return -1;
+        }
+    }
+}
+
+// 处理逻辑流分片（按stream_id重组，分片数据直接交给对应的接收处理）
+int handle_stream_data(client_connection_t* client, const wire_view_t* view) {
+    if (!client || !view) {
+        return -1;
+    }
+    
+    uint32_t stream_id = WIRE_GET_U32(view, stream_data_msg, stream_id);
+    uint16_t inner_type = WIRE_GET_U16(view, stream_data_msg, inner_type);
+    uint8_t stream_flags = WIRE_GET_U8(view, stream_data_msg, stream_flags);
+    uint32_t total_length = WIRE_GET_U32(view, stream_data_msg, total_length);
+    const char* fragment = WIRE_GET_PTR(view, stream_data_msg, data);
+    size_t fragment_length = view->length - WIRE_SIZE(view->version, stream_data_msg);
+    mux_stream_t* stream = mux_stream_find(client->streams, stream_id);
+    
+    if (stream_flags & STREAM_FLAG_BEGIN) {
+        if (stream) {
+            send_error_response(client, "逻辑流ID重复");
+            return -1;
+        }
+        
+        // 目前只有文件上传会以分片形式发送
+        if (inner_type != MSG_FILE_UPLOAD) {
+            printf("不支持分片传输的消息类型: %d\n", inner_type);
+            send_error_response(client, "不支持的消息类型");
+            return -1;
+        }
+        
+        if (file_upload_too_large(view->version, total_length)) {
+            printf("文件上传超出大小上限: %u 字节\n", total_length);
+            send_file_response(client, STATUS_ERROR, "文件超出大小上限");
+            return -1;
+        }
+        
+        stream = mux_stream_open(client->streams, stream_id, inner_type, total_length);
+        if (!stream) {
+            send_error_response(client, "同时打开的逻辑流过多");
+            return -1;
+        }
+        
+        stream->context = upload_stream_create(view->version);
+        if (!stream->context) {
+            mux_stream_close(stream);
+            send_error_response(client, "服务器内存不足");
+            return -1;
+        }
+    } else if (!stream) {
+        send_error_response(client, "未知的逻辑流");
+        return -1;
+    }
+    
+    if (fragment_length > stream->total_length - stream->received) {
+        printf("逻辑流数据超出声明长度: %u\n", stream->stream_id);
+        send_error_response(client, "逻辑流数据长度错误");
+        return -1;
+    }
+    
+    upload_stream_t* upload = (upload_stream_t*)stream->context;
+    upload_stream_write(upload, fragment, fragment_length);
+    stream->received += (uint32_t)fragment_length;
+    
+    if (!(stream_flags & STREAM_FLAG_END)) {
+        return 0;
+    }
+    
+    if (stream->received != stream->total_length) {
+        printf("逻辑流数据不完整: %u\n", stream->stream_id);
+        send_error_response(client, "逻辑流数据长度错误");
+        return -1;
+    }
+    
+    int result = upload_stream_finish(client, upload);
+    upload_stream_destroy(upload);
+    mux_stream_close(stream);
+    
+    return result;
+}
+
+// 放弃所有未接收完的逻辑流
+void close_client_streams(client_connection_t* client) {
+    if (!client) return;
+    
+    for (int i = 0; i < MUX_MAX_STREAMS; i++) {
+        if (client->streams[i].stream_id != 0) {
+            upload_stream_destroy((upload_stream_t*)client->streams[i].context);
+            mux_stream_close(&client->streams[i]);
+        }
+    }
+}
+
 // 处理版本检查
 int handle_version_check(client_connection_t* client, version_check_msg_t* msg) {
     if (!client || !msg) {
@@ -51,9 +208,25 @@ int handle_version_check(client_connection_t* client, version_check_msg_t* msg)
     // 更新客户端信息
     strncpy(client->client_version, msg->client_version, sizeof(client->client_version) - 1);
     
+    // 分批发布在clients_mutex下比较其他连接的客户端标识
+    pthread_mutex_lock(&g_server.clients_mutex);
+    memcpy(client->client_id, msg->client_id, sizeof(client->client_id));
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    
+    // 协商能力位（取双方都支持的部分）
+    client->capabilities = msg->capabilities & SERVER_CAPABILITIES;
+    mux_sender_set_capabilities(&client->sender, client->capabilities);
+    
     // 检查是否有更新可用
     int update_available = check_update_available(msg->client_version);
     
+    // 需要更新的客户端由分批发布决定现在提供还是稍后再检查
+    uint32_t retry_after = 0;
+    latest_version_t latest;
+    if (update_available && version_cache_get(&latest) == 0 && latest.package_available) {
+        update_available = rollout_offer(client, &latest, &retry_after);
+    }
+    
     status_code_t status = update_available ? STATUS_UPDATE_AVAILABLE : STATUS_NO_UPDATE;
     
     // 记录客户端连接 - 修复inet_ntoa静态缓冲区问题
@@ -62,25 +235,119 @@ int handle_version_check(client_connection_t* client, version_check_msg_t* msg)
     client_ip[sizeof(client_ip) - 1] = '\0';
     database_log_client_connection(client_ip, msg->client_version, "connect");
     
-    return send_version_response(client, status);
+    return send_version_response(client, status, retry_after);
+}
+
+// 发送从客户端当前版本出发的差量补丁，没有可用补丁时返回1
+static int send_update_delta(client_connection_t* client) {
+    update_package_t* package = version_cache_get_package();
+    const update_delta_t* delta = update_package_find_delta(package, client->client_version);
+    if (!delta) {
+        update_package_release(package);
+        return 1;
+    }
+    
+    uint8_t version = WIRE_VERSION_FOR(client->capabilities);
+    size_t header_length = WIRE_SIZE(version, update_delta_msg);
+    unsigned char* message = calloc(1, header_length + delta->delta_length);
+    if (!message) {
+        update_package_release(package);
+        return 1;
+    }
+    
+    WIRE_PUT_STR(message, version, update_delta_msg, base_version, delta->base_version);
+    memcpy(message + WIRE_OFFSET(version, update_delta_msg, base_hash), delta->base_hash, SHA256_DIGEST_SIZE);
+    memcpy(message + WIRE_OFFSET(version, update_delta_msg, target_hash), package->client_hash, SHA256_DIGEST_SIZE);
+    WIRE_PUT_U32(message, version, update_delta_msg, target_size, package->client_size);
+    WIRE_PUT_U32(message, version, update_delta_msg, delta_length, (uint32_t)delta->delta_length);
+    memcpy(message + header_length, delta->delta, delta->delta_length);
+    
+    size_t delta_length = delta->delta_length;
+    update_package_release(package);
+    
+    int result = server_send_message(client, MSG_UPDATE_DELTA, message, header_length + delta_length);
+    free(message);
+    
+    if (result == 0) {
+        printf("差量补丁已发送: %s, %zu 字节\n", client->client_version, delta_length);
+    }
+    return result;
 }
 
 // 处理更新请求
-int handle_update_request(client_connection_t* client) {
+int handle_update_request(client_connection_t* client, const wire_view_t* view) {
     if (!client) {
         return -1;
     }
     
-    printf("处理更新请求\n");
+    uint32_t flags = view ? WIRE_GET_U32(view, update_request_msg, flags) : 0;
+    uint32_t resume_offset = 0;
+    uint32_t range_length = 0;
+    const uint8_t* package_hash = NULL;
+    if (view && view->length >= WIRE_OFFSET(view->version, update_request_msg, range_length)) {
+        resume_offset = WIRE_GET_U32(view, update_request_msg, resume_offset);
+        package_hash = (const uint8_t*)WIRE_GET_PTR(view, update_request_msg, package_hash);
+    }
+    if (view && view->length >= WIRE_SIZE(view->version, update_request_msg)) {
+        range_length = WIRE_GET_U32(view, update_request_msg, range_length);
+    }
+    printf("处理更新请求: 标志=0x%08x, 续传偏移=%u, 范围长度=%u\n", flags, resume_offset, range_length);
     
-    // 检查更新文件是否存在
-    struct stat st;
-    if (stat(UPDATE_FILE_PATH, &st) == -1) {
+    // 客户端按分块清单的下载已结束（全部分块校验通过），归还这次下载占用的传输名额
+    if (flags & UPDATE_REQUEST_DONE) {
+        rollout_chunked_end(client, 0);
+        return 0;
+    }
+    
+    // 检查更新文件是否存在（读取内存中的最新版本快照）
+    latest_version_t latest;
+    if (version_cache_get(&latest) != 0 || !latest.package_available) {
         printf("更新文件不存在: %s\n", UPDATE_FILE_PATH);
         send_error_response(client, "更新文件不可用");
         return -1;
     }
     
+    // 分块清单很小，不占用传输名额；重新取清单表示之前的分块下载已放弃
+    if (flags & UPDATE_REQUEST_MANIFEST) {
+        rollout_chunked_end(client, -1);
+        return send_update_manifest(client);
+    }
+    
+    // 传输名额已满时回复稍后再检查（客户端按retry_after重新做版本检查）。
+    // 按分块清单逐段下载时，第一段获准后占用一个名额直到客户端报告下载结束或断开连接，
+    // 同一更新包后续的范围请求沿用这个名额；其他请求表示之前的分块下载已放弃
+    int chunked = range_length > 0 && package_hash;
+    if (!(chunked && rollout_chunked_active(client, package_hash))) {
+        rollout_chunked_end(client, -1);
+        
+        uint32_t retry_after = 0;
+        if (rollout_admit(client, &retry_after) != 0) {
+            printf("更新传输名额已满，%u 秒后重试\n", retry_after);
+            return send_version_response(client, STATUS_NO_UPDATE, retry_after);
+        }
+        if (chunked) {
+            rollout_chunked_begin(client, package_hash);
+        }
+    }
+    
+    // 支持差量更新的客户端优先发送补丁，客户端补丁应用失败后会要求完整更新包
+    if ((client->capabilities & CAP_DELTA_UPDATE) && !(flags & UPDATE_REQUEST_FULL)) {
+        int result = send_update_delta(client);
+        if (result <= 0) {
+            return result;
+        }
+    }
+    
+    // 客户端已有同一更新包的前半部分时只发送剩余部分，请求了范围时只发送该范围
+    if ((resume_offset > 0 || range_length > 0) && package_hash) {
+        int result = send_update_resume(client, resume_offset, range_length, package_hash);
+        if (result <= 0) {
+            return result;
+        }
+        // 更新包已变化，改发的完整更新包单独占用名额
+        rollout_chunked_end(client, -1);
+    }
+    
     return send_update_file(client);
 }
 
@@ -94,60 +361,238 @@ int handle_heartbeat(client_connection_t* client) {
     client->last_heartbeat = time(NULL);
     
     // 发送心跳响应
-    message_header_t header;
-    init_message_header(&header, MSG_HEARTBEAT, 0);
-    header.checksum = 0;
+    return server_send_message(client, MSG_HEARTBEAT, NULL, 0);
+}
+
+// 数据查询结果帧的目标大小（单行超过该大小时单独成帧）
+#define DATA_QUERY_FRAME_SIZE (64 * 1024)
+
+// 每页结果的字节预算：行数未到上限但数据超过预算时提前结束本页并带MORE标志（至少返回一行）。
+// 开始查询前等待这条连接上排队的数据降到同样的大小以下，每条连接排队的结果最多约两页
+#define DATA_QUERY_PAGE_BYTES (4 * 1024 * 1024)
+
+// 数据查询结果的组帧状态
+typedef struct {
+    client_connection_t* client;
+    uint8_t version;          // 结果帧的线格式版本
+    uint32_t query_id;
+    uint32_t limit;           // 本页行数上限
+    uint32_t total_rows;      // 本页已输出的行数
+    size_t page_bytes;        // 本页已输出的行数据字节数
+    int more;                 // 查到了超出本页的行
+    unsigned char* buffer;    // 当前帧
+    size_t capacity;
+    size_t length;
+    uint32_t row_count;       // 当前帧的行数
+    int64_t last_time;        // 当前帧最后一行的游标
+    int64_t last_id;
+} data_query_builder_t;
+
+// 发送当前结果帧
+static int data_query_flush(data_query_builder_t* builder, uint16_t status, uint16_t flags) {
+    uint8_t version = builder->version;
+    
+    WIRE_PUT_U32(builder->buffer, version, data_query_result_msg, query_id, builder->query_id);
+    WIRE_PUT_U16(builder->buffer, version, data_query_result_msg, status, status);
+    WIRE_PUT_U16(builder->buffer, version, data_query_result_msg, flags, flags);
+    WIRE_PUT_U32(builder->buffer, version, data_query_result_msg, row_count, builder->row_count);
+    WIRE_PUT_U64(builder->buffer, version, data_query_result_msg, next_after_time, (uint64_t)builder->last_time);
+    WIRE_PUT_U64(builder->buffer, version, data_query_result_msg, next_after_id, (uint64_t)builder->last_id);
+    
+    int result = server_send_message(builder->client, MSG_DATA_QUERY_RESULT, builder->buffer, builder->length);
+    
+    builder->length = WIRE_SIZE(version, data_query_result_msg);
+    builder->row_count = 0;
+    return result;
+}
+
+// 查询结果行回调：把行追加到当前帧，帧满时先发出
+static int data_query_add_row(const field_data_row_t* row, void* context) {
+    data_query_builder_t* builder = (data_query_builder_t*)context;
+    uint8_t version = builder->version;
+    
+    // 多查的一行只用于判断是否还有下一页
+    if (builder->total_rows >= builder->limit) {
+        builder->more = 1;
+        return 1;
+    }
     
-    if (send(client->socket_fd, &header, sizeof(header), 0) != sizeof(header)) {
-        perror("send heartbeat response");
-        return -1;
+    size_t stride = DATA_QUERY_ROW_STRIDE(version, row->data_size);
+    size_t header_length = WIRE_SIZE(version, data_query_result_msg);
+    
+    // 本页数据超出字节预算时这一行留到下一页
+    if (builder->total_rows > 0 && builder->page_bytes + stride > DATA_QUERY_PAGE_BYTES) {
+        builder->more = 1;
+        return 1;
+    }
+    
+    if (builder->row_count > 0 && builder->length + stride > builder->capacity) {
+        if (data_query_flush(builder, STATUS_SUCCESS, 0) != 0) {
+            return -1;
+        }
     }
     
+    // 单行超过帧大小时扩大缓冲区
+    if (header_length + stride > builder->capacity) {
+        unsigned char* buffer = realloc(builder->buffer, header_length + stride);
+        if (!buffer) {
+            return -1;
+        }
+        builder->buffer = buffer;
+        builder->capacity = header_length + stride;
+    }
+    
+    unsigned char* entry = builder->buffer + builder->length;
+    memset(entry, 0, stride);
+    WIRE_PUT_U64(entry, version, data_query_row, id, (uint64_t)row->id);
+    WIRE_PUT_U64(entry, version, data_query_row, upload_time, (uint64_t)row->upload_time);
+    WIRE_PUT_U32(entry, version, data_query_row, data_size, (uint32_t)row->data_size);
+    WIRE_PUT_STR(entry, version, data_query_row, field_name, row->field_name);
+    if (row->data_size > 0) {
+        memcpy(entry + WIRE_OFFSET(version, data_query_row, data), row->data, row->data_size);
+    }
+    
+    builder->length += stride;
+    builder->row_count++;
+    builder->total_rows++;
+    builder->page_bytes += stride;
+    builder->last_time = row->upload_time;
+    builder->last_id = row->id;
+    
     return 0;
 }
 
+// 处理数据查询：按键集游标查询一页数据，边读边组帧发送
+int handle_data_query(client_connection_t* client, const wire_view_t* view) {
+    if (!client || !view) {
+        return -1;
+    }
+    
+    field_data_query_t query;
+    memset(&query, 0, sizeof(query));
+    WIRE_GET_STR(view, data_query_msg, table_name, query.table_name, sizeof(query.table_name));
+    WIRE_GET_STR(view, data_query_msg, field_name, query.field_name, sizeof(query.field_name));
+    query.start_time = (int64_t)WIRE_GET_U64(view, data_query_msg, start_time);
+    query.end_time = (int64_t)WIRE_GET_U64(view, data_query_msg, end_time);
+    query.after_time = (int64_t)WIRE_GET_U64(view, data_query_msg, after_time);
+    query.after_id = (int64_t)WIRE_GET_U64(view, data_query_msg, after_id);
+    
+    uint32_t limit = WIRE_GET_U32(view, data_query_msg, limit);
+    if (limit == 0) {
+        limit = DATA_QUERY_DEFAULT_LIMIT;
+    } else if (limit > DATA_QUERY_MAX_LIMIT) {
+        limit = DATA_QUERY_MAX_LIMIT;
+    }
+    // 多查一行以判断是否还有下一页
+    query.limit = limit + 1;
+    
+    // 客户端没有及时接收之前的结果时先等待，不占用只读连接
+    if (mux_sender_wait_queued(&client->sender, DATA_QUERY_PAGE_BYTES) != 0) {
+        return -1;
+    }
+    
+    // 结果帧使用与查询帧相同的线格式（旧客户端发v1，协商了v2的客户端发v2）
+    data_query_builder_t builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.client = client;
+    builder.version = view->version;
+    builder.query_id = WIRE_GET_U32(view, data_query_msg, query_id);
+    builder.limit = limit;
+    builder.last_time = query.after_time;
+    builder.last_id = query.after_id;
+    builder.capacity = DATA_QUERY_FRAME_SIZE;
+    builder.length = WIRE_SIZE(builder.version, data_query_result_msg);
+    builder.buffer = malloc(builder.capacity);
+    if (!builder.buffer) {
+        send_error_response(client, "服务器内存不足");
+        return -1;
+    }
+    
+    printf("数据查询: 表=%s, 字段=%s, 时间=[%lld, %lld), 游标=(%lld, %lld), 行数=%u\n",
+           query.table_name, query.field_name[0] ? query.field_name : "*",
+           (long long)query.start_time, (long long)query.end_time,
+           (long long)query.after_time, (long long)query.after_id, limit);
+    
+    int result = 0;
+    if (query.table_name[0] == '\0') {
+        result = data_query_flush(&builder, STATUS_INVALID_REQUEST, DATA_QUERY_FLAG_LAST);
+    } else if (database_query_field_data(&query, data_query_add_row, &builder) < 0) {
+        // 已读出的行照常发出，最后一帧带错误状态，客户端可以从其游标重试
+        if (builder.row_count > 0) {
+            data_query_flush(&builder, STATUS_SUCCESS, 0);
+        }
+        result = data_query_flush(&builder, STATUS_SERVER_ERROR, DATA_QUERY_FLAG_LAST);
+    } else {
+        uint16_t flags = DATA_QUERY_FLAG_LAST | (builder.more ? DATA_QUERY_FLAG_MORE : 0);
+        result = data_query_flush(&builder, STATUS_SUCCESS, flags);
+    }
+    
+    free(builder.buffer);
+    return result;
+}
+
 // 发送版本响应
-int send_version_response(client_connection_t* client, status_code_t status) {
+int send_version_response(client_connection_t* client, status_code_t status, uint32_t retry_after) {
     if (!client) {
         return -1;
     }
     
-    version_response_msg_t response;
+    // 按协商后的线格式编码（客户端声明支持v2时响应本身即为v2）
+    uint8_t version = WIRE_VERSION_FOR(client->capabilities);
+    union {
+        version_response_msg_t v1;
+        version_response_msg_v2_t v2;
+    } response;
     memset(&response, 0, sizeof(response));
-    response.status = status;
     
-    // 设置服务器版本
-    strncpy(response.server_version, SERVER_VERSION, sizeof(response.server_version) - 1);
+    WIRE_PUT_U16(&response, version, version_response_msg, status, status);
     
-    // 获取最新版本
-    database_get_latest_version(response.latest_version, sizeof(response.latest_version));
+    // 设置服务器版本
+    WIRE_PUT_STR(&response, version, version_response_msg, server_version, SERVER_VERSION);
     
-    // 如果有更新，设置更新包大小
-    if (status == STATUS_UPDATE_AVAILABLE) {
-        struct stat st;
-        if (stat(UPDATE_FILE_PATH, &st) == 0) {
-            response.update_size = (uint32_t)st.st_size;
+    // 最新版本和更新包大小取自内存快照
+    latest_version_t latest;
+    if (version_cache_get(&latest) == 0) {
+        WIRE_PUT_STR(&response, version, version_response_msg, latest_version, latest.version);
+        
+        // 如果有更新，设置更新包大小
+        if (status == STATUS_UPDATE_AVAILABLE && latest.package_available) {
+            WIRE_PUT_U32(&response, version, version_response_msg, update_size, (uint32_t)latest.package_size);
         }
     }
     
-    // 创建消息头
-    message_header_t header;
-    init_message_header(&header, MSG_VERSION_RESPONSE, sizeof(response));
-    header.checksum = calculate_checksum(&response, sizeof(response));
+    // 返回协商后的能力位和建议的心跳间隔
+    WIRE_PUT_U32(&response, version, version_response_msg, capabilities, client->capabilities);
+    WIRE_PUT_U32(&response, version, version_response_msg, heartbeat_interval, SERVER_HEARTBEAT_INTERVAL);
+    WIRE_PUT_U32(&response, version, version_response_msg, retry_after, retry_after);
     
-    // 发送消息头
-    if (send(client->socket_fd, &header, sizeof(header), 0) != sizeof(header)) {
-        perror("send header");
-        return -1;
+    // 告知更新包哈希（客户端据此校验下载结果和续传），有从客户端当前版本出发的补丁时告知补丁大小
+    if (status == STATUS_UPDATE_AVAILABLE) {
+        update_package_t* package = version_cache_get_package();
+        if (package) {
+            memcpy((char*)&response + WIRE_OFFSET(version, version_response_msg, package_hash),
+                   package->hash, SHA256_DIGEST_SIZE);
+        }
+        
+        const update_delta_t* delta = (client->capabilities & CAP_DELTA_UPDATE) ?
+            update_package_find_delta(package, client->client_version) : NULL;
+        if (delta) {
+            WIRE_PUT_U32(&response, version, version_response_msg, delta_size,
+                         (uint32_t)(WIRE_SIZE(version, update_delta_msg) + delta->delta_length));
+        }
+        update_package_release(package);
     }
     
-    // 发送响应数据
-    if (send(client->socket_fd, &response, sizeof(response), 0) != sizeof(response)) {
-        perror("send response");
+    if (server_send_message(client, MSG_VERSION_RESPONSE, &response,
+                            WIRE_SIZE(version, version_response_msg)) != 0) {
         return -1;
     }
     
-    printf("版本响应已发送: 状态=%d\n", status);
+    if (retry_after > 0) {
+        printf("版本响应已发送: 状态=%d, 能力位=0x%08x, %u 秒后重新检查\n", status, client->capabilities, retry_after);
+    } else {
+        printf("版本响应已发送: 状态=%d, 能力位=0x%08x\n", status, client->capabilities);
+    }
     return 0;
 }
 
@@ -157,96 +602,315 @@ int check_update_available(const char* client_version) {
         return 0;
     }
     
-    char latest_version[32];
-    if (database_get_latest_version(latest_version, sizeof(latest_version)) != 0) {
+    latest_version_t latest;
+    if (version_cache_get(&latest) != 0) {
         return 0;
     }
     
     // 简单的版本比较（实际项目中应该使用更复杂的版本比较逻辑）
-    int result = strcmp(client_version, latest_version);
+    int result = strcmp(client_version, latest.version);
     return result < 0; // 客户端版本小于最新版本
 }
 
-// 发送更新文件
-int send_update_file(client_connection_t* client) {
-    if (!client) {
-        return -1;
+// 异步发送更新文件的日志上下文
+typedef struct {
+    char client_ip[INET_ADDRSTRLEN];
+    long file_size;
+    update_package_t* package;  // 发送共享编码副本时持有的引用
+    mux_frame_file_t* range;    // 从帧文件续传时的剩余部分
+    time_t start_time;          // 传输开始时间（计入分批发布的传输名额），0表示沿用分块下载的名额
+} update_send_context_t;
+
+// 创建发送上下文，接管package引用。transfer非0时为这次发送占用一个传输名额，
+// 否则这次发送是分块下载的一段，名额由rollout_chunked_begin/rollout_chunked_end管理
+static update_send_context_t* update_send_context_create(client_connection_t* client, update_package_t* package,
+                                                         long file_size, int transfer) {
+    update_send_context_t* context = calloc(1, sizeof(update_send_context_t));
+    if (!context) {
+        return NULL;
     }
     
-    FILE* file = fopen(UPDATE_FILE_PATH, "rb");
-    if (!file) {
-        perror("fopen update file");
-        send_error_response(client, "无法打开更新文件");
+    strncpy(context->client_ip, inet_ntoa(client->address.sin_addr), sizeof(context->client_ip) - 1);
+    context->client_ip[sizeof(context->client_ip) - 1] = '\0';
+    context->file_size = file_size;
+    context->package = package;
+    if (transfer) {
+        context->start_time = rollout_transfer_begin();
+    }
+    return context;
+}
+
+// 释放发送上下文并归还占用的传输名额
+static void update_send_context_destroy(update_send_context_t* context, int result) {
+    if (context->start_time != 0) {
+        rollout_transfer_end(context->start_time, result);
+    }
+    if (context->range) {
+        mux_frame_file_destroy(context->range);
+        free(context->range);
+    }
+    update_package_release(context->package);
+    free(context);
+}
+
+// 更新文件发送完成（在发送线程中调用）
+static void update_send_complete(void* context, int result) {
+    update_send_context_t* send_context = (update_send_context_t*)context;
+    char log_msg[256];
+    
+    if (result == 0) {
+        printf("更新文件已发送: %ld 字节\n", send_context->file_size);
+        snprintf(log_msg, sizeof(log_msg), "更新文件已发送给客户端，大小: %ld 字节", send_context->file_size);
+        database_log_system_event("INFO", log_msg, send_context->client_ip);
+    } else {
+        printf("更新文件发送失败\n");
+        snprintf(log_msg, sizeof(log_msg), "更新文件发送失败，大小: %ld 字节", send_context->file_size);
+        database_log_system_event("ERROR", log_msg, send_context->client_ip);
+    }
+    
+    update_send_context_destroy(send_context, result);
+}
+
+// 续传更新包：先通知续传起点，再发送更新包从offset开始的length字节（0表示到末尾）。
+// 客户端的哈希与当前更新包不符（更新包已变化）或范围无效时返回1，改为发送完整更新包
+int send_update_resume(client_connection_t* client, uint32_t offset, uint32_t length, const uint8_t* package_hash) {
+    if (!client || !package_hash) {
         return -1;
     }
     
-    // 获取文件大小
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    update_package_t* package = version_cache_get_package();
+    if (!package || memcmp(package->hash, package_hash, SHA256_DIGEST_SIZE) != 0 ||
+        offset % 3 != 0 || offset >= package->size) {
+        update_package_release(package);
+        return 1;
+    }
     
-    if (file_size <= 0) {
-        fclose(file);
-        send_error_response(client, "更新文件为空");
+    // 续传起点向下对齐到分片边界（原始数据48KB，编码后64KB），续传的各分片与完整发送时的分片
+    // 覆盖相同的数据；客户端按续传通知中的起点截断临时文件
+    if (length == 0) {
+        offset -= offset % (MUX_FRAGMENT_SIZE / 4 * 3);
+    }
+    
+    // 范围的终点必须是3的倍数或更新包末尾
+    uint64_t remaining = package->size - offset;
+    if (length == 0) {
+        length = (uint32_t)remaining;
+    } else if (length > remaining || (length % 3 != 0 && length != remaining)) {
+        update_package_release(package);
+        return 1;
+    }
+    
+    // Base64每3字节编码为4字符，从3的倍数处截取的编码即为这一段的编码。
+    // 校验和由发送线程边发送边计算，请求线程不预先读一遍这一段
+    size_t encoded_offset = (size_t)offset / 3 * 4;
+    size_t encoded_length = length == remaining ? package->encoded_length - encoded_offset : (size_t)length / 3 * 4;
+    update_send_context_t* context = update_send_context_create(client, package, (long)length,
+                                                                !rollout_chunked_active(client, package->hash));
+    if (!context) {
+        update_package_release(package);
+        return 1;
+    }
+    
+    if (package->frame) {
+        context->range = malloc(sizeof(mux_frame_file_t));
+        if (!context->range ||
+            mux_frame_file_init_deferred(context->range, package->frame->fd,
+                                         package->frame->offset + (off_t)encoded_offset,
+                                         (uint32_t)encoded_length, MSG_UPDATE_DATA) != 0) {
+            free(context->range);
+            context->range = NULL;
+            update_send_context_destroy(context, -1);
+            return 1;
+        }
+    }
+    
+    uint8_t version = WIRE_VERSION_FOR(client->capabilities);
+    union {
+        update_resume_msg_t v1;
+        update_resume_msg_v2_t v2;
+    } notice;
+    memset(&notice, 0, sizeof(notice));
+    WIRE_PUT_U32(&notice, version, update_resume_msg, offset, offset);
+    WIRE_PUT_U32(&notice, version, update_resume_msg, total_size, (uint32_t)package->size);
+    memcpy((char*)&notice + WIRE_OFFSET(version, update_resume_msg, package_hash), package->hash, SHA256_DIGEST_SIZE);
+    
+    // 等通知写入socket后再排队数据，保证客户端先收到续传起点
+    if (mux_send_message(&client->sender, MSG_UPDATE_RESUME, &notice, WIRE_SIZE(version, update_resume_msg), 1) != 0) {
+        update_send_complete(context, -1);
         return -1;
     }
     
-    // 读取文件内容
-    unsigned char* file_data = malloc(file_size);
-    if (!file_data) {
-        fclose(file);
-        send_error_response(client, "服务器内存不足");
+    long file_size = context->file_size;
+    int queued = context->range ?
+        mux_send_frame_file(&client->sender, context->range, update_send_complete, context) :
+        mux_send_shared(&client->sender, MSG_UPDATE_DATA, package->encoded + encoded_offset, encoded_length,
+                        NULL, update_send_complete, context);
+    if (queued != 0) {
+        update_send_complete(context, -1);
+        fprintf(stderr, "更新数据排队失败\n");
         return -1;
     }
     
-    size_t read_size = fread(file_data, 1, file_size, file);
-    fclose(file);
+    printf("更新文件开始续传: 偏移=%u, 发送 %ld 字节\n", offset, file_size);
+    return 0;
+}
+
+// 发送当前更新包的分块清单
+int send_update_manifest(client_connection_t* client) {
+    if (!client) {
+        return -1;
+    }
     
-    if (read_size != (size_t)file_size) {
-        free(file_data);
-        send_error_response(client, "读取更新文件失败");
+    update_package_t* package = version_cache_get_package();
+    if (!package || !package->chunk_hashes) {
+        update_package_release(package);
+        send_error_response(client, "更新包分块清单不可用");
         return -1;
     }
     
-    // Base64编码
-    size_t encoded_size = base64_encoded_length(file_size);
-    char* encoded_data = malloc(encoded_size + 1);
-    if (!encoded_data) {
-        free(file_data);
+    uint8_t version = WIRE_VERSION_FOR(client->capabilities);
+    size_t header_length = WIRE_SIZE(version, update_manifest_msg);
+    size_t hashes_length = (size_t)package->chunk_count * SHA256_DIGEST_SIZE;
+    unsigned char* message = calloc(1, header_length + hashes_length);
+    if (!message) {
+        update_package_release(package);
         send_error_response(client, "服务器内存不足");
         return -1;
     }
     
-    int encode_result = base64_encode(file_data, file_size, encoded_data, encoded_size + 1);
-    free(file_data);
+    memcpy(message + WIRE_OFFSET(version, update_manifest_msg, package_hash), package->hash, SHA256_DIGEST_SIZE);
+    WIRE_PUT_U32(message, version, update_manifest_msg, package_size, (uint32_t)package->size);
+    WIRE_PUT_U32(message, version, update_manifest_msg, chunk_size, UPDATE_CHUNK_SIZE);
+    WIRE_PUT_U32(message, version, update_manifest_msg, chunk_count, package->chunk_count);
+    memcpy(message + header_length, package->chunk_hashes, hashes_length);
     
-    if (encode_result == -1) {
-        free(encoded_data);
-        send_error_response(client, "文件编码失败");
+    uint32_t chunk_count = package->chunk_count;
+    update_package_release(package);
+    
+    int result = server_send_message(client, MSG_UPDATE_MANIFEST, message, header_length + hashes_length);
+    free(message);
+    
+    if (result == 0) {
+        printf("分块清单已发送: %u 个分块\n", chunk_count);
+    }
+    return result;
+}
+
+// 发送更新文件
+int send_update_file(client_connection_t* client) {
+    if (!client) {
         return -1;
     }
     
-    // 发送更新数据
-    message_header_t header;
-    init_message_header(&header, MSG_UPDATE_DATA, encode_result);
-    header.checksum = calculate_checksum(encoded_data, encode_result);
+    // 优先引用版本缓存中预先编码好的更新包（内存副本或帧文件），不再逐个连接读文件和编码
+    update_package_t* package = version_cache_get_package();
+    if (package) {
+        update_send_context_t* context = update_send_context_create(client, package, (long)package->size, 1);
+        if (!context) {
+            update_package_release(package);
+            send_error_response(client, "服务器内存不足");
+            return -1;
+        }
+        
+        // 排队后上下文和更新包可能已被发送线程释放
+        long file_size = context->file_size;
+        const char* source = package->frame ? "帧文件" : "共享编码副本";
+        
+        int queued = package->frame ?
+            mux_send_frame_file(&client->sender, package->frame, update_send_complete, context) :
+            mux_send_shared(&client->sender, MSG_UPDATE_DATA, package->encoded, package->encoded_length,
+                            &package->checksum, update_send_complete, context);
+        if (queued != 0) {
+            update_send_context_destroy(context, -1);
+            fprintf(stderr, "更新数据排队失败\n");
+            return -1;
+        }
+        
+        printf("更新文件开始发送（%s）: %ld 字节\n", source, file_size);
+        return 0;
+    }
     
-    // 发送消息头
-    if (send(client->socket_fd, &header, sizeof(header), 0) != sizeof(header)) {
-        perror("send header");
-        free(encoded_data);
+    FILE* file = fopen(UPDATE_FILE_PATH, "rb");
+    if (!file) {
+        perror("fopen update file");
+        send_error_response(client, "无法打开更新文件");
         return -1;
     }
     
-    // 发送编码后的文件数据
-    ssize_t sent = send(client->socket_fd, encoded_data, encode_result, 0);
-    free(encoded_data);
+    // 获取文件大小
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
     
-    if (sent != encode_result) {
-        perror("send update data");
+    if (file_size <= 0) {
+        fclose(file);
+        send_error_response(client, "更新文件为空");
         return -1;
     }
     
+    // 大文件交给发送线程边读边编码发送，不整体读入内存；发送期间仍可处理其他消息
+    if (is_stream_frame(MSG_UPDATE_DATA, 0, base64_encoded_length(file_size))) {
+        update_send_context_t* context = update_send_context_create(client, NULL, file_size, 1);
+        if (!context) {
+            fclose(file);
+            send_error_response(client, "服务器内存不足");
+            return -1;
+        }
+        
+        if (mux_send_file_base64(&client->sender, MSG_UPDATE_DATA, NULL, 0, file, (size_t)file_size,
+                                 update_send_complete, context, 0) != 0) {
+            update_send_context_destroy(context, -1);
+            fprintf(stderr, "更新数据排队失败\n");
+            return -1;
+        }
+        
+        printf("更新文件开始发送: %ld 字节\n", file_size);
+        return 0;
+    } else {
+        // 读取文件内容
+        unsigned char* file_data = malloc(file_size);
+        if (!file_data) {
+            fclose(file);
+            send_error_response(client, "服务器内存不足");
+            return -1;
+        }
+        
+        size_t read_size = fread(file_data, 1, file_size, file);
+        fclose(file);
+        
+        if (read_size != (size_t)file_size) {
+            free(file_data);
+            send_error_response(client, "读取更新文件失败");
+            return -1;
+        }
+        
+        // Base64编码
+        size_t encoded_size = base64_encoded_length(file_size);
+        char* encoded_data = malloc(encoded_size + 1);
+        if (!encoded_data) {
+            free(file_data);
+            send_error_response(client, "服务器内存不足");
+            return -1;
+        }
+        
+        int encode_result = base64_encode(file_data, file_size, encoded_data, encoded_size + 1);
+        free(file_data);
+        
+        if (encode_result == -1) {
+            free(encoded_data);
+            send_error_response(client, "文件编码失败");
+            return -1;
+        }
+        
+        // 发送编码后的更新数据
+        int send_result = server_send_message(client, MSG_UPDATE_DATA, encoded_data, encode_result);
+        free(encoded_data);
+        
+        if (send_result != 0) {
+            return -1;
+        }
+    }
+    
     printf("更新文件已发送: %ld 字节\n", file_size);
     
     // 记录系统日志
@@ -1,4 +1,5 @@
 #include "server.h"
+#include "../common/utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -80,11 +81,11 @@ int server_init(int port) {
 void server_cleanup() {
     g_server.running = 0;
     
-    // 关闭所有客户端连接
+    // 通知所有客户端处理线程断开连接
     pthread_mutex_lock(&g_server.clients_mutex);
     for (int i = 0; i < MAX_CLIENTS; i++) {
         if (g_server.clients[i].active) {
-            disconnect_client(&g_server.clients[i]);
+            shutdown_client(&g_server.clients[i]);
         }
     }
     pthread_mutex_unlock(&g_server.clients_mutex);
@@ -127,7 +128,7 @@ void server_stop() {
     }
 }
 
-// 接受客户端连接
+// 接受客户端连接（连接数已满时拒绝这个连接并返回0，只有监听socket出错时返回-1）
 int accept_client_connection() {
     struct sockaddr_in client_addr;
     socklen_t client_addr_len = sizeof(client_addr);
@@ -137,7 +138,11 @@ int accept_client_connection() {
                               &client_addr_len);
     
     if (client_socket == -1) {
-        if (errno != EINTR && g_server.running) {
+        // 连接在accept前被对端重置等临时错误不影响继续接受连接
+        if (errno == EINTR || errno == ECONNABORTED) {
+            return 0;
+        }
+        if (g_server.running) {
             perror("accept");
         }
         return -1;
@@ -158,7 +163,7 @@ int accept_client_connection() {
         pthread_mutex_unlock(&g_server.clients_mutex);
         printf("服务器已达到最大客户端连接数，拒绝新连接\n");
         close(client_socket);
-        return -1;
+        return 0;
     }
     
     // 初始化客户端连接
@@ -177,7 +182,7 @@ int accept_client_connection() {
         client->active = 0;
         close(client_socket);
         pthread_mutex_unlock(&g_server.clients_mutex);
-        return -1;
+        return 0;
     }
     
     // 分离线程，让其自动清理
@@ -194,7 +199,7 @@ int accept_client_connection() {
     return 0;
 }
 
-// 断开客户端连接
+// 断开客户端连接并释放槽位（只由该连接的处理线程在停止发送线程后调用，调用者持有clients_mutex）
 void disconnect_client(client_connection_t* client) {
     if (!client || !client->active) {
         return;
@@ -206,7 +211,12 @@ void disconnect_client(client_connection_t* client) {
     
     client->active = 0;
     
+    // 归还提供更新时保留的和进行中的分块下载占用的传输名额
+    rollout_release_offer(client);
+    rollout_chunked_end(client, -1);
+    
     if (client->socket_fd > 0) {
+        shutdown(client->socket_fd, SHUT_RDWR);
         close(client->socket_fd);
         client->socket_fd = 0;
     }
@@ -214,6 +224,17 @@ void disconnect_client(client_connection_t* client) {
     g_server.client_count--;
 }
 
+// 从其他线程断开客户端连接（调用者持有clients_mutex）：只关闭socket的收发，处理线程和发送线程
+// 随即出错退出，由处理线程关闭socket、停止发送线程并释放槽位。在此之前槽位保持占用，
+// 新连接不会复用仍在使用的发送调度器和文件描述符
+void shutdown_client(client_connection_t* client) {
+    if (!client || !client->active || client->socket_fd <= 0) {
+        return;
+    }
+    
+    shutdown(client->socket_fd, SHUT_RDWR);
+}
+
 // 记录客户端连接日志
 void log_client_connection(client_connection_t* client, const char* action) {
     if (!client) return;
@@ -225,13 +246,39 @@ void log_client_connection(client_connection_t* client, const char* action) {
            client->client_version);
 }
 
+// 发送消息（交给发送调度器排队，按协商结果压缩和分片交错）
+int server_send_message(client_connection_t* client, uint16_t type, const void* data, size_t length) {
+    if (!client || (length > 0 && !data)) {
+        return -1;
+    }
+    
+    if (mux_send_message(&client->sender, type, data, length, 0) != 0) {
+        fprintf(stderr, "消息排队失败: 类型=%d\n", type);
+        return -1;
+    }
+    
+    return 0;
+}
+
 // 客户端处理线程
 void* client_handler(void* arg) {
     client_connection_t* client = (client_connection_t*)arg;
-    char buffer[BUFFER_SIZE];
     
     log_client_connection(client, "连接");
     
+    // 启动发送线程，之后所有发往该客户端的消息都经发送调度器排队
+    int sender_ready = mux_sender_init(&client->sender) == 0;
+    if (!sender_ready || mux_sender_start(&client->sender, client->socket_fd) != 0) {
+        fprintf(stderr, "启动发送线程失败\n");
+        if (sender_ready) {
+            mux_sender_destroy(&client->sender);
+        }
+        pthread_mutex_lock(&g_server.clients_mutex);
+        disconnect_client(client);
+        pthread_mutex_unlock(&g_server.clients_mutex);
+        return NULL;
+    }
+    
     while (client->active && g_server.running) {
         // 接收消息头
         message_header_t header;
@@ -251,13 +298,28 @@ void* client_handler(void* arg) {
             break;
         }
         
-        // 验证消息头
+        // 验证消息头（v2帧的消息头为小端）
+        wire_decode_header(&header);
         if (!validate_message_header(&header)) {
             printf("无效的消息头\n");
             send_error_response(client, "无效的消息头");
             break;
         }
         
+        // 收到任何帧都说明客户端存活，不必等待显式心跳
+        client->last_heartbeat = time(NULL);
+        
+        // 大消息交给处理函数边接收边处理，不整体读入内存
+        if (is_stream_frame(header.type, header.flags, header.length)) {
+            if (handle_stream_message(client, &header) != 0) {
+                printf("处理客户端流消息失败\n");
+                break;
+            }
+            
+            client->last_heartbeat = time(NULL);
+            continue;
+        }
+        
         // 接收消息数据
         char* data = NULL;
         if (header.length > 0) {
@@ -286,6 +348,25 @@ void* client_handler(void* arg) {
             break;
         }
         
+        // 解压数据
+        if (header.flags & FRAME_FLAG_COMPRESSED) {
+            unsigned char* decompressed = NULL;
+            size_t decompressed_length = 0;
+            
+            if (decompress_frame(FRAME_CODEC(header.flags), data, header.length,
+                                 &decompressed, &decompressed_length, MAX_FRAME_LENGTH) != 0) {
+                printf("消息解压失败\n");
+                send_error_response(client, "数据解压失败");
+                free(data);
+                break;
+            }
+            
+            free(data);
+            data = (char*)decompressed;
+            header.length = (uint32_t)decompressed_length;
+            header.flags = 0;
+        }
+        
         // 处理消息
         if (handle_client_message(client, &header, data) != 0) {
             printf("处理客户端消息失败\n");
@@ -301,6 +382,10 @@ void* client_handler(void* arg) {
     
     log_client_connection(client, "断开");
     
+    // 放弃未接收完的逻辑流，发送完排队的消息后停止发送线程
+    close_client_streams(client);
+    mux_sender_destroy(&client->sender);
+    
     // 清理客户端连接
     pthread_mutex_lock(&g_server.clients_mutex);
     disconnect_client(client);
@@ -0,0 +1,608 @@
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// 数据保留：后台线程定期按各表的保留策略删除旧行。删除在写连接上分批进行，
+// 每批一个短事务，只在批次内持有db_mutex，组提交写线程的事务可以穿插在批次之间。
+// 行ID随写入时间递增，因此按ID从小到大删除：超龄删除从最早的行开始，遇到第一行未过期的行即停止；
+// 超量删除保留ID最大的max_rows行。开启归档时，被删除的行先复制到按日期命名的归档数据库
+
+// 保留策略，0表示不限制。默认所有表都不限制，只有用-R设置了策略的表才会删除旧行
+typedef struct {
+    const char* table;        // 表名
+    const char* time_column;  // 写入时间列
+    int max_age_days;         // 最长保留天数
+    long long max_rows;       // 最多保留行数
+} retention_policy_t;
+
+static retention_policy_t g_policies[] = {
+    { "system_logs",  "timestamp",    0,  0 },
+    { "clients",      "connect_time", 0,  0 },
+    { "file_uploads", "upload_time",  0,  0 },
+    { "field_data",   "upload_time",  0,  0 }    // 同时适用于物化数据表data_*
+};
+
+#define RETENTION_POLICY_COUNT (int)(sizeof(g_policies) / sizeof(g_policies[0]))
+
+// 一次清理的目标表
+typedef struct {
+    const char* table;
+    const char* id_column;
+    const char* time_column;
+    const retention_policy_t* policy;
+    char* archive_sql;        // 本轮复制到归档数据库的INSERT语句，首次归档时生成
+} retention_target_t;
+
+// 保留线程状态
+static struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int running;
+    int started;
+} g_retention;
+
+static int g_archive_enabled = 0;
+static long long g_deleted_rows = 0;   // 累计删除行数（原子访问）
+static long long g_archived_rows = 0;  // 累计归档行数（原子访问）
+static int g_vacuum_warned = 0;        // 是否已提示过数据库未开启增量清理（只在保留线程中访问）
+
+// 设置保留策略，格式为 表名:天数[:行数]
+int retention_set_policy(const char* spec) {
+    const char* colon = spec ? strchr(spec, ':') : NULL;
+    if (!colon) {
+        return -1;
+    }
+    
+    retention_policy_t* policy = NULL;
+    for (int i = 0; i < RETENTION_POLICY_COUNT; i++) {
+        if (strlen(g_policies[i].table) == (size_t)(colon - spec) &&
+            strncmp(g_policies[i].table, spec, colon - spec) == 0) {
+            policy = &g_policies[i];
+            break;
+        }
+    }
+    if (!policy) {
+        return -1;
+    }
+    
+    char* end;
+    long days = strtol(colon + 1, &end, 10);
+    if (end == colon + 1 || days < 0 || days > 36500) {
+        return -1;
+    }
+    
+    long long rows = policy->max_rows;
+    if (*end == ':') {
+        const char* start = end + 1;
+        rows = strtoll(start, &end, 10);
+        if (end == start || rows < 0) {
+            return -1;
+        }
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+    
+    policy->max_age_days = (int)days;
+    policy->max_rows = rows;
+    return 0;
+}
+
+// 开启或关闭归档
+void retention_set_archive(int enabled) {
+    g_archive_enabled = enabled;
+}
+
+// 打印当前保留策略（用于帮助信息）
+void retention_print_policies() {
+    for (int i = 0; i < RETENTION_POLICY_COUNT; i++) {
+        char age[32];
+        char rows[32];
+        
+        if (g_policies[i].max_age_days > 0) {
+            snprintf(age, sizeof(age), "%d天", g_policies[i].max_age_days);
+        } else {
+            snprintf(age, sizeof(age), "不限");
+        }
+        if (g_policies[i].max_rows > 0) {
+            snprintf(rows, sizeof(rows), "%lld行", g_policies[i].max_rows);
+        } else {
+            snprintf(rows, sizeof(rows), "不限");
+        }
+        
+        printf("                 %-13s 保留%s，最多%s\n", g_policies[i].table, age, rows);
+    }
+}
+
+// 打印清理统计
+void retention_print_status() {
+    printf("数据保留: 已删除 %lld 行，已归档 %lld 行%s\n",
+           __atomic_load_n(&g_deleted_rows, __ATOMIC_RELAXED),
+           __atomic_load_n(&g_archived_rows, __ATOMIC_RELAXED),
+           g_archive_enabled ? "" : " (未开启归档)");
+}
+
+// 线程是否仍在运行（清理过程中不持有线程锁读取）
+static int retention_running() {
+    return __atomic_load_n(&g_retention.running, __ATOMIC_ACQUIRE);
+}
+
+// 等待指定毫秒数，线程被停止时提前返回0
+static int retention_sleep(long ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    
+    pthread_mutex_lock(&g_retention.mutex);
+    while (g_retention.running) {
+        if (pthread_cond_timedwait(&g_retention.cond, &g_retention.mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    int running = g_retention.running;
+    pthread_mutex_unlock(&g_retention.mutex);
+    
+    return running;
+}
+
+// 在写连接上执行SQL（调用者持有db_mutex）
+static int retention_exec(const char* sql) {
+    char* error_msg = NULL;
+    
+    if (sqlite3_exec(g_server.database, sql, NULL, NULL, &error_msg) != SQLITE_OK) {
+        fprintf(stderr, "数据保留执行SQL失败: %s\n", error_msg ? error_msg : sqlite3_errmsg(g_server.database));
+        sqlite3_free(error_msg);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// 执行带至多两个整数参数、返回一个整数的查询（调用者持有db_mutex）。
+// 有结果返回1，无结果返回0，出错返回-1
+static int retention_query_id(const char* sql, int param_count, sqlite3_int64 p1, sqlite3_int64 p2,
+                              sqlite3_int64* value) {
+    sqlite3_stmt* stmt;
+    
+    if (sqlite3_prepare_v2(g_server.database, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "数据保留准备查询失败: %s\n", sqlite3_errmsg(g_server.database));
+        return -1;
+    }
+    
+    if (param_count > 0) {
+        sqlite3_bind_int64(stmt, 1, p1);
+    }
+    if (param_count > 1) {
+        sqlite3_bind_int64(stmt, 2, p2);
+    }
+    
+    int rc = sqlite3_step(stmt);
+    int result = -1;
+    if (rc == SQLITE_ROW) {
+        *value = sqlite3_column_int64(stmt, 0);
+        result = 1;
+    } else if (rc == SQLITE_DONE) {
+        result = 0;
+    }
+    
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+// 附加今天的归档数据库（调用者持有db_mutex）
+static int retention_attach_archive() {
+    struct stat st = {0};
+    if (stat(ARCHIVE_DIR, &st) == -1 && mkdir(ARCHIVE_DIR, 0755) == -1) {
+        perror("mkdir " ARCHIVE_DIR);
+        return -1;
+    }
+    
+    char date[16];
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    strftime(date, sizeof(date), "%Y%m%d", &local);
+    
+    char* sql = sqlite3_mprintf("ATTACH DATABASE '%q/archive-%q.db' AS archive;", ARCHIVE_DIR, date);
+    int result = sql ? retention_exec(sql) : -1;
+    sqlite3_free(sql);
+    
+    return result;
+}
+
+// 准备归档表：不存在时按源表结构创建，补齐源表后来新增的列，生成复制语句（调用者持有db_mutex）
+static int retention_prepare_archive(retention_target_t* target) {
+    char* sql = sqlite3_mprintf("CREATE TABLE IF NOT EXISTS archive.\"%w\" AS SELECT * FROM main.\"%w\" WHERE 0;",
+                                target->table, target->table);
+    int result = sql ? retention_exec(sql) : -1;
+    sqlite3_free(sql);
+    if (result != 0) {
+        return -1;
+    }
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(g_server.database,
+                           "SELECT name, name NOT IN (SELECT name FROM pragma_table_info(?1, 'archive')) "
+                           "FROM pragma_table_info(?1, 'main') ORDER BY cid",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "数据保留准备查询失败: %s\n", sqlite3_errmsg(g_server.database));
+        return -1;
+    }
+    sqlite3_bind_text(stmt, 1, target->table, -1, SQLITE_STATIC);
+    
+    sqlite3_str* columns = sqlite3_str_new(g_server.database);
+    int count = 0;
+    
+    while (result == 0 && sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* name = (const char*)sqlite3_column_text(stmt, 0);
+        
+        if (sqlite3_column_int(stmt, 1)) {
+            sql = sqlite3_mprintf("ALTER TABLE archive.\"%w\" ADD COLUMN \"%w\";", target->table, name);
+            result = sql ? retention_exec(sql) : -1;
+            sqlite3_free(sql);
+        }
+        
+        sqlite3_str_appendf(columns, "%s\"%w\"", count++ ? "," : "", name);
+    }
+    sqlite3_finalize(stmt);
+    
+    char* list = sqlite3_str_finish(columns);
+    if (result != 0 || !list || count == 0) {
+        sqlite3_free(list);
+        return -1;
+    }
+    
+    target->archive_sql = sqlite3_mprintf("INSERT INTO archive.\"%w\" (%s) SELECT %s FROM main.\"%w\" WHERE \"%w\" <= ?1;",
+                                          target->table, list, list, target->table, target->id_column);
+    sqlite3_free(list);
+    
+    return target->archive_sql ? 0 : -1;
+}
+
+// 在一个事务中删除（并归档）ID不大于last_id的行，返回删除的行数（调用者持有db_mutex）
+static int retention_delete_through(retention_target_t* target, sqlite3_int64 last_id, int archive) {
+    if (archive && !target->archive_sql && retention_prepare_archive(target) != 0) {
+        return -1;
+    }
+    
+    if (retention_exec("BEGIN IMMEDIATE;") != 0) {
+        return -1;
+    }
+    
+    sqlite3_stmt* stmt;
+    int archived = 0;
+    int deleted = -1;
+    
+    if (archive) {
+        if (sqlite3_prepare_v2(g_server.database, target->archive_sql, -1, &stmt, NULL) != SQLITE_OK) {
+            goto fail;
+        }
+        sqlite3_bind_int64(stmt, 1, last_id);
+        int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        if (rc != SQLITE_DONE) {
+            goto fail;
+        }
+        archived = sqlite3_changes(g_server.database);
+    }
+    
+    char* sql = sqlite3_mprintf("DELETE FROM main.\"%w\" WHERE \"%w\" <= ?1;", target->table, target->id_column);
+    if (!sql || sqlite3_prepare_v2(g_server.database, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        sqlite3_free(sql);
+        goto fail;
+    }
+    sqlite3_free(sql);
+    sqlite3_bind_int64(stmt, 1, last_id);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        goto fail;
+    }
+    deleted = sqlite3_changes(g_server.database);
+    
+    if (retention_exec("COMMIT;") != 0) {
+        goto fail;
+    }
+    
+    __atomic_add_fetch(&g_deleted_rows, deleted, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_archived_rows, archived, __ATOMIC_RELAXED);
+    return deleted;
+
+fail:
+    fprintf(stderr, "清理表 %s 失败: %s\n", target->table, sqlite3_errmsg(g_server.database));
+    sqlite3_exec(g_server.database, "ROLLBACK;", NULL, NULL, NULL);
+    return -1;
+}
+
+// 找出从最早的行开始连续过期的一段（最多一批）的最后一个ID（调用者持有db_mutex）。
+// 有过期行返回1，没有返回0，出错返回-1
+static int retention_find_expired(retention_target_t* target, const char* cutoff, sqlite3_int64* last_id) {
+    char* sql = sqlite3_mprintf("SELECT \"%w\", \"%w\" < ?1 FROM main.\"%w\" ORDER BY \"%w\" LIMIT ?2;",
+                                target->id_column, target->time_column, target->table, target->id_column);
+    sqlite3_stmt* stmt;
+    
+    if (!sql || sqlite3_prepare_v2(g_server.database, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        sqlite3_free(sql);
+        fprintf(stderr, "数据保留准备查询失败: %s\n", sqlite3_errmsg(g_server.database));
+        return -1;
+    }
+    sqlite3_free(sql);
+    
+    sqlite3_bind_text(stmt, 1, cutoff, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, RETENTION_BATCH_ROWS);
+    
+    int found = 0;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW && sqlite3_column_int(stmt, 1)) {
+        *last_id = sqlite3_column_int64(stmt, 0);
+        found = 1;
+    }
+    sqlite3_finalize(stmt);
+    
+    return rc == SQLITE_ROW || rc == SQLITE_DONE ? found : -1;
+}
+
+// 删除超过最长保留天数的行
+static void retention_enforce_age(retention_target_t* target, int archive) {
+    // 时间列为CURRENT_TIMESTAMP写入的UTC时间
+    char cutoff[32];
+    time_t limit = time(NULL) - (time_t)target->policy->max_age_days * 24 * 3600;
+    struct tm utc;
+    gmtime_r(&limit, &utc);
+    strftime(cutoff, sizeof(cutoff), "%Y-%m-%d %H:%M:%S", &utc);
+    
+    int deleted;
+    do {
+        sqlite3_int64 last_id = 0;
+        
+        pthread_mutex_lock(&g_server.db_mutex);
+        int found = retention_find_expired(target, cutoff, &last_id);
+        deleted = found == 1 ? retention_delete_through(target, last_id, archive) : -1;
+        pthread_mutex_unlock(&g_server.db_mutex);
+        
+        // 不足一批说明遇到了未过期的行
+    } while (deleted == RETENTION_BATCH_ROWS && retention_sleep(RETENTION_BATCH_PAUSE_MS));
+}
+
+// 删除超出最大行数的最早的行
+static void retention_enforce_rows(retention_target_t* target, int archive) {
+    char* sql = sqlite3_mprintf("SELECT \"%w\" FROM main.\"%w\" ORDER BY \"%w\" DESC LIMIT 1 OFFSET ?1;",
+                                target->id_column, target->table, target->id_column);
+    char* batch_sql = sqlite3_mprintf("SELECT \"%w\" FROM main.\"%w\" WHERE \"%w\" <= ?1 ORDER BY \"%w\" LIMIT 1 OFFSET ?2;",
+                                      target->id_column, target->table, target->id_column, target->id_column);
+    if (!sql || !batch_sql) {
+        sqlite3_free(sql);
+        sqlite3_free(batch_sql);
+        return;
+    }
+    
+    // 之后写入的行ID更大，本轮只需删除到此时第max_rows+1新的行为止
+    sqlite3_int64 limit_id = 0;
+    pthread_mutex_lock(&g_server.db_mutex);
+    int found = retention_query_id(sql, 1, target->policy->max_rows, 0, &limit_id);
+    pthread_mutex_unlock(&g_server.db_mutex);
+    
+    while (found == 1) {
+        sqlite3_int64 last_id = limit_id;
+        
+        pthread_mutex_lock(&g_server.db_mutex);
+        int more = retention_query_id(batch_sql, 2, limit_id, RETENTION_BATCH_ROWS - 1, &last_id);
+        int deleted = more >= 0 ? retention_delete_through(target, last_id, archive) : -1;
+        pthread_mutex_unlock(&g_server.db_mutex);
+        
+        if (deleted < 0 || last_id >= limit_id || !retention_sleep(RETENTION_BATCH_PAUSE_MS)) {
+            break;
+        }
+    }
+    
+    sqlite3_free(sql);
+    sqlite3_free(batch_sql);
+}
+
+// 按策略清理一张表
+static void retention_enforce(retention_target_t* target, int archive) {
+    if (target->policy->max_age_days > 0) {
+        retention_enforce_age(target, archive);
+    }
+    if (target->policy->max_rows > 0 && retention_running()) {
+        retention_enforce_rows(target, archive);
+    }
+    
+    sqlite3_free(target->archive_sql);
+    target->archive_sql = NULL;
+}
+
+// 清理field_data策略下的物化数据表
+static void retention_enforce_materialized(const retention_policy_t* policy, int archive) {
+    sqlite3_stmt* stmt;
+    char** tables = NULL;
+    int count = 0;
+    
+    pthread_mutex_lock(&g_server.db_mutex);
+    if (sqlite3_prepare_v2(g_server.database,
+                           "SELECT name FROM sqlite_master WHERE type = 'table' AND name GLOB 'data_*'",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            char** grown = realloc(tables, (count + 1) * sizeof(char*));
+            if (!grown) {
+                break;
+            }
+            tables = grown;
+            if ((tables[count] = strdup((const char*)sqlite3_column_text(stmt, 0)))) {
+                count++;
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+    pthread_mutex_unlock(&g_server.db_mutex);
+    
+    for (int i = 0; i < count; i++) {
+        retention_target_t target = { tables[i], "_id", "_upload_time", policy, NULL };
+        if (retention_running()) {
+            retention_enforce(&target, archive);
+        }
+        free(tables[i]);
+    }
+    free(tables);
+}
+
+// 增量回收空闲页，分多次进行以免长时间占用写连接
+static void retention_vacuum() {
+    sqlite3_int64 mode = 0;
+    pthread_mutex_lock(&g_server.db_mutex);
+    retention_query_id("PRAGMA auto_vacuum", 0, 0, 0, &mode);
+    pthread_mutex_unlock(&g_server.db_mutex);
+    
+    // 未开启增量清理时删除的行只变成空闲页供之后的写入重复使用，文件不会缩小。
+    // 切换需要停服后执行一次VACUUM，删除过行之后提示一次
+    if (mode != 2) {
+        if (!g_vacuum_warned && __atomic_load_n(&g_deleted_rows, __ATOMIC_RELAXED) > 0) {
+            g_vacuum_warned = 1;
+            printf("数据保留: 数据库未开启增量清理，删除旧行后文件不会缩小。"
+                   "需要缩小时停止服务器后执行一次: sqlite3 %s \"PRAGMA auto_vacuum=INCREMENTAL; VACUUM;\"\n",
+                   DATABASE_PATH);
+        }
+        return;
+    }
+    
+    char sql[64];
+    snprintf(sql, sizeof(sql), "PRAGMA incremental_vacuum(%d);", RETENTION_VACUUM_PAGES);
+    
+    while (retention_running()) {
+        sqlite3_int64 free_pages = 0;
+        
+        pthread_mutex_lock(&g_server.db_mutex);
+        int result = retention_query_id("PRAGMA freelist_count", 0, 0, 0, &free_pages);
+        if (result == 1 && free_pages > 0) {
+            result = retention_exec(sql);
+        }
+        pthread_mutex_unlock(&g_server.db_mutex);
+        
+        if (result < 0 || free_pages <= RETENTION_VACUUM_PAGES || !retention_sleep(RETENTION_BATCH_PAUSE_MS)) {
+            break;
+        }
+    }
+}
+
+// 外置值是否仍被field_data中的行引用：引用返回1，未引用返回0，出错返回-1
+static int retention_blob_referenced(const char* hash_hex) {
+    sqlite3_stmt* stmt;
+    int result = -1;
+    
+    pthread_mutex_lock(&g_server.db_mutex);
+    if (sqlite3_prepare_v2(g_server.database, "SELECT 1 FROM field_data WHERE blob_hash = ? LIMIT 1",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, hash_hex, -1, SQLITE_STATIC);
+        int rc = sqlite3_step(stmt);
+        result = rc == SQLITE_ROW ? 1 : rc == SQLITE_DONE ? 0 : -1;
+        sqlite3_finalize(stmt);
+    }
+    pthread_mutex_unlock(&g_server.db_mutex);
+    
+    return result;
+}
+
+// 执行一轮清理
+static void retention_run() {
+    int archive = 0;
+    
+    if (g_archive_enabled) {
+        pthread_mutex_lock(&g_server.db_mutex);
+        archive = retention_attach_archive() == 0;
+        pthread_mutex_unlock(&g_server.db_mutex);
+    }
+    
+    for (int i = 0; i < RETENTION_POLICY_COUNT && retention_running(); i++) {
+        const retention_policy_t* policy = &g_policies[i];
+        if (policy->max_age_days == 0 && policy->max_rows == 0) {
+            continue;
+        }
+        
+        retention_target_t target = { policy->table, "id", policy->time_column, policy, NULL };
+        retention_enforce(&target, archive);
+        
+        if (strcmp(policy->table, "field_data") == 0) {
+            retention_enforce_materialized(policy, archive);
+        }
+    }
+    
+    if (archive) {
+        pthread_mutex_lock(&g_server.db_mutex);
+        retention_exec("DETACH DATABASE archive;");
+        pthread_mutex_unlock(&g_server.db_mutex);
+    }
+    
+    // 删除不再被引用的外置值；归档的行仍引用外置文件，开启归档时不回收
+    if (!g_archive_enabled && retention_running()) {
+        int removed = blob_store_collect(retention_blob_referenced);
+        if (removed > 0) {
+            printf("已回收 %d 个外置值文件\n", removed);
+        }
+    }
+    
+    retention_vacuum();
+}
+
+// 保留线程：启动时清理一次，之后每隔RETENTION_INTERVAL秒清理一次
+static void* retention_thread(void* arg) {
+    (void)arg;
+    
+    do {
+        retention_run();
+    } while (retention_sleep(RETENTION_INTERVAL * 1000L));
+    
+    return NULL;
+}
+
+// 启动数据保留线程
+int retention_start() {
+    if (pthread_mutex_init(&g_retention.mutex, NULL) != 0) {
+        perror("pthread_mutex_init retention");
+        return -1;
+    }
+    
+    if (pthread_cond_init(&g_retention.cond, NULL) != 0) {
+        perror("pthread_cond_init retention");
+        pthread_mutex_destroy(&g_retention.mutex);
+        return -1;
+    }
+    
+    g_retention.running = 1;
+    if (pthread_create(&g_retention.thread, NULL, retention_thread, NULL) != 0) {
+        perror("pthread_create retention");
+        g_retention.running = 0;
+        pthread_cond_destroy(&g_retention.cond);
+        pthread_mutex_destroy(&g_retention.mutex);
+        return -1;
+    }
+    
+    g_retention.started = 1;
+    return 0;
+}
+
+// 停止数据保留线程，正在进行的批次提交后退出
+void retention_stop() {
+    if (!g_retention.started) {
+        return;
+    }
+    
+    pthread_mutex_lock(&g_retention.mutex);
+    __atomic_store_n(&g_retention.running, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&g_retention.cond);
+    pthread_mutex_unlock(&g_retention.mutex);
+    
+    pthread_join(g_retention.thread, NULL);
+    
+    pthread_cond_destroy(&g_retention.cond);
+    pthread_mutex_destroy(&g_retention.mutex);
+    g_retention.started = 0;
+}
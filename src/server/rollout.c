@@ -0,0 +1,295 @@
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 分批发布：版本检查时只有落在当前批次内、且还有传输名额的客户端收到STATUS_UPDATE_AVAILABLE。
+// 提供更新即为客户端保留一个名额，客户端请求更新包时名额转为传输中，传输完成后归还；
+// 提供后ROLLOUT_OFFER_HOLD秒内没有请求（关闭了自动更新等）或断开连接时保留的名额作废。
+// 旧客户端不先做版本检查就请求更新包时同样受名额上限约束。
+// 后台预取的客户端在另一条连接上检查版本和下载，名额只在客户端标识相同的连接之间转移。
+// 按分块清单下载时客户端逐段请求，从第一段获准到客户端报告下载结束或断开连接只占用一个名额
+
+static struct {
+    pthread_mutex_t mutex;
+    int max_transfers;            // 同时进行的更新传输上限，0表示不限
+    int offered;                  // 已提供更新、尚未开始传输的客户端数
+    int transferring;             // 正在进行的更新传输数
+    long long total_offers;       // 累计提供更新次数
+    long long total_deferred;     // 累计暂缓次数
+    time_t window_start;          // 当前统计分钟的起点
+    int window_offers;            // 当前分钟内提供更新的次数
+    int window_deferred;          // 当前分钟内因名额已满暂缓的次数
+    int last_offers;              // 上一分钟提供更新的次数
+    int last_deferred;            // 上一分钟因名额已满暂缓的次数
+    double average_transfer;      // 最近完成的传输耗时的滑动平均（秒），0表示还没有样本
+} g_rollout = { PTHREAD_MUTEX_INITIALIZER, ROLLOUT_DEFAULT_MAX_TRANSFERS, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0.0 };
+
+// 设置同时进行的更新传输上限
+void rollout_set_max_transfers(int max_transfers) {
+    pthread_mutex_lock(&g_rollout.mutex);
+    g_rollout.max_transfers = max_transfers > 0 ? max_transfers : 0;
+    pthread_mutex_unlock(&g_rollout.mutex);
+}
+
+// 按分钟滚动统计窗口（持有锁时调用）
+static void rollout_roll_window(time_t now) {
+    if (now - g_rollout.window_start < 60) {
+        return;
+    }
+    
+    // 超过一分钟没有活动时上一分钟的计数为0
+    int consecutive = now - g_rollout.window_start < 120;
+    g_rollout.last_offers = consecutive ? g_rollout.window_offers : 0;
+    g_rollout.last_deferred = consecutive ? g_rollout.window_deferred : 0;
+    g_rollout.window_offers = 0;
+    g_rollout.window_deferred = 0;
+    g_rollout.window_start = now;
+}
+
+// 是否还有传输名额（持有锁时调用）
+static int rollout_has_capacity() {
+    return g_rollout.max_transfers == 0 ||
+           g_rollout.offered + g_rollout.transferring < g_rollout.max_transfers;
+}
+
+// 名额已满时建议的重试间隔（持有锁时调用）：按平均传输时间估算名额空出的时间，等待的客户端越多
+// 越往后推，再加上±25%的随机抖动，避免被暂缓的客户端同时回来
+static uint32_t rollout_busy_retry() {
+    double estimate = g_rollout.average_transfer > 0 ? g_rollout.average_transfer : ROLLOUT_RETRY_MIN;
+    if (g_rollout.max_transfers > 0) {
+        int waiting = g_rollout.window_deferred > g_rollout.last_deferred ?
+                      g_rollout.window_deferred : g_rollout.last_deferred;
+        estimate *= 1.0 + (double)waiting / g_rollout.max_transfers;
+    }
+    estimate *= 0.75 + (double)(rand() % 51) / 100.0;
+    
+    if (estimate < ROLLOUT_RETRY_MIN) {
+        estimate = ROLLOUT_RETRY_MIN;
+    } else if (estimate > ROLLOUT_RETRY_MAX) {
+        estimate = ROLLOUT_RETRY_MAX;
+    }
+    return (uint32_t)estimate;
+}
+
+// 客户端是否报告了标识
+static int rollout_has_client_id(const client_connection_t* client) {
+    for (size_t i = 0; i < sizeof(client->client_id); i++) {
+        if (client->client_id[i] != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 查找同一客户端（标识相同）上保留了名额的其他连接，即该客户端的预取连接或主连接。
+// 没有标识的旧客户端不共享名额，避免同一地址后面的多个客户端绕过名额上限（持有clients_mutex和分批发布的锁时调用）
+static client_connection_t* rollout_find_sibling_offer(const client_connection_t* client) {
+    if (!rollout_has_client_id(client)) {
+        return NULL;
+    }
+    
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        client_connection_t* other = &g_server.clients[i];
+        if (other != client && other->active && other->update_offer_time != 0 &&
+            memcmp(other->client_id, client->client_id, sizeof(client->client_id)) == 0) {
+            return other;
+        }
+    }
+    return NULL;
+}
+
+// 客户端所在的批次（0-99）：由客户端标识（没有标识时用地址）和最新版本号决定，同一版本内固定，
+// 换版本后重新分布。同一NAT后面的客户端地址相同，只按地址分批会全部落进同一批次
+static int rollout_cohort(const client_connection_t* client, const char* version) {
+    uint32_t hash = 2166136261u;
+    const unsigned char* key = (const unsigned char*)&client->address.sin_addr.s_addr;
+    size_t key_length = sizeof(client->address.sin_addr.s_addr);
+    
+    // 客户端标识只由该连接自己的处理线程写入，这里读取不需要加锁
+    if (rollout_has_client_id(client)) {
+        key = client->client_id;
+        key_length = sizeof(client->client_id);
+    }
+    
+    for (size_t i = 0; i < key_length; i++) {
+        hash = (hash ^ key[i]) * 16777619u;
+    }
+    for (const char* p = version; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    
+    return (int)(hash % 100);
+}
+
+// 版本检查时决定是否向需要更新的客户端提供更新。提供时返回1并保留传输名额；
+// 暂缓时返回0，retry_after为建议的重新检查间隔
+int rollout_offer(client_connection_t* client, const latest_version_t* latest, uint32_t* retry_after) {
+    *retry_after = 0;
+    
+    if (rollout_cohort(client, latest->version) >= latest->rollout_percent) {
+        *retry_after = ROLLOUT_COHORT_RECHECK;
+        pthread_mutex_lock(&g_rollout.mutex);
+        g_rollout.total_deferred++;
+        pthread_mutex_unlock(&g_rollout.mutex);
+        return 0;
+    }
+    
+    time_t now = time(NULL);
+    int offered = 1;
+    
+    pthread_mutex_lock(&g_server.clients_mutex);
+    pthread_mutex_lock(&g_rollout.mutex);
+    rollout_roll_window(now);
+    
+    // 同一连接重复检查、或同一客户端的另一条连接已保留名额时沿用已保留的名额
+    if (client->update_offer_time == 0 && !rollout_find_sibling_offer(client)) {
+        if (rollout_has_capacity()) {
+            client->update_offer_time = now;
+            g_rollout.offered++;
+        } else {
+            offered = 0;
+        }
+    }
+    
+    if (offered) {
+        g_rollout.total_offers++;
+        g_rollout.window_offers++;
+    } else {
+        g_rollout.total_deferred++;
+        g_rollout.window_deferred++;
+        *retry_after = rollout_busy_retry();
+    }
+    pthread_mutex_unlock(&g_rollout.mutex);
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    
+    return offered;
+}
+
+// 客户端请求更新包时调用：已保留名额的客户端总能开始传输，没有保留的在还有名额时才能开始。
+// 允许时返回0，名额已满时返回-1，retry_after为建议的重新检查间隔
+int rollout_admit(client_connection_t* client, uint32_t* retry_after) {
+    int result = 0;
+    *retry_after = 0;
+    
+    pthread_mutex_lock(&g_server.clients_mutex);
+    pthread_mutex_lock(&g_rollout.mutex);
+    rollout_roll_window(time(NULL));
+    
+    client_connection_t* holder = client->update_offer_time != 0 ? client : rollout_find_sibling_offer(client);
+    if (holder) {
+        // 保留的名额交给接下来的传输（rollout_transfer_begin时重新计入）
+        holder->update_offer_time = 0;
+        g_rollout.offered--;
+    } else if (!rollout_has_capacity()) {
+        g_rollout.total_deferred++;
+        g_rollout.window_deferred++;
+        *retry_after = rollout_busy_retry();
+        result = -1;
+    }
+    
+    pthread_mutex_unlock(&g_rollout.mutex);
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    return result;
+}
+
+// 客户端断开时释放保留的名额
+void rollout_release_offer(client_connection_t* client) {
+    pthread_mutex_lock(&g_rollout.mutex);
+    if (client->update_offer_time != 0) {
+        client->update_offer_time = 0;
+        g_rollout.offered--;
+    }
+    pthread_mutex_unlock(&g_rollout.mutex);
+}
+
+// 释放提供后长时间没有使用的名额（由状态监控线程定期调用）
+void rollout_expire_offer(client_connection_t* client, time_t now) {
+    pthread_mutex_lock(&g_rollout.mutex);
+    if (client->update_offer_time != 0 && now - client->update_offer_time > ROLLOUT_OFFER_HOLD) {
+        client->update_offer_time = 0;
+        g_rollout.offered--;
+    }
+    pthread_mutex_unlock(&g_rollout.mutex);
+}
+
+// 开始一次更新传输，返回开始时间，传输结束时传给rollout_transfer_end
+time_t rollout_transfer_begin() {
+    pthread_mutex_lock(&g_rollout.mutex);
+    g_rollout.transferring++;
+    pthread_mutex_unlock(&g_rollout.mutex);
+    
+    return time(NULL);
+}
+
+// 归还传输名额，成功完成的传输计入平均传输时间（持有锁时调用）
+static void rollout_finish_transfer(time_t start_time, int result) {
+    double elapsed = difftime(time(NULL), start_time);
+    
+    g_rollout.transferring--;
+    if (result == 0) {
+        g_rollout.average_transfer = g_rollout.average_transfer > 0 ?
+            g_rollout.average_transfer * 0.8 + elapsed * 0.2 : elapsed;
+    }
+}
+
+// 结束一次更新传输
+void rollout_transfer_end(time_t start_time, int result) {
+    pthread_mutex_lock(&g_rollout.mutex);
+    rollout_finish_transfer(start_time, result);
+    pthread_mutex_unlock(&g_rollout.mutex);
+}
+
+// 获准按分块清单下载后调用：直到rollout_chunked_end之前，这条连接上的范围请求共用一个传输名额
+void rollout_chunked_begin(client_connection_t* client, const uint8_t* package_hash) {
+    pthread_mutex_lock(&g_rollout.mutex);
+    if (client->chunked_start == 0) {
+        g_rollout.transferring++;
+        client->chunked_start = time(NULL);
+    }
+    memcpy(client->chunked_hash, package_hash, SHA256_DIGEST_SIZE);
+    pthread_mutex_unlock(&g_rollout.mutex);
+}
+
+// 连接上是否有进行中的分块下载（package_hash不为NULL时还要属于该更新包）
+int rollout_chunked_active(client_connection_t* client, const uint8_t* package_hash) {
+    pthread_mutex_lock(&g_rollout.mutex);
+    int active = client->chunked_start != 0 &&
+                 (!package_hash || memcmp(client->chunked_hash, package_hash, SHA256_DIGEST_SIZE) == 0);
+    pthread_mutex_unlock(&g_rollout.mutex);
+    return active;
+}
+
+// 结束分块下载并归还名额（客户端报告结束、开始另一次下载或断开连接时调用，没有进行中的下载时什么都不做）
+void rollout_chunked_end(client_connection_t* client, int result) {
+    pthread_mutex_lock(&g_rollout.mutex);
+    if (client->chunked_start != 0) {
+        rollout_finish_transfer(client->chunked_start, result);
+        client->chunked_start = 0;
+    }
+    pthread_mutex_unlock(&g_rollout.mutex);
+}
+
+// 打印分批发布状态
+void rollout_print_status() {
+    latest_version_t latest;
+    int percent = version_cache_get(&latest) == 0 ? latest.rollout_percent : 100;
+    
+    pthread_mutex_lock(&g_rollout.mutex);
+    rollout_roll_window(time(NULL));
+    
+    char limit[16];
+    if (g_rollout.max_transfers > 0) {
+        snprintf(limit, sizeof(limit), "%d", g_rollout.max_transfers);
+    } else {
+        snprintf(limit, sizeof(limit), "不限");
+    }
+    
+    printf("更新发布: 批次 %d%%, 传输中 %d/%s, 已保留名额 %d\n",
+           percent, g_rollout.transferring, limit, g_rollout.offered);
+    printf("更新提供: 上一分钟 %d 次 (暂缓 %d 次), 累计 %lld 次 (暂缓 %lld 次), 平均传输 %.1f 秒\n",
+           g_rollout.last_offers, g_rollout.last_deferred, g_rollout.total_offers,
+           g_rollout.total_deferred, g_rollout.average_transfer);
+    
+    pthread_mutex_unlock(&g_rollout.mutex);
+}
@@ -3,6 +3,10 @@
 
 #include "../common/protocol.h"
 #include "../common/base64.h"
+#include "../common/compress.h"
+#include "../common/mux.h"
+#include "../common/wire.h"
+#include "../common/sha256.h"
 #include <pthread.h>
 #include <sqlite3.h>
 #include <sys/socket.h>
@@ -13,21 +17,171 @@
 // 服务器配置
 #define MAX_CLIENTS 100
 #define SERVER_VERSION "1.0.0"
-#define UPDATE_FILE_PATH "data/updates/client_update.tar.gz"
+#define UPDATE_DIR "data/updates"
+#define UPDATE_FILE_NAME "client_update.tar.gz"
+#define UPDATE_FILE_PATH UPDATE_DIR "/" UPDATE_FILE_NAME
 #define DATABASE_PATH "data/database/server.db"
 #define UPLOAD_DIR "data/uploads/"
 
+// 单个上传文件的大小上限（解码后的字节数，-u选项，0表示不限）。超出上限的上传在写入任何数据之前拒绝
+#define UPLOAD_DEFAULT_MAX_SIZE (100 * 1024 * 1024)
+
+// 心跳超时（秒）：超过该时间没有收到客户端的任何帧则断开连接
+#define HEARTBEAT_TIMEOUT 300
+
+// 在版本响应中建议的心跳间隔，客户端空闲退避后的最大间隔仍小于超时
+#define SERVER_HEARTBEAT_INTERVAL (HEARTBEAT_TIMEOUT / (HEARTBEAT_BACKOFF_LIMIT + 1))
+
+// 数据库写线程的组提交批次上限：满足任一条件即提交一个事务
+#define DB_BATCH_MAX_ROWS 500
+#define DB_BATCH_MAX_DELAY_MS 5
+
+// 系统日志队列：请求线程无锁入队，日志线程每隔DB_LOG_FLUSH_MS毫秒取出并在一个事务中批量写入；
+// 队列满（数据库跟不上）时丢弃新日志并计数，不阻塞请求。队列长度必须是2的幂
+#define DB_LOG_QUEUE_SIZE 4096
+#define DB_LOG_FLUSH_MS 5
+#define DB_LOG_MESSAGE_LEN 512
+
+// 只读连接池大小：读取使用独立连接，在WAL模式下与写线程并发执行
+#define DB_READ_POOL_SIZE 4
+
+// 连接遇到锁冲突时的等待时间（毫秒）
+#define DB_BUSY_TIMEOUT_MS 5000
+
+// 默认存储配置（见database.c中的配置表，可用-s选项切换）
+#define DB_DEFAULT_PROFILE "balanced"
+
+// WAL检查点策略：后台线程每隔DB_CHECKPOINT_INTERVAL秒，或WAL累积DB_CHECKPOINT_PAGES页时做一次被动检查点；
+// 超过DB_WAL_TRUNCATE_PAGES页时改用TRUNCATE检查点并截断WAL文件
+#define DB_CHECKPOINT_INTERVAL 30
+#define DB_CHECKPOINT_PAGES 1000
+#define DB_WAL_TRUNCATE_PAGES 16000
+#define DB_WAL_SIZE_LIMIT (64 * 1024 * 1024)
+
+// 外部修改数据库文件后重新查询最新版本的最小间隔（秒）
+#define VERSION_CACHE_DB_RECHECK_INTERVAL 1
+
+// 数据保留：后台线程每隔RETENTION_INTERVAL秒按各表的最长保留天数和最大行数删除旧行，
+// 每个事务最多删除RETENTION_BATCH_ROWS行，批次之间暂停RETENTION_BATCH_PAUSE_MS毫秒让出写连接；
+// 删除后每次增量回收RETENTION_VACUUM_PAGES个空闲页
+#define RETENTION_INTERVAL 600
+#define RETENTION_BATCH_ROWS 1000
+#define RETENTION_BATCH_PAUSE_MS 20
+#define RETENTION_VACUUM_PAGES 256
+#define ARCHIVE_DIR "data/archive"
+
+// 外置值存储：超过BLOB_OFFLOAD_THRESHOLD字节的字段值写入BLOB_DIR下按SHA-256命名的文件，
+// 行中只保留哈希、大小和前BLOB_PREVIEW_SIZE字节的预览；回收时保留最近BLOB_GC_GRACE秒内写入的文件
+#define BLOB_DIR "data/blobs"
+#define BLOB_OFFLOAD_THRESHOLD (16 * 1024)
+#define BLOB_PREVIEW_SIZE 256
+#define BLOB_GC_GRACE 3600
+
+// 更新包缓存上限：不超过该大小的更新包预先编码后常驻内存；更大的更新包预先编码写入帧文件，
+// 发送时用sendfile从页缓存直接写入socket
+#define UPDATE_PACKAGE_CACHE_MAX (256 * 1024 * 1024)
+#define UPDATE_FRAME_PATH UPDATE_DIR "/.client_update.frame"
+
+// 差量更新：从version_info中最近UPDATE_DELTA_MAX_BASES个带update_file_path的旧版本，
+// 各生成一个到最新更新包中客户端可执行文件的补丁。补丁不比完整更新包小、或超过单帧上限时不提供
+#define UPDATE_DELTA_MAX_BASES 3
+#define UPDATE_CLIENT_MEMBER "client"
+#define UPDATE_CLIENT_MAX (64 * 1024 * 1024)
+
+// 分块清单：更新包按UPDATE_CHUNK_SIZE切分并计算每块的SHA-256，客户端据此只下载缺失或损坏的分块。
+// 分块大小是3的倍数，从分块边界开始的范围在Base64编码后的消息体中也是连续的一段
+#define UPDATE_CHUNK_SIZE (768 * 1024)
+
+// 分批发布：最新版本在version_info中的rollout_percent（默认100）决定多少比例的客户端收到更新，
+// 客户端按标识（旧客户端没有标识时按地址）和最新版本号分到0-99的批次；同时进行的更新传输不超过上限（-U选项，0表示不限）。
+// 暂缓提供更新时版本响应带retry_after：不在批次内的客户端ROLLOUT_COHORT_RECHECK秒后再检查，
+// 因名额已满暂缓的客户端按最近的平均传输时间估算，限制在[ROLLOUT_RETRY_MIN, ROLLOUT_RETRY_MAX]内
+#define ROLLOUT_DEFAULT_MAX_TRANSFERS 32
+#define ROLLOUT_COHORT_RECHECK 600
+#define ROLLOUT_RETRY_MIN 10
+#define ROLLOUT_RETRY_MAX 900
+#define ROLLOUT_OFFER_HOLD 60     // 提供更新后为客户端保留传输名额的时间（秒）
+
+// 服务端支持的能力位
+#define SERVER_CAPABILITIES (CAP_COMPRESS_ZLIB | CAP_MULTIPLEX | CAP_WIRE_V2 | CAP_DELTA_UPDATE | CAP_CHUNK_MANIFEST)
+
 // 客户端连接结构
 typedef struct {
     int socket_fd;
     pthread_t thread_id;
     struct sockaddr_in address;
-    int active;
+    int active;               // 槽位被占用；只有处理线程退出时（disconnect_client）才清除
     char client_version[32];
     time_t connect_time;
-    time_t last_heartbeat;
+    time_t last_heartbeat;    // 最近一次收到该客户端任何帧的时间
+    uint32_t capabilities;    // 版本检查时协商的能力位
+    uint8_t client_id[CLIENT_ID_SIZE];  // 版本检查时客户端报告的标识，全0表示未知（写入时持有clients_mutex）
+    time_t update_offer_time; // 提供更新时为其保留传输名额的时间，0表示没有保留（由分批发布的锁保护）
+    time_t chunked_start;     // 按分块清单的下载开始的时间，0表示没有进行中的（由分批发布的锁保护）
+    uint8_t chunked_hash[SHA256_DIGEST_SIZE];  // 进行中的分块下载所属更新包的SHA-256
+    mux_sender_t sender;      // 发送调度器（所有发往该客户端的消息经此排队）
+    mux_stream_t streams[MUX_MAX_STREAMS];  // 正在接收的逻辑流
 } client_connection_t;
 
+// 最新版本快照（版本检查只读取内存中的快照，不访问数据库和文件系统）
+typedef struct {
+    char version[32];                          // 最新版本号
+    int package_available;                     // 更新包是否存在
+    uint64_t package_size;                     // 更新包大小
+    uint8_t package_hash[SHA256_DIGEST_SIZE];  // 更新包SHA-256
+    char package_hash_hex[SHA256_HEX_SIZE];    // 更新包SHA-256（十六进制）
+    int rollout_percent;                       // 分批发布比例（0-100）
+    uint64_t generation;                       // 快照代数，每次刷新递增
+} latest_version_t;
+
+// 从旧版本客户端可执行文件到最新版本的差量补丁
+typedef struct {
+    char base_version[32];                     // 旧版本号
+    uint8_t base_hash[SHA256_DIGEST_SIZE];     // 旧可执行文件的SHA-256
+    unsigned char* delta;                      // 补丁（见delta.h）
+    size_t delta_length;
+} update_delta_t;
+
+// 预先编码的更新包（只读，多个发送共享，按引用计数释放）
+typedef struct {
+    int refcount;                              // 引用计数（原子访问）
+    uint64_t size;                             // 更新包大小
+    uint8_t hash[SHA256_DIGEST_SIZE];          // 更新包SHA-256
+    char* encoded;                             // Base64编码后的更新包，即MSG_UPDATE_DATA消息体
+    size_t encoded_length;
+    uint32_t checksum;                         // 消息体的帧校验和
+    mux_frame_file_t* frame;                   // 超过缓存上限时消息体在帧文件中（encoded为NULL）
+    uint8_t client_hash[SHA256_DIGEST_SIZE];   // 更新包中客户端可执行文件的SHA-256（有补丁时有效）
+    uint32_t client_size;
+    update_delta_t* deltas;                    // 各旧版本的差量补丁
+    int delta_count;
+    uint8_t (*chunk_hashes)[SHA256_DIGEST_SIZE];  // 各分块的SHA-256（分块清单）
+    uint32_t chunk_count;
+} update_package_t;
+
+// 字段数据查询条件（时间均为Unix秒）
+typedef struct {
+    char table_name[64];
+    char field_name[64];      // 空字符串表示所有字段
+    int64_t start_time;       // 下界（包含）
+    int64_t end_time;         // 上界（不包含），0表示不限
+    int64_t after_time;       // 键集游标
+    int64_t after_id;
+    uint32_t limit;           // 最多返回的行数
+} field_data_query_t;
+
+// 字段数据查询结果行（指针只在回调期间有效）
+typedef struct {
+    int64_t id;
+    int64_t upload_time;
+    const char* field_name;
+    const void* data;
+    size_t data_size;
+} field_data_row_t;
+
+// 查询结果行回调：返回0继续，1停止，-1出错
+typedef int (*field_data_row_handler_t)(const field_data_row_t* row, void* context);
+
 // 服务器状态结构
 typedef struct {
     int server_socket;
@@ -40,15 +194,28 @@ typedef struct {
     pthread_mutex_t db_mutex;
 } server_state_t;
 
-// 文件传输状态
+// 文件传输状态（上传数据边接收边解码写入临时文件）
 typedef struct {
     char filename[MAX_FILENAME_LEN];
     FILE* file_handle;
     uint32_t total_size;
     uint32_t received_size;
     time_t start_time;
+    char temp_path[MAX_FILENAME_LEN];
+    base64_decoder_t decoder;
 } file_transfer_t;
 
+// 分片接收的文件上传（消息前缀可能跨分片）
+typedef struct {
+    uint8_t version;                  // 线格式版本
+    unsigned char prefix[sizeof(file_upload_msg_v2_t)];
+    size_t prefix_length;             // 该版本的前缀长度
+    size_t prefix_received;
+    char filename[MAX_FILENAME_LEN];
+    file_transfer_t transfer;
+    int failed;
+} upload_stream_t;
+
 // 全局服务器状态
 extern server_state_t g_server;
 
@@ -60,17 +227,24 @@ void server_stop();
 void* client_handler(void* arg);
 int accept_client_connection();
 void disconnect_client(client_connection_t* client);
+void shutdown_client(client_connection_t* client);
+int server_send_message(client_connection_t* client, uint16_t type, const void* data, size_t length);
 
 // 消息处理函数
 int handle_client_message(client_connection_t* client, message_header_t* header, char* data);
 int handle_version_check(client_connection_t* client, version_check_msg_t* msg);
-int handle_update_request(client_connection_t* client);
-int handle_file_upload(client_connection_t* client, file_upload_msg_t* msg);
-int handle_data_upload(client_connection_t* client, data_upload_msg_t* msg);
+int handle_update_request(client_connection_t* client, const wire_view_t* view);
+int handle_file_upload(client_connection_t* client, const wire_view_t* view);
+int handle_data_upload(client_connection_t* client, const wire_view_t* view);
 int handle_heartbeat(client_connection_t* client);
+int handle_stream_message(client_connection_t* client, message_header_t* header);
+int handle_file_upload_stream(client_connection_t* client, message_header_t* header);
+int handle_stream_data(client_connection_t* client, const wire_view_t* view);
+int handle_data_query(client_connection_t* client, const wire_view_t* view);
+void close_client_streams(client_connection_t* client);
 
 // 响应发送函数
-int send_version_response(client_connection_t* client, status_code_t status);
+int send_version_response(client_connection_t* client, status_code_t status, uint32_t retry_after);
 int send_file_response(client_connection_t* client, status_code_t status, const char* message);
 int send_data_response(client_connection_t* client, status_code_t status, const char* message);
 int send_error_response(client_connection_t* client, const char* error_message);
@@ -81,15 +255,83 @@ void database_cleanup();
 int database_store_field_data(const char* table_name, const char* field_name, 
                              const unsigned char* data, size_t data_size);
 int database_create_tables();
+int database_log_client_connection(const char* client_ip, const char* client_version, 
+                                  const char* action);
+int database_log_file_upload(const char* client_ip, const char* filename, 
+                            size_t file_size, const char* file_path);
+int database_log_system_event(const char* level, const char* message, const char* client_ip);
+int database_get_latest_version(char* version_buffer, size_t buffer_size, int* rollout_percent);
+int database_set_profile(const char* name);
+const char* database_profile_name();
+void database_print_profiles();
+void database_set_version_listener(void (*listener)(void));
+void database_set_materialize(int enabled);
+void database_log_stats(long long* written, long long* dropped);
+int database_query_field_data(const field_data_query_t* query, field_data_row_handler_t handler, void* context);
+int database_get_release_packages(const char* latest_version, int limit,
+                                  int (*handler)(const char* version, const char* path, void* context),
+                                  void* context);
+
+// 最新版本缓存函数
+int version_cache_init();
+void version_cache_cleanup();
+int version_cache_get(latest_version_t* latest);
+void version_cache_invalidate();
+update_package_t* version_cache_get_package();
+
+// 更新包缓存函数
+update_package_t* update_package_load(FILE* file, uint64_t size);
+update_package_t* update_package_acquire(update_package_t* package);
+void update_package_release(update_package_t* package);
+void update_package_build_deltas(update_package_t* package, const char* latest_version);
+const update_delta_t* update_package_find_delta(const update_package_t* package, const char* version);
+
+// 分批发布函数
+void rollout_set_max_transfers(int max_transfers);
+int rollout_offer(client_connection_t* client, const latest_version_t* latest, uint32_t* retry_after);
+int rollout_admit(client_connection_t* client, uint32_t* retry_after);
+void rollout_release_offer(client_connection_t* client);
+void rollout_expire_offer(client_connection_t* client, time_t now);
+time_t rollout_transfer_begin();
+void rollout_transfer_end(time_t start_time, int result);
+void rollout_chunked_begin(client_connection_t* client, const uint8_t* package_hash);
+int rollout_chunked_active(client_connection_t* client, const uint8_t* package_hash);
+void rollout_chunked_end(client_connection_t* client, int result);
+void rollout_print_status();
+
+// 外置值存储函数
+int blob_store_put(const void* data, size_t size, char hash_hex[SHA256_HEX_SIZE]);
+void* blob_store_get(const char* hash_hex, size_t size);
+int blob_store_collect(int (*referenced)(const char* hash_hex));
+
+// 数据保留函数
+int retention_set_policy(const char* spec);
+void retention_set_archive(int enabled);
+void retention_print_policies();
+void retention_print_status();
+int retention_start();
+void retention_stop();
 
 // 文件处理函数
+void file_upload_set_max_size(uint64_t max_size);
+int file_upload_too_large(uint8_t version, uint64_t message_length);
 int save_uploaded_file(const char* filename, const unsigned char* data, size_t data_size);
 int create_upload_directory();
 char* get_upload_file_path(const char* filename);
+int file_transfer_begin(file_transfer_t* transfer, const char* filename, uint32_t file_size);
+int file_transfer_write(file_transfer_t* transfer, const char* encoded, size_t length);
+int file_transfer_finish(file_transfer_t* transfer);
+void file_transfer_abort(file_transfer_t* transfer);
+upload_stream_t* upload_stream_create(uint8_t version);
+int upload_stream_write(upload_stream_t* upload, const char* data, size_t length);
+int upload_stream_finish(client_connection_t* client, upload_stream_t* upload);
+void upload_stream_destroy(upload_stream_t* upload);
 
 // 更新相关函数
 int check_update_available(const char* client_version);
 int send_update_file(client_connection_t* client);
+int send_update_resume(client_connection_t* client, uint32_t offset, uint32_t length, const uint8_t* package_hash);
+int send_update_manifest(client_connection_t* client);
 
 // 工具函数
 void log_client_connection(client_connection_t* client, const char* action);
@@ -0,0 +1,347 @@
+#include "server.h"
+#include "../common/utils.h"
+#include "../common/stream.h"
+#include "../common/archive.h"
+#include "../common/delta.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+// 更新包缓存：更新包变化时读入并编码一次，得到只读的MSG_UPDATE_DATA消息体和校验和，
+// 所有客户端的发送都引用这一份副本。引用计数归零（快照被替换且所有发送完成）时释放。
+// 超过UPDATE_PACKAGE_CACHE_MAX的更新包编码后写入帧文件 [v2消息头] + [Base64消息体]，
+// 发送时由内核从页缓存直接写入socket，更新包内容不再经过服务端的用户态内存。
+// 读入时同时计算各分块的SHA-256，作为分块清单发给客户端
+
+// 写入全部数据
+static int update_package_write(int fd, const void* data, size_t length) {
+    const char* cursor = data;
+    
+    while (length > 0) {
+        ssize_t written = write(fd, cursor, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        cursor += written;
+        length -= (size_t)written;
+    }
+    
+    return 0;
+}
+
+// 为大小为size的更新包分配分块哈希
+static int update_package_alloc_chunks(update_package_t* package, uint64_t size) {
+    package->chunk_count = (uint32_t)((size + UPDATE_CHUNK_SIZE - 1) / UPDATE_CHUNK_SIZE);
+    package->chunk_hashes = calloc(package->chunk_count, SHA256_DIGEST_SIZE);
+    return package->chunk_hashes ? 0 : -1;
+}
+
+// 按顺序送入更新包从offset开始的一段数据，每凑满一个分块（或到达末尾）记录该分块的SHA-256
+static void update_package_hash_chunks(update_package_t* package, sha256_context_t* context, uint64_t size,
+                                       uint64_t offset, const unsigned char* data, size_t length) {
+    while (length > 0) {
+        uint64_t within = offset % UPDATE_CHUNK_SIZE;
+        size_t piece = UPDATE_CHUNK_SIZE - within < length ? (size_t)(UPDATE_CHUNK_SIZE - within) : length;
+        
+        if (within == 0) {
+            sha256_init(context);
+        }
+        sha256_update(context, data, piece);
+        
+        offset += piece;
+        data += piece;
+        length -= piece;
+        
+        if (offset % UPDATE_CHUNK_SIZE == 0 || offset == size) {
+            sha256_final(context, package->chunk_hashes[(offset - 1) / UPDATE_CHUNK_SIZE]);
+        }
+    }
+}
+
+// 编码更新包并写入帧文件。帧文件先写入临时文件再重命名，打开的描述符由更新包持有，
+// 帧文件被下一次刷新替换后，正在进行的发送仍读取原来的文件内容
+static update_package_t* update_package_build_frame(FILE* file, uint64_t size) {
+    size_t encoded_length = base64_encoded_length((size_t)size);
+    if (encoded_length > UINT32_MAX) {
+        fprintf(stderr, "更新包过大: %llu 字节\n", (unsigned long long)size);
+        return NULL;
+    }
+    
+    char temp_path[] = UPDATE_FRAME_PATH ".XXXXXX";
+    int fd = mkstemp(temp_path);
+    if (fd == -1) {
+        fprintf(stderr, "创建帧文件失败 %s: %s\n", temp_path, strerror(errno));
+        return NULL;
+    }
+    
+    update_package_t* package = calloc(1, sizeof(update_package_t));
+    mux_frame_file_t* frame = calloc(1, sizeof(mux_frame_file_t));
+    unsigned char* raw = malloc(STREAM_CHUNK_SIZE);
+    char* encoded = malloc(base64_encoded_length(STREAM_CHUNK_SIZE) + 1);
+    message_header_t header;
+    int failed = !package || !frame || !raw || !encoded || update_package_alloc_chunks(package, size) != 0;
+    
+    // 先占住消息头的位置，校验和算出后再写入
+    memset(&header, 0, sizeof(header));
+    if (!failed && update_package_write(fd, &header, sizeof(header)) != 0) {
+        failed = 1;
+    }
+    
+    sha256_context_t hash;
+    sha256_context_t chunk_hash;
+    sha256_init(&hash);
+    
+    uint64_t remaining = size;
+    while (!failed && remaining > 0) {
+        size_t chunk = remaining < STREAM_CHUNK_SIZE ? (size_t)remaining : STREAM_CHUNK_SIZE;
+        int length = -1;
+        
+        if (fread(raw, 1, chunk, file) == chunk) {
+            sha256_update(&hash, raw, chunk);
+            update_package_hash_chunks(package, &chunk_hash, size, size - remaining, raw, chunk);
+            length = base64_encode(raw, chunk, encoded, base64_encoded_length(STREAM_CHUNK_SIZE) + 1);
+        }
+        
+        if (length < 0 || update_package_write(fd, encoded, (size_t)length) != 0) {
+            failed = 1;
+        }
+        remaining -= chunk;
+    }
+    free(raw);
+    free(encoded);
+    
+    if (!failed && mux_frame_file_init(frame, fd, sizeof(header), (uint32_t)encoded_length, MSG_UPDATE_DATA) != 0) {
+        failed = 1;
+    }
+    
+    if (!failed) {
+        init_message_header(&header, MSG_UPDATE_DATA, (uint32_t)encoded_length);
+        header.version = WIRE_V2;
+        header.checksum = frame->checksum;
+        wire_encode_header(&header);
+        
+        if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            rename(temp_path, UPDATE_FRAME_PATH) == -1) {
+            mux_frame_file_destroy(frame);
+            failed = 1;
+        }
+    }
+    
+    if (failed) {
+        fprintf(stderr, "生成帧文件失败: %s\n", UPDATE_FRAME_PATH);
+        close(fd);
+        unlink(temp_path);
+        free(frame);
+        if (package) {
+            free(package->chunk_hashes);
+        }
+        free(package);
+        return NULL;
+    }
+    
+    sha256_final(&hash, package->hash);
+    package->size = size;
+    package->encoded_length = encoded_length;
+    package->checksum = frame->checksum;
+    package->frame = frame;
+    package->refcount = 1;
+    
+    return package;
+}
+
+// 读入更新包并编码，失败返回NULL
+update_package_t* update_package_load(FILE* file, uint64_t size) {
+    if (!file || size == 0) {
+        return NULL;
+    }
+    
+    if (size > UPDATE_PACKAGE_CACHE_MAX) {
+        return update_package_build_frame(file, size);
+    }
+    
+    unsigned char* raw = malloc((size_t)size);
+    update_package_t* package = calloc(1, sizeof(update_package_t));
+    if (!raw || !package) {
+        fprintf(stderr, "分配更新包缓存失败: %llu 字节\n", (unsigned long long)size);
+        free(raw);
+        free(package);
+        return NULL;
+    }
+    
+    if (fread(raw, 1, (size_t)size, file) != (size_t)size) {
+        fprintf(stderr, "读取更新包失败: %s\n", UPDATE_FILE_PATH);
+        free(raw);
+        free(package);
+        return NULL;
+    }
+    
+    package->size = size;
+    sha256_digest(raw, (size_t)size, package->hash);
+    
+    sha256_context_t chunk_hash;
+    if (update_package_alloc_chunks(package, size) != 0) {
+        fprintf(stderr, "分配更新包缓存失败: %llu 字节\n", (unsigned long long)size);
+        free(raw);
+        free(package);
+        return NULL;
+    }
+    update_package_hash_chunks(package, &chunk_hash, size, 0, raw, (size_t)size);
+    
+    size_t encoded_capacity = base64_encoded_length((size_t)size) + 1;
+    package->encoded = malloc(encoded_capacity);
+    int encoded = package->encoded ? base64_encode(raw, (size_t)size, package->encoded, encoded_capacity) : -1;
+    free(raw);
+    
+    if (encoded < 0) {
+        fprintf(stderr, "编码更新包失败\n");
+        free(package->encoded);
+        free(package->chunk_hashes);
+        free(package);
+        return NULL;
+    }
+    
+    package->encoded_length = (size_t)encoded;
+    package->checksum = calculate_checksum(package->encoded, package->encoded_length);
+    package->refcount = 1;
+    
+    return package;
+}
+
+// 增加一个引用
+update_package_t* update_package_acquire(update_package_t* package) {
+    if (package) {
+        __atomic_add_fetch(&package->refcount, 1, __ATOMIC_RELAXED);
+    }
+    return package;
+}
+
+// 释放一个引用，最后一个引用释放时回收缓存
+void update_package_release(update_package_t* package) {
+    if (package && __atomic_sub_fetch(&package->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (package->frame) {
+            close(package->frame->fd);
+            mux_frame_file_destroy(package->frame);
+            free(package->frame);
+        }
+        for (int i = 0; i < package->delta_count; i++) {
+            free(package->deltas[i].delta);
+        }
+        free(package->deltas);
+        free(package->chunk_hashes);
+        free(package->encoded);
+        free(package);
+    }
+}
+
+// 登记了更新包的旧版本
+typedef struct {
+    char version[32];
+    char path[512];
+} update_release_t;
+
+typedef struct {
+    update_release_t releases[UPDATE_DELTA_MAX_BASES];
+    int count;
+} update_release_list_t;
+
+static int update_package_collect_release(const char* version, const char* path, void* context) {
+    update_release_list_t* list = (update_release_list_t*)context;
+    if (list->count >= UPDATE_DELTA_MAX_BASES) {
+        return 1;
+    }
+    
+    snprintf(list->releases[list->count].version, sizeof(list->releases[0].version), "%s", version);
+    snprintf(list->releases[list->count].path, sizeof(list->releases[0].path), "%s", path);
+    list->count++;
+    return 0;
+}
+
+// 为最近的旧版本生成到当前更新包的差量补丁（发布前调用，更新包此时还没有被共享）
+void update_package_build_deltas(update_package_t* package, const char* latest_version) {
+    if (!package || !latest_version) {
+        return;
+    }
+    
+    update_release_list_t list;
+    memset(&list, 0, sizeof(list));
+    if (database_get_release_packages(latest_version, UPDATE_DELTA_MAX_BASES,
+                                      update_package_collect_release, &list) != 0 || list.count == 0) {
+        return;
+    }
+    
+    unsigned char* target = NULL;
+    size_t target_size = 0;
+    if (archive_read_member(UPDATE_FILE_PATH, UPDATE_CLIENT_MEMBER, UPDATE_CLIENT_MAX, &target, &target_size) != 0) {
+        fprintf(stderr, "更新包中没有客户端可执行文件，不生成差量补丁\n");
+        return;
+    }
+    
+    package->deltas = calloc((size_t)list.count, sizeof(update_delta_t));
+    if (!package->deltas) {
+        free(target);
+        return;
+    }
+    
+    sha256_digest(target, target_size, package->client_hash);
+    package->client_size = (uint32_t)target_size;
+    
+    // 补丁连同消息头必须能放进一帧，并且比完整更新包（Base64编码后）小才有意义
+    size_t limit = base64_encoded_length((size_t)package->size);
+    if (limit > MAX_FRAME_LENGTH - sizeof(update_delta_msg_v2_t)) {
+        limit = MAX_FRAME_LENGTH - sizeof(update_delta_msg_v2_t);
+    }
+    
+    for (int i = 0; i < list.count; i++) {
+        const update_release_t* release = &list.releases[i];
+        unsigned char* base = NULL;
+        size_t base_size = 0;
+        
+        if (archive_read_member(release->path, UPDATE_CLIENT_MEMBER, UPDATE_CLIENT_MAX, &base, &base_size) != 0) {
+            fprintf(stderr, "无法读取版本 %s 的客户端可执行文件: %s\n", release->version, release->path);
+            continue;
+        }
+        
+        update_delta_t* delta = &package->deltas[package->delta_count];
+        if (delta_create(base, base_size, target, target_size, &delta->delta, &delta->delta_length) != 0) {
+            fprintf(stderr, "生成版本 %s 的差量补丁失败\n", release->version);
+            free(base);
+            continue;
+        }
+        
+        if (delta->delta_length >= limit) {
+            printf("版本 %s 的差量补丁过大 (%zu 字节)，使用完整更新包\n", release->version, delta->delta_length);
+            free(delta->delta);
+            delta->delta = NULL;
+            free(base);
+            continue;
+        }
+        
+        snprintf(delta->base_version, sizeof(delta->base_version), "%s", release->version);
+        sha256_digest(base, base_size, delta->base_hash);
+        free(base);
+        
+        printf("差量补丁: %s -> %s, %zu 字节 (完整更新包 %llu 字节)\n", release->version, latest_version,
+               delta->delta_length, (unsigned long long)package->size);
+        package->delta_count++;
+    }
+    
+    free(target);
+}
+
+// 查找从指定版本出发的差量补丁，没有时返回NULL
+const update_delta_t* update_package_find_delta(const update_package_t* package, const char* version) {
+    if (!package || !version) {
+        return NULL;
+    }
+    
+    for (int i = 0; i < package->delta_count; i++) {
+        if (strcmp(package->deltas[i].base_version, version) == 0) {
+            return &package->deltas[i];
+        }
+    }
+    
+    return NULL;
+}
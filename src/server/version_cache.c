@@ -0,0 +1,361 @@
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+// 最新版本缓存：版本检查读取当前快照，刷新时构造新快照并原子替换指针（RCU方式）。
+// 读者只对所在纪元的计数器做原子加减，不加锁；发布者替换指针后翻转纪元，
+// 等旧纪元的读者全部退出再释放旧快照。只有监视线程（以及其启动前、停止后的初始化和清理）会发布快照
+
+// 事件通知值：停止监视线程
+#define VERSION_CACHE_STOP ((uint64_t)1 << 32)
+
+// 快照：对外复制的版本信息，加上快照持有引用的预先编码更新包
+typedef struct {
+    latest_version_t info;
+    update_package_t* package;               // 更新包不存在或超过缓存上限时为NULL
+} version_snapshot_t;
+
+static version_snapshot_t* g_current = NULL; // 当前快照
+static unsigned int g_epoch = 0;             // 当前纪元（低位选择读者计数器）
+static long g_readers[2] = {0, 0};           // 各纪元中正在读取快照的读者数
+
+// 监视线程状态
+static struct {
+    pthread_t thread;
+    int inotify_fd;
+    int event_fd;
+    int started;
+} g_watcher = { 0, -1, -1, 0 };
+
+// 发布新快照，等待仍在读取旧快照的读者退出后释放旧快照
+static void version_cache_publish(version_snapshot_t* snapshot) {
+    version_snapshot_t* old = __atomic_exchange_n(&g_current, snapshot, __ATOMIC_SEQ_CST);
+    
+    // 翻转纪元后新读者计入另一个计数器，只需等待旧纪元的读者
+    unsigned int epoch = __atomic_fetch_add(&g_epoch, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&g_readers[epoch & 1], __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
+    }
+    
+    // 正在发送的客户端仍持有旧更新包的引用，发送完成后才释放
+    if (old) {
+        update_package_release(old->package);
+        free(old);
+    }
+}
+
+// 读者进入：计入当前纪元的读者计数器，返回计数器下标，读完后传给version_cache_leave。
+// 取纪元与计入之间发布者可能已翻转纪元并结束等待，计入后纪元变化时撤销并重试，
+// 保证之后的发布者一定会等待这个计数器
+static unsigned int version_cache_enter() {
+    while (1) {
+        unsigned int epoch = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&g_readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST) == epoch) {
+            return epoch & 1;
+        }
+        __atomic_fetch_sub(&g_readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+// 读者退出
+static void version_cache_leave(unsigned int slot) {
+    __atomic_fetch_sub(&g_readers[slot], 1, __ATOMIC_RELEASE);
+}
+
+// 读取更新包的大小和哈希，同时预先编码（常驻内存或写入帧文件）
+static void version_cache_load_package(version_snapshot_t* snapshot) {
+    latest_version_t* info = &snapshot->info;
+    
+    update_package_release(snapshot->package);
+    snapshot->package = NULL;
+    info->package_available = 0;
+    info->package_size = 0;
+    memset(info->package_hash, 0, sizeof(info->package_hash));
+    info->package_hash_hex[0] = '\0';
+    
+    FILE* file = fopen(UPDATE_FILE_PATH, "rb");
+    if (!file) {
+        return;
+    }
+    
+    long long size = -1;
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0 && st.st_size > 0) {
+        snapshot->package = update_package_load(file, (uint64_t)st.st_size);
+    }
+    
+    if (snapshot->package) {
+        size = (long long)snapshot->package->size;
+        memcpy(info->package_hash, snapshot->package->hash, SHA256_DIGEST_SIZE);
+    } else {
+        rewind(file);
+        size = sha256_file(file, info->package_hash);
+    }
+    fclose(file);
+    
+    // 不再使用的帧文件直接删除，正在发送的连接仍持有打开的描述符
+    if (!snapshot->package || !snapshot->package->frame) {
+        unlink(UPDATE_FRAME_PATH);
+    }
+    
+    if (size < 0) {
+        fprintf(stderr, "读取更新包失败: %s\n", UPDATE_FILE_PATH);
+        return;
+    }
+    
+    info->package_available = 1;
+    info->package_size = (uint64_t)size;
+    sha256_to_hex(info->package_hash, info->package_hash_hex);
+}
+
+// 按需重新加载版本号和更新包，有变化时发布新快照
+static void version_cache_refresh(int reload_version, int reload_package) {
+    version_snapshot_t* current = g_current;
+    version_snapshot_t* snapshot = calloc(1, sizeof(version_snapshot_t));
+    if (!snapshot) {
+        fprintf(stderr, "分配版本快照失败\n");
+        return;
+    }
+    
+    latest_version_t* info = &snapshot->info;
+    if (current) {
+        memcpy(info, &current->info, sizeof(latest_version_t));
+        snapshot->package = update_package_acquire(current->package);
+    } else {
+        reload_version = 1;
+        reload_package = 1;
+    }
+    
+    if (reload_version &&
+        database_get_latest_version(info->version, sizeof(info->version), &info->rollout_percent) != 0) {
+        // 查询失败时保留原版本号和发布比例（首次加载时退回服务器版本、全量发布）
+        if (!current) {
+            strncpy(info->version, SERVER_VERSION, sizeof(info->version) - 1);
+            info->rollout_percent = 100;
+        }
+    }
+    
+    // 差量补丁以最新版本为目标，版本号变化时随更新包一起重新生成
+    if (current && strcmp(info->version, current->info.version) != 0) {
+        reload_package = 1;
+    }
+    
+    if (reload_package) {
+        version_cache_load_package(snapshot);
+        update_package_build_deltas(snapshot->package, info->version);
+    }
+    
+    // 外部写数据库时会频繁重查版本号，内容未变化就不发布
+    if (current && strcmp(info->version, current->info.version) == 0 &&
+        info->rollout_percent == current->info.rollout_percent &&
+        info->package_available == current->info.package_available &&
+        info->package_size == current->info.package_size &&
+        memcmp(info->package_hash, current->info.package_hash, SHA256_DIGEST_SIZE) == 0) {
+        update_package_release(snapshot->package);
+        free(snapshot);
+        return;
+    }
+    
+    info->generation = current ? current->info.generation + 1 : 1;
+    version_cache_publish(snapshot);
+    
+    printf("最新版本缓存已更新: 版本=%s, 发布比例=%d%%, 更新包=%s, 大小=%llu, SHA-256=%s%s\n",
+           info->version, info->rollout_percent, info->package_available ? "可用" : "不存在",
+           (unsigned long long)info->package_size,
+           info->package_available ? info->package_hash_hex : "-",
+           !snapshot->package ? "" : snapshot->package->frame ? " (已生成帧文件)" : " (已预先编码)");
+}
+
+// 监视线程：inotify通知更新包或数据库文件变化，eventfd通知进程内的version_info修改和停止
+static void* version_cache_watch_thread(void* arg) {
+    (void)arg;
+    
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int database_dirty = 0;
+    time_t last_database_check = 0;
+    
+    while (1) {
+        int reload_version = 0;
+        int reload_package = 0;
+        
+        // 数据库文件被修改时按最小间隔重查版本号
+        int timeout = -1;
+        if (database_dirty) {
+            time_t wait = last_database_check + VERSION_CACHE_DB_RECHECK_INTERVAL - time(NULL);
+            timeout = wait > 0 ? (int)wait * 1000 : 0;
+        }
+        
+        struct pollfd fds[2] = {
+            { g_watcher.inotify_fd, POLLIN, 0 },
+            { g_watcher.event_fd, POLLIN, 0 }
+        };
+        
+        int ready = poll(fds, 2, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll version cache");
+            break;
+        }
+        
+        if (fds[1].revents & POLLIN) {
+            uint64_t value;
+            if (read(g_watcher.event_fd, &value, sizeof(value)) == sizeof(value)) {
+                if (value >= VERSION_CACHE_STOP) {
+                    break;
+                }
+                reload_version = 1;
+            }
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            ssize_t length = read(g_watcher.inotify_fd, buffer, sizeof(buffer));
+            for (ssize_t offset = 0; offset < length; ) {
+                struct inotify_event* event = (struct inotify_event*)(buffer + offset);
+                
+                if (event->len > 0) {
+                    if (strcmp(event->name, UPDATE_FILE_NAME) == 0) {
+                        reload_package = 1;
+                    } else if (strncmp(event->name, "server.db", 9) == 0) {
+                        database_dirty = 1;
+                    }
+                }
+                
+                offset += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        
+        if (database_dirty && time(NULL) >= last_database_check + VERSION_CACHE_DB_RECHECK_INTERVAL) {
+            reload_version = 1;
+        }
+        
+        if (reload_version) {
+            database_dirty = 0;
+            last_database_check = time(NULL);
+        }
+        
+        if (reload_version || reload_package) {
+            version_cache_refresh(reload_version, reload_package);
+        }
+    }
+    
+    return NULL;
+}
+
+// 在进程内修改version_info后调用（写线程提交后通过监听回调触发）
+void version_cache_invalidate() {
+    if (g_watcher.event_fd >= 0) {
+        uint64_t value = 1;
+        if (write(g_watcher.event_fd, &value, sizeof(value)) != sizeof(value)) {
+            perror("write version cache event");
+        }
+    }
+}
+
+// 初始化最新版本缓存（database_init之后调用）
+int version_cache_init() {
+    // 首次加载在启动监视线程之前同步完成
+    version_cache_refresh(1, 1);
+    if (!g_current) {
+        return -1;
+    }
+    
+    // 更新目录不存在时创建，保证可以监视更新包的出现
+    if (mkdir(UPDATE_DIR, 0755) == -1 && errno != EEXIST) {
+        perror("mkdir update directory");
+    }
+    
+    g_watcher.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    g_watcher.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_watcher.inotify_fd < 0 || g_watcher.event_fd < 0) {
+        perror("初始化版本缓存监视失败");
+        version_cache_cleanup();
+        return -1;
+    }
+    
+    // 更新包通常通过写入后关闭或重命名替换；数据库目录用于发现外部工具对version_info的修改
+    if (inotify_add_watch(g_watcher.inotify_fd, UPDATE_DIR,
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+        perror("inotify_add_watch update directory");
+    }
+    if (inotify_add_watch(g_watcher.inotify_fd, "data/database", IN_MODIFY | IN_CLOSE_WRITE) < 0) {
+        perror("inotify_add_watch database directory");
+    }
+    
+    if (pthread_create(&g_watcher.thread, NULL, version_cache_watch_thread, NULL) != 0) {
+        perror("pthread_create version cache");
+        version_cache_cleanup();
+        return -1;
+    }
+    g_watcher.started = 1;
+    
+    database_set_version_listener(version_cache_invalidate);
+    
+    return 0;
+}
+
+// 停止监视线程并释放快照
+void version_cache_cleanup() {
+    database_set_version_listener(NULL);
+    
+    if (g_watcher.started) {
+        uint64_t value = VERSION_CACHE_STOP;
+        if (write(g_watcher.event_fd, &value, sizeof(value)) != sizeof(value)) {
+            perror("write version cache event");
+        }
+        pthread_join(g_watcher.thread, NULL);
+        g_watcher.started = 0;
+    }
+    
+    if (g_watcher.inotify_fd >= 0) {
+        close(g_watcher.inotify_fd);
+        g_watcher.inotify_fd = -1;
+    }
+    if (g_watcher.event_fd >= 0) {
+        close(g_watcher.event_fd);
+        g_watcher.event_fd = -1;
+    }
+    
+    version_cache_publish(NULL);
+}
+
+// 复制当前快照（无锁、无I/O）
+int version_cache_get(latest_version_t* latest) {
+    if (!latest) {
+        return -1;
+    }
+    
+    unsigned int slot = version_cache_enter();
+    
+    version_snapshot_t* current = __atomic_load_n(&g_current, __ATOMIC_SEQ_CST);
+    if (current) {
+        memcpy(latest, &current->info, sizeof(latest_version_t));
+    }
+    
+    version_cache_leave(slot);
+    
+    return current ? 0 : -1;
+}
+
+// 获取当前预先编码的更新包（增加引用，用完后调用update_package_release），没有时返回NULL
+update_package_t* version_cache_get_package() {
+    unsigned int slot = version_cache_enter();
+    
+    // 读者退出前快照不会被释放，快照持有的引用保证计数不会先归零
+    version_snapshot_t* current = __atomic_load_n(&g_current, __ATOMIC_SEQ_CST);
+    update_package_t* package = current ? update_package_acquire(current->package) : NULL;
+    
+    version_cache_leave(slot);
+    
+    return package;
+}
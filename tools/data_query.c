@@ -0,0 +1,355 @@
+// 数据查询工具：通过MSG_DATA_QUERY从服务端分页拉取字段数据，按键集游标翻页直到取完
+#include "../src/common/protocol.h"
+#include "../src/common/compress.h"
+#include "../src/common/utils.h"
+#include "../src/common/wire.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+// 查询参数
+typedef struct {
+    const char* host;
+    int port;
+    const char* table_name;
+    const char* field_name;
+    uint64_t start_time;
+    uint64_t end_time;
+    uint32_t page_size;
+    uint64_t max_rows;        // 0表示不限
+    int hex;                  // 以十六进制输出数据
+} query_options_t;
+
+// 连接服务器
+static int connect_server(const char* host, int port) {
+    struct addrinfo hints;
+    struct addrinfo* result;
+    char port_string[16];
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port_string, sizeof(port_string), "%d", port);
+    
+    if (getaddrinfo(host, port_string, &hints, &result) != 0) {
+        fprintf(stderr, "无法解析服务器地址: %s\n", host);
+        return -1;
+    }
+    
+    int socket_fd = -1;
+    for (struct addrinfo* address = result; address; address = address->ai_next) {
+        socket_fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (socket_fd < 0) {
+            continue;
+        }
+        if (connect(socket_fd, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        close(socket_fd);
+        socket_fd = -1;
+    }
+    
+    freeaddrinfo(result);
+    
+    if (socket_fd < 0) {
+        fprintf(stderr, "无法连接服务器 %s:%d\n", host, port);
+    }
+    return socket_fd;
+}
+
+// 发送一帧
+static int send_frame(int socket_fd, uint8_t version, uint16_t type, const void* data, size_t length) {
+    message_header_t header;
+    
+    init_message_header(&header, type, (uint32_t)length);
+    header.version = version;
+    header.checksum = calculate_checksum(data, length);
+    wire_encode_header(&header);
+    
+    if (send_all(socket_fd, &header, sizeof(header)) != 0) {
+        return -1;
+    }
+    return length > 0 ? send_all(socket_fd, data, length) : 0;
+}
+
+// 接收一帧（压缩帧解压后返回），调用者释放*data
+static int recv_frame(int socket_fd, message_header_t* header, unsigned char** data, size_t* length) {
+    if (recv_all(socket_fd, header, sizeof(*header)) != 0) {
+        fprintf(stderr, "接收消息头失败\n");
+        return -1;
+    }
+    
+    wire_decode_header(header);
+    if (!validate_message_header(header) || header->length > MAX_FRAME_LENGTH) {
+        fprintf(stderr, "无效的消息头\n");
+        return -1;
+    }
+    
+    unsigned char* body = malloc(header->length + 1);
+    if (!body) {
+        return -1;
+    }
+    
+    if (header->length > 0 && recv_all(socket_fd, body, header->length) != 0) {
+        fprintf(stderr, "接收消息数据失败\n");
+        free(body);
+        return -1;
+    }
+    
+    if (calculate_checksum(body, header->length) != header->checksum) {
+        fprintf(stderr, "校验和错误\n");
+        free(body);
+        return -1;
+    }
+    
+    if (header->flags & FRAME_FLAG_COMPRESSED) {
+        unsigned char* decompressed = NULL;
+        size_t decompressed_length = 0;
+        if (decompress_frame(FRAME_CODEC(header->flags), body, header->length,
+                             &decompressed, &decompressed_length, MAX_FRAME_LENGTH) != 0) {
+            fprintf(stderr, "解压失败\n");
+            free(body);
+            return -1;
+        }
+        free(body);
+        *data = decompressed;
+        *length = decompressed_length;
+    } else {
+        *data = body;
+        *length = header->length;
+    }
+    
+    return 0;
+}
+
+// 版本检查：协商v2线格式和压缩
+static int negotiate(int socket_fd, uint32_t* capabilities) {
+    version_check_msg_t check;
+    memset(&check, 0, sizeof(check));
+    WIRE_PUT_STR(&check, WIRE_V1, version_check_msg, client_version, "data_query");
+    WIRE_PUT_STR(&check, WIRE_V1, version_check_msg, platform, "tool");
+    WIRE_PUT_U32(&check, WIRE_V1, version_check_msg, capabilities, CAP_WIRE_V2 | CAP_COMPRESS_ZLIB);
+    
+    if (send_frame(socket_fd, WIRE_V1, MSG_VERSION_CHECK, &check, sizeof(check)) != 0) {
+        return -1;
+    }
+    
+    message_header_t header;
+    unsigned char* data;
+    size_t length;
+    if (recv_frame(socket_fd, &header, &data, &length) != 0) {
+        return -1;
+    }
+    
+    wire_view_t view;
+    *capabilities = 0;
+    if (header.type == MSG_VERSION_RESPONSE &&
+        wire_view_init(&view, header.version, data, length,
+                       WIRE_OFFSET(header.version, version_response_msg, heartbeat_interval)) == 0) {
+        *capabilities = WIRE_GET_U32(&view, version_response_msg, capabilities);
+    }
+    
+    free(data);
+    return 0;
+}
+
+// 输出一行
+static void print_row(const wire_view_t* row, const char* data, uint32_t data_size, int hex) {
+    char field_name[65];
+    WIRE_GET_STR(row, data_query_row, field_name, field_name, sizeof(field_name));
+    
+    printf("%llu\t%llu\t%s\t", (unsigned long long)WIRE_GET_U64(row, data_query_row, id),
+           (unsigned long long)WIRE_GET_U64(row, data_query_row, upload_time), field_name);
+    
+    int printable = !hex;
+    for (uint32_t i = 0; printable && i < data_size; i++) {
+        if (!isprint((unsigned char)data[i]) && !isspace((unsigned char)data[i])) {
+            printable = 0;
+        }
+    }
+    
+    if (printable) {
+        printf("%.*s\n", (int)data_size, data);
+    } else {
+        for (uint32_t i = 0; i < data_size; i++) {
+            printf("%02x", (unsigned char)data[i]);
+        }
+        printf("\n");
+    }
+}
+
+// 打印使用说明
+static void print_usage(const char* program_name) {
+    printf("使用方法: %s -t <表名> [选项]\n", program_name);
+    printf("选项:\n");
+    printf("  -H <地址>    服务器地址 (默认: 127.0.0.1)\n");
+    printf("  -p <端口>    服务器端口 (默认: %d)\n", DEFAULT_PORT);
+    printf("  -t <表名>    查询的表名\n");
+    printf("  -f <字段>    只查询指定字段 (默认: 所有字段)\n");
+    printf("  -s <时间>    上传时间下界，Unix秒 (包含)\n");
+    printf("  -e <时间>    上传时间上界，Unix秒 (不包含)\n");
+    printf("  -l <行数>    每页行数 (默认: %d，最多: %d)\n", DATA_QUERY_DEFAULT_LIMIT, DATA_QUERY_MAX_LIMIT);
+    printf("  -n <行数>    最多输出的行数 (默认: 全部)\n");
+    printf("  -x           以十六进制输出数据\n");
+    printf("  -h           显示此帮助信息\n");
+    printf("输出格式: ID<TAB>上传时间<TAB>字段名<TAB>数据\n");
+}
+
+int main(int argc, char* argv[]) {
+    query_options_t options = { "127.0.0.1", DEFAULT_PORT, NULL, "", 0, 0, 0, 0, 0 };
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "H:p:t:f:s:e:l:n:xh")) != -1) {
+        switch (opt) {
+            case 'H': options.host = optarg; break;
+            case 'p': options.port = atoi(optarg); break;
+            case 't': options.table_name = optarg; break;
+            case 'f': options.field_name = optarg; break;
+            case 's': options.start_time = strtoull(optarg, NULL, 10); break;
+            case 'e': options.end_time = strtoull(optarg, NULL, 10); break;
+            case 'l': options.page_size = (uint32_t)atoi(optarg); break;
+            case 'n': options.max_rows = strtoull(optarg, NULL, 10); break;
+            case 'x': options.hex = 1; break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    
+    if (!options.table_name) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    int socket_fd = connect_server(options.host, options.port);
+    if (socket_fd < 0) {
+        return 1;
+    }
+    
+    uint32_t capabilities = 0;
+    if (negotiate(socket_fd, &capabilities) != 0) {
+        close(socket_fd);
+        return 1;
+    }
+    uint8_t version = WIRE_VERSION_FOR(capabilities);
+    
+    uint64_t after_time = 0;
+    uint64_t after_id = 0;
+    uint64_t total_rows = 0;
+    uint32_t query_id = 0;
+    int more = 1;
+    int failed = 0;
+    
+    // 每页发一次查询，读取结果帧直到本页最后一帧，再用最后一帧的游标查询下一页
+    while (more && !failed) {
+        union {
+            data_query_msg_t v1;
+            data_query_msg_v2_t v2;
+        } query;
+        memset(&query, 0, sizeof(query));
+        query_id++;
+        
+        WIRE_PUT_U32(&query, version, data_query_msg, query_id, query_id);
+        WIRE_PUT_STR(&query, version, data_query_msg, table_name, options.table_name);
+        WIRE_PUT_STR(&query, version, data_query_msg, field_name, options.field_name);
+        WIRE_PUT_U64(&query, version, data_query_msg, start_time, options.start_time);
+        WIRE_PUT_U64(&query, version, data_query_msg, end_time, options.end_time);
+        WIRE_PUT_U64(&query, version, data_query_msg, after_time, after_time);
+        WIRE_PUT_U64(&query, version, data_query_msg, after_id, after_id);
+        WIRE_PUT_U32(&query, version, data_query_msg, limit, options.page_size);
+        
+        if (send_frame(socket_fd, version, MSG_DATA_QUERY, &query, WIRE_SIZE(version, data_query_msg)) != 0) {
+            fprintf(stderr, "发送查询失败\n");
+            failed = 1;
+            break;
+        }
+        
+        int last = 0;
+        while (!last) {
+            message_header_t header;
+            unsigned char* data;
+            size_t length;
+            
+            if (recv_frame(socket_fd, &header, &data, &length) != 0) {
+                failed = 1;
+                break;
+            }
+            
+            // 心跳等其他消息直接忽略
+            wire_view_t view;
+            if (header.type != MSG_DATA_QUERY_RESULT ||
+                wire_view_init(&view, header.version, data, length,
+                               WIRE_SIZE(header.version, data_query_result_msg)) != 0 ||
+                WIRE_GET_U32(&view, data_query_result_msg, query_id) != query_id) {
+                if (header.type == MSG_ERROR) {
+                    fprintf(stderr, "服务器错误\n");
+                    failed = 1;
+                    last = 1;
+                }
+                free(data);
+                continue;
+            }
+            
+            uint16_t status = WIRE_GET_U16(&view, data_query_result_msg, status);
+            uint16_t flags = WIRE_GET_U16(&view, data_query_result_msg, flags);
+            uint32_t row_count = WIRE_GET_U32(&view, data_query_result_msg, row_count);
+            
+            size_t offset = WIRE_OFFSET(view.version, data_query_result_msg, rows);
+            for (uint32_t i = 0; i < row_count; i++) {
+                wire_view_t row;
+                if (wire_view_init(&row, view.version, data + offset, length - offset,
+                                   WIRE_SIZE(view.version, data_query_row)) != 0) {
+                    fprintf(stderr, "结果帧格式错误\n");
+                    failed = 1;
+                    break;
+                }
+                
+                uint32_t data_size = WIRE_GET_U32(&row, data_query_row, data_size);
+                size_t stride = DATA_QUERY_ROW_STRIDE(view.version, data_size);
+                if (WIRE_SIZE(view.version, data_query_row) + data_size > row.length) {
+                    fprintf(stderr, "结果帧格式错误\n");
+                    failed = 1;
+                    break;
+                }
+                
+                if (!options.max_rows || total_rows < options.max_rows) {
+                    print_row(&row, WIRE_GET_PTR(&row, data_query_row, data), data_size, options.hex);
+                    total_rows++;
+                }
+                
+                offset += stride < row.length ? stride : row.length;
+            }
+            
+            if (status != STATUS_SUCCESS) {
+                fprintf(stderr, "查询失败: 状态=%d\n", status);
+                failed = 1;
+            }
+            
+            after_time = WIRE_GET_U64(&view, data_query_result_msg, next_after_time);
+            after_id = WIRE_GET_U64(&view, data_query_result_msg, next_after_id);
+            
+            if (flags & DATA_QUERY_FLAG_LAST) {
+                last = 1;
+                more = (flags & DATA_QUERY_FLAG_MORE) != 0;
+            }
+            
+            free(data);
+        }
+        
+        if (options.max_rows && total_rows >= options.max_rows) {
+            more = 0;
+        }
+    }
+    
+    close(socket_fd);
+    
+    fprintf(stderr, "共 %llu 行\n", (unsigned long long)total_rows);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,325 @@
+// 数据库存储配置基准测试：对每个存储配置分别测量持久写入、即发即弃日志写入和读写并发下的读取吞吐量
+#include "../src/server/server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+// 数据库模块使用的全局服务器状态
+server_state_t g_server = {0};
+
+// 基准测试参数
+typedef struct {
+    int rows;                 // 每项写入测试的行数
+    int threads;              // 并发写入线程数
+    int readers;              // 并发读取线程数
+    int read_seconds;         // 读取测试时长（秒）
+    int value_size;           // 字段数据大小（字节）
+    const char* directory;    // 临时数据库所在目录
+} bench_options_t;
+
+// 单个配置的测试结果
+typedef struct {
+    double durable_rows_per_sec;
+    double log_rows_per_sec;
+    long long log_dropped;
+    double reads_per_sec;
+    double concurrent_writes_per_sec;
+} bench_result_t;
+
+// 写入线程参数
+typedef struct {
+    int rows;
+    int value_size;
+    volatile int* stop;       // 非NULL时持续写入直到stop置位
+    long written;
+} writer_arg_t;
+
+// 读取线程参数
+typedef struct {
+    volatile int* stop;
+    long reads;
+} reader_arg_t;
+
+// 结果输出（测试期间标准输出被重定向，避免数据库模块的逐行日志影响计时）
+static FILE* g_report = NULL;
+
+static const char* g_profile_names[] = { "compat", "safe", "balanced", "fast" };
+
+// 当前时间（秒）
+static double now_seconds() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// 持久写入线程
+static void* durable_writer_thread(void* arg) {
+    writer_arg_t* writer = (writer_arg_t*)arg;
+    unsigned char* value = malloc(writer->value_size);
+    if (!value) {
+        return NULL;
+    }
+    memset(value, 'x', writer->value_size);
+    
+    for (long i = 0; writer->stop ? !*writer->stop : i < writer->rows; i++) {
+        if (database_store_field_data("bench", "value", value, writer->value_size) == 0) {
+            writer->written++;
+        }
+    }
+    
+    free(value);
+    return NULL;
+}
+
+// 读取线程
+static void* reader_thread(void* arg) {
+    reader_arg_t* reader = (reader_arg_t*)arg;
+    char version[32];
+    int rollout_percent;
+    
+    while (!*reader->stop) {
+        if (database_get_latest_version(version, sizeof(version), &rollout_percent) == 0) {
+            reader->reads++;
+        }
+    }
+    
+    return NULL;
+}
+
+// 删除临时数据库目录
+static void remove_bench_directory(const char* path) {
+    const char* files[] = { "server.db", "server.db-wal", "server.db-shm", "server.db-journal" };
+    char file_path[1024];
+    
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(file_path, sizeof(file_path), "%s/data/database/%s", path, files[i]);
+        unlink(file_path);
+    }
+    
+    snprintf(file_path, sizeof(file_path), "%s/data/database", path);
+    rmdir(file_path);
+    snprintf(file_path, sizeof(file_path), "%s/data", path);
+    rmdir(file_path);
+    rmdir(path);
+}
+
+// 对一个存储配置运行全部测试
+static int run_profile(const char* profile, const bench_options_t* options, bench_result_t* result) {
+    char template[1024];
+    char cwd[1024];
+    
+    memset(result, 0, sizeof(*result));
+    
+    if (!getcwd(cwd, sizeof(cwd))) {
+        perror("getcwd");
+        return -1;
+    }
+    
+    snprintf(template, sizeof(template), "%s/db_bench.XXXXXX", options->directory);
+    if (!mkdtemp(template) || chdir(template) != 0) {
+        perror("创建临时目录失败");
+        return -1;
+    }
+    
+    // database_init只创建最后一级目录
+    if (mkdir("data", 0755) != 0) {
+        perror("mkdir data");
+        if (chdir(cwd) != 0) {
+            perror("chdir");
+        }
+        rmdir(template);
+        return -1;
+    }
+    
+    database_set_profile(profile);
+    if (database_init() != 0) {
+        fprintf(g_report, "配置 %s 初始化数据库失败\n", profile);
+        if (chdir(cwd) != 0) {
+            perror("chdir");
+        }
+        remove_bench_directory(template);
+        return -1;
+    }
+    
+    // 持久写入：多个线程并发调用database_store_field_data，每次调用等待所在批次提交
+    pthread_t threads[options->threads > options->readers ? options->threads : options->readers];
+    writer_arg_t writers[options->threads];
+    
+    double start = now_seconds();
+    for (int i = 0; i < options->threads; i++) {
+        writers[i] = (writer_arg_t){ options->rows / options->threads, options->value_size, NULL, 0 };
+        pthread_create(&threads[i], NULL, durable_writer_thread, &writers[i]);
+    }
+    
+    long written = 0;
+    for (int i = 0; i < options->threads; i++) {
+        pthread_join(threads[i], NULL);
+        written += writers[i].written;
+    }
+    result->durable_rows_per_sec = written / (now_seconds() - start);
+    
+    // 读写并发：多个线程读取最新版本，同时一个线程持续写入
+    volatile int stop = 0;
+    reader_arg_t readers[options->readers];
+    writer_arg_t background = { 0, options->value_size, &stop, 0 };
+    pthread_t background_thread;
+    
+    pthread_create(&background_thread, NULL, durable_writer_thread, &background);
+    start = now_seconds();
+    for (int i = 0; i < options->readers; i++) {
+        readers[i] = (reader_arg_t){ &stop, 0 };
+        pthread_create(&threads[i], NULL, reader_thread, &readers[i]);
+    }
+    
+    sleep(options->read_seconds);
+    stop = 1;
+    
+    long reads = 0;
+    for (int i = 0; i < options->readers; i++) {
+        pthread_join(threads[i], NULL);
+        reads += readers[i].reads;
+    }
+    pthread_join(background_thread, NULL);
+    
+    double elapsed = now_seconds() - start;
+    result->reads_per_sec = reads / elapsed;
+    result->concurrent_writes_per_sec = background.written / elapsed;
+    
+    // 系统日志写入：计时包含database_cleanup等待日志线程写完剩余队列，只统计实际写入的行，队列满时丢弃的不计
+    long long logs_before = 0;
+    long long logs_after = 0;
+    long long dropped = 0;
+    database_log_stats(&logs_before, NULL);
+    
+    start = now_seconds();
+    for (int i = 0; i < options->rows; i++) {
+        database_log_system_event("INFO", "db_bench log event", "127.0.0.1");
+    }
+    database_cleanup();
+    database_log_stats(&logs_after, &dropped);
+    result->log_rows_per_sec = (logs_after - logs_before) / (now_seconds() - start);
+    result->log_dropped = dropped;
+    
+    if (chdir(cwd) != 0) {
+        perror("chdir");
+    }
+    remove_bench_directory(template);
+    
+    return 0;
+}
+
+// 打印使用说明
+static void print_usage(const char* program_name) {
+    printf("使用方法: %s [选项]\n", program_name);
+    printf("选项:\n");
+    printf("  -s <配置>    只测试指定的存储配置 (默认: 全部)\n");
+    database_print_profiles();
+    printf("  -n <行数>    每项写入测试的行数 (默认: 20000)\n");
+    printf("  -t <线程>    并发写入线程数 (默认: 32)\n");
+    printf("  -r <线程>    并发读取线程数 (默认: 4)\n");
+    printf("  -d <秒>      读取测试时长 (默认: 3)\n");
+    printf("  -b <字节>    字段数据大小 (默认: 256)\n");
+    printf("  -o <目录>    临时数据库所在目录 (默认: /tmp)\n");
+    printf("  -h           显示此帮助信息\n");
+}
+
+int main(int argc, char* argv[]) {
+    bench_options_t options = { 20000, 32, 4, 3, 256, "/tmp" };
+    const char* only_profile = NULL;
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "s:n:t:r:d:b:o:h")) != -1) {
+        switch (opt) {
+            case 's':
+                if (database_set_profile(optarg) != 0) {
+                    fprintf(stderr, "错误: 未知的存储配置 %s\n", optarg);
+                    return 1;
+                }
+                only_profile = optarg;
+                break;
+            case 'n':
+                options.rows = atoi(optarg);
+                break;
+            case 't':
+                options.threads = atoi(optarg);
+                break;
+            case 'r':
+                options.readers = atoi(optarg);
+                break;
+            case 'd':
+                options.read_seconds = atoi(optarg);
+                break;
+            case 'b':
+                options.value_size = atoi(optarg);
+                break;
+            case 'o':
+                options.directory = optarg;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    
+    if (options.rows <= 0 || options.threads <= 0 || options.readers <= 0 ||
+        options.read_seconds <= 0 || options.value_size <= 0) {
+        fprintf(stderr, "错误: 参数必须为正数\n");
+        return 1;
+    }
+    
+    if (pthread_mutex_init(&g_server.db_mutex, NULL) != 0) {
+        perror("pthread_mutex_init db_mutex");
+        return 1;
+    }
+    
+    // 保留原标准输出用于报告，测试期间丢弃数据库模块的输出
+    int report_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (report_fd < 0 || null_fd < 0 || !(g_report = fdopen(report_fd, "w"))) {
+        perror("重定向标准输出失败");
+        return 1;
+    }
+    
+    fprintf(g_report, "行数=%d 写线程=%d 读线程=%d 读取时长=%d秒 数据大小=%d字节\n\n",
+            options.rows, options.threads, options.readers, options.read_seconds, options.value_size);
+    fprintf(g_report, "%-10s %14s %14s %10s %14s %14s\n",
+            "配置", "持久写入/秒", "日志写入/秒", "日志丢弃", "并发读取/秒", "并发写入/秒");
+    fflush(g_report);
+    
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(g_profile_names) / sizeof(g_profile_names[0]); i++) {
+        if (only_profile && strcmp(only_profile, g_profile_names[i]) != 0) {
+            continue;
+        }
+        
+        bench_result_t result;
+        fflush(stdout);
+        dup2(null_fd, STDOUT_FILENO);
+        int rc = run_profile(g_profile_names[i], &options, &result);
+        fflush(stdout);
+        dup2(report_fd, STDOUT_FILENO);
+        
+        if (rc != 0) {
+            failed = 1;
+            continue;
+        }
+        
+        fprintf(g_report, "%-10s %14.0f %14.0f %10lld %14.0f %14.0f\n", g_profile_names[i],
+                result.durable_rows_per_sec, result.log_rows_per_sec, result.log_dropped,
+                result.reads_per_sec, result.concurrent_writes_per_sec);
+        fflush(g_report);
+    }
+    
+    close(null_fd);
+    fclose(g_report);
+    pthread_mutex_destroy(&g_server.db_mutex);
+    
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,849 @@
+// 更新风暴压测工具：在临时目录启动本地服务端并放入指定大小的合成更新包，N个模拟客户端同时
+// 做版本检查并下载完整更新包，统计服务端CPU、内存峰值、完成时间分位数和总吞吐量
+#include "../src/common/protocol.h"
+#include "../src/common/base64.h"
+#include "../src/common/compress.h"
+#include "../src/common/sha256.h"
+#include "../src/common/stream.h"
+#include "../src/common/utils.h"
+#include "../src/common/wire.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ftw.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define STORM_CLIENT_VERSION "0.0.0"    // 模拟客户端上报的版本，低于任何发布版本
+#define STORM_REJECT_TIMEOUT 1800       // 连接一直被拒绝（服务端连接数已满）时最多等待的时间（秒）
+#define STORM_REJECT_BACKOFF_MAX 5000   // 连接被拒绝后重连间隔的上限（毫秒）
+#define STORM_READY_TIMEOUT 60          // 等待服务端加载更新包并开始接受连接的最长时间（秒）
+#define STORM_SAMPLE_INTERVAL_MS 100    // 压测期间采样服务端内存的间隔（毫秒）
+#define STORM_THREAD_STACK (256 * 1024) // 模拟客户端线程的栈大小，数千个线程时避免占用过多内存
+
+// 一次下载尝试的结果
+enum {
+    STORM_DONE = 0,           // 下载完成
+    STORM_FAILED = -1,        // 失败，不再重试
+    STORM_REJECTED = 1,       // 服务端连接数已满，没有回复版本检查
+    STORM_DEFERRED = 2        // 分批发布暂缓，按retry_after重试
+};
+
+// 压测参数
+typedef struct {
+    const char* server_path;  // 服务端可执行文件
+    int port;
+    int clients;              // 模拟客户端数
+    size_t package_size;      // 合成更新包大小（字节）
+    int max_transfers;        // 服务端同时进行的更新传输上限（-U），-1表示使用服务端默认值
+    uint32_t capabilities;    // 模拟客户端声明的能力位
+    int timeout;              // 接收超时（秒）
+    int verify;               // 解码并校验更新包的SHA-256
+    int keep;                 // 保留临时目录（包括服务端日志）
+    const char* directory;    // 临时目录所在目录
+} storm_options_t;
+
+// 单个模拟客户端的状态和结果
+typedef struct {
+    const storm_options_t* options;
+    unsigned int seed;        // 重试间隔抖动的随机数种子
+    uint8_t client_id[CLIENT_ID_SIZE];  // 版本检查中报告的客户端标识（按序号生成，各不相同）
+    int completed;
+    double elapsed;           // 从起跑到下载完成的时间（秒）
+    int rejected;             // 连接被拒绝的次数
+    int deferred;             // 被分批发布暂缓的次数
+    long long wire_bytes;     // 收到的更新数据（Base64）字节数
+    char error[128];
+} storm_client_t;
+
+// 接收更新数据的上下文
+typedef struct {
+    long long bytes;
+    int verify;
+    base64_decoder_t decoder;
+    sha256_context_t digest;
+    unsigned char output[(STREAM_CHUNK_SIZE / 4 + 1) * 3];
+} storm_receive_t;
+
+// 所有模拟客户端同时起跑
+static pthread_mutex_t g_start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_start_cond = PTHREAD_COND_INITIALIZER;
+static int g_started = 0;
+static double g_start_time = 0;
+static int g_finished = 0;
+
+// 当前时间（秒）
+static double now_seconds() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// 解析带K/M/G后缀的字节数
+static size_t parse_size(const char* text) {
+    char* end = NULL;
+    unsigned long long value = strtoull(text, &end, 10);
+    
+    if (!end || end == text) {
+        return 0;
+    }
+    switch (*end) {
+        case 'k': case 'K': value *= 1024ULL; end++; break;
+        case 'm': case 'M': value *= 1024ULL * 1024; end++; break;
+        case 'g': case 'G': value *= 1024ULL * 1024 * 1024; end++; break;
+        default: break;
+    }
+    
+    return *end == '\0' && value <= UINT32_MAX ? (size_t)value : 0;
+}
+
+// 连接本地服务端
+static int storm_connect(int port, int timeout) {
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_fd < 0) {
+        return -1;
+    }
+    
+    struct timeval tv = { timeout, 0 };
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    
+    if (connect(socket_fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(socket_fd);
+        return -1;
+    }
+    return socket_fd;
+}
+
+// 发送一帧
+static int storm_send_frame(int socket_fd, uint8_t version, uint16_t type, const void* data, size_t length) {
+    message_header_t header;
+    
+    init_message_header(&header, type, (uint32_t)length);
+    header.version = version;
+    header.checksum = calculate_checksum(data, length);
+    wire_encode_header(&header);
+    
+    if (send_all(socket_fd, &header, sizeof(header)) != 0) {
+        return -1;
+    }
+    return length > 0 ? send_all(socket_fd, data, length) : 0;
+}
+
+// 接收消息头（大的更新数据帧按流接收，不受单帧长度上限约束）
+static int storm_recv_header(int socket_fd, message_header_t* header) {
+    if (recv_all(socket_fd, header, sizeof(*header)) != 0) {
+        return -1;
+    }
+    
+    wire_decode_header(header);
+    if (!validate_message_header(header) ||
+        (header->length > MAX_FRAME_LENGTH && !is_stream_frame(header->type, header->flags, header->length))) {
+        return -1;
+    }
+    return 0;
+}
+
+// 接收整个消息体（压缩帧解压后返回），调用者释放*data。流帧不整体读入，由调用方按流接收
+static int storm_recv_body(int socket_fd, const message_header_t* header, unsigned char** data, size_t* length) {
+    if (header->length > MAX_FRAME_LENGTH) {
+        return -1;
+    }
+    
+    unsigned char* body = malloc(header->length + 1);
+    if (!body) {
+        return -1;
+    }
+    
+    if ((header->length > 0 && recv_all(socket_fd, body, header->length) != 0) ||
+        calculate_checksum(body, header->length) != header->checksum) {
+        free(body);
+        return -1;
+    }
+    
+    if (header->flags & FRAME_FLAG_COMPRESSED) {
+        unsigned char* decompressed = NULL;
+        size_t decompressed_length = 0;
+        int result = decompress_frame(FRAME_CODEC(header->flags), body, header->length,
+                                      &decompressed, &decompressed_length, MAX_FRAME_LENGTH);
+        free(body);
+        if (result != 0) {
+            return -1;
+        }
+        *data = decompressed;
+        *length = decompressed_length;
+    } else {
+        *data = body;
+        *length = header->length;
+    }
+    
+    return 0;
+}
+
+// 发送版本检查（client_id为NULL时不带客户端标识）
+static int storm_send_check(int socket_fd, uint32_t capabilities, const uint8_t* client_id) {
+    version_check_msg_t check;
+    memset(&check, 0, sizeof(check));
+    WIRE_PUT_STR(&check, WIRE_V1, version_check_msg, client_version, STORM_CLIENT_VERSION);
+    WIRE_PUT_STR(&check, WIRE_V1, version_check_msg, platform, "storm");
+    WIRE_PUT_U32(&check, WIRE_V1, version_check_msg, capabilities, capabilities);
+    if (client_id) {
+        memcpy(check.client_id, client_id, sizeof(check.client_id));
+    }
+    
+    return storm_send_frame(socket_fd, WIRE_V1, MSG_VERSION_CHECK, &check, sizeof(check));
+}
+
+// 解析版本响应，返回状态码，格式错误返回-1
+static int storm_parse_response(const message_header_t* header, const unsigned char* data, size_t length,
+                                uint32_t* capabilities, uint32_t* update_size,
+                                uint8_t package_hash[SHA256_DIGEST_SIZE], uint32_t* retry_after) {
+    wire_view_t view;
+    if (wire_view_init(&view, header->version, data, length,
+                       WIRE_OFFSET(header->version, version_response_msg, heartbeat_interval)) != 0) {
+        return -1;
+    }
+    
+    *capabilities = WIRE_GET_U32(&view, version_response_msg, capabilities);
+    *update_size = WIRE_GET_U32(&view, version_response_msg, update_size);
+    memset(package_hash, 0, SHA256_DIGEST_SIZE);
+    if (view.length >= WIRE_OFFSET(view.version, version_response_msg, retry_after)) {
+        memcpy(package_hash, WIRE_GET_PTR(&view, version_response_msg, package_hash), SHA256_DIGEST_SIZE);
+    }
+    *retry_after = view.length >= WIRE_SIZE(view.version, version_response_msg) ?
+                   WIRE_GET_U32(&view, version_response_msg, retry_after) : 0;
+    
+    return WIRE_GET_U16(&view, version_response_msg, status);
+}
+
+// 处理一块更新数据
+static int storm_consume(void* context, const char* data, size_t length) {
+    storm_receive_t* receive = (storm_receive_t*)context;
+    receive->bytes += length;
+    
+    if (receive->verify) {
+        int decoded = base64_decoder_update(&receive->decoder, data, length,
+                                            receive->output, sizeof(receive->output));
+        if (decoded < 0) {
+            return -1;
+        }
+        sha256_update(&receive->digest, receive->output, (size_t)decoded);
+    }
+    return 0;
+}
+
+// 接收更新数据帧并核对长度（和SHA-256）
+static int storm_receive_package(storm_client_t* client, int socket_fd, const message_header_t* header,
+                                 uint32_t update_size, const uint8_t package_hash[SHA256_DIGEST_SIZE]) {
+    storm_receive_t* receive = calloc(1, sizeof(storm_receive_t));
+    if (!receive) {
+        snprintf(client->error, sizeof(client->error), "内存不足");
+        return STORM_FAILED;
+    }
+    receive->verify = client->options->verify;
+    base64_decoder_init(&receive->decoder);
+    sha256_init(&receive->digest);
+    
+    int result = 0;
+    if (header->flags & FRAME_FLAG_COMPRESSED) {
+        unsigned char* data = NULL;
+        size_t length = 0;
+        result = storm_recv_body(socket_fd, header, &data, &length);
+        if (result == 0) {
+            result = storm_consume(receive, (const char*)data, length);
+            free(data);
+        }
+    } else {
+        uint32_t checksum = 0;
+        result = stream_recv_body(socket_fd, header->length, &checksum, storm_consume, receive);
+        if (result == 0 && checksum != header->checksum) {
+            result = -1;
+        }
+    }
+    client->wire_bytes += receive->bytes;
+    
+    if (result != 0) {
+        snprintf(client->error, sizeof(client->error), "接收更新数据失败");
+        result = STORM_FAILED;
+    } else if ((size_t)receive->bytes != base64_encoded_length(update_size)) {
+        snprintf(client->error, sizeof(client->error), "更新数据长度错误: %lld 字节", receive->bytes);
+        result = STORM_FAILED;
+    } else if (receive->verify) {
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        uint8_t unknown[SHA256_DIGEST_SIZE] = {0};
+        sha256_final(&receive->digest, digest);
+        if (base64_decoder_finish(&receive->decoder) != 0 ||
+            (memcmp(package_hash, unknown, SHA256_DIGEST_SIZE) != 0 &&
+             memcmp(digest, package_hash, SHA256_DIGEST_SIZE) != 0)) {
+            snprintf(client->error, sizeof(client->error), "更新包SHA-256校验失败");
+            result = STORM_FAILED;
+        }
+    }
+    
+    free(receive);
+    return result;
+}
+
+// 在一条连接上做版本检查并下载完整更新包
+static int storm_download(storm_client_t* client, int socket_fd, uint32_t* retry_after) {
+    const storm_options_t* options = client->options;
+    message_header_t header;
+    unsigned char* data = NULL;
+    size_t length = 0;
+    
+    // 服务端连接数已满时直接关闭连接，版本检查收不到回复
+    if (storm_send_check(socket_fd, options->capabilities, client->client_id) != 0 ||
+        storm_recv_header(socket_fd, &header) != 0) {
+        return STORM_REJECTED;
+    }
+    
+    while (header.type != MSG_VERSION_RESPONSE) {
+        if (storm_recv_body(socket_fd, &header, &data, &length) != 0 ||
+            (free(data), storm_recv_header(socket_fd, &header)) != 0) {
+            snprintf(client->error, sizeof(client->error), "接收版本响应失败");
+            return STORM_FAILED;
+        }
+    }
+    
+    uint32_t capabilities = 0;
+    uint32_t update_size = 0;
+    uint8_t package_hash[SHA256_DIGEST_SIZE];
+    if (storm_recv_body(socket_fd, &header, &data, &length) != 0) {
+        snprintf(client->error, sizeof(client->error), "接收版本响应失败");
+        return STORM_FAILED;
+    }
+    int status = storm_parse_response(&header, data, length, &capabilities, &update_size,
+                                      package_hash, retry_after);
+    free(data);
+    
+    if (status != STATUS_UPDATE_AVAILABLE) {
+        if (status == STATUS_NO_UPDATE && *retry_after > 0) {
+            return STORM_DEFERRED;
+        }
+        snprintf(client->error, sizeof(client->error), "版本检查没有提供更新: 状态=%d", status);
+        return STORM_FAILED;
+    }
+    
+    uint8_t version = WIRE_VERSION_FOR(capabilities);
+    union {
+        update_request_msg_t v1;
+        update_request_msg_v2_t v2;
+    } request;
+    memset(&request, 0, sizeof(request));
+    WIRE_PUT_U32(&request, version, update_request_msg, flags, UPDATE_REQUEST_FULL);
+    
+    if (storm_send_frame(socket_fd, version, MSG_UPDATE_REQUEST, &request,
+                         WIRE_SIZE(version, update_request_msg)) != 0) {
+        snprintf(client->error, sizeof(client->error), "发送更新请求失败");
+        return STORM_FAILED;
+    }
+    
+    // 跳过心跳等其他消息；名额已满时服务端以版本响应代替更新数据
+    while (1) {
+        if (storm_recv_header(socket_fd, &header) != 0) {
+            snprintf(client->error, sizeof(client->error), "接收更新数据失败");
+            return STORM_FAILED;
+        }
+        
+        if (header.type == MSG_UPDATE_DATA) {
+            return storm_receive_package(client, socket_fd, &header, update_size, package_hash);
+        }
+        
+        if (storm_recv_body(socket_fd, &header, &data, &length) != 0) {
+            snprintf(client->error, sizeof(client->error), "接收消息失败");
+            return STORM_FAILED;
+        }
+        
+        if (header.type == MSG_VERSION_RESPONSE) {
+            status = storm_parse_response(&header, data, length, &capabilities, &update_size,
+                                          package_hash, retry_after);
+            free(data);
+            if (*retry_after > 0) {
+                return STORM_DEFERRED;
+            }
+            snprintf(client->error, sizeof(client->error), "更新请求被拒绝: 状态=%d", status);
+            return STORM_FAILED;
+        }
+        
+        free(data);
+        if (header.type == MSG_ERROR) {
+            snprintf(client->error, sizeof(client->error), "服务器错误");
+            return STORM_FAILED;
+        }
+    }
+}
+
+// 运行一个模拟客户端：连接被拒绝时稍后重连，被暂缓时按服务端建议的间隔重新检查
+static int storm_run_client(storm_client_t* client) {
+    double rejected_since = 0;
+    int backoff = 200;
+    
+    while (1) {
+        uint32_t retry_after = 0;
+        int result = STORM_REJECTED;
+        
+        int socket_fd = storm_connect(client->options->port, client->options->timeout);
+        if (socket_fd >= 0) {
+            result = storm_download(client, socket_fd, &retry_after);
+            close(socket_fd);
+        }
+        
+        switch (result) {
+            case STORM_DONE:
+                return 0;
+            case STORM_REJECTED:
+                // 客户端远多于服务端连接数上限时要等前面的客户端下载完，按等待时间而不是次数放弃
+                client->rejected++;
+                if (rejected_since == 0) {
+                    rejected_since = now_seconds();
+                } else if (now_seconds() - rejected_since > STORM_REJECT_TIMEOUT) {
+                    snprintf(client->error, sizeof(client->error), "连接被拒绝 %d 次", client->rejected);
+                    return -1;
+                }
+                // 重连间隔从0.2秒起逐次加倍到5秒，加上抖动，避免被拒绝的客户端同时回来
+                usleep((useconds_t)(backoff / 2 + rand_r(&client->seed) % (backoff / 2 + 1)) * 1000);
+                backoff = backoff * 2 > STORM_REJECT_BACKOFF_MAX ? STORM_REJECT_BACKOFF_MAX : backoff * 2;
+                break;
+            case STORM_DEFERRED:
+                rejected_since = 0;
+                backoff = 200;
+                client->deferred++;
+                sleep(retry_after);
+                break;
+            default:
+                return -1;
+        }
+    }
+}
+
+// 模拟客户端线程
+static void* storm_client_thread(void* arg) {
+    storm_client_t* client = (storm_client_t*)arg;
+    
+    pthread_mutex_lock(&g_start_mutex);
+    while (!g_started) {
+        pthread_cond_wait(&g_start_cond, &g_start_mutex);
+    }
+    pthread_mutex_unlock(&g_start_mutex);
+    
+    if (storm_run_client(client) == 0) {
+        client->completed = 1;
+        client->elapsed = now_seconds() - g_start_time;
+    }
+    
+    __atomic_add_fetch(&g_finished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// 生成合成更新包（随机数据，压缩不会减小传输量）
+static int storm_write_package(const char* path, size_t size) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        perror("创建更新包失败");
+        return -1;
+    }
+    
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ (uint64_t)time(NULL);
+    uint64_t block[8192];
+    int result = 0;
+    
+    while (size > 0 && result == 0) {
+        for (size_t i = 0; i < sizeof(block) / sizeof(block[0]); i++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            block[i] = state;
+        }
+        
+        size_t chunk = size < sizeof(block) ? size : sizeof(block);
+        if (fwrite(block, 1, chunk, file) != chunk) {
+            result = -1;
+        }
+        size -= chunk;
+    }
+    
+    if (fclose(file) != 0 || result != 0) {
+        perror("写入更新包失败");
+        return -1;
+    }
+    return 0;
+}
+
+// 在工作目录中启动服务端，输出写入server.log
+static pid_t storm_start_server(const storm_options_t* options, const char* server_path, const char* directory) {
+    char port[16];
+    char max_transfers[16];
+    snprintf(port, sizeof(port), "%d", options->port);
+    snprintf(max_transfers, sizeof(max_transfers), "%d", options->max_transfers);
+    
+    pid_t pid = fork();
+    if (pid != 0) {
+        if (pid < 0) {
+            perror("fork");
+        }
+        return pid;
+    }
+    
+    int log_fd = -1;
+    if (chdir(directory) != 0 || (log_fd = open("server.log", O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror("准备服务端工作目录失败");
+        _exit(127);
+    }
+    dup2(log_fd, STDOUT_FILENO);
+    dup2(log_fd, STDERR_FILENO);
+    close(log_fd);
+    
+    if (options->max_transfers >= 0) {
+        execl(server_path, server_path, "-p", port, "-U", max_transfers, (char*)NULL);
+    } else {
+        execl(server_path, server_path, "-p", port, (char*)NULL);
+    }
+    perror("启动服务端失败");
+    _exit(127);
+}
+
+// 等待服务端加载完更新包：版本检查提供了大小一致的更新时就绪
+static int storm_wait_ready(pid_t pid, const storm_options_t* options) {
+    double deadline = now_seconds() + STORM_READY_TIMEOUT;
+    
+    while (now_seconds() < deadline) {
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            fprintf(stderr, "服务端已退出\n");
+            return -1;
+        }
+        
+        int socket_fd = storm_connect(options->port, 1);
+        if (socket_fd >= 0) {
+            message_header_t header;
+            unsigned char* data = NULL;
+            size_t length = 0;
+            int ready = 0;
+            
+            if (storm_send_check(socket_fd, 0, NULL) == 0 && storm_recv_header(socket_fd, &header) == 0 &&
+                storm_recv_body(socket_fd, &header, &data, &length) == 0) {
+                uint32_t capabilities, update_size, retry_after;
+                uint8_t package_hash[SHA256_DIGEST_SIZE];
+                ready = header.type == MSG_VERSION_RESPONSE &&
+                        storm_parse_response(&header, data, length, &capabilities, &update_size,
+                                             package_hash, &retry_after) == STATUS_UPDATE_AVAILABLE &&
+                        update_size == options->package_size;
+                free(data);
+            }
+            close(socket_fd);
+            
+            if (ready) {
+                return 0;
+            }
+        }
+        usleep(200000);
+    }
+    
+    fprintf(stderr, "等待服务端就绪超时\n");
+    return -1;
+}
+
+// 停止服务端
+static void storm_stop_server(pid_t pid) {
+    int status;
+    kill(pid, SIGTERM);
+    
+    for (int i = 0; i < 50; i++) {
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            return;
+        }
+        usleep(100000);
+    }
+    
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+}
+
+// 读取进程累计的CPU时间（用户态+内核态，秒）
+static double storm_read_cpu(pid_t pid) {
+    char path[64];
+    char buffer[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    size_t length = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[length] = '\0';
+    
+    // 进程名可能含空格，从最后一个')'之后开始解析，utime和stime是第14、15个字段
+    char* fields = strrchr(buffer, ')');
+    unsigned long utime = 0;
+    unsigned long stime = 0;
+    if (!fields || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                          &utime, &stime) != 2) {
+        return 0;
+    }
+    
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// 读取/proc/<pid>/status中的内存字段（KB）
+static long storm_read_memory(pid_t pid, const char* field) {
+    char path[64];
+    char line[256];
+    size_t field_length = strlen(field);
+    long value = 0;
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, field, field_length) == 0 && line[field_length] == ':') {
+            value = atol(line + field_length + 1);
+            break;
+        }
+    }
+    fclose(file);
+    return value;
+}
+
+// 删除临时目录中的一项
+static int storm_remove_entry(const char* path, const struct stat* sb, int type, struct FTW* ftw) {
+    (void)sb;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+// 按完成时间排序
+static int compare_elapsed(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// 第percent百分位（最近秩）
+static double percentile(const double* sorted, int count, int percent) {
+    int rank = (count * percent + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// 运行压测并输出报告
+static int storm_run(const storm_options_t* options, pid_t server_pid) {
+    storm_client_t* clients = calloc(options->clients, sizeof(storm_client_t));
+    pthread_t* threads = calloc(options->clients, sizeof(pthread_t));
+    double* elapsed = calloc(options->clients, sizeof(double));
+    if (!clients || !threads || !elapsed) {
+        fprintf(stderr, "内存不足\n");
+        free(clients);
+        free(threads);
+        free(elapsed);
+        return -1;
+    }
+    
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, STORM_THREAD_STACK);
+    
+    int created = 0;
+    for (; created < options->clients; created++) {
+        clients[created].options = options;
+        clients[created].seed = (unsigned int)created * 2654435761u;
+        clients[created].client_id[0] = 0x53;
+        memcpy(clients[created].client_id + 1, &created, sizeof(created));
+        if (pthread_create(&threads[created], &attr, storm_client_thread, &clients[created]) != 0) {
+            fprintf(stderr, "只创建了 %d 个模拟客户端线程\n", created);
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    
+    long rss_before = storm_read_memory(server_pid, "VmRSS");
+    long rss_peak = rss_before;
+    double cpu_before = storm_read_cpu(server_pid);
+    
+    pthread_mutex_lock(&g_start_mutex);
+    g_start_time = now_seconds();
+    g_started = 1;
+    pthread_cond_broadcast(&g_start_cond);
+    pthread_mutex_unlock(&g_start_mutex);
+    
+    // 压测期间定期采样服务端内存
+    while (__atomic_load_n(&g_finished, __ATOMIC_ACQUIRE) < created) {
+        long rss = storm_read_memory(server_pid, "VmRSS");
+        if (rss > rss_peak) {
+            rss_peak = rss;
+        }
+        usleep(STORM_SAMPLE_INTERVAL_MS * 1000);
+    }
+    
+    double wall = now_seconds() - g_start_time;
+    double cpu = storm_read_cpu(server_pid) - cpu_before;
+    long rss_hwm = storm_read_memory(server_pid, "VmHWM");
+    
+    int completed = 0;
+    int rejected = 0;
+    int deferred = 0;
+    int errors_shown = 0;
+    long long wire_bytes = 0;
+    for (int i = 0; i < created; i++) {
+        pthread_join(threads[i], NULL);
+        rejected += clients[i].rejected;
+        deferred += clients[i].deferred;
+        wire_bytes += clients[i].wire_bytes;
+        if (clients[i].completed) {
+            elapsed[completed++] = clients[i].elapsed;
+        } else if (errors_shown++ < 5) {
+            fprintf(stderr, "客户端 %d 失败: %s\n", i, clients[i].error);
+        }
+    }
+    qsort(elapsed, completed, sizeof(double), compare_elapsed);
+    
+    double package_bytes = (double)completed * options->package_size;
+    printf("完成 %d/%d，失败 %d，连接被拒绝 %d 次，暂缓 %d 次，总耗时 %.2f 秒\n",
+           completed, options->clients, options->clients - completed, rejected, deferred, wall);
+    if (completed > 0) {
+        printf("完成时间: p50 %.2f 秒，p99 %.2f 秒，最长 %.2f 秒\n",
+               percentile(elapsed, completed, 50), percentile(elapsed, completed, 99), elapsed[completed - 1]);
+    }
+    printf("总吞吐量: 更新包 %.1f MB/秒，Base64数据 %.1f MB/秒\n",
+           package_bytes / wall / (1024 * 1024), wire_bytes / wall / (1024 * 1024));
+    printf("服务端CPU: %.2f 秒 (用户态+内核态)，平均占用 %.0f%%\n", cpu, cpu / wall * 100);
+    printf("服务端内存: 压测前RSS %.1f MB，压测期间峰值RSS %.1f MB，进程峰值(VmHWM) %.1f MB\n",
+           rss_before / 1024.0, rss_peak / 1024.0, rss_hwm / 1024.0);
+    
+    free(clients);
+    free(threads);
+    free(elapsed);
+    return completed == options->clients ? 0 : -1;
+}
+
+// 打印使用说明
+static void print_usage(const char* program_name) {
+    printf("使用方法: %s [选项]\n", program_name);
+    printf("选项:\n");
+    printf("  -n <数量>    模拟客户端数 (默认: 100)\n");
+    printf("  -S <大小>    合成更新包大小，可带K/M/G后缀 (默认: 8M)\n");
+    printf("  -U <数量>    服务端同时进行的更新传输上限，0表示不限 (默认: 0；-1表示使用服务端默认值)\n");
+    printf("  -C <能力位>  模拟客户端声明的能力位，十六进制，只支持CAP_COMPRESS_ZLIB|CAP_WIRE_V2 (默认: 0)\n");
+    printf("  -V           解码并校验每个客户端收到的更新包SHA-256 (占用压测机CPU)\n");
+    printf("  -b <路径>    服务端可执行文件 (默认: build/server)\n");
+    printf("  -p <端口>    服务端端口 (默认: 18888)\n");
+    printf("  -t <秒>      接收超时 (默认: 300)\n");
+    printf("  -o <目录>    临时工作目录所在目录 (默认: /tmp)\n");
+    printf("  -k           保留临时工作目录 (包括服务端日志server.log)\n");
+    printf("  -h           显示此帮助信息\n");
+}
+
+int main(int argc, char* argv[]) {
+    storm_options_t options = { "build/server", 18888, 100, 8 * 1024 * 1024, 0, 0, 300, 0, 0, "/tmp" };
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "n:S:U:C:Vb:p:t:o:kh")) != -1) {
+        switch (opt) {
+            case 'n': options.clients = atoi(optarg); break;
+            case 'S': options.package_size = parse_size(optarg); break;
+            case 'U': options.max_transfers = atoi(optarg); break;
+            case 'C': options.capabilities = (uint32_t)strtoul(optarg, NULL, 16); break;
+            case 'V': options.verify = 1; break;
+            case 'b': options.server_path = optarg; break;
+            case 'p': options.port = atoi(optarg); break;
+            case 't': options.timeout = atoi(optarg); break;
+            case 'o': options.directory = optarg; break;
+            case 'k': options.keep = 1; break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    
+    if (options.clients <= 0 || options.package_size == 0 || options.timeout <= 0 ||
+        options.port <= 0 || options.port > 65535) {
+        fprintf(stderr, "错误: 参数无效\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    // 多路复用需要重组分片，模拟客户端不声明
+    if (options.capabilities & ~(uint32_t)(CAP_COMPRESS_ZLIB | CAP_WIRE_V2)) {
+        fprintf(stderr, "错误: 不支持的能力位 0x%x\n", options.capabilities);
+        return 1;
+    }
+    
+    char server_path[PATH_MAX];
+    if (!realpath(options.server_path, server_path)) {
+        fprintf(stderr, "找不到服务端可执行文件 %s，先运行 make\n", options.server_path);
+        return 1;
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    
+    // 每个模拟客户端一个连接
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    
+    char directory[1024];
+    char path[1100];
+    snprintf(directory, sizeof(directory), "%s/update_storm.XXXXXX", options.directory);
+    if (!mkdtemp(directory)) {
+        perror("创建临时目录失败");
+        return 1;
+    }
+    
+    snprintf(path, sizeof(path), "%s/data", directory);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/data/updates", directory);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/data/updates/client_update.tar.gz", directory);
+    
+    int result = 1;
+    if (storm_write_package(path, options.package_size) == 0) {
+        char limit_text[16];
+        if (options.max_transfers > 0) {
+            snprintf(limit_text, sizeof(limit_text), "%d", options.max_transfers);
+        } else {
+            snprintf(limit_text, sizeof(limit_text), options.max_transfers == 0 ? "不限" : "默认");
+        }
+        printf("更新风暴: 客户端 %d 个，更新包 %zu 字节，传输上限 %s，能力位 0x%x%s\n",
+               options.clients, options.package_size, limit_text, options.capabilities,
+               options.verify ? "，校验SHA-256" : "");
+        fflush(stdout);
+        
+        pid_t server_pid = storm_start_server(&options, server_path, directory);
+        if (server_pid > 0) {
+            if (storm_wait_ready(server_pid, &options) == 0 && storm_run(&options, server_pid) == 0) {
+                result = 0;
+            }
+            storm_stop_server(server_pid);
+        }
+    }
+    
+    if (options.keep) {
+        printf("临时目录: %s\n", directory);
+    } else {
+        nftw(directory, storm_remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+    return result;
+}